@@ -23,18 +23,101 @@
 namespace dem
 {
 
+namespace
+{
+
+/**
+ * Returns the binary form of a btxid as stored in the database.
+ */
+std::string
+BtxidToBlob (const xaya::uint256& btxid)
+{
+  return std::string (reinterpret_cast<const char*> (btxid.GetBlob ()),
+                      xaya::uint256::NUM_BYTES);
+}
+
+/**
+ * Parses a btxid from its binary form in the database.
+ */
+xaya::uint256
+BtxidFromBlob (const std::string& blob)
+{
+  CHECK_EQ (blob.size (), xaya::uint256::NUM_BYTES)
+      << "Invalid btxid in the database";
+
+  xaya::uint256 res;
+  res.FromBlob (reinterpret_cast<const unsigned char*> (blob.data ()));
+  return res;
+}
+
+/**
+ * Converts the current row of a statement selecting btxid and height
+ * to the JSON format of a trade returned from the paginated queries.
+ */
+Json::Value
+TradeRowToJson (const xaya::SQLiteDatabase::Statement& stmt)
+{
+  Json::Value res(Json::objectValue);
+  res["btxid"] = BtxidFromBlob (stmt.GetBlob (0)).ToHex ();
+  res["height"] = static_cast<Json::Int> (stmt.Get<int64_t> (1));
+  return res;
+}
+
+} // anonymous namespace
+
 void
 DemGame::SetupSchema (xaya::SQLiteDatabase& db)
 {
+  CheckTradesTableFormat (db);
+
   /* The data table that we need is really simple, as we just need to describe
      the map of executed trades (identified by btxid) to their confirmation
-     height.  */
+     height.  The btxid is stored in binary form, and since it is the only
+     key we need, the table does not need a separate rowid.  */
   db.Execute (R"(
     CREATE TABLE IF NOT EXISTS `trades` (
-      `btxid` TEXT NOT NULL PRIMARY KEY,
+      `btxid` BLOB NOT NULL PRIMARY KEY,
       `height` INTEGER NOT NULL
-    )
+    ) WITHOUT ROWID
   )");
+
+  /* Indexers query for the trades confirmed since some height.  Since the
+     table has no rowid, the index contains the btxid as well and covers
+     those queries completely.  */
+  db.Execute (R"(
+    CREATE INDEX IF NOT EXISTS `trades_by_height`
+      ON `trades` (`height`)
+  )");
+
+  /* Trades that have been pruned from the main table because they are
+     buried deep enough are only remembered by their btxid.  */
+  db.Execute (R"(
+    CREATE TABLE IF NOT EXISTS `finalised_trades` (
+      `btxid` BLOB NOT NULL PRIMARY KEY
+    ) WITHOUT ROWID
+  )");
+}
+
+void
+DemGame::CheckTradesTableFormat (xaya::SQLiteDatabase& db)
+{
+  auto stmt = db.Prepare (R"(
+    SELECT `sql`
+      FROM `sqlite_master`
+      WHERE `type` = 'table' AND `name` = 'trades'
+  )");
+  if (!stmt.Step ())
+    return;
+  const auto sql = stmt.Get<std::string> (0);
+  CHECK (!stmt.Step ());
+
+  /* Converting the table in place would break the undo data of blocks
+     from before the upgrade, which still refers to hex btxids, and thus
+     any reorg back across the upgrade.  Hence we require a resync from
+     scratch instead.  */
+  CHECK (sql.find ("WITHOUT ROWID") != std::string::npos)
+      << "The database uses the old format of the trades table;"
+      << " please remove the GSP data directory and resync";
 }
 
 void
@@ -73,9 +156,11 @@ DemGame::InitialiseState (xaya::SQLiteDatabase& db)
 }
 
 void
-DemGame::ParseMove (const Json::Value& mv, std::string& btxid)
+DemGame::ParseMove (const Json::Value& mv, xaya::uint256& btxid)
 {
-  btxid = mv["btxid"].asString ();
+  const auto& val = mv["btxid"];
+  CHECK (val.isString () && btxid.FromHex (val.asString ()))
+      << "Invalid btxid in move:\n" << mv;
 }
 
 void
@@ -91,16 +176,55 @@ DemGame::UpdateState (xaya::SQLiteDatabase& db, const Json::Value& blockData)
 
   for (const auto& entry : blockData["moves"])
     {
-      std::string btxid;
+      xaya::uint256 btxid;
       ParseMove (entry, btxid);
 
-      LOG (INFO) << "Finished trade btxid: " << btxid;
+      LOG (INFO) << "Finished trade btxid: " << btxid.ToHex ();
 
-      stmt.Bind (1, btxid);
+      stmt.BindBlob (1, BtxidToBlob (btxid));
       stmt.Bind (2, height);
       stmt.Execute ();
       stmt.Reset ();
     }
+
+  PruneTrades (db, height);
+  ++blockVersion;
+}
+
+void
+DemGame::SetRetentionDepth (const unsigned depth)
+{
+  CHECK (depth == 0 || depth >= MIN_RETENTION_DEPTH)
+      << "Trade retention depth " << depth << " is too low";
+  retentionDepth = depth;
+}
+
+void
+DemGame::PruneTrades (xaya::SQLiteDatabase& db, const unsigned height) const
+{
+  if (retentionDepth == 0 || height < retentionDepth)
+    return;
+
+  /* The changes are tracked in the undo data like any other update, so
+     that a reorg brings back the pruned trades as they were.  */
+  const unsigned maxHeight = height - retentionDepth;
+
+  auto archive = db.Prepare (R"(
+    INSERT INTO `finalised_trades`
+      (`btxid`)
+      SELECT `btxid`
+        FROM `trades`
+        WHERE `height` <= ?1
+  )");
+  archive.Bind (1, maxHeight);
+  archive.Execute ();
+
+  auto prune = db.Prepare (R"(
+    DELETE FROM `trades`
+      WHERE `height` <= ?1
+  )");
+  prune.Bind (1, maxHeight);
+  prune.Execute ();
 }
 
 Json::Value
@@ -115,16 +239,34 @@ DemGame::GetStateAsJson (const xaya::SQLiteDatabase& db)
   Json::Value res(Json::objectValue);
   while (stmt.Step ())
     {
-      const auto btxid = stmt.Get<std::string> (0);
+      /* Ordering by the binary btxid is the same as ordering by
+         the (lower-case) hex string.  */
+      const auto btxid = BtxidFromBlob (stmt.GetBlob (0));
       const auto height = stmt.Get<int64_t> (1);
-      res[btxid] = static_cast<Json::Int> (height);
+      res[btxid.ToHex ()] = static_cast<Json::Int> (height);
     }
 
   return res;
 }
 
+uint64_t
+DemGame::GetStateVersion () const
+{
+  CHECK (pending != nullptr) << "PendingMoves has not been set";
+  return blockVersion + pending->GetVersion ();
+}
+
 DemGame::TradeData
-DemGame::CheckTrade (const xaya::Game& g, const std::string& btxid)
+DemGame::CheckTrade (const xaya::Game& g, const xaya::uint256& btxid)
+{
+  auto res = CheckTrades (g, {btxid});
+  CHECK_EQ (res.size (), 1);
+  return std::move (res.front ());
+}
+
+std::vector<DemGame::TradeData>
+DemGame::CheckTrades (const xaya::Game& g,
+                      const std::vector<xaya::uint256>& btxids)
 {
   /* Checking the pending and confirmed state is done without locking the
      GSP in-between, so in theory there could be race conditions that change
@@ -147,51 +289,169 @@ DemGame::CheckTrade (const xaya::Game& g, const std::string& btxid)
      highly unlikely situation, and even then the result is not a big deal
      in practice.  */
 
-  const Json::Value pending = g.GetPendingJsonState ()["pending"];
+  CHECK (pending != nullptr) << "PendingMoves has not been set";
+  const auto isPending = pending->ArePending (btxids);
+  CHECK_EQ (isPending.size (), btxids.size ());
+
   Json::Value confirmed = GetCustomStateData (g, "data",
-      [&btxid] (const xaya::SQLiteDatabase& db) -> Json::Value
+      [&btxids] (const xaya::SQLiteDatabase& db) -> Json::Value
       {
         auto stmt = db.PrepareRo (R"(
           SELECT `height`
             FROM `trades`
             WHERE `btxid` = ?1
         )");
-        stmt.Bind (1, btxid);
-
-        if (!stmt.Step ())
-          return Json::Value ();
-
-        const auto height = stmt.Get<int> (0);
-        CHECK (!stmt.Step ());
+        auto stmtFinal = db.PrepareRo (R"(
+          SELECT COUNT (*)
+            FROM `finalised_trades`
+            WHERE `btxid` = ?1
+        )");
 
-        return static_cast<Json::Int> (height);
+        /* For each btxid, the result is the confirmation height, true
+           if the trade is finalised, or null if it is not known.  */
+        Json::Value heights(Json::arrayValue);
+        for (const auto& id : btxids)
+          {
+            const auto blob = BtxidToBlob (id);
+            stmt.Reset ();
+            stmt.BindBlob (1, blob);
+
+            if (!stmt.Step ())
+              {
+                stmtFinal.Reset ();
+                stmtFinal.BindBlob (1, blob);
+                CHECK (stmtFinal.Step ());
+                if (stmtFinal.Get<int> (0) > 0)
+                  heights.append (true);
+                else
+                  heights.append (Json::Value ());
+                continue;
+              }
+
+            const auto height = stmt.Get<int> (0);
+            CHECK (!stmt.Step ());
+
+            heights.append (static_cast<Json::Int> (height));
+          }
+
+        return heights;
       });
 
-  CHECK (pending.isObject ());
   CHECK (confirmed.isObject ());
 
   Json::Value data;
   CHECK (confirmed.removeMember ("data", &data));
-  CHECK (data.isNull () || data.isUInt ());
-
-  TradeData res;
-  res.gspState = confirmed;
+  CHECK (data.isArray ());
+  CHECK_EQ (data.size (), btxids.size ());
 
-  if (data.isInt ())
+  std::vector<TradeData> res;
+  res.reserve (btxids.size ());
+  for (unsigned i = 0; i < btxids.size (); ++i)
     {
-      res.state = TradeState::CONFIRMED;
-      res.confirmationHeight = data.asUInt ();
-      return res;
+      const auto& height = data[i];
+      CHECK (height.isNull () || height.isBool () || height.isUInt ());
+
+      TradeData cur;
+      cur.gspState = confirmed;
+      cur.confirmationHeight = 0;
+
+      if (height.isBool ())
+        cur.state = TradeState::FINAL;
+      else if (height.isInt ())
+        {
+          cur.state = TradeState::CONFIRMED;
+          cur.confirmationHeight = height.asUInt ();
+        }
+      else if (isPending[i])
+        cur.state = TradeState::PENDING;
+      else
+        cur.state = TradeState::UNKNOWN;
+
+      res.push_back (std::move (cur));
     }
 
-  if (pending.isMember (btxid))
-    {
-      res.state = TradeState::PENDING;
-      return res;
-    }
-
-  res.state = TradeState::UNKNOWN;
   return res;
 }
 
+Json::Value
+DemGame::ListTrades (const xaya::Game& g, const xaya::uint256* after,
+                     const unsigned limit)
+{
+  CHECK (limit > 0 && limit <= MAX_PAGE_SIZE) << "Invalid limit: " << limit;
+
+  return GetCustomStateData (g, "data",
+      [after, limit] (const xaya::SQLiteDatabase& db) -> Json::Value
+      {
+        /* An empty blob compares less than every btxid, so that we can
+           use the same query also for the first page.  */
+        auto stmt = db.PrepareRo (R"(
+          SELECT `btxid`, `height`
+            FROM `trades`
+            WHERE `btxid` > ?1
+            ORDER BY `btxid`
+            LIMIT ?2
+        )");
+        stmt.BindBlob (1, after == nullptr ? "" : BtxidToBlob (*after));
+        stmt.Bind (2, limit + 1);
+
+        Json::Value trades(Json::arrayValue);
+        Json::Value next;
+        while (stmt.Step ())
+          {
+            if (trades.size () == limit)
+              {
+                next = trades[limit - 1]["btxid"];
+                break;
+              }
+            trades.append (TradeRowToJson (stmt));
+          }
+
+        Json::Value res(Json::objectValue);
+        res["trades"] = trades;
+        res["next"] = next;
+        return res;
+      });
+}
+
+Json::Value
+DemGame::GetTradesSince (const xaya::Game& g, const unsigned height,
+                         const unsigned limit)
+{
+  CHECK (limit > 0 && limit <= MAX_PAGE_SIZE) << "Invalid limit: " << limit;
+
+  return GetCustomStateData (g, "data",
+      [height, limit] (const xaya::SQLiteDatabase& db) -> Json::Value
+      {
+        auto stmt = db.PrepareRo (R"(
+          SELECT `btxid`, `height`
+            FROM `trades`
+            WHERE `height` >= ?1
+            ORDER BY `height`, `btxid`
+        )");
+        stmt.Bind (1, height);
+
+        /* We step through the rows one by one and stop as soon as the
+           limit is reached and a new block starts.  A block can only
+           contain a bounded number of trades, so the page stays bounded.  */
+        Json::Value trades(Json::arrayValue);
+        Json::Value next;
+        while (stmt.Step ())
+          {
+            const auto cur = stmt.Get<int64_t> (1);
+            if (trades.size () >= limit
+                  && cur != trades[trades.size () - 1]["height"].asInt64 ())
+              {
+                next = static_cast<Json::Int> (cur);
+                break;
+              }
+            trades.append (TradeRowToJson (stmt));
+          }
+
+        Json::Value res(Json::objectValue);
+        res["trades"] = trades;
+        res["next"] = next;
+        return res;
+      });
+}
+
 } // namespace dem
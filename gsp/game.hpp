@@ -23,10 +23,14 @@
 
 #include <xayagame/game.hpp>
 #include <xayagame/sqlitegame.hpp>
+#include <xayautil/uint256.hpp>
 
 #include <json/json.h>
 
+#include <atomic>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace dem
 {
@@ -44,7 +48,35 @@ private:
    * Parses a move from the notification JSON object.
    * This is also used for pending moves.
    */
-  static void ParseMove (const Json::Value& mv, std::string& btxid);
+  static void ParseMove (const Json::Value& mv, xaya::uint256& btxid);
+
+  /**
+   * Verifies that an existing `trades` table is not in the old format
+   * (with the btxid as hex string in a rowid table).  Such a database
+   * has to be resynced from scratch.
+   */
+  static void CheckTradesTableFormat (xaya::SQLiteDatabase& db);
+
+  /**
+   * The tracker of pending moves, which is used to look up pending trades
+   * directly (without going through the pending state as JSON).
+   */
+  const PendingMoves* pending = nullptr;
+
+  /**
+   * If non-zero, trades confirmed more than this many blocks ago are moved
+   * from the `trades` table to `finalised_trades`.
+   */
+  unsigned retentionDepth = 0;
+
+  /** Counter bumped whenever a block is attached.  */
+  std::atomic<uint64_t> blockVersion;
+
+  /**
+   * Moves all trades that are now deeper than the retention depth
+   * over to the table of finalised trades.
+   */
+  void PruneTrades (xaya::SQLiteDatabase& db, unsigned height) const;
 
   friend class dem::PendingMoves;
 
@@ -62,6 +94,22 @@ protected:
 
 public:
 
+  DemGame ()
+    : blockVersion(0)
+  {}
+
+  /** Maximum number of trades returned in a single page.  */
+  static constexpr unsigned MAX_PAGE_SIZE = 1'000;
+
+  /**
+   * Minimum (non-zero) depth for pruning of trades.  Daemons treat a trade
+   * reported as final as succeeded, so this must be above the confirmations
+   * they require before they consider the trade done themselves.  Otherwise
+   * a pruned trade could be final before it is ever reported as confirmed
+   * deep enough for the daemon (for instance right after a reorg).
+   */
+  static constexpr unsigned MIN_RETENTION_DEPTH = 100;
+
   /**
    * Possible state of a trade.
    */
@@ -73,6 +121,11 @@ public:
     PENDING,
     /** The trade's atomic transaction has been confirmed.  */
     CONFIRMED,
+    /**
+     * The trade has been confirmed so long ago that it is final, and its
+     * exact confirmation height has been pruned.
+     */
+    FINAL,
   };
 
   /**
@@ -95,10 +148,65 @@ public:
 
   };
 
+  /**
+   * Sets the tracker of pending moves used by the GSP.  This must be
+   * called before any trades are checked.
+   */
+  void
+  SetPendingMoves (const PendingMoves& p)
+  {
+    pending = &p;
+  }
+
+  /**
+   * Enables pruning of trades that have been confirmed more than the given
+   * number of blocks ago.  Those trades are only remembered as being final,
+   * and are no longer part of the game state as JSON or the paginated
+   * queries.  Zero disables pruning, and otherwise the depth must be
+   * at least MIN_RETENTION_DEPTH.
+   */
+  void SetRetentionDepth (unsigned depth);
+
+  /**
+   * Returns a number that increases whenever the confirmed or pending
+   * state changes (the sum of the block and pending versions), so that it
+   * can be used as key for caching trade lookups.  Block detaches are
+   * covered by the pending state, which is reset for each of them.
+   */
+  uint64_t GetStateVersion () const;
+
   /**
    * Queries for the state of the trade with given btxid.
    */
-  TradeData CheckTrade (const xaya::Game& g, const std::string& btxid);
+  TradeData CheckTrade (const xaya::Game& g, const xaya::uint256& btxid);
+
+  /**
+   * Queries for the state of multiple trades at once.  All of them are
+   * answered from the same pending and confirmed snapshot (and with a single
+   * lookup of each), so that the results are consistent with each other.
+   * The returned data is in the same order as the btxids passed in.
+   */
+  std::vector<TradeData> CheckTrades (
+      const xaya::Game& g, const std::vector<xaya::uint256>& btxids);
+
+  /**
+   * Returns a page of up to limit confirmed trades, ordered by btxid and
+   * starting after the given btxid (or from the beginning if after is null).
+   * The result is the custom state data with "trades" and the "next" cursor
+   * (null if there are no more trades) as data.
+   */
+  Json::Value ListTrades (const xaya::Game& g, const xaya::uint256* after,
+                          unsigned limit);
+
+  /**
+   * Returns the trades confirmed at or after the given height, ordered by
+   * height.  Blocks are never split between pages, so the page may contain
+   * more than limit trades to finish the last block.  The "next" field
+   * of the returned data is the height to continue from, or null if there
+   * are no more trades.
+   */
+  Json::Value GetTradesSince (const xaya::Game& g, unsigned height,
+                              unsigned limit);
 
 };
 
@@ -42,6 +42,13 @@ DEFINE_int32 (enable_pruning, -1,
               "if non-negative (including zero), old undo data will be pruned"
               " and only as many blocks as specified will be kept");
 
+DEFINE_int32 (trades_retention_depth, 0,
+              "if positive, trades confirmed more than this many blocks ago"
+              " are pruned and only remembered as final; this must be"
+              " at least 100 (so that it is well above the confirmations"
+              " required by daemons), and can be combined with"
+              " --enable_pruning");
+
 DEFINE_string (datadir, "",
                "base data directory for state data"
                " (will be extended by 'dem' and the chain)");
@@ -97,6 +104,21 @@ main (int argc, char** argv)
       return EXIT_FAILURE;
     }
 
+  if (FLAGS_trades_retention_depth < 0)
+    {
+      std::cerr << "Error: --trades_retention_depth must not be negative"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+  if (FLAGS_trades_retention_depth > 0
+        && static_cast<unsigned> (FLAGS_trades_retention_depth)
+              < dem::DemGame::MIN_RETENTION_DEPTH)
+    {
+      std::cerr << "Error: --trades_retention_depth must be zero or at least "
+                << dem::DemGame::MIN_RETENTION_DEPTH << std::endl;
+      return EXIT_FAILURE;
+    }
+
   xaya::GameDaemonConfiguration config;
   config.XayaRpcUrl = FLAGS_xaya_rpc_url;
   if (FLAGS_game_rpc_port != 0)
@@ -117,6 +139,8 @@ main (int argc, char** argv)
 
   dem::PendingMoves pending;
   config.PendingMoves = &pending;
+  logic.SetPendingMoves (pending);
+  logic.SetRetentionDepth (FLAGS_trades_retention_depth);
 
   return xaya::SQLiteMain (config, "dem", logic);
 }
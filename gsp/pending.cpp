@@ -22,28 +22,60 @@
 
 #include <glog/logging.h>
 
+#include <mutex>
+
 namespace dem
 {
 
 void
 PendingMoves::Clear ()
 {
-  pending = Json::Value (Json::objectValue);
+  std::lock_guard<std::shared_timed_mutex> lock(mut);
+  btxids.clear ();
+  ++version;
 }
 
 Json::Value
 PendingMoves::ToJson () const
 {
-  return pending;
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  for (const auto& id : btxids)
+    res[id.ToHex ()] = Json::Value (Json::objectValue);
+
+  return res;
 }
 
 void
 PendingMoves::AddPendingMove (const Json::Value& mv)
 {
-  std::string btxid;
+  xaya::uint256 btxid;
   DemGame::ParseMove (mv, btxid);
 
-  pending[btxid] = Json::Value (Json::objectValue);
+  std::lock_guard<std::shared_timed_mutex> lock(mut);
+  btxids.insert (btxid);
+  ++version;
+}
+
+bool
+PendingMoves::IsPending (const xaya::uint256& btxid) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+  return btxids.count (btxid) > 0;
+}
+
+std::vector<bool>
+PendingMoves::ArePending (const std::vector<xaya::uint256>& ids) const
+{
+  std::vector<bool> res;
+  res.reserve (ids.size ());
+
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+  for (const auto& id : ids)
+    res.push_back (btxids.count (id) > 0);
+
+  return res;
 }
 
 } // namespace dem
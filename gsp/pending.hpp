@@ -20,24 +20,60 @@
 #define DEMOCRIT_GSP_PENDING_HPP
 
 #include <xayagame/pendingmoves.hpp>
+#include <xayautil/uint256.hpp>
 
 #include <json/json.h>
 
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <shared_mutex>
+#include <unordered_set>
+#include <vector>
+
 namespace dem
 {
 
 /**
- * Tracker for pending moves in the Democrit GSP.
+ * Hasher for btxids.  Since they are hashes themselves, we can just use
+ * their first bytes.
+ */
+struct BtxidHash
+{
+
+  size_t
+  operator() (const xaya::uint256& btxid) const
+  {
+    size_t res;
+    std::memcpy (&res, btxid.GetBlob (), sizeof (res));
+    return res;
+  }
+
+};
+
+/**
+ * Tracker for pending moves in the Democrit GSP.  Besides providing the
+ * pending state as JSON, it allows to look up whether btxids are pending
+ * directly (and thread-safe), which is what checktrade needs.
  */
 class PendingMoves : public xaya::PendingMoveProcessor
 {
 
 private:
 
+  /** The btxids of all pending trades.  */
+  std::unordered_set<xaya::uint256, BtxidHash> btxids;
+
   /**
-   * The current pending state.  It is already in the JSON form for simplicity.
+   * Lock for btxids.  The pending move processor is only updated with the
+   * game's lock held, but lookups come from the RPC server threads without
+   * it.
    */
-  Json::Value pending;
+  mutable std::shared_timed_mutex mut;
+
+  /** Counter that is bumped whenever the pending state changes.  */
+  std::atomic<uint64_t> version;
 
 protected:
 
@@ -47,11 +83,32 @@ protected:
 public:
 
   PendingMoves ()
-    : pending(Json::objectValue)
+    : version(0)
   {}
 
+  /**
+   * Returns a number that changes (increases) whenever the pending state
+   * is modified.  This is used to invalidate cached lookups.
+   */
+  uint64_t
+  GetVersion () const
+  {
+    return version;
+  }
+
   Json::Value ToJson () const override;
 
+  /**
+   * Returns true if the trade with the given btxid is pending.
+   */
+  bool IsPending (const xaya::uint256& btxid) const;
+
+  /**
+   * Checks for multiple btxids whether they are pending.  All of them are
+   * looked up in the same state.
+   */
+  std::vector<bool> ArePending (const std::vector<xaya::uint256>& ids) const;
+
 };
 
 } // namespace dem
@@ -18,11 +18,37 @@
 
 #include "rpcserver.hpp"
 
+#include <xayagame/gamerpcserver.hpp>
+#include <xayautil/uint256.hpp>
+
+#include <jsonrpccpp/common/errors.h>
+#include <jsonrpccpp/common/exception.h>
+
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <string>
+#include <vector>
+
 namespace dem
 {
 
+namespace
+{
+
+DEFINE_int32 (checktrade_cache_size, 100'000,
+              "maximum number of btxids for which checktrade results are"
+              " cached until the next block or pending change (0 disables)");
+
+} // anonymous namespace
+
+RpcServer::RpcServer (xaya::Game& g, DemGame& l,
+                      jsonrpc::AbstractServerConnector& conn)
+  : GspRpcServerStub(conn), game(g), logic(l),
+    cache(std::max (FLAGS_checktrade_cache_size, 0))
+{}
+
 void
 RpcServer::stop ()
 {
@@ -51,12 +77,59 @@ RpcServer::getpendingstate ()
   return game.GetPendingJsonState ();
 }
 
+std::string
+RpcServer::waitforchange (const std::string& knownBlock)
+{
+  VLOG (1) << "RPC method called: waitforchange " << knownBlock;
+  return xaya::GameRpcServer::DefaultWaitForChange (game, knownBlock);
+}
+
 Json::Value
-RpcServer::checktrade (const std::string& btxid)
+RpcServer::waitforpendingchange (const int knownVersion)
 {
-  LOG (INFO) << "RPC method called: checktrade " << btxid;
-  const auto data = logic.CheckTrade (game, btxid);
+  VLOG (1) << "RPC method called: waitforpendingchange " << knownVersion;
+  return xaya::GameRpcServer::DefaultWaitForPendingChange (game, knownVersion);
+}
+
+namespace
+{
+
+/**
+ * Parses a btxid passed to the RPC interface as hex string.  Throws
+ * an invalid-params error if it is not valid.
+ */
+xaya::uint256
+ParseBtxid (const std::string& hex)
+{
+  xaya::uint256 res;
+  if (!res.FromHex (hex))
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "invalid btxid: " + hex);
 
+  return res;
+}
+
+/**
+ * Verifies that a page size passed to the RPC interface is valid.  Throws
+ * an invalid-params error if not.
+ */
+void
+CheckPageSize (const int limit)
+{
+  if (limit <= 0 || limit > static_cast<int> (DemGame::MAX_PAGE_SIZE))
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "limit must be between 1 and "
+            + std::to_string (DemGame::MAX_PAGE_SIZE));
+}
+
+/**
+ * Converts the trade data for a single trade to the JSON format returned
+ * from the RPC interface (without the GSP state).
+ */
+Json::Value
+TradeDataToJson (const DemGame::TradeData& data)
+{
   Json::Value state(Json::objectValue);
   switch (data.state)
     {
@@ -70,13 +143,115 @@ RpcServer::checktrade (const std::string& btxid)
       state["state"] = "confirmed";
       state["height"] = static_cast<Json::Int> (data.confirmationHeight);
       break;
+    case DemGame::TradeState::FINAL:
+      state["state"] = "final";
+      break;
     default:
       LOG (FATAL) << "Unexpected trade state";
     }
 
+  return state;
+}
+
+} // anonymous namespace
+
+std::vector<DemGame::TradeData>
+RpcServer::CheckTrades (const std::vector<xaya::uint256>& btxids)
+{
+  /* The version is retrieved before doing any lookups.  If the state
+     changes while we look up, the results will be stored with the old
+     version and thus never be used.  */
+  const uint64_t version = logic.GetStateVersion ();
+
+  std::vector<DemGame::TradeData> res(btxids.size ());
+  bool allCached = true;
+  for (size_t i = 0; i < btxids.size () && allCached; ++i)
+    allCached = cache.Lookup (btxids[i], version, res[i]);
+
+  if (allCached)
+    return res;
+
+  /* All entries of a batch must be for the same GSP state, as the caller
+     uses a single state (e.g. the height) for all of them.  Cached entries
+     may be for an older state than what a fresh lookup sees (if a block
+     was attached in the mean time), so on any miss, we compute the whole
+     batch fresh from a single snapshot.  */
+  res = logic.CheckTrades (game, btxids);
+  CHECK_EQ (res.size (), btxids.size ());
+  for (size_t i = 0; i < btxids.size (); ++i)
+    cache.Store (btxids[i], version, res[i]);
+
+  return res;
+}
+
+Json::Value
+RpcServer::checktrade (const std::string& btxid)
+{
+  LOG (INFO) << "RPC method called: checktrade " << btxid;
+  const auto data = CheckTrades ({ParseBtxid (btxid)}).front ();
+
   Json::Value res = data.gspState;
-  res["data"] = state;
+  res["data"] = TradeDataToJson (data);
+  return res;
+}
+
+Json::Value
+RpcServer::checktrades (const Json::Value& btxids)
+{
+  LOG (INFO) << "RPC method called: checktrades " << btxids.size ();
+
+  if (!btxids.isArray () || btxids.empty ())
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "btxids must be a non-empty array");
+
+  std::vector<xaya::uint256> ids;
+  for (const auto& id : btxids)
+    {
+      if (!id.isString ())
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+            "btxids must be strings");
+      ids.push_back (ParseBtxid (id.asString ()));
+    }
+
+  const auto data = CheckTrades (ids);
+  CHECK_EQ (data.size (), ids.size ());
+
+  /* All entries share the same GSP state, so we can just take it
+     from the first one.  */
+  Json::Value res = data.front ().gspState;
+  Json::Value states(Json::arrayValue);
+  for (const auto& d : data)
+    states.append (TradeDataToJson (d));
+
+  res["data"] = states;
   return res;
 }
 
+Json::Value
+RpcServer::listtrades (const std::string& after, const int limit)
+{
+  LOG (INFO) << "RPC method called: listtrades " << after << " " << limit;
+  CheckPageSize (limit);
+
+  if (after.empty ())
+    return logic.ListTrades (game, nullptr, limit);
+
+  const auto btxid = ParseBtxid (after);
+  return logic.ListTrades (game, &btxid, limit);
+}
+
+Json::Value
+RpcServer::gettradessince (const int height, const int limit)
+{
+  LOG (INFO) << "RPC method called: gettradessince " << height << " " << limit;
+  CheckPageSize (limit);
+
+  if (height < 0)
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "height must not be negative");
+
+  return logic.GetTradesSince (game, height, limit);
+}
+
 } // namespace dem
@@ -22,12 +22,15 @@
 #include "rpc-stubs/gsprpcserverstub.h"
 
 #include "game.hpp"
+#include "tradecache.hpp"
 
 #include <xayagame/game.hpp>
 
 #include <json/json.h>
 #include <jsonrpccpp/server.h>
 
+#include <vector>
+
 namespace dem
 {
 
@@ -45,19 +48,33 @@ private:
   /** The Democrit GSP implementation.  */
   DemGame& logic;
 
+  /** Cache for the results of checktrade(s).  */
+  TradeCache cache;
+
+  /**
+   * Looks up the state of the given trades, using and filling the cache.
+   * The cache is only used if it has all of them, so that the results are
+   * always for the same GSP state.
+   */
+  std::vector<DemGame::TradeData> CheckTrades (
+      const std::vector<xaya::uint256>& btxids);
+
 public:
 
   explicit RpcServer (xaya::Game& g, DemGame& l,
-                      jsonrpc::AbstractServerConnector& conn)
-    : GspRpcServerStub(conn), game(g), logic(l)
-  {}
+                      jsonrpc::AbstractServerConnector& conn);
 
   void stop () override;
   Json::Value getnullstate () override;
   Json::Value getcurrentstate () override;
   Json::Value getpendingstate () override;
+  std::string waitforchange (const std::string& knownBlock) override;
+  Json::Value waitforpendingchange (int knownVersion) override;
 
   Json::Value checktrade (const std::string& btxid) override;
+  Json::Value checktrades (const Json::Value& btxids) override;
+  Json::Value listtrades (const std::string& after, int limit) override;
+  Json::Value gettradessince (int height, int limit) override;
 
 };
 
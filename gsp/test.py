@@ -42,6 +42,28 @@ class DemGspTest (XayaGameTest):
     actual = self.getCustomState ("data", "checktrade", btxid)
     self.assertEqual (actual, state)
 
+  def expectStates (self, btxids, states):
+    actual = self.getCustomState ("data", "checktrades", btxids=btxids)
+    self.assertEqual (actual, states)
+
+  def listAllTrades (self, limit):
+    """
+    Retrieves all confirmed trades through the paginated listtrades
+    method, and returns them in the format of the game state.
+    """
+
+    res = {}
+    after = ""
+    while True:
+      page = self.getCustomState ("data", "listtrades",
+                                  after=after, limit=limit)
+      assert len (page["trades"]) <= limit
+      for t in page["trades"]:
+        res[t["btxid"]] = t["height"]
+      if page["next"] is None:
+        return res
+      after = page["next"]
+
   def sendMove (self, name, mv={}):
     """
     Sends a move with the given name for our game.  The difference to the
@@ -67,6 +89,8 @@ class DemGspTest (XayaGameTest):
     self.expectPending ({})
     unknownHash = "aa" * 32
     self.expectState (unknownHash, {"state": "unknown"})
+    self.expectError (-32602, ".*invalid btxid.*",
+                      self.rpc.game.checktrade, "foo")
     reorgBlk = self.rpc.xaya.getbestblockhash ()
 
     self.mainLogger.info ("Sending some moves...")
@@ -79,6 +103,10 @@ class DemGspTest (XayaGameTest):
       id3: {},
     })
     self.expectState (id1, {"state": "pending"})
+    self.expectStates ([id2, unknownHash], [
+      {"state": "pending"},
+      {"state": "unknown"},
+    ])
     self.generate (1)
     height = self.rpc.xaya.getblockcount ()
     self.generate (20)
@@ -89,6 +117,32 @@ class DemGspTest (XayaGameTest):
       id3: height,
     })
     self.expectState (id2, {"state": "confirmed", "height": height})
+    self.expectStates ([id1, unknownHash, id3], [
+      {"state": "confirmed", "height": height},
+      {"state": "unknown"},
+      {"state": "confirmed", "height": height},
+    ])
+
+    self.mainLogger.info ("Testing paginated queries...")
+    expected = self.getGameState ()
+    for limit in [1, 2, 10]:
+      self.assertEqual (self.listAllTrades (limit), expected)
+    self.expectError (-32602, ".*limit.*",
+                      self.rpc.game.listtrades, after="", limit=0)
+    self.expectError (-32602, ".*invalid btxid.*",
+                      self.rpc.game.listtrades, after="foo", limit=1)
+
+    # The block with all three trades is not split even with a limit of one.
+    page = self.getCustomState ("data", "gettradessince",
+                                height=height - 1, limit=1)
+    self.assertEqual (page["next"], None)
+    self.assertEqual (sorted ([t["btxid"] for t in page["trades"]]),
+                      sorted ([id1, id2, id3]))
+    for t in page["trades"]:
+      self.assertEqual (t["height"], height)
+    page = self.getCustomState ("data", "gettradessince",
+                                height=height + 1, limit=10)
+    self.assertEqual (page, {"trades": [], "next": None})
 
     self.mainLogger.info ("Testing reorg...")
     oldState = self.getGameState ()
@@ -111,6 +165,21 @@ class DemGspTest (XayaGameTest):
     self.expectGameState (oldState)
     self.expectState (idReorg, {"state": "unknown"})
 
+    self.mainLogger.info ("Testing batch of cached and new trades...")
+    self.expectStates ([id1], [{"state": "confirmed", "height": height}])
+    id4 = self.sendMove ("bar")
+    self.generate (1)
+    newHeight = self.rpc.xaya.getblockcount ()
+    self.syncGame ()
+    # id1's result is cached from before the block.  The batch must still
+    # be answered consistently for the new block.
+    res = self.rpc.game.checktrades (btxids=[id1, id4])
+    self.assertEqual (res["height"], newHeight)
+    self.assertEqual (res["data"], [
+      {"state": "confirmed", "height": height},
+      {"state": "confirmed", "height": newHeight},
+    ])
+
 
 if __name__ == "__main__":
   DemGspTest ().main ()
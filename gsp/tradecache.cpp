@@ -0,0 +1,64 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "tradecache.hpp"
+
+namespace dem
+{
+
+bool
+TradeCache::Lookup (const xaya::uint256& btxid, const uint64_t v,
+                    DemGame::TradeData& data)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (v != version)
+    return false;
+
+  const auto mit = entries.find (btxid);
+  if (mit == entries.end ())
+    return false;
+
+  data = mit->second;
+  return true;
+}
+
+void
+TradeCache::Store (const xaya::uint256& btxid, const uint64_t v,
+                   const DemGame::TradeData& data)
+{
+  if (maxEntries == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (v < version)
+    return;
+  if (v > version)
+    {
+      entries.clear ();
+      version = v;
+    }
+
+  if (entries.size () >= maxEntries)
+    entries.clear ();
+
+  entries[btxid] = data;
+}
+
+} // namespace dem
@@ -0,0 +1,92 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_GSP_TRADECACHE_HPP
+#define DEMOCRIT_GSP_TRADECACHE_HPP
+
+#include "game.hpp"
+#include "pending.hpp"
+
+#include <xayautil/uint256.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+
+namespace dem
+{
+
+/**
+ * Cache for the results of checktrade lookups.  Entries are tagged with the
+ * state version (as per DemGame::GetStateVersion) they were computed for,
+ * and the whole cache is dropped as soon as a newer version is seen.  This
+ * allows repeated polls for the same btxids to be answered without touching
+ * the database or the pending state.
+ */
+class TradeCache
+{
+
+private:
+
+  /** Maximum number of entries, after which the cache is flushed.  */
+  const size_t maxEntries;
+
+  /** The state version for which the entries are valid.  */
+  uint64_t version = 0;
+
+  /** The cached results.  */
+  std::unordered_map<xaya::uint256, DemGame::TradeData, BtxidHash> entries;
+
+  /** Lock for this instance.  */
+  std::mutex mut;
+
+public:
+
+  /**
+   * Constructs the cache with a given maximum size.  If it is zero,
+   * then nothing will be cached at all.
+   */
+  explicit TradeCache (const size_t m)
+    : maxEntries(m)
+  {}
+
+  TradeCache () = delete;
+  TradeCache (const TradeCache&) = delete;
+  void operator= (const TradeCache&) = delete;
+
+  /**
+   * Looks up the data for a btxid at the given state version.  Returns
+   * true and fills in the data if it is cached.
+   */
+  bool Lookup (const xaya::uint256& btxid, uint64_t v,
+               DemGame::TradeData& data);
+
+  /**
+   * Stores the data for a btxid, which has been computed for the given
+   * state version.  The version must have been obtained before the lookup
+   * started.  Results for older versions than the current one are ignored.
+   */
+  void Store (const xaya::uint256& btxid, uint64_t v,
+              const DemGame::TradeData& data);
+
+};
+
+} // namespace dem
+
+#endif // DEMOCRIT_GSP_TRADECACHE_HPP
@@ -23,16 +23,26 @@
 #include "assetspec.hpp"
 #include "daemon.hpp"
 #include "rpcserver.hpp"
+#include "private/rpcclient.hpp"
 
 #include <xayautil/uint256.hpp>
 
-#include <jsonrpccpp/client/connectors/httpclient.h>
+#include <jsonrpccpp/common/exception.h>
 #include <jsonrpccpp/server/connectors/httpserver.h>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace
 {
@@ -50,6 +60,14 @@ DEFINE_string (dem_rpc_url, "",
 
 DEFINE_int32 (rpc_port, 0,
               "the port at which Democrit's JSON-RPC server will be started");
+/* Each waitforchange long-poll occupies one worker thread for up to its
+   timeout (five seconds).  The number of threads must thus be larger than
+   the number of clients long-polling at the same time, or other calls
+   will be delayed until a long-poll returns.  The default matches the one
+   of jsonrpc::HttpServer, which was used before this became a flag.  */
+DEFINE_int32 (rpc_threads, 50,
+              "number of worker threads for Democrit's JSON-RPC server;"
+              " each pending waitforchange call blocks one of them");
 
 DEFINE_string (account, "",
                "Xaya account name (without p/) of the local user");
@@ -89,8 +107,17 @@ GetNfAsset (const Asset& str)
   return res;
 }
 
+/** Time to wait before retrying block notifications from the GSP.  */
+constexpr auto WATCHER_RETRY = std::chrono::seconds (5);
+
 /**
  * The AssetSpec for the nonfungible GSP.
+ *
+ * Calls to the GSP are done through a per-thread RPC client, so that
+ * validation from different threads is not serialised.  Assets that exist
+ * are cached forever (since they cannot be destroyed), and balances are
+ * cached for the GSP's current best block, which is tracked through
+ * waitforchange in a background thread.
  */
 class NfAssetSpec : public democrit::AssetSpec
 {
@@ -98,19 +125,194 @@ class NfAssetSpec : public democrit::AssetSpec
 private:
 
   /** The RPC client to use for GSP queries.  */
-  NfRpcClient& gsp;
+  mutable democrit::RpcClient<NfRpcClient> gsp;
+
+  /** Assets that are known to exist.  */
+  mutable std::set<Asset> knownAssets;
+
+  /**
+   * The GSP's current best block as per the watcher thread.  Balances are
+   * only cached while this is known.
+   */
+  mutable xaya::uint256 tip;
+
+  /** Whether or not the watcher currently knows the best block.  */
+  mutable bool tipKnown = false;
+
+  /** Cached balances (by name and asset) at the tip block.  */
+  mutable std::map<std::pair<std::string, Asset>, Amount> balances;
+
+  /** Lock for the cached data.  */
+  mutable std::mutex mutCache;
+
+  /** Thread running the block watcher.  */
+  std::thread watcher;
+
+  /** Set to true when the watcher should stop.  */
+  bool stopWatcher = false;
+
+  /** Lock for stopWatcher.  */
+  std::mutex mutWatcher;
+
+  /** Condition variable to wake up the watcher when it should stop.  */
+  std::condition_variable cvWatcher;
+
+  /**
+   * Sleeps the watcher thread for the given duration, or until it
+   * is requested to stop.  Returns false if it should stop.
+   */
+  bool
+  WatcherSleep (const std::chrono::milliseconds dur)
+  {
+    std::unique_lock<std::mutex> lock(mutWatcher);
+    cvWatcher.wait_for (lock, dur, [this] ()
+      {
+        return stopWatcher;
+      });
+    return !stopWatcher;
+  }
+
+  /**
+   * Updates the known tip block, clearing the balance cache.
+   */
+  void
+  SetTip (const bool known, const xaya::uint256& newTip)
+  {
+    std::lock_guard<std::mutex> lock(mutCache);
+    tipKnown = known;
+    tip = newTip;
+    balances.clear ();
+  }
 
   /**
-   * Mutex to synchronise access to the RPC client (which is not thread safe
-   * by itself).
+   * Runs the loop that waits for changes to the GSP's best block.
    */
-  mutable std::mutex mutRpc;
+  void
+  RunWatcher ()
+  {
+    std::string knownBlock;
+    while (WatcherSleep (std::chrono::milliseconds::zero ()))
+      {
+        std::string newBlock;
+        try
+          {
+            newBlock = gsp->waitforchange (knownBlock);
+          }
+        catch (const jsonrpc::JsonRpcException& exc)
+          {
+            LOG (WARNING)
+                << "Block notifications from the GSP failed, not caching"
+                << " balances: " << exc.what ();
+            knownBlock.clear ();
+            SetTip (false, xaya::uint256 ());
+            WatcherSleep (WATCHER_RETRY);
+            continue;
+          }
+
+        if (newBlock == knownBlock)
+          continue;
+
+        VLOG (1) << "New best block in the GSP: " << newBlock;
+        knownBlock = newBlock;
+
+        xaya::uint256 newTip;
+        const bool known = newTip.FromHex (newBlock);
+        SetTip (known, newTip);
+      }
+  }
+
+  /**
+   * Looks up a balance in the cache.  Returns true if it was found, and
+   * sets the hash to the block at which it is valid.
+   */
+  bool
+  LookupBalance (const std::string& name, const Asset& asset,
+                 Amount& balance, xaya::uint256& hash) const
+  {
+    std::lock_guard<std::mutex> lock(mutCache);
+    if (!tipKnown)
+      return false;
+
+    const auto mit = balances.find (std::make_pair (name, asset));
+    if (mit == balances.end ())
+      return false;
+
+    balance = mit->second;
+    hash = tip;
+    return true;
+  }
+
+  /**
+   * Parses a getbalance response, and stores the result in the cache
+   * if it is for the current tip block.
+   */
+  void
+  ProcessBalance (const std::string& name, const Asset& asset,
+                  const Json::Value& response,
+                  Amount& balance, xaya::uint256& hash) const
+  {
+    CHECK (response.isObject ()) << "Invalid getbalance result: " << response;
+
+    const auto& balanceVal = response["data"];
+    CHECK (balanceVal.isInt64 ());
+    balance = balanceVal.asInt64 ();
+
+    const auto& hashVal = response["blockhash"];
+    CHECK (hashVal.isString ());
+    CHECK (hash.FromHex (hashVal.asString ()));
+
+    std::lock_guard<std::mutex> lock(mutCache);
+    if (tipKnown && hash == tip)
+      balances[std::make_pair (name, asset)] = balance;
+  }
+
+  /**
+   * Parses a getassetdetails response, and remembers the asset if it
+   * exists.  Returns true if it does.
+   */
+  bool
+  ProcessAssetDetails (const Asset& asset, const Json::Value& response) const
+  {
+    CHECK (response.isObject () && response.isMember ("data"))
+        << "Invalid getassetdetails result: " << response;
+    if (response["data"].isNull ())
+      return false;
+
+    std::lock_guard<std::mutex> lock(mutCache);
+    knownAssets.insert (asset);
+    return true;
+  }
+
+  /**
+   * Returns true if the asset is known to exist from the cache.
+   */
+  bool
+  IsKnownAsset (const Asset& asset) const
+  {
+    std::lock_guard<std::mutex> lock(mutCache);
+    return knownAssets.count (asset) > 0;
+  }
 
 public:
 
-  explicit NfAssetSpec (NfRpcClient& g)
-    : gsp(g)
-  {}
+  explicit NfAssetSpec (const std::string& gspUrl)
+    : gsp(gspUrl)
+  {
+    watcher = std::thread ([this] ()
+      {
+        RunWatcher ();
+      });
+  }
+
+  ~NfAssetSpec ()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutWatcher);
+      stopWatcher = true;
+      cvWatcher.notify_all ();
+    }
+    watcher.join ();
+  }
 
   std::string
   GetGameId () const override
@@ -125,14 +327,10 @@ public:
     if (jsonAsset.isNull ())
       return false;
 
-    Json::Value response;
-    {
-      std::lock_guard<std::mutex> lock(mutRpc);
-      response = gsp.getassetdetails (jsonAsset);
-    }
-    CHECK (response.isMember ("data"));
+    if (IsKnownAsset (asset))
+      return true;
 
-    return !response["data"].isNull ();
+    return ProcessAssetDetails (asset, gsp->getassetdetails (jsonAsset));
   }
 
   bool
@@ -142,21 +340,12 @@ public:
     const auto jsonAsset = GetNfAsset (asset);
     CHECK (jsonAsset.isObject ());
 
-    Json::Value response;
-    {
-      std::lock_guard<std::mutex> lock(mutRpc);
-      response = gsp.getbalance (jsonAsset, name);
-    }
-    CHECK (response.isObject ());
-
-    const auto& balance = response["data"];
-    CHECK (balance.isInt64 ());
+    Amount balance = 0;
+    if (!LookupBalance (name, asset, balance, hash))
+      ProcessBalance (name, asset, gsp->getbalance (jsonAsset, name),
+                      balance, hash);
 
-    const auto& hashVal = response["blockhash"];
-    CHECK (hashVal.isString ());
-    CHECK (hash.FromHex (hashVal.asString ()));
-
-    return n <= balance.asInt64 ();
+    return n <= balance;
   }
 
   bool
@@ -166,6 +355,122 @@ public:
     return true;
   }
 
+  std::vector<bool>
+  IsAssetBatch (const std::vector<Asset>& assets) const override
+  {
+    std::vector<bool> res(assets.size (), false);
+
+    /* All lookups for assets not yet known are sent in a single JSON-RPC
+       batch request.  We keep track of the asset index for each call.  */
+    std::vector<Json::Value> params;
+    std::vector<size_t> indices;
+    for (size_t i = 0; i < assets.size (); ++i)
+      {
+        const auto jsonAsset = GetNfAsset (assets[i]);
+        if (jsonAsset.isNull ())
+          continue;
+
+        if (IsKnownAsset (assets[i]))
+          {
+            res[i] = true;
+            continue;
+          }
+
+        Json::Value cur(Json::arrayValue);
+        cur.append (jsonAsset);
+        params.push_back (cur);
+        indices.push_back (i);
+      }
+
+    const auto responses = gsp.CallBatch ("getassetdetails", params);
+    CHECK_EQ (responses.size (), indices.size ());
+    for (size_t i = 0; i < indices.size (); ++i)
+      res[indices[i]] = ProcessAssetDetails (assets[indices[i]], responses[i]);
+
+    return res;
+  }
+
+  std::vector<bool>
+  CanSellBatch (const std::vector<AmountQuery>& queries,
+                xaya::uint256& hash) const override
+  {
+    std::vector<bool> res(queries.size (), false);
+    if (queries.empty ())
+      return res;
+
+    std::vector<Amount> balances(queries.size ());
+    std::vector<xaya::uint256> hashes(queries.size ());
+
+    bool found = false;
+    std::vector<size_t> pending;
+    for (size_t i = 0; i < queries.size (); ++i)
+      {
+        const auto& q = queries[i];
+        if (!LookupBalance (q.name, q.asset, balances[i], hashes[i]))
+          {
+            pending.push_back (i);
+            continue;
+          }
+
+        res[i] = (q.n <= balances[i]);
+        if (res[i])
+          {
+            hash = hashes[i];
+            found = true;
+          }
+      }
+
+    /* The GSP may have processed a new block while answering the batch
+       (or since cached results were stored).  In that case, successful
+       results at other blocks than the last one are queried again from
+       the GSP (not the cache), until they all agree on the block.  */
+    while (!pending.empty ())
+      {
+        std::vector<Json::Value> params;
+        for (const auto i : pending)
+          {
+            const auto jsonAsset = GetNfAsset (queries[i].asset);
+            CHECK (jsonAsset.isObject ());
+
+            Json::Value cur(Json::objectValue);
+            cur["asset"] = jsonAsset;
+            cur["name"] = queries[i].name;
+            params.push_back (cur);
+          }
+
+        const auto responses = gsp.CallBatch ("getbalance", params);
+        CHECK_EQ (responses.size (), pending.size ());
+        for (size_t k = 0; k < pending.size (); ++k)
+          {
+            const size_t i = pending[k];
+            const auto& q = queries[i];
+            ProcessBalance (q.name, q.asset, responses[k],
+                            balances[i], hashes[i]);
+
+            res[i] = (q.n <= balances[i]);
+            if (res[i])
+              {
+                hash = hashes[i];
+                found = true;
+              }
+          }
+
+        pending.clear ();
+        if (found)
+          for (size_t i = 0; i < res.size (); ++i)
+            if (res[i] && hashes[i] != hash)
+              pending.push_back (i);
+      }
+
+    return res;
+  }
+
+  std::vector<bool>
+  CanBuyBatch (const std::vector<AmountQuery>& queries) const override
+  {
+    return std::vector<bool> (queries.size (), true);
+  }
+
   Json::Value
   GetTransferMove (const std::string& sender, const std::string& receiver,
                    const Asset& asset, const Amount n) const override
@@ -207,15 +512,15 @@ main (int argc, char** argv)
 
       if (FLAGS_rpc_port == 0)
         throw UsageError ("--rpc_port must be set");
+      if (FLAGS_rpc_threads < 1)
+        throw UsageError ("--rpc_threads must be positive");
 
       if (FLAGS_account.empty ())
         throw UsageError ("--account must be set");
       if (FLAGS_jid.empty ())
         throw UsageError ("--jid must be set");
 
-      jsonrpc::HttpClient httpGsp(FLAGS_gsp_rpc_url);
-      NfRpcClient gsp(httpGsp);
-      NfAssetSpec spec(gsp);
+      NfAssetSpec spec(FLAGS_gsp_rpc_url);
 
       democrit::Daemon daemon(spec, FLAGS_account,
                               FLAGS_xaya_rpc_url, FLAGS_dem_rpc_url,
@@ -224,7 +529,8 @@ main (int argc, char** argv)
         daemon.SetRootCA (FLAGS_cafile);
       daemon.Connect ();
 
-      jsonrpc::HttpServer httpServer(FLAGS_rpc_port);
+      jsonrpc::HttpServer httpServer(FLAGS_rpc_port, "", "",
+                                     FLAGS_rpc_threads);
       httpServer.BindLocalhost ();
       democrit::RpcServer server(daemon, httpServer);
 
@@ -0,0 +1,102 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/addresscache.hpp"
+
+#include <glog/logging.h>
+
+#include <vector>
+
+namespace democrit
+{
+
+AddressCache::~AddressCache ()
+{
+  refiller.reset ();
+}
+
+void
+AddressCache::StartRefills (const std::chrono::milliseconds intv)
+{
+  CHECK (refiller == nullptr) << "Refills have already been started";
+  refiller = std::make_unique<IntervalJob> (intv, [this] ()
+    {
+      try
+        {
+          Refill ();
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          LOG (WARNING) << "Failed to refill address cache: " << exc.what ();
+        }
+    });
+}
+
+void
+AddressCache::Refill ()
+{
+  size_t missing;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    if (addresses.size () >= targetSize)
+      return;
+    missing = targetSize - addresses.size ();
+  }
+
+  /* Only the refiller adds to the cache, so we can do the RPC call without
+     holding the lock.  If addresses are taken in the mean time, the next
+     refill will pick that up.  */
+  const std::vector<Json::Value> params(missing,
+                                        Json::Value (Json::arrayValue));
+  const auto res = rpc.CallBatch ("getnewaddress", params);
+
+  std::lock_guard<std::mutex> lock(mut);
+  for (const auto& addr : res)
+    {
+      CHECK (addr.isString ());
+      addresses.push_back (addr.asString ());
+    }
+
+  VLOG (1) << "Added " << res.size () << " addresses to the cache";
+}
+
+std::string
+AddressCache::Get ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    if (!addresses.empty ())
+      {
+        std::string res = std::move (addresses.front ());
+        addresses.pop_front ();
+        return res;
+      }
+  }
+
+  VLOG (1) << "Address cache is empty, requesting new address";
+  return rpc->getnewaddress ();
+}
+
+size_t
+AddressCache::GetSize () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return addresses.size ();
+}
+
+} // namespace democrit
@@ -0,0 +1,83 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/addresscache.hpp"
+
+#include "mockxaya.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+namespace democrit
+{
+namespace
+{
+
+class AddressCacheTests : public testing::Test
+{
+
+protected:
+
+  TestEnvironment<MockXayaRpcServer> env;
+  AddressCache cache;
+
+  AddressCacheTests ()
+    : cache(env.GetXayaRpc (), 3)
+  {}
+
+};
+
+TEST_F (AddressCacheTests, FallbackWhenEmpty)
+{
+  EXPECT_EQ (cache.GetSize (), 0);
+  EXPECT_EQ (cache.Get (), "addr 1");
+  EXPECT_EQ (cache.Get (), "addr 2");
+}
+
+TEST_F (AddressCacheTests, Refill)
+{
+  cache.Refill ();
+  EXPECT_EQ (cache.GetSize (), 3);
+
+  EXPECT_EQ (cache.Get (), "addr 1");
+  EXPECT_EQ (cache.GetSize (), 2);
+
+  cache.Refill ();
+  EXPECT_EQ (cache.GetSize (), 3);
+  cache.Refill ();
+  EXPECT_EQ (cache.GetSize (), 3);
+
+  EXPECT_EQ (cache.Get (), "addr 2");
+  EXPECT_EQ (cache.Get (), "addr 3");
+  EXPECT_EQ (cache.Get (), "addr 4");
+  EXPECT_EQ (cache.Get (), "addr 5");
+  EXPECT_EQ (cache.GetSize (), 0);
+}
+
+TEST_F (AddressCacheTests, BackgroundRefills)
+{
+  cache.StartRefills (std::chrono::milliseconds (1));
+  for (int i = 0; i < 100 && cache.GetSize () < 3; ++i)
+    std::this_thread::sleep_for (std::chrono::milliseconds (10));
+  EXPECT_EQ (cache.GetSize (), 3);
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -0,0 +1,90 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/assetinterner.hpp"
+
+#include <glog/logging.h>
+
+#include <limits>
+#include <mutex>
+
+namespace democrit
+{
+
+AssetId
+AssetInterner::Intern (const Asset& asset)
+{
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mut);
+    const auto mit = ids.find (asset);
+    if (mit != ids.end ())
+      return mit->second;
+  }
+
+  std::lock_guard<std::shared_timed_mutex> lock(mut);
+
+  /* Some other thread may have added the asset in the mean time.  */
+  const auto mit = ids.find (asset);
+  if (mit != ids.end ())
+    return mit->second;
+
+  CHECK_LT (assets.size (), std::numeric_limits<AssetId>::max ())
+      << "Too many interned assets";
+  const AssetId id = assets.size ();
+  assets.push_back (asset);
+  ids.emplace (asset, id);
+
+  return id;
+}
+
+bool
+AssetInterner::Find (const Asset& asset, AssetId& id) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+
+  const auto mit = ids.find (asset);
+  if (mit == ids.end ())
+    return false;
+
+  id = mit->second;
+  return true;
+}
+
+const Asset&
+AssetInterner::Get (const AssetId id) const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+  CHECK_LT (id, assets.size ()) << "Invalid asset handle: " << id;
+  return assets[id];
+}
+
+size_t
+AssetInterner::Size () const
+{
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+  return assets.size ();
+}
+
+AssetInterner&
+AssetInterner::Global ()
+{
+  static AssetInterner instance;
+  return instance;
+}
+
+} // namespace democrit
@@ -0,0 +1,93 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/assetinterner.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+
+namespace democrit
+{
+namespace
+{
+
+using AssetInternerTests = testing::Test;
+
+TEST_F (AssetInternerTests, RoundTrip)
+{
+  AssetInterner table;
+
+  const auto gold = table.Intern ("gold");
+  const auto silver = table.Intern ("silver");
+  EXPECT_NE (gold, silver);
+  EXPECT_EQ (table.Intern ("gold"), gold);
+  EXPECT_EQ (table.Size (), 2);
+
+  EXPECT_EQ (table.Get (gold), "gold");
+  EXPECT_EQ (table.Get (silver), "silver");
+}
+
+TEST_F (AssetInternerTests, Find)
+{
+  AssetInterner table;
+  const auto gold = table.Intern ("gold");
+
+  AssetId id;
+  ASSERT_TRUE (table.Find ("gold", id));
+  EXPECT_EQ (id, gold);
+  EXPECT_FALSE (table.Find ("silver", id));
+  EXPECT_EQ (table.Size (), 1);
+}
+
+TEST_F (AssetInternerTests, ReferencesStayValid)
+{
+  AssetInterner table;
+  const auto& first = table.Get (table.Intern ("first"));
+
+  for (unsigned i = 0; i < 10'000; ++i)
+    table.Intern ("asset " + std::to_string (i));
+
+  EXPECT_EQ (first, "first");
+}
+
+TEST_F (AssetInternerTests, Concurrent)
+{
+  AssetInterner table;
+
+  std::vector<std::thread> threads;
+  std::vector<std::vector<AssetId>> ids(4);
+  for (unsigned t = 0; t < ids.size (); ++t)
+    threads.emplace_back ([&table, &ids, t] ()
+      {
+        for (unsigned i = 0; i < 1'000; ++i)
+          ids[t].push_back (table.Intern ("asset " + std::to_string (i)));
+      });
+  for (auto& t : threads)
+    t.join ();
+
+  EXPECT_EQ (table.Size (), 1'000);
+  for (unsigned t = 1; t < ids.size (); ++t)
+    EXPECT_EQ (ids[t], ids[0]);
+  for (unsigned i = 0; i < 1'000; ++i)
+    EXPECT_EQ (table.Get (ids[0][i]), "asset " + std::to_string (i));
+}
+
+} // anonymous namespace
+} // namespace democrit
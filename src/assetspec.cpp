@@ -0,0 +1,86 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "assetspec.hpp"
+
+namespace democrit
+{
+
+std::vector<bool>
+AssetSpec::IsAssetBatch (const std::vector<Asset>& assets) const
+{
+  std::vector<bool> res;
+  res.reserve (assets.size ());
+  for (const auto& a : assets)
+    res.push_back (IsAsset (a));
+
+  return res;
+}
+
+std::vector<bool>
+AssetSpec::CanSellBatch (const std::vector<AmountQuery>& queries,
+                         xaya::uint256& hash) const
+{
+  std::vector<bool> res(queries.size (), false);
+  std::vector<xaya::uint256> hashes(queries.size ());
+
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < queries.size (); ++i)
+    pending.push_back (i);
+
+  /* The last successful check determines the block we return.  If earlier
+     checks succeeded at a different block, we do not know whether they
+     are still valid.  Reporting them as failed would make the caller drop
+     valid orders, so we check them again instead until all successful
+     results agree on the block.  */
+  bool found = false;
+  while (!pending.empty ())
+    {
+      for (const auto i : pending)
+        {
+          const auto& q = queries[i];
+          res[i] = CanSell (q.name, q.asset, q.n, hashes[i]);
+          if (res[i])
+            {
+              hash = hashes[i];
+              found = true;
+            }
+        }
+
+      pending.clear ();
+      if (found)
+        for (size_t i = 0; i < res.size (); ++i)
+          if (res[i] && hashes[i] != hash)
+            pending.push_back (i);
+    }
+
+  return res;
+}
+
+std::vector<bool>
+AssetSpec::CanBuyBatch (const std::vector<AmountQuery>& queries) const
+{
+  std::vector<bool> res;
+  res.reserve (queries.size ());
+  for (const auto& q : queries)
+    res.push_back (CanBuy (q.name, q.asset, q.n));
+
+  return res;
+}
+
+} // namespace democrit
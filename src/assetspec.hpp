@@ -25,6 +25,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace democrit
 {
@@ -53,6 +54,24 @@ class AssetSpec
 
 public:
 
+  /**
+   * A single query for one of the batch methods checking whether or not
+   * an account can sell or buy some amount of an asset.
+   */
+  struct AmountQuery
+  {
+
+    /** The account name (without p/ prefix).  */
+    std::string name;
+
+    /** The asset to check.  */
+    Asset asset;
+
+    /** The amount to check.  */
+    Amount n;
+
+  };
+
   AssetSpec () = default;
   virtual ~AssetSpec () = default;
 
@@ -103,6 +122,36 @@ public:
   virtual bool CanBuy (const std::string& name,
                        const Asset& asset, Amount n) const = 0;
 
+  /**
+   * Checks a whole batch of assets with IsAsset, returning the result
+   * for each of them.  By default this just calls IsAsset for each entry,
+   * but implementations can override it to make the lookups more efficient
+   * (e.g. with a single RPC round trip).
+   */
+  virtual std::vector<bool> IsAssetBatch (
+      const std::vector<Asset>& assets) const;
+
+  /**
+   * Checks a whole batch of CanSell queries, returning the result for each
+   * of them.  If any of the results is true, then hash is set to the block
+   * hash at which those checks were done.  If the underlying state changed
+   * during the batch, then successful checks done at an earlier block are
+   * repeated, so that all true results are confirmed at the returned
+   * block hash.
+   *
+   * By default this calls CanSell for each entry, but implementations
+   * can override it to do the checks more efficiently.
+   */
+  virtual std::vector<bool> CanSellBatch (
+      const std::vector<AmountQuery>& queries, xaya::uint256& hash) const;
+
+  /**
+   * Checks a whole batch of CanBuy queries, returning the result for each
+   * of them.  By default this just calls CanBuy for each entry.
+   */
+  virtual std::vector<bool> CanBuyBatch (
+      const std::vector<AmountQuery>& queries) const;
+
   /**
    * Constructs and returns a move (without the game-ID envelope) that
    * transfers the given asset from a sender account to a recipient account.
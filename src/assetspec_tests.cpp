@@ -0,0 +1,171 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "assetspec.hpp"
+
+#include <xayautil/hash.hpp>
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+namespace democrit
+{
+namespace
+{
+
+using testing::ElementsAre;
+
+/**
+ * Simple AssetSpec used to test the default batch implementations.  All
+ * assets starting with "valid" are valid, and accounts can sell as many
+ * units as their name's length.  Each call to CanSell returns the block
+ * hash of a counter that can be advanced.
+ */
+class BatchTestAssets : public AssetSpec
+{
+
+public:
+
+  /**
+   * Counter for the block hash returned.  While "advance" is non-zero,
+   * each call to CanSell increments it.
+   */
+  mutable unsigned block = 0;
+
+  /** Number of further calls to CanSell that advance the block.  */
+  mutable unsigned advance = 0;
+
+  static xaya::uint256
+  GetBlockHash (const unsigned n)
+  {
+    std::ostringstream msg;
+    msg << "block " << n;
+    return xaya::SHA256::Hash (msg.str ());
+  }
+
+  std::string
+  GetGameId () const override
+  {
+    return "test";
+  }
+
+  bool
+  IsAsset (const Asset& asset) const override
+  {
+    return asset.substr (0, 5) == "valid";
+  }
+
+  bool
+  CanSell (const std::string& name, const Asset& asset, const Amount n,
+           xaya::uint256& hash) const override
+  {
+    hash = GetBlockHash (block);
+    if (advance > 0)
+      {
+        ++block;
+        --advance;
+      }
+    return n <= static_cast<Amount> (name.size ());
+  }
+
+  bool
+  CanBuy (const std::string& name, const Asset& asset,
+          const Amount n) const override
+  {
+    return name != "nobody";
+  }
+
+  Json::Value
+  GetTransferMove (const std::string& sender, const std::string& receiver,
+                   const Asset& asset, const Amount n) const override
+  {
+    return Json::Value ();
+  }
+
+};
+
+class AssetSpecBatchTests : public testing::Test
+{
+
+protected:
+
+  BatchTestAssets spec;
+
+};
+
+TEST_F (AssetSpecBatchTests, IsAsset)
+{
+  EXPECT_THAT (spec.IsAssetBatch ({}), ElementsAre ());
+  EXPECT_THAT (spec.IsAssetBatch ({"valid 1", "invalid", "valid 2"}),
+               ElementsAre (true, false, true));
+}
+
+TEST_F (AssetSpecBatchTests, CanBuy)
+{
+  EXPECT_THAT (spec.CanBuyBatch ({
+    {"domob", "gold", 10},
+    {"nobody", "gold", 1},
+  }), ElementsAre (true, false));
+}
+
+TEST_F (AssetSpecBatchTests, CanSell)
+{
+  xaya::uint256 hash;
+  EXPECT_THAT (spec.CanSellBatch ({
+    {"domob", "gold", 5},
+    {"domob", "gold", 6},
+    {"andy", "gold", 1},
+  }, hash), ElementsAre (true, false, true));
+  EXPECT_EQ (hash, BatchTestAssets::GetBlockHash (0));
+}
+
+TEST_F (AssetSpecBatchTests, CanSellBlockChanged)
+{
+  /* The first two checks are done at blocks 0 and 1.  Both are then
+     repeated, and agree on block 2.  */
+  spec.advance = 2;
+
+  xaya::uint256 hash;
+  EXPECT_THAT (spec.CanSellBatch ({
+    {"domob", "gold", 1},
+    {"andy", "gold", 1},
+    {"domob", "gold", 100},
+  }, hash), ElementsAre (true, true, false));
+  EXPECT_EQ (hash, BatchTestAssets::GetBlockHash (2));
+  EXPECT_EQ (spec.advance, 0);
+}
+
+TEST_F (AssetSpecBatchTests, CanSellBlockChangedRepeatedly)
+{
+  /* The block keeps moving during the rechecks as well.  Valid sells are
+     still reported as such in the end.  */
+  spec.advance = 5;
+
+  xaya::uint256 hash;
+  EXPECT_THAT (spec.CanSellBatch ({
+    {"domob", "gold", 1},
+    {"andy", "gold", 1},
+    {"domob", "gold", 5},
+  }, hash), ElementsAre (true, true, true));
+  EXPECT_EQ (hash, BatchTestAssets::GetBlockHash (5));
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -21,6 +21,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <mutex>
 #include <sstream>
 
 namespace democrit
@@ -33,6 +34,12 @@ DEFINE_string (democrit_xid_servers, "chat.xaya.io",
 namespace
 {
 
+/**
+ * Maximum number of memoised authentication results.  If more JIDs
+ * are cached, we simply clear the cache.
+ */
+constexpr size_t MAX_CACHED_JIDS = 10'000;
+
 /**
  * Parses a comma-separated string into pieces.
  */
@@ -118,7 +125,8 @@ DecodeName (const std::string& name, std::string& decoded)
       return true;
     }
 
-  std::ostringstream out;
+  std::string out;
+  out.reserve (hexPart.size () / 2);
   uint8_t cur = 0;
   bool inByte = false;
   bool foundNonSimple = false;
@@ -137,7 +145,7 @@ DecodeName (const std::string& name, std::string& decoded)
           if (!IsSimpleChar (decodedChar))
             foundNonSimple = true;
 
-          out << decodedChar;
+          out.push_back (decodedChar);
           cur = 0;
           inByte = false;
         }
@@ -155,7 +163,7 @@ DecodeName (const std::string& name, std::string& decoded)
   if (!foundNonSimple)
     return false;
 
-  decoded = out.str ();
+  decoded = std::move (out);
   return true;
 }
 
@@ -172,20 +180,51 @@ Authenticator::Authenticator ()
 bool
 Authenticator::Authenticate (const gloox::JID& jid, std::string& account) const
 {
+  {
+    std::shared_lock<std::shared_timed_mutex> lock(mut);
+    const auto mit = accountForJid.find (jid.full ());
+    if (mit != accountForJid.end ())
+      {
+        account = mit->second;
+
+        /* In the common case, the account is still known with this JID
+           and we are done.  Otherwise we need the exclusive lock for
+           updating it below.  */
+        const auto mitKnown = knownJids.find (account);
+        if (mitKnown != knownJids.end () && mitKnown->second == jid)
+          return true;
+      }
+  }
+
   if (xidServers.count (jid.server ()) == 0)
     return false;
 
   if (!DecodeName (jid.username (), account))
     return false;
 
+  std::lock_guard<std::shared_timed_mutex> lock(mut);
+  if (accountForJid.size () >= MAX_CACHED_JIDS)
+    accountForJid.clear ();
+  accountForJid[jid.full ()] = account;
+
   VLOG (1) << "JID for account " << account << ": " << jid.full ();
   knownJids[account] = jid;
+
   return true;
 }
 
+void
+Authenticator::Forget (const gloox::JID& jid)
+{
+  std::lock_guard<std::shared_timed_mutex> lock(mut);
+  accountForJid.erase (jid.full ());
+}
+
 bool
 Authenticator::LookupJid (const std::string& account, gloox::JID& jid) const
 {
+  std::shared_lock<std::shared_timed_mutex> lock(mut);
+
   const auto mit = knownJids.find (account);
   if (mit == knownJids.end ())
     return false;
@@ -0,0 +1,81 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/authenticator.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <gloox/jid.h>
+
+#include <glog/logging.h>
+
+#include <string>
+
+namespace democrit
+{
+namespace
+{
+
+/**
+ * JID that is authenticated.  It uses the default server list
+ * and a hex-encoded name, which is the more expensive case.
+ */
+constexpr const char* JID = "x-466f6f20426172@chat.xaya.io/resource";
+
+/**
+ * Authenticates the same JID repeatedly, which is answered from the
+ * memoised results.
+ */
+void
+AuthenticateCached (benchmark::State& state)
+{
+  const Authenticator auth;
+  const gloox::JID jid(JID);
+
+  for (auto _ : state)
+    {
+      std::string account;
+      CHECK (auth.Authenticate (jid, account));
+      benchmark::DoNotOptimize (account);
+    }
+}
+BENCHMARK (AuthenticateCached);
+
+/**
+ * Authenticates a JID whose result has been dropped from the memoised
+ * data before, so that it is decoded fully each time.  This includes
+ * the cost of Forget.
+ */
+void
+AuthenticateUncached (benchmark::State& state)
+{
+  Authenticator auth;
+  const gloox::JID jid(JID);
+
+  for (auto _ : state)
+    {
+      auth.Forget (jid);
+      std::string account;
+      CHECK (auth.Authenticate (jid, account));
+      benchmark::DoNotOptimize (account);
+    }
+}
+BENCHMARK (AuthenticateUncached);
+
+} // anonymous namespace
+} // namespace democrit
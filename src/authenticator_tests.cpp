@@ -77,6 +77,24 @@ protected:
     return *auth;
   }
 
+  /**
+   * Drops the memoised result for a JID (parsed from string).
+   */
+  void
+  Forget (const std::string& jid)
+  {
+    auth->Forget (gloox::JID (jid));
+  }
+
+  /**
+   * Returns the number of memoised authentication results.
+   */
+  size_t
+  GetNumCached () const
+  {
+    return auth->accountForJid.size ();
+  }
+
 };
 
 namespace
@@ -168,5 +186,49 @@ TEST_F (AuthenticatorTests, LookupJid)
   ASSERT_FALSE (GetAuth ().LookupJid ("abc", jid));
 }
 
+TEST_F (AuthenticatorTests, MemoisedResults)
+{
+  SetServers ("server");
+
+  ExpectInvalid ("domob@other");
+  EXPECT_EQ (GetNumCached (), 0);
+
+  ExpectValid ("domob@server/foo", "domob");
+  ExpectValid ("domob@server/foo", "domob");
+  EXPECT_EQ (GetNumCached (), 1);
+  ExpectValid ("x-c3a4c3b6c3bc@server/bar", u8"äöü");
+  EXPECT_EQ (GetNumCached (), 2);
+
+  Forget ("domob@server/foo");
+  EXPECT_EQ (GetNumCached (), 1);
+  Forget ("domob@server/foo");
+  EXPECT_EQ (GetNumCached (), 1);
+
+  ExpectValid ("domob@server/foo", "domob");
+  EXPECT_EQ (GetNumCached (), 2);
+}
+
+TEST_F (AuthenticatorTests, MemoisedUpdatesKnownJid)
+{
+  SetServers ("server");
+
+  ExpectValid ("domob@server/foo", "domob");
+  ExpectValid ("domob@server/bar", "domob");
+
+  gloox::JID jid;
+  ASSERT_TRUE (GetAuth ().LookupJid ("domob", jid));
+  EXPECT_EQ (jid, "domob@server/bar");
+
+  /* This is a cache hit, but should still switch back the known JID.  */
+  ExpectValid ("domob@server/foo", "domob");
+  ASSERT_TRUE (GetAuth ().LookupJid ("domob", jid));
+  EXPECT_EQ (jid, "domob@server/foo");
+
+  /* Forgetting a JID does not affect LookupJid.  */
+  Forget ("domob@server/foo");
+  ASSERT_TRUE (GetAuth ().LookupJid ("domob", jid));
+  EXPECT_EQ (jid, "domob@server/foo");
+}
+
 } // anonymous namespace
 } // namespace democrit
@@ -0,0 +1,77 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "benchutils.hpp"
+
+#include <utility>
+
+namespace democrit
+{
+
+std::string
+GetBenchAsset (const unsigned n)
+{
+  return "asset " + std::to_string (n);
+}
+
+std::string
+GetBenchAccount (const unsigned n)
+{
+  return "account" + std::to_string (n);
+}
+
+proto::OrdersOfAccount
+BenchOrders (const std::string& account, const unsigned numOrders,
+             const unsigned seed)
+{
+  proto::OrdersOfAccount res;
+  res.set_account (account);
+
+  auto& orders = *res.mutable_orders ();
+  for (unsigned i = 0; i < numOrders; ++i)
+    {
+      proto::Order o;
+      o.set_asset (GetBenchAsset (i % BENCH_NUM_ASSETS));
+      o.set_max_units (1 + i % 7);
+      if (i % 2 == 0)
+        {
+          o.set_type (proto::Order::BID);
+          o.set_price_sat (1'000 + (i * 13 + seed) % 500);
+        }
+      else
+        {
+          o.set_type (proto::Order::ASK);
+          o.set_price_sat (1'500 + (i * 17 + seed) % 500);
+        }
+      orders[i + 1] = std::move (o);
+    }
+
+  return res;
+}
+
+void
+FillOrderbook (OrderBook& ob, const unsigned numOrders)
+{
+  const unsigned numAccounts
+      = (numOrders + BENCH_ORDERS_PER_ACCOUNT - 1) / BENCH_ORDERS_PER_ACCOUNT;
+  for (unsigned i = 0; i < numAccounts; ++i)
+    ob.UpdateOrders (BenchOrders (GetBenchAccount (i),
+                                  BENCH_ORDERS_PER_ACCOUNT));
+}
+
+} // namespace democrit
@@ -0,0 +1,78 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_BENCHUTILS_HPP
+#define DEMOCRIT_BENCHUTILS_HPP
+
+#include "private/orderbook.hpp"
+#include "proto/orders.pb.h"
+
+#include <string>
+
+namespace democrit
+{
+
+/** Number of orders per account when filling orderbooks.  */
+constexpr unsigned BENCH_ORDERS_PER_ACCOUNT = 100;
+
+/** Number of distinct assets that the benchmark orders are spread over.  */
+constexpr unsigned BENCH_NUM_ASSETS = 10;
+
+/**
+ * Returns the name of the n-th asset used in benchmarks.
+ */
+std::string GetBenchAsset (unsigned n);
+
+/**
+ * Constructs a set of orders for one account.  They are spread evenly
+ * over BENCH_NUM_ASSETS assets and alternate between bids and asks, with
+ * varying prices.  The seed is used to vary the prices, e.g. so that
+ * repeated updates for an account actually change its orders.
+ */
+proto::OrdersOfAccount BenchOrders (const std::string& account,
+                                    unsigned numOrders, unsigned seed = 0);
+
+/**
+ * Fills an orderbook with (roughly) the given total number of orders,
+ * made up of accounts with BENCH_ORDERS_PER_ACCOUNT orders each.
+ */
+void FillOrderbook (OrderBook& ob, unsigned numOrders);
+
+/**
+ * Returns the name of the n-th account used for filling orderbooks.
+ */
+std::string GetBenchAccount (unsigned n);
+
+/**
+ * Orderbook without any practical timeout of orders, as used
+ * in the benchmarks.
+ */
+class BenchOrderbook : public OrderBook
+{
+
+public:
+
+  BenchOrderbook ()
+    : OrderBook(std::chrono::hours (1))
+  {}
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_BENCHUTILS_HPP
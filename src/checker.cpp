@@ -23,6 +23,8 @@
 
 #include <glog/logging.h>
 
+#include <vector>
+
 namespace democrit
 {
 
@@ -109,13 +111,92 @@ TradeChecker::GetTotalSat (Amount& total) const
 namespace
 {
 
+/**
+ * Looks up the header data for the given block, either from the cache
+ * or (if it is not yet cached) with getblockheader.  Returns false if the
+ * block is not known to Xaya Core.
+ */
+bool
+GetBlockHeader (RpcClient<XayaRpcClient>& rpc, BlockHeaderCache& cache,
+                const xaya::uint256& hash, BlockHeaderCache::Header& out)
+{
+  if (cache.Lookup (hash, out))
+    return true;
+
+  Json::Value data;
+  try
+    {
+      data = rpc->getblockheader (hash.ToHex ());
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      LOG (WARNING)
+          << "getblockheader failed for " << hash.ToHex ()
+          << ": " << exc.what ();
+      return false;
+    }
+
+  out = BlockHeaderCache::Header::FromJson (data);
+  CHECK (out.hash == hash)
+      << "getblockheader returned wrong block for " << hash.ToHex ()
+      << ": " << data;
+  cache.Insert (out);
+
+  return true;
+}
+
+/**
+ * Makes sure that the given blocks are in the header cache, fetching all
+ * missing ones with a single batched getblockheader call.  If that fails,
+ * nothing is done, and the blocks will be retrieved one by one
+ * later on instead.
+ */
+void
+PrefetchBlockHeaders (RpcClient<XayaRpcClient>& rpc, BlockHeaderCache& cache,
+                      const std::vector<xaya::uint256>& hashes)
+{
+  std::vector<Json::Value> params;
+  for (const auto& h : hashes)
+    {
+      BlockHeaderCache::Header dummy;
+      if (cache.Lookup (h, dummy))
+        continue;
+
+      Json::Value cur(Json::arrayValue);
+      cur.append (h.ToHex ());
+      params.push_back (cur);
+    }
+
+  if (params.size () < 2)
+    return;
+
+  std::vector<Json::Value> headers;
+  try
+    {
+      headers = rpc.CallBatch ("getblockheader", params);
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      VLOG (1) << "Batched getblockheader failed: " << exc.what ();
+      return;
+    }
+
+  for (const auto& h : headers)
+    cache.Insert (BlockHeaderCache::Header::FromJson (h));
+}
+
 /**
  * Checks if the given ancestor block hash is indeed an ancestor of the
  * given child block, according to the Xaya RPC interface.  We check at most
  * n blocks back.
+ *
+ * Based on the block heights, we can tell right away if the ancestor is
+ * too far back (or not back at all).  Otherwise we walk back the chain of
+ * parent blocks from the child.  All header data is taken from the cache
+ * if possible, so in the common case no RPC calls are needed at all.
  */
 bool
-IsBlockAncestor (RpcClient<XayaRpcClient>& rpc,
+IsBlockAncestor (RpcClient<XayaRpcClient>& rpc, BlockHeaderCache& cache,
                  const xaya::uint256& ancestor,
                  const xaya::uint256& child,
                  const int n)
@@ -123,25 +204,25 @@ IsBlockAncestor (RpcClient<XayaRpcClient>& rpc,
   if (ancestor == child)
     return true;
 
-  if (n == 0)
+  PrefetchBlockHeaders (rpc, cache, {ancestor, child});
+
+  BlockHeaderCache::Header ancestorHeader, cur;
+  if (!GetBlockHeader (rpc, cache, ancestor, ancestorHeader)
+        || !GetBlockHeader (rpc, cache, child, cur))
+    return false;
+
+  if (cur.height < ancestorHeader.height
+        || cur.height - ancestorHeader.height > static_cast<unsigned> (n))
     return false;
-  CHECK_GT (n, 0);
 
-  const auto childData = rpc->getblockheader (child.ToHex ());
-  CHECK (childData.isObject ());
-  const auto prevVal = childData["previousblockhash"];
-  if (prevVal.isNull ())
+  while (cur.height > ancestorHeader.height)
     {
-      /* This is the case for the genesis block.  */
-      return false;
+      CHECK (!cur.parent.IsNull ());
+      if (!GetBlockHeader (rpc, cache, cur.parent, cur))
+        return false;
     }
-  CHECK (prevVal.isString ());
-  xaya::uint256 parent;
-  CHECK (parent.FromHex (prevVal.asString ()))
-      << "getblockheader prev block hash is not valid uint256: "
-      << childData;
 
-  return IsBlockAncestor (rpc, ancestor, parent, n - 1);
+  return cur.hash == ancestor;
 }
 
 } // anonymous namespace
@@ -218,7 +299,8 @@ TradeChecker::CheckForBuyerTrade (proto::OutPoint& nameInput) const
       return false;
     }
 
-  if (!IsBlockAncestor (xaya, utxoBlock, gspBlock, MAX_BLOCK_ANCESTORS_CHECKED))
+  if (!IsBlockAncestor (xaya, headers, utxoBlock, gspBlock,
+                        MAX_BLOCK_ANCESTORS_CHECKED))
     {
       LOG (WARNING)
           << "UTXO block is not ancestor of GSP block; still syncing?\n"
@@ -233,8 +315,8 @@ bool
 TradeChecker::CheckForBuyerSignature (const std::string& beforeStr,
                                       const std::string& afterStr) const
 {
-  const auto before = xaya->decodepsbt (beforeStr);
-  const auto after = xaya->decodepsbt (afterStr);
+  const auto before = psbts.Decode (beforeStr);
+  const auto after = psbts.Decode (afterStr);
 
   /* The "tx" field inside the PSBT is always unsigned, so should never
      change at all by signing (no matter what).  */
@@ -304,8 +386,7 @@ TradeChecker::CheckForSellerOutputs (const std::string& psbt,
 {
   CHECK (sd.has_chi_address () && sd.has_name_address ());
 
-  const auto decoded = xaya->decodepsbt (psbt);
-  CHECK (decoded.isObject ());
+  const auto decoded = psbts.Decode (psbt);
   const auto& tx = decoded["tx"];
   CHECK (tx.isObject ());
   const auto& vout = tx["vout"];
@@ -402,8 +483,8 @@ TradeChecker::CheckForSellerSignature (const std::string& beforeStr,
   const auto& nmOut = sd.name_output ();
   CHECK (nmOut.has_hash () && nmOut.has_n ());
 
-  const auto before = xaya->decodepsbt (beforeStr);
-  const auto after = xaya->decodepsbt (afterStr);
+  const auto before = psbts.Decode (beforeStr);
+  const auto after = psbts.Decode (afterStr);
 
   /* The "tx" field inside the PSBT is always unsigned, so should never
      change at all by signing (no matter what).  */
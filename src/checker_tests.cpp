@@ -43,11 +43,15 @@ protected:
 
   TestEnvironment<MockXayaRpcServer> env;
   TestAssets spec;
+  BlockHeaderCache headers;
+  PsbtDecoder psbts;
 
   TradeChecker checker;
 
   TradeCheckerTests ()
-    : checker(spec, env.GetXayaRpc (), "buyer", "seller", "gold", 10, 3)
+    : headers(100), psbts(env.GetXayaRpc (), 100),
+      checker(spec, env.GetXayaRpc (), headers, psbts,
+              "buyer", "seller", "gold", 10, 3)
   {
     /* By default, the setting is such that the game allows the trade.  Tests
        for this will overwrite the data as needed.  */
@@ -99,8 +103,8 @@ TEST_F (TradeCheckerTests, GetTotalSat)
 
   for (const auto& t : tests)
     {
-      const TradeChecker c(spec, env.GetXayaRpc (), "buyer", "seller", "gold",
-                           t.price, t.units);
+      const TradeChecker c(spec, env.GetXayaRpc (), headers, psbts,
+                           "buyer", "seller", "gold", t.price, t.units);
       Amount res;
       ASSERT_EQ (c.GetTotalSat (res), t.expectedSuccess);
       if (t.expectedSuccess)
@@ -144,13 +148,15 @@ protected:
 
 TEST_F (TradeCheckerForBuyerTests, InvalidAsset)
 {
-  TradeChecker c(spec, env.GetXayaRpc (), "buyer", "seller", "invalid", 1, 1);
+  TradeChecker c(spec, env.GetXayaRpc (), headers, psbts,
+                 "buyer", "seller", "invalid", 1, 1);
   ExpectInvalid (c);
 }
 
 TEST_F (TradeCheckerForBuyerTests, BuyerCannotReceive)
 {
-  TradeChecker c(spec, env.GetXayaRpc (), "uninit", "seller", "gold", 1, 1);
+  TradeChecker c(spec, env.GetXayaRpc (), headers, psbts,
+                 "uninit", "seller", "gold", 1, 1);
   ExpectInvalid (c);
 }
 
@@ -228,6 +234,42 @@ TEST_F (TradeCheckerForBuyerTests, ValidAncestorBlock)
   ExpectValid (checker);
 }
 
+TEST_F (TradeCheckerForBuyerTests, UnknownGspBlock)
+{
+  xaya::uint256 unknown;
+  ASSERT_TRUE (unknown.FromHex (
+      "aa00000000000000000000000000000000000000000000000000000000000000"));
+  spec.SetBlock (unknown);
+  env.GetXayaServer ().SetBestBlock (env.GetXayaServer ().GetBlockHash (10));
+
+  env.GetXayaServer ().AddUtxo ("seller txid", 12);
+  ExpectInvalid (checker);
+}
+
+TEST_F (TradeCheckerForBuyerTests, CachedBlockHeaders)
+{
+  spec.SetBlock (env.GetXayaServer ().GetBlockHash (10));
+  env.GetXayaServer ().SetBestBlock (env.GetXayaServer ().GetBlockHash (8));
+  env.GetXayaServer ().AddUtxo ("seller txid", 12);
+
+  ExpectValid (checker);
+  const unsigned calls = env.GetXayaServer ().GetNumBlockHeaderCalls ();
+  EXPECT_GT (calls, 0);
+  EXPECT_EQ (headers.GetSize (), 3);
+
+  /* Checking another trade against the same blocks is answered completely
+     from the cache.  */
+  const TradeChecker other(spec, env.GetXayaRpc (), headers, psbts,
+                           "buyer", "seller", "gold", 5, 1);
+  ExpectValid (other);
+  EXPECT_EQ (env.GetXayaServer ().GetNumBlockHeaderCalls (), calls);
+
+  /* A block too far back is rejected just based on the heights.  */
+  env.GetXayaServer ().SetBestBlock (env.GetXayaServer ().GetBlockHash (8));
+  spec.SetBlock (env.GetXayaServer ().GetBlockHash (12));
+  ExpectInvalid (checker);
+}
+
 /* ************************************************************************** */
 
 class TradeCheckerForBuyerSignatureTests : public TradeCheckerTests
@@ -424,7 +466,8 @@ TEST_F (TradeCheckerForSellerOutputsTests, ExtraOutputOk)
 
 TEST_F (TradeCheckerForSellerOutputsTests, ZeroTotalNeedsNoChiOutput)
 {
-  TradeChecker c(spec, env.GetXayaRpc (), "buyer", "seller", "gold", 0, 1);
+  TradeChecker c(spec, env.GetXayaRpc (), headers, psbts,
+                 "buyer", "seller", "gold", 0, 1);
 
   const auto baseVouts = GetValidVout (c);
   Json::Value vouts(Json::arrayValue);
@@ -450,7 +493,8 @@ TEST_F (TradeCheckerForSellerOutputsTests, ChiAndNameSameAddress)
 TEST_F (TradeCheckerForSellerOutputsTests, TotalOverflow)
 {
   const auto max = std::numeric_limits<Amount>::max ();
-  TradeChecker c(spec, env.GetXayaRpc (), "buyer", "seller", "gold", max, 2);
+  TradeChecker c(spec, env.GetXayaRpc (), headers, psbts,
+                 "buyer", "seller", "gold", max, 2);
 
   Json::Value vouts = GetValidVout (checker);
   vouts[0]["value"] = 10.0 * max;
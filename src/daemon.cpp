@@ -19,22 +19,43 @@
 #include "daemon.hpp"
 
 #include "private/authenticator.hpp"
+#include "private/inputpool.hpp"
 #include "private/intervaljob.hpp"
+#include "private/metrics.hpp"
 #include "private/mucclient.hpp"
 #include "private/myorders.hpp"
 #include "private/orderbook.hpp"
+#include "private/ordersingress.hpp"
+#include "private/roomshards.hpp"
 #include "private/rpcclient.hpp"
 #include "private/stanzas.hpp"
 #include "private/state.hpp"
 #include "private/trades.hpp"
+#include "private/validationcache.hpp"
+#include "private/versioncounter.hpp"
+#include "private/workerpool.hpp"
 #include "proto/processing.pb.h"
 #include "rpc-stubs/demgsprpcclient.h"
 #include "rpc-stubs/xayarpcclient.h"
 
+#include <xayautil/jsonutils.hpp>
+
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
 
 namespace democrit
 {
@@ -43,6 +64,49 @@ DEFINE_int64 (democrit_order_timeout_ms, 10 * 60 * 1'000,
               "Timeout (in milliseconds) of orders when not refreshed");
 DEFINE_int64 (democrit_reconnect_ms, 10 * 1'000,
               "Interval (in milliseconds) for trying to reconnect to XMPP");
+DEFINE_int64 (democrit_order_broadcast_delay_ms, 100,
+              "Delay (in milliseconds) for collecting changes to our own"
+              " orders into a single broadcast");
+DEFINE_int32 (democrit_worker_threads, 4,
+              "Number of worker threads for processing received order"
+              " broadcasts");
+DEFINE_int32 (democrit_trade_worker_threads, 2,
+              "Number of worker threads per account for processing"
+              " received trade messages");
+DEFINE_uint64 (democrit_max_pending_trade_messages, 1'000,
+               "Maximum number of received trade messages per account"
+               " waiting for processing; further messages are dropped");
+DEFINE_uint64 (democrit_max_pending_order_updates, 1'000,
+               "Maximum number of received order updates waiting for"
+               " validation; further updates are dropped");
+DEFINE_string (democrit_state_dir, "",
+               "If set, persist the daemon state (own orders and trades)"
+               " in this directory and restore it on startup");
+DEFINE_int32 (democrit_state_snapshot_interval, 1'000,
+              "Number of journal entries after which a new snapshot of"
+              " the persisted state is written");
+DEFINE_int64 (democrit_state_sync_ms, 100,
+              "Interval (in milliseconds) for syncing the state journal"
+              " to disk");
+DEFINE_uint64 (democrit_validation_cache_size, 10'000,
+               "Maximum number of cached validation results for received"
+               " orders");
+DEFINE_int64 (democrit_validation_block_ms, 1'000,
+              "Interval (in milliseconds) for checking Xaya's best block"
+              " to flush the validation cache");
+DEFINE_int32 (democrit_input_pool_size, 0,
+              "If positive, keep this many pre-selected and locked wallet"
+              " coins per denomination for funding trades as buyer");
+DEFINE_string (democrit_input_pool_denominations, "1,10,100",
+               "Comma-separated list of CHI denominations for the input pool");
+DEFINE_int64 (democrit_input_pool_refill_ms, 10 * 1'000,
+              "Interval (in milliseconds) for refilling the input pool");
+DEFINE_int32 (democrit_room_shards, 0,
+              "If positive, partition order broadcasts by asset into this"
+              " many rooms named after the main room");
+DEFINE_string (democrit_room_shard_subscriptions, "",
+               "Comma-separated list of the shards to join and trade in"
+               " (all shards if empty)");
 
 /**
  * Whether or not we should use the "legacy" V1 protocol for the Xaya
@@ -53,6 +117,189 @@ bool useLegacyXayaRpcInDaemon = true;
 
 /* ************************************************************************** */
 
+/**
+ * Actual implementation of the market data shared between daemons.  This
+ * holds the orderbooks and everything needed to process and validate
+ * received order broadcasts into them.
+ */
+class SharedMarket::Impl
+{
+
+private:
+
+  /** Lock for the attached accounts and the listener.  */
+  mutable std::mutex mutAccounts;
+
+  /** Accounts of the daemons attached to this market.  */
+  std::set<std::string> accounts;
+
+  /**
+   * Account of the daemon that is currently handing received broadcasts
+   * to us, or empty if none has claimed that yet.
+   */
+  std::string listener;
+
+  /**
+   * Queries the current best block and updates the validation cache
+   * with it.  This is run periodically, so that cached results from
+   * previous blocks are flushed without an extra RPC call for each
+   * received broadcast.
+   */
+  void UpdateValidationBlock ();
+
+  /**
+   * Validates and processes a full update of orders received from
+   * the given account in the room of the given shard.  This is run on
+   * the worker threads.
+   */
+  void ProcessOrders (unsigned shard, const std::string& account,
+                      const proto::OrdersOfAccount& data);
+
+  /**
+   * Validates and processes a delta update of orders received from
+   * the given account in the room of the given shard.  This is run on
+   * the worker threads.
+   */
+  void ProcessOrdersDelta (unsigned shard, const std::string& account,
+                           const proto::OrdersDelta& data);
+
+public:
+
+  /** Asset spec used to validate orders.  */
+  const AssetSpec& spec;
+
+  /** Partitioning of the order broadcasts into rooms.  */
+  const RoomShards shards;
+
+  /** Authenticator for JIDs to account names.  */
+  Authenticator auth;
+
+  /** Aggregated version of all orderbooks, bumped on any change.  */
+  VersionCounter booksVersion;
+
+  /**
+   * General orderbooks that we know of, one for each shard we subscribe to.
+   * Without sharding, there is just one for shard zero.
+   */
+  std::map<unsigned, std::unique_ptr<OrderBook>> books;
+
+  /** The endpoint of xayaRpc.  */
+  const std::string xayaEndpoint;
+
+  /**
+   * RPC connection to Xaya, used for the validation cache.  It is also
+   * used by attached daemons with the same endpoint.
+   */
+  RpcClient<XayaRpcClient> xayaRpc;
+
+  /** RPC connection to the g/dem GSP.  */
+  RpcClient<DemGspRpcClient> demGsp;
+
+  /** Cache for validation results of received orders.  */
+  ValidationCache validationCache;
+
+  /** Received order updates waiting to be processed by the workers.  */
+  OrdersIngress ingress;
+
+  /**
+   * Worker threads for processing received order updates.  This is declared
+   * after all the things the processing needs, so that it is destructed
+   * (and the workers stopped) before them.
+   */
+  std::unique_ptr<WorkerPool> workers;
+
+  /** Periodic job running UpdateValidationBlock.  */
+  std::unique_ptr<IntervalJob> validationBlockJob;
+
+  explicit Impl (const AssetSpec& s, const std::string& xr,
+                 const std::string& dg, const std::string& mucRoom);
+
+  ~Impl ();
+
+  Impl () = delete;
+  Impl (const Impl&) = delete;
+  void operator= (const Impl&) = delete;
+
+  /**
+   * Registers an attached daemon's account.
+   */
+  void Attach (const std::string& account);
+
+  /**
+   * Unregisters an attached daemon's account when it is destructed.
+   */
+  void Detach (const std::string& account);
+
+  /**
+   * Returns true if the given account is one of the attached daemons.
+   */
+  bool IsAttached (const std::string& account) const;
+
+  /**
+   * Called by an attached daemon before handing us a received broadcast.
+   * Returns true if it is (or now becomes) the listener, and thus should
+   * do so.
+   */
+  bool ClaimListener (const std::string& account);
+
+  /**
+   * Called by an attached daemon when it knows it is disconnected, so
+   * that another one can take over as listener.
+   */
+  void ReleaseListener (const std::string& account);
+
+  /**
+   * Returns true if the given order seems valid for the given account,
+   * according to the asset spec.
+   */
+  bool ValidateOrder (const std::string& account, const proto::Order& o) const;
+
+  /**
+   * Validates a batch of orders for the given account, using the batch
+   * methods of the asset spec.  If cache is not null, then it is used
+   * (and updated) for the game-state dependent checks.
+   */
+  std::vector<bool> ValidateOrders (
+      const std::string& account,
+      const std::vector<const proto::Order*>& orders,
+      ValidationCache* cache) const;
+
+  /**
+   * Returns the orderbook of the shard the given asset is in, or null
+   * if we do not subscribe to it.
+   */
+  const OrderBook* GetBook (const Asset& asset) const;
+
+  /**
+   * Runs a query for multiple assets against the orderbooks of their
+   * shards, and merges the results.  Assets in shards we do not subscribe
+   * to are returned with empty books.
+   */
+  template <typename Fcn>
+    proto::OrderbookByAsset QueryBooks (const std::vector<Asset>& assets,
+                                        const Fcn& query) const;
+
+  /**
+   * Queues a full update of orders of an account in the given shard for
+   * processing on the workers.
+   */
+  void SubmitOrders (unsigned shard, const std::string& account,
+                     proto::OrdersOfAccount&& data);
+
+  /**
+   * Queues a delta update of orders of an account in the given shard for
+   * processing on the workers.
+   */
+  void SubmitOrdersDelta (unsigned shard, const std::string& account,
+                          std::shared_ptr<const proto::OrdersDelta> data);
+
+  /**
+   * Queues the removal of all orders of an account that disconnected.
+   */
+  void SubmitDisconnect (const std::string& account);
+
+};
+
 /**
  * Specific MyOrders class that we use in the Daemon.  It implements the
  * update method to broadcast onto the MUC channel.
@@ -62,18 +309,70 @@ class Daemon::MyOrdersImpl : public MyOrders
 
 private:
 
+  /**
+   * Broadcast state for our orders in one of the room shards.
+   */
+  struct ShardState
+  {
+
+    /**
+     * The orders as we last broadcast them (full or as delta).  Deltas
+     * are computed against this state.
+     */
+    proto::OrdersOfAccount lastBroadcast;
+
+    /** Sequence number of the last broadcast we sent.  */
+    uint64_t sequence = 0;
+
+    /**
+     * Set if the next broadcast must be a full one, e.g. because we just
+     * (re)connected and others do not know our state yet.
+     */
+    bool needFull = true;
+
+  };
+
   Impl& impl;
 
+  /** Broadcast state of each shard (created on demand).  */
+  std::map<unsigned, ShardState> shards;
+
+  /** Lock for the broadcast state.  */
+  std::mutex mutBroadcast;
+
+  /**
+   * Broadcasts an update of our orders, either as full update or
+   * as a delta against lastBroadcast.  The orders are split up by
+   * shard, and each part is sent to the shard's room.
+   */
+  void Broadcast (const proto::OrdersOfAccount& ownOrders, bool full);
+
+  /**
+   * Broadcasts the update for our orders in one shard.  This is called
+   * with mutBroadcast held.
+   */
+  void BroadcastShard (unsigned shard, const proto::OrdersOfAccount& orders,
+                       bool full);
+
 protected:
 
   bool ValidateOrder (const std::string& account,
                       const proto::Order& o) const override;
+  std::vector<bool> ValidateOrders (
+      const std::string& account,
+      const std::vector<const proto::Order*>& orders) const override;
   void UpdateOrders (const proto::OrdersOfAccount& ownOrders) override;
+  void OrdersChanged (const proto::OrdersOfAccount& ownOrders) override;
 
 public:
 
   explicit MyOrdersImpl (Impl& i);
 
+  /**
+   * Makes sure the next broadcast will be a full update.
+   */
+  void ForceFullUpdate ();
+
 };
 
 /**
@@ -85,38 +384,51 @@ class Daemon::Impl : private MucClient
 
 private:
 
-  /** Asset spec used to validate orders.  */
-  const AssetSpec& spec;
+  /** The market data we use.  */
+  SharedMarket::Impl& market;
+
+  /**
+   * Set if the market is shared with other daemons, rather than
+   * being our own.
+   */
+  const bool shared;
+
+  /** Our account name.  */
+  const std::string account;
 
   /** The internal "global" state with thread-safe access.  */
   State state;
 
-  /** Authenticator for JIDs to account names.  */
-  Authenticator auth;
-
   /** MyOrders implementation used.  */
   MyOrdersImpl myOrders;
 
-  /** General orderbook that we know of.  */
-  OrderBook allOrders;
+  /**
+   * RPC connection to the Xaya wallet, if we need one of our own (because
+   * our endpoint differs from the market's).
+   */
+  std::unique_ptr<RpcClient<XayaRpcClient>> ownXayaRpc;
 
-  /** RPC connection to the Xaya wallet.  */
-  RpcClient<XayaRpcClient> xayaRpc;
+  /** RPC connection to the Xaya wallet (ours or the market's).  */
+  RpcClient<XayaRpcClient>& xayaRpc;
 
-  /** RPC connection to the g/dem GSP.  */
-  RpcClient<DemGspRpcClient> demGsp;
+  /** On-disk store for old archived trades (may be null).  */
+  std::unique_ptr<TradeArchive> archive;
+
+  /** Pool of pre-selected coins for funding trades (may be null).  */
+  std::unique_ptr<InputPool> inputPool;
 
   /** Handler for active trades.  */
   TradeManager trades;
 
-  /** Interval job for checking the connection and perhaps reconnecting.  */
-  std::unique_ptr<IntervalJob> reconnecter;
-
   /**
-   * Returns true if the given order seems valid for the given account,
-   * according to the asset spec.
+   * Worker threads for processing received trade messages.  This is
+   * declared after all the things the processing needs, so that it is
+   * destructed (and the workers stopped) before them.
    */
-  bool ValidateOrder (const std::string& account, const proto::Order& o) const;
+  std::unique_ptr<WorkerPool> workers;
+
+  /** Interval job for checking the connection and perhaps reconnecting.  */
+  std::unique_ptr<IntervalJob> reconnecter;
 
   /**
    * Sends a ProcessingMessage via XMPP to the counterparty specified in
@@ -124,6 +436,24 @@ private:
    */
   void SendProcessingMessage (proto::ProcessingMessage&& msg);
 
+  /**
+   * Processes a received trade message (with the counterparty set to
+   * the authenticated sender) and sends the reply, if any.  This is run
+   * on the worker threads.
+   */
+  void ProcessPrivate (const proto::ProcessingMessage& msg);
+
+  /**
+   * Removes our own orders from a result of the orderbook.  They are only
+   * there if the market is shared.
+   */
+  void RemoveOwnOrders (proto::OrderbookForAsset& book) const;
+
+  /**
+   * Returns the version counter for the given kind of data.
+   */
+  const VersionCounter& GetVersionCounter (DataKind kind) const;
+
   friend class Daemon;
   friend class MyOrdersImpl;
 
@@ -134,13 +464,20 @@ protected:
   void HandlePrivate (const gloox::JID& sender,
                       const gloox::Stanza& msg) override;
   void HandleDisconnect (const gloox::JID& disconnected) override;
+  void HandleOwnDisconnect () override;
 
 public:
 
-  explicit Impl (const AssetSpec& s, const std::string& account,
-                 const std::string& xr, const std::string& dg,
-                 const std::string& jid, const std::string& password,
-                 const std::string& mucRoom);
+  /**
+   * Constructs the instance for the given market.  If it is shared,
+   * then persisted state is stored in a subdirectory named after our
+   * account name.
+   */
+  explicit Impl (SharedMarket::Impl& m, bool sh, const std::string& a,
+                 const std::string& xr,
+                 const std::string& jid, const std::string& password);
+
+  ~Impl ();
 
   Impl () = delete;
   Impl (const Impl&) = delete;
@@ -151,8 +488,10 @@ public:
 /* ************************************************************************** */
 
 Daemon::MyOrdersImpl::MyOrdersImpl (Impl& i)
-  : MyOrders(i.state,
-             std::chrono::milliseconds (FLAGS_democrit_order_timeout_ms) / 2),
+  : MyOrders(
+        i.state,
+        std::chrono::milliseconds (FLAGS_democrit_order_timeout_ms) / 2,
+        std::chrono::milliseconds (FLAGS_democrit_order_broadcast_delay_ms)),
     impl(i)
 {}
 
@@ -160,52 +499,294 @@ bool
 Daemon::MyOrdersImpl::ValidateOrder (const std::string& account,
                                      const proto::Order& o) const
 {
-  return impl.ValidateOrder (account, o);
+  /* We can only publish orders in rooms we joined.  */
+  if (!impl.market.shards.IsSubscribed (o.asset ()))
+    return false;
+
+  return impl.market.ValidateOrder (account, o);
+}
+
+std::vector<bool>
+Daemon::MyOrdersImpl::ValidateOrders (
+    const std::string& account,
+    const std::vector<const proto::Order*>& orders) const
+{
+  auto res = impl.market.ValidateOrders (account, orders, nullptr);
+  for (size_t i = 0; i < orders.size (); ++i)
+    if (!impl.market.shards.IsSubscribed (orders[i]->asset ()))
+      res[i] = false;
+
+  return res;
 }
 
 void
 Daemon::MyOrdersImpl::UpdateOrders (const proto::OrdersOfAccount& ownOrders)
+{
+  Broadcast (ownOrders, true);
+}
+
+void
+Daemon::MyOrdersImpl::OrdersChanged (const proto::OrdersOfAccount& ownOrders)
+{
+  Broadcast (ownOrders, false);
+}
+
+void
+Daemon::MyOrdersImpl::ForceFullUpdate ()
+{
+  std::lock_guard<std::mutex> lock(mutBroadcast);
+  for (auto& entry : shards)
+    entry.second.needFull = true;
+}
+
+void
+Daemon::MyOrdersImpl::Broadcast (const proto::OrdersOfAccount& ownOrders,
+                                 const bool full)
 {
   impl.state.ReadState ([&] (const proto::State& s)
     {
       CHECK_EQ (ownOrders.account (), s.account ());
     });
 
+  std::lock_guard<std::mutex> lock(mutBroadcast);
+
   if (!impl.IsConnected ())
     {
       VLOG (1) << "Ignoring order refresh while not connected";
+      for (auto& entry : shards)
+        entry.second.needFull = true;
       return;
     }
 
+  std::map<unsigned, proto::OrdersOfAccount> parts;
+  for (const auto s : impl.market.shards.GetSubscribed ())
+    parts[s].set_account (ownOrders.account ());
+  for (const auto& entry : ownOrders.orders ())
+    {
+      const unsigned shard
+          = impl.market.shards.GetShard (entry.second.asset ());
+      const auto mit = parts.find (shard);
+      if (mit == parts.end ())
+        {
+          LOG_FIRST_N (WARNING, 10)
+              << "Not broadcasting own order " << entry.first
+              << " in a shard we do not subscribe to";
+          continue;
+        }
+      mit->second.mutable_orders ()->insert (entry);
+    }
+
+  for (const auto& entry : parts)
+    BroadcastShard (entry.first, entry.second, full);
+}
+
+void
+Daemon::MyOrdersImpl::BroadcastShard (const unsigned shard,
+                                      const proto::OrdersOfAccount& orders,
+                                      const bool full)
+{
+  auto& st = shards[shard];
+
+  /* With sharding, we do not announce anything in rooms where we have
+     no orders (and have not told others about any before).  Others simply
+     do not know about us there, which is equivalent.  */
+  if (impl.market.shards.IsSharded ()
+        && orders.orders ().empty () && st.lastBroadcast.orders ().empty ())
+    {
+      st.needFull = true;
+      return;
+    }
+
+  /* Full updates are replaceable in the send queue, as a newer one
+     contains all the information.  */
   MucClient::ExtensionData ext;
-  ext.push_back (std::make_unique<AccountOrdersStanza> (ownOrders));
-  impl.PublishMessage (std::move (ext));
+  bool replaceable = false;
+
+  if (full || st.needFull)
+    {
+      replaceable = true;
+      proto::OrdersOfAccount data = orders;
+      data.set_sequence (++st.sequence);
+      /* In a shared market, our orders are fed into it directly.  The
+         listener (which may be us) does not process broadcasts of attached
+         accounts from the room.  */
+      if (impl.shared)
+        impl.market.SubmitOrders (shard, impl.account,
+                                  proto::OrdersOfAccount (data));
+      ext.push_back (std::make_unique<AccountOrdersStanza> (std::move (data)));
+      st.needFull = false;
+    }
+  else
+    {
+      proto::OrdersDelta delta;
+      if (!ComputeOrdersDelta (st.lastBroadcast, orders, delta))
+        {
+          VLOG (1) << "No changes to broadcast for own orders in " << shard;
+          return;
+        }
+      delta.set_sequence (++st.sequence);
+      VLOG (1)
+          << "Broadcasting delta of own orders in " << shard << ":\n"
+          << delta.DebugString ();
+      auto data = std::make_shared<const proto::OrdersDelta> (
+          std::move (delta));
+      if (impl.shared)
+        impl.market.SubmitOrdersDelta (shard, impl.account, data);
+      ext.push_back (std::make_unique<OrdersDeltaStanza> (std::move (data)));
+    }
+
+  st.lastBroadcast = orders;
+  Metrics::Global ().Increment ("orders.broadcasts");
+  impl.PublishMessage (impl.market.shards.GetRoom (shard), std::move (ext),
+                       replaceable);
 }
 
-Daemon::Impl::Impl (const AssetSpec& s, const std::string& account,
-                    const std::string& xr, const std::string& dg,
-                    const std::string& jid, const std::string& password,
-                    const std::string& mucRoom)
-  : MucClient (gloox::JID (jid), password, gloox::JID (mucRoom)),
-    spec(s), state(account),
-    myOrders(*this),
-    allOrders(std::chrono::milliseconds (FLAGS_democrit_order_timeout_ms)),
-    xayaRpc(xr, useLegacyXayaRpcInDaemon), demGsp(dg),
-    trades(state, myOrders, spec, xayaRpc, demGsp, true)
+namespace
 {
-  std::string jidAccount;
-  CHECK (auth.Authenticate (gloox::JID (jid), jidAccount))
-      << "Failed to authenticate our own JID " << jid;
-  CHECK_EQ (jidAccount, account)
-      << "Our JID " << jid << " does not match claimed account " << account;
 
-  RegisterExtension (std::make_unique<AccountOrdersStanza> ());
-  RegisterExtension (std::make_unique<ProcessingMessageStanza> ());
+/**
+ * Returns the directory for persisting state in, or an empty string if
+ * the state should not be persisted.  If subdir is not empty, then it is
+ * a subdirectory of the main state directory (which is created if needed).
+ */
+std::string
+GetStateDir (const std::string& subdir)
+{
+  if (FLAGS_democrit_state_dir.empty () || subdir.empty ())
+    return FLAGS_democrit_state_dir;
+
+  const std::string res = FLAGS_democrit_state_dir + "/" + subdir;
+  CHECK (mkdir (res.c_str (), 0700) == 0 || errno == EEXIST)
+      << "Failed to create " << res << ": " << std::strerror (errno);
+
+  return res;
+}
+
+/**
+ * Constructs the state persistence layer according to the flags,
+ * or returns null if the state should not be persisted.
+ */
+std::unique_ptr<StatePersistence>
+OpenStatePersistence (const std::string& subdir)
+{
+  const std::string dir = GetStateDir (subdir);
+  if (dir.empty ())
+    return nullptr;
+
+  CHECK_GT (FLAGS_democrit_state_snapshot_interval, 0);
+  LOG (INFO) << "Persisting state in " << dir;
+  return std::make_unique<StatePersistence> (
+      dir, FLAGS_democrit_state_snapshot_interval,
+      std::chrono::milliseconds (FLAGS_democrit_state_sync_ms));
+}
+
+/**
+ * Opens the on-disk trade archive if state persistence is enabled,
+ * or returns null otherwise.
+ */
+std::unique_ptr<TradeArchive>
+OpenTradeArchive (const std::string& subdir)
+{
+  const std::string dir = GetStateDir (subdir);
+  if (dir.empty ())
+    return nullptr;
+
+  return std::make_unique<TradeArchive> (dir + "/archive");
+}
+
+/**
+ * Constructs the room sharding for the given base room according to
+ * the flags.
+ */
+RoomShards
+MakeRoomShards (const std::string& mucRoom)
+{
+  CHECK_GE (FLAGS_democrit_room_shards, 0);
+
+  std::set<unsigned> subs;
+  std::istringstream in(FLAGS_democrit_room_shard_subscriptions);
+  std::string cur;
+  while (std::getline (in, cur, ','))
+    {
+      std::istringstream num(cur);
+      unsigned shard;
+      CHECK (num >> shard && num.eof ())
+          << "Invalid room shard: " << cur;
+      subs.insert (shard);
+    }
+
+  return RoomShards (gloox::JID (mucRoom), FLAGS_democrit_room_shards, subs);
+}
+
+/**
+ * Constructs the input pool if enabled by flags, or returns null otherwise.
+ */
+std::unique_ptr<InputPool>
+OpenInputPool (RpcClient<XayaRpcClient>& rpc)
+{
+  if (FLAGS_democrit_input_pool_size <= 0)
+    return nullptr;
+
+  std::vector<Amount> denominations;
+  std::istringstream in(FLAGS_democrit_input_pool_denominations);
+  std::string cur;
+  while (std::getline (in, cur, ','))
+    {
+      std::istringstream num(cur);
+      double chi;
+      Amount amount;
+      CHECK (num >> chi
+               && xaya::ChiAmountFromJson (Json::Value (chi), amount))
+          << "Invalid input pool denomination: " << cur;
+      denominations.push_back (amount);
+    }
+  CHECK (!denominations.empty ()) << "No input pool denominations given";
+
+  auto res = std::make_unique<InputPool> (rpc, denominations,
+                                          FLAGS_democrit_input_pool_size);
+  res->StartRefills (
+      std::chrono::milliseconds (FLAGS_democrit_input_pool_refill_ms));
+
+  return res;
+}
+
+/**
+ * Returns the RPC client to use for an attached daemon's wallet, if it
+ * cannot use the market's one.
+ */
+std::unique_ptr<RpcClient<XayaRpcClient>>
+MakeOwnXayaRpc (const std::string& endpoint, const std::string& marketEndpoint)
+{
+  if (endpoint == marketEndpoint)
+    return nullptr;
+
+  return std::make_unique<RpcClient<XayaRpcClient>> (
+      endpoint, useLegacyXayaRpcInDaemon);
+}
+
+/**
+ * Removes all entries from a repeated proto field that satisfy
+ * the given predicate, keeping the order of the others.
+ */
+template <typename T, typename Pred>
+  void
+  RemoveIf (google::protobuf::RepeatedPtrField<T>& field, const Pred& pred)
+{
+  int kept = 0;
+  for (int i = 0; i < field.size (); ++i)
+    if (!pred (field.Get (i)))
+      field.SwapElements (kept++, i);
+
+  while (field.size () > kept)
+    field.RemoveLast ();
 }
 
+/**
+ * Performs the basic checks of an order that do not depend on the game
+ * state, e.g. that the amounts are consistent.
+ */
 bool
-Daemon::Impl::ValidateOrder (const std::string& account,
-                             const proto::Order& o) const
+IsOrderWellFormed (const proto::Order& o)
 {
   if (o.max_units () == 0)
     return false;
@@ -221,77 +802,544 @@ Daemon::Impl::ValidateOrder (const std::string& account,
   if (!o.has_price_sat ())
     return false;
 
-  if (!spec.IsAsset (o.asset ()))
-    return false;
+  return true;
+}
+
+} // anonymous namespace
+
+SharedMarket::Impl::Impl (const AssetSpec& s, const std::string& xr,
+                          const std::string& dg, const std::string& mucRoom)
+  : spec(s), shards(MakeRoomShards (mucRoom)),
+    xayaEndpoint(xr), xayaRpc(xr, useLegacyXayaRpcInDaemon), demGsp(dg),
+    validationCache(FLAGS_democrit_validation_cache_size),
+    ingress(FLAGS_democrit_max_pending_order_updates),
+    workers(std::make_unique<WorkerPool> (FLAGS_democrit_worker_threads))
+{
+  if (shards.IsSharded ())
+    LOG (INFO)
+        << "Using " << FLAGS_democrit_room_shards << " room shards, joining "
+        << shards.GetSubscribed ().size () << " of them";
+
+  const std::chrono::milliseconds timeout(FLAGS_democrit_order_timeout_ms);
+  for (const auto shard : shards.GetSubscribed ())
+    books.emplace (shard,
+                   std::make_unique<OrderBook> (timeout, &booksVersion));
+
+  validationBlockJob = std::make_unique<IntervalJob> (
+      std::chrono::milliseconds (FLAGS_democrit_validation_block_ms),
+      [this] ()
+        {
+          UpdateValidationBlock ();
+        });
+}
+
+SharedMarket::Impl::~Impl ()
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+  CHECK (accounts.empty ())
+      << "Destroying shared market with " << accounts.size ()
+      << " daemons still attached";
+}
+
+void
+SharedMarket::Impl::Attach (const std::string& account)
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+  CHECK (accounts.insert (account).second)
+      << "Account " << account << " is already attached to the market";
+}
+
+void
+SharedMarket::Impl::Detach (const std::string& account)
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+  CHECK_EQ (accounts.erase (account), 1)
+      << "Account " << account << " is not attached to the market";
+  if (listener == account)
+    listener.clear ();
+}
+
+bool
+SharedMarket::Impl::IsAttached (const std::string& account) const
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+  return accounts.count (account) > 0;
+}
+
+bool
+SharedMarket::Impl::ClaimListener (const std::string& account)
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+
+  if (listener.empty ())
+    {
+      LOG_IF (INFO, accounts.size () > 1)
+          << "Daemon for " << account << " is now the market's listener";
+      listener = account;
+    }
+
+  return listener == account;
+}
+
+void
+SharedMarket::Impl::ReleaseListener (const std::string& account)
+{
+  std::lock_guard<std::mutex> lock(mutAccounts);
+  if (listener == account)
+    listener.clear ();
+}
+
+bool
+SharedMarket::Impl::ValidateOrder (const std::string& account,
+                                   const proto::Order& o) const
+{
+  return ValidateOrders (account, {&o}, nullptr)[0];
+}
+
+std::vector<bool>
+SharedMarket::Impl::ValidateOrders (
+    const std::string& account,
+    const std::vector<const proto::Order*>& orders,
+    ValidationCache* cache) const
+{
+  std::vector<bool> res(orders.size (), false);
+
+  /* Orders (by index) for which we need to query the asset spec.  */
+  std::vector<size_t> pending;
+  for (size_t i = 0; i < orders.size (); ++i)
+    {
+      const auto& o = *orders[i];
+      if (!IsOrderWellFormed (o))
+        continue;
+
+      bool cached;
+      if (cache != nullptr && cache->Lookup (account, o, cached))
+        res[i] = cached;
+      else
+        pending.push_back (i);
+    }
+
+  if (pending.empty ())
+    return res;
+
+  std::vector<Asset> assets;
+  assets.reserve (pending.size ());
+  for (const auto i : pending)
+    assets.push_back (orders[i]->asset ());
+  const auto isAsset = spec.IsAssetBatch (assets);
+  CHECK_EQ (isAsset.size (), assets.size ());
+
+  std::vector<size_t> buyIndices, sellIndices;
+  std::vector<AssetSpec::AmountQuery> buys, sells;
+  for (size_t k = 0; k < pending.size (); ++k)
+    {
+      if (!isAsset[k])
+        continue;
+
+      const auto i = pending[k];
+      const auto& o = *orders[i];
+      const AssetSpec::AmountQuery q = {account, o.asset (),
+                                        static_cast<Amount> (o.max_units ())};
+
+      switch (o.type ())
+        {
+        case proto::Order::BID:
+          buyIndices.push_back (i);
+          buys.push_back (q);
+          break;
+
+        case proto::Order::ASK:
+          sellIndices.push_back (i);
+          sells.push_back (q);
+          break;
+
+        default:
+          LOG (FATAL)
+              << "Unexpected order type: " << static_cast<int> (o.type ());
+        }
+    }
+
+  if (!buys.empty ())
+    {
+      const auto canBuy = spec.CanBuyBatch (buys);
+      CHECK_EQ (canBuy.size (), buys.size ());
+      for (size_t k = 0; k < buys.size (); ++k)
+        res[buyIndices[k]] = canBuy[k];
+    }
+
+  /* The results are only cached if we know the block they were computed
+     at, which is the case if CanSellBatch found a valid order.  */
+  xaya::uint256 hash;
+  bool hasHash = false;
+  if (!sells.empty ())
+    {
+      const auto canSell = spec.CanSellBatch (sells, hash);
+      CHECK_EQ (canSell.size (), sells.size ());
+      for (size_t k = 0; k < sells.size (); ++k)
+        {
+          res[sellIndices[k]] = canSell[k];
+          if (canSell[k])
+            hasHash = true;
+        }
+    }
+
+  if (cache != nullptr && hasHash)
+    for (const auto i : pending)
+      cache->Store (account, *orders[i], res[i], hash);
+
+  return res;
+}
 
-  switch (o.type ())
+void
+SharedMarket::Impl::UpdateValidationBlock ()
+{
+  try
+    {
+      xaya::uint256 hash;
+      if (hash.FromHex (xayaRpc->getbestblockhash ()))
+        {
+          validationCache.SetBlock (hash);
+          return;
+        }
+      LOG (WARNING) << "Got invalid best block hash from Xaya";
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
     {
-    case proto::Order::BID:
-      return spec.CanBuy (account, o.asset (), o.max_units ());
+      LOG (WARNING) << "Failed to query best block hash: " << exc.what ();
+    }
+
+  validationCache.Invalidate ();
+}
+
+void
+SharedMarket::Impl::ProcessOrders (const unsigned shard,
+                                   const std::string& account,
+                                   const proto::OrdersOfAccount& data)
+{
+  proto::OrdersOfAccount orders;
+  orders.set_account (account);
+  if (data.has_sequence ())
+    orders.set_sequence (data.sequence ());
+
+  std::vector<const proto::Order*> toValidate;
+  for (const auto& o : data.orders ())
+    toValidate.push_back (&o.second);
+  const auto valid = ValidateOrders (account, toValidate, &validationCache);
+
+  size_t index = 0;
+  for (const auto& o : data.orders ())
+    if (valid[index++] && shards.GetShard (o.second.asset ()) == shard)
+      orders.mutable_orders ()->insert (o);
+    else
+      LOG (WARNING)
+          << "Ignoring invalid order from " << account << "\n:"
+          << o.second.DebugString ();
+
+  books.at (shard)->UpdateOrders (std::move (orders));
+}
+
+void
+SharedMarket::Impl::ProcessOrdersDelta (const unsigned shard,
+                                        const std::string& account,
+                                        const proto::OrdersDelta& data)
+{
+  /* Invalid orders in the delta are treated as removed, so that we
+     drop any previous (valid) version of them.  */
+  proto::OrdersDelta delta;
+  delta.set_sequence (data.sequence ());
+  *delta.mutable_removed () = data.removed ();
+  std::vector<const proto::Order*> toValidate;
+  for (const auto& o : data.upserted ())
+    toValidate.push_back (&o.second);
+  const auto valid = ValidateOrders (account, toValidate, &validationCache);
+
+  size_t index = 0;
+  for (const auto& o : data.upserted ())
+    if (valid[index++] && shards.GetShard (o.second.asset ()) == shard)
+      delta.mutable_upserted ()->insert (o);
+    else
+      {
+        LOG (WARNING)
+            << "Ignoring invalid order from " << account << "\n:"
+            << o.second.DebugString ();
+        delta.add_removed (o.first);
+      }
+
+  if (!books.at (shard)->UpdateOrdersDelta (account, std::move (delta)))
+    LOG (WARNING)
+        << "Order delta from " << account << " does not match our state,"
+        << " waiting for the next full update";
+}
 
-    case proto::Order::ASK:
-      xaya::uint256 dummy;
-      return spec.CanSell (account, o.asset (), o.max_units (), dummy);
+const OrderBook*
+SharedMarket::Impl::GetBook (const Asset& asset) const
+{
+  const auto mit = books.find (shards.GetShard (asset));
+  if (mit == books.end ())
+    return nullptr;
 
-    default:
-      LOG (FATAL) << "Unexpected order type: " << static_cast<int> (o.type ());
+  return mit->second.get ();
+}
+
+template <typename Fcn>
+  proto::OrderbookByAsset
+  SharedMarket::Impl::QueryBooks (const std::vector<Asset>& assets,
+                                  const Fcn& query) const
+{
+  proto::OrderbookByAsset res;
+  auto& assetMap = *res.mutable_assets ();
+
+  std::map<unsigned, std::vector<Asset>> byShard;
+  for (const auto& a : assets)
+    {
+      const unsigned shard = shards.GetShard (a);
+      if (books.count (shard) > 0)
+        byShard[shard].push_back (a);
+      else
+        assetMap[a].set_asset (a);
+    }
+
+  for (const auto& entry : byShard)
+    {
+      auto part = query (*books.at (entry.first), entry.second);
+      for (auto& a : *part.mutable_assets ())
+        assetMap[a.first].Swap (&a.second);
     }
+
+  return res;
+}
+
+namespace
+{
+
+/**
+ * Returns the key used in the ingress queue for full updates of the given
+ * account in the given shard.
+ */
+std::string
+IngressKey (const std::string& account, const unsigned shard)
+{
+  return account + '\n' + std::to_string (shard);
+}
+
+} // anonymous namespace
+
+void
+SharedMarket::Impl::SubmitOrders (const unsigned shard,
+                                  const std::string& account,
+                                  proto::OrdersOfAccount&& data)
+{
+  /* All order updates of an account are processed sequentially in the
+     order received.  Full updates go through the ingress queue, where
+     a newer update replaces a still pending one of the same account (and
+     shard).  In that case, there is already a task scheduled that will
+     pick up the new data.  */
+  const std::string key = IngressKey (account, shard);
+  if (ingress.AddFull (key, std::move (data)) != OrdersIngress::Result::QUEUED)
+    return;
+
+  workers->Submit (WorkerPool::Priority::LOW, account,
+      [this, shard, account, key] ()
+      {
+        proto::OrdersOfAccount pending;
+        if (ingress.TakeFull (key, pending))
+          ProcessOrders (shard, account, pending);
+      });
+}
+
+void
+SharedMarket::Impl::SubmitOrdersDelta (
+    const unsigned shard, const std::string& account,
+    std::shared_ptr<const proto::OrdersDelta> data)
+{
+  if (ingress.AddDelta () != OrdersIngress::Result::QUEUED)
+    return;
+
+  workers->Submit (WorkerPool::Priority::LOW, account,
+      [this, shard, account, data] ()
+      {
+        ingress.FinishDelta ();
+        ProcessOrdersDelta (shard, account, *data);
+      });
+}
+
+void
+SharedMarket::Impl::SubmitDisconnect (const std::string& account)
+{
+  /* This is queued together with the account's order updates, so that
+     it is not overtaken by an update that was received before.  A still
+     pending full update is superseded by the disconnect.  It is dropped,
+     so that an update received later is queued behind the disconnect
+     instead of being coalesced into the earlier slot.  */
+  for (const auto& entry : books)
+    ingress.DropFull (IngressKey (account, entry.first));
+
+  workers->Submit (WorkerPool::Priority::LOW, account, [this, account] ()
+    {
+      for (auto& entry : books)
+        {
+          proto::OrdersOfAccount o;
+          o.set_account (account);
+          /* We leave the orders empty.  */
+          entry.second->UpdateOrders (std::move (o));
+        }
+    });
+}
+
+/* ************************************************************************** */
+
+Daemon::Impl::Impl (SharedMarket::Impl& m, const bool sh,
+                    const std::string& a, const std::string& xr,
+                    const std::string& jid, const std::string& password)
+  : MucClient (gloox::JID (jid), password, m.shards.GetRooms ()),
+    market(m), shared(sh), account(a),
+    state(account, OpenStatePersistence (shared ? account : "")),
+    myOrders(*this),
+    ownXayaRpc(MakeOwnXayaRpc (xr, market.xayaEndpoint)),
+    xayaRpc(ownXayaRpc != nullptr ? *ownXayaRpc : market.xayaRpc),
+    archive(OpenTradeArchive (shared ? account : "")),
+    inputPool(OpenInputPool (xayaRpc)),
+    trades(state, myOrders, market.spec, xayaRpc, market.demGsp,
+           archive.get (), inputPool.get (), true),
+    workers(std::make_unique<WorkerPool> (
+        FLAGS_democrit_trade_worker_threads))
+{
+  /* Trade messages are queued in response to other participants, so the
+     number pending must be bounded.  */
+  workers->SetMaxPending (WorkerPool::Priority::HIGH,
+                          FLAGS_democrit_max_pending_trade_messages);
+
+  std::string jidAccount;
+  CHECK (market.auth.Authenticate (gloox::JID (jid), jidAccount))
+      << "Failed to authenticate our own JID " << jid;
+  CHECK_EQ (jidAccount, account)
+      << "Our JID " << jid << " does not match claimed account " << account;
+
+  market.Attach (account);
+
+  RegisterExtension (std::make_unique<AccountOrdersStanza> ());
+  RegisterExtension (std::make_unique<OrdersDeltaStanza> ());
+  RegisterExtension (std::make_unique<ProcessingMessageStanza> ());
+}
+
+Daemon::Impl::~Impl ()
+{
+  /* Make sure no more messages are received and handed to the workers
+     while we are shutting down.  */
+  reconnecter.reset ();
+  Disconnect ();
+  workers.reset ();
+
+  /* Others will see us leave the room, but in a shared market, we have to
+     remove our own orders from it ourselves.  */
+  market.Detach (account);
+  if (shared)
+    market.SubmitDisconnect (account);
 }
 
 void
 Daemon::Impl::SendProcessingMessage (proto::ProcessingMessage&& msg)
 {
   gloox::JID receiver;
-  if (!auth.LookupJid (msg.counterparty (), receiver))
+  if (!market.auth.LookupJid (msg.counterparty (), receiver))
     {
       LOG (ERROR) << "Failed to lookup JID for account " << msg.counterparty ();
       return;
     }
 
-  msg.clear_counterparty ();
-  MucClient::ExtensionData ext;
-  ext.push_back (std::make_unique<ProcessingMessageStanza> (msg));
+  if (!IsConnected ())
+    {
+      LOG (WARNING)
+          << "Not connected, dropping processing message for "
+          << msg.counterparty ();
+      return;
+    }
 
+  msg.clear_counterparty ();
   VLOG (1)
       << "Sending processing message to " << receiver.full () << ":\n"
       << msg.DebugString ();
+
+  MucClient::ExtensionData ext;
+  ext.push_back (std::make_unique<ProcessingMessageStanza> (std::move (msg)));
   SendMessage (receiver, std::move (ext));
 }
 
+void
+Daemon::Impl::ProcessPrivate (const proto::ProcessingMessage& msg)
+{
+  proto::ProcessingMessage reply;
+  if (trades.ProcessMessage (msg, reply))
+    SendProcessingMessage (std::move (reply));
+}
+
+void
+Daemon::Impl::RemoveOwnOrders (proto::OrderbookForAsset& book) const
+{
+  const auto isOwn = [this] (const proto::Order& o)
+    {
+      return o.account () == account;
+    };
+
+  RemoveIf (*book.mutable_bids (), isOwn);
+  RemoveIf (*book.mutable_asks (), isOwn);
+}
+
 void
 Daemon::Impl::HandleMessage (const gloox::JID& sender, const gloox::Stanza& msg)
 {
-  std::string account;
-  if (!auth.Authenticate (sender, account))
+  /* All attached daemons receive the same broadcasts, so only one of them
+     hands them on to the market.  While we are disconnecting, we must not
+     claim that role back right after releasing it.  */
+  if (!IsConnected () || !market.ClaimListener (account))
+    return;
+
+  std::string senderAccount;
+  if (!market.auth.Authenticate (sender, senderAccount))
     {
       LOG (WARNING) << "Failed to get account for JID " << sender.full ();
       return;
     }
 
+  /* Broadcasts of attached accounts are fed into the market directly.  */
+  if (market.IsAttached (senderAccount))
+    return;
+
+  /* We only parse the messages here on the XMPP thread, and then hand them
+     off to the market's workers for validation and processing.  */
+
+  unsigned shard;
+  if (!market.shards.GetShardForRoom (msg.from ().bareJID (), shard))
+    {
+      LOG (WARNING)
+          << "Ignoring message from unknown room " << msg.from ().full ();
+      return;
+    }
+
   const auto* ordersExt
       = msg.findExtension<AccountOrdersStanza> (AccountOrdersStanza::EXT_TYPE);
   if (ordersExt != nullptr && ordersExt->IsValid ())
     {
-      proto::OrdersOfAccount orders;
-      orders.set_account (account);
-
-      for (const auto& o : ordersExt->GetData ().orders ())
-        if (ValidateOrder (account, o.second))
-          orders.mutable_orders ()->insert (o);
-        else
-          LOG (WARNING)
-              << "Ignoring invalid order from " << account << "\n:"
-              << o.second.DebugString ();
+      Metrics::Global ().Increment ("orders.received");
+      proto::OrdersOfAccount data = ordersExt->GetData ();
+      market.SubmitOrders (shard, senderAccount, std::move (data));
+    }
 
-      allOrders.UpdateOrders (std::move (orders));
+  const auto* deltaExt
+      = msg.findExtension<OrdersDeltaStanza> (OrdersDeltaStanza::EXT_TYPE);
+  if (deltaExt != nullptr && deltaExt->IsValid ())
+    {
+      Metrics::Global ().Increment ("orders.received");
+      market.SubmitOrdersDelta (shard, senderAccount,
+                                deltaExt->GetSharedData ());
     }
 }
 
 void
 Daemon::Impl::HandlePrivate (const gloox::JID& sender, const gloox::Stanza& msg)
 {
-  std::string account;
-  if (!auth.Authenticate (sender, account))
+  std::string senderAccount;
+  if (!market.auth.Authenticate (sender, senderAccount))
     {
       LOG (WARNING) << "Failed to get account for JID " << sender.full ();
       return;
@@ -302,39 +1350,95 @@ Daemon::Impl::HandlePrivate (const gloox::JID& sender, const gloox::Stanza& msg)
           ProcessingMessageStanza::EXT_TYPE);
   if (pmExt != nullptr && pmExt->IsValid ())
     {
-      proto::ProcessingMessage msg = pmExt->GetData ();
-      msg.set_counterparty (account);
-
-      proto::ProcessingMessage reply;
-      if (trades.ProcessMessage (msg, reply))
-        SendProcessingMessage (std::move (reply));
+      /* The stanza's data is shared with the worker task, so that the
+         XMPP thread does not have to copy potentially large PSBTs.  The
+         counterparty is filled in on the worker.  */
+      const auto data = pmExt->GetSharedData ();
+
+      /* Messages are only serialised per trade (i.e. counterparty and
+         identifier, matching the trade key), so that multiple trades with
+         the same counterparty can negotiate in parallel.  TradeManager
+         holds only the trade's own lock while doing the RPC calls for
+         a negotiation step.  */
+      const std::string key = senderAccount + '\n' + data->identifier ();
+      const bool queued = workers->Submit (WorkerPool::Priority::HIGH, key,
+          [this, senderAccount, data] ()
+          {
+            proto::ProcessingMessage msg = *data;
+            msg.set_counterparty (senderAccount);
+            ProcessPrivate (msg);
+          });
+      if (!queued)
+        {
+          Metrics::Global ().Increment ("trades.messages.dropped");
+          LOG (WARNING)
+              << "Too many pending trade messages, dropping one from "
+              << senderAccount;
+        }
     }
 }
 
 void
 Daemon::Impl::HandleDisconnect (const gloox::JID& disconnected)
 {
-  std::string account;
-  if (!auth.Authenticate (disconnected, account))
+  if (!IsConnected () || !market.ClaimListener (account))
+    return;
+
+  std::string disconnectedAccount;
+  if (!market.auth.Authenticate (disconnected, disconnectedAccount))
     {
       LOG (WARNING) << "Failed to get account for JID " << disconnected.full ();
       return;
     }
 
-  proto::OrdersOfAccount o;
-  o.set_account (account);
-  /* We leave the orders empty.  */
-  allOrders.UpdateOrders (std::move (o));
+  /* Participants that left will not send more messages through the room,
+     so there is no need to keep their memoised authentication.  */
+  market.auth.Forget (disconnected);
+
+  /* The orders of attached daemons are fed into the market directly, and
+     removed by the daemon itself when it is destructed.  Leaving the room
+     (e.g. while reconnecting) does not affect them.  */
+  if (market.IsAttached (disconnectedAccount))
+    return;
+
+  market.SubmitDisconnect (disconnectedAccount);
 }
 
+void
+Daemon::Impl::HandleOwnDisconnect ()
+{
+  /* Another attached daemon that is still connected takes over with the
+     next broadcast it receives.  */
+  market.ReleaseListener (account);
+}
+
+/* ************************************************************************** */
+
+SharedMarket::SharedMarket (const AssetSpec& spec,
+                            const std::string& xayaRpc,
+                            const std::string& demGspRpc,
+                            const std::string& mucRoom)
+  : impl(std::make_unique<Impl> (spec, xayaRpc, demGspRpc, mucRoom))
+{}
+
+SharedMarket::~SharedMarket () = default;
+
 /* ************************************************************************** */
 
 Daemon::Daemon (const AssetSpec& spec, const std::string& account,
                 const std::string& xayaRpc, const std::string& demGsp,
                 const std::string& jid, const std::string& password,
                 const std::string& mucRoom)
-  : impl(std::make_unique<Impl> (spec, account, xayaRpc, demGsp,
-                                 jid, password, mucRoom))
+  : ownMarket(std::make_unique<SharedMarket> (spec, xayaRpc, demGsp, mucRoom)),
+    impl(std::make_unique<Impl> (*ownMarket->impl, false, account, xayaRpc,
+                                 jid, password))
+{}
+
+Daemon::Daemon (SharedMarket& market, const std::string& account,
+                const std::string& xayaRpc,
+                const std::string& jid, const std::string& password)
+  : impl(std::make_unique<Impl> (*market.impl, true, account, xayaRpc,
+                                 jid, password))
 {}
 
 Daemon::~Daemon () = default;
@@ -357,7 +1461,14 @@ Daemon::Connect ()
   impl->reconnecter = std::make_unique<IntervalJob> (reconnectIntv, [this] ()
     {
       if (!impl->IsConnected ())
-        impl->Connect ();
+        {
+          /* The listener role is normally released already when the
+             disconnect starts, but make sure in case the connection was
+             lost in some other way.  */
+          impl->market.ReleaseListener (impl->account);
+          impl->myOrders.ForceFullUpdate ();
+          impl->Connect ();
+        }
     });
 }
 
@@ -370,13 +1481,102 @@ Daemon::GetStateForTesting ()
 proto::OrderbookForAsset
 Daemon::GetOrdersForAsset (const Asset& asset) const
 {
-  return impl->allOrders.GetForAsset (asset);
+  proto::OrderbookForAsset res;
+
+  const auto* book = impl->market.GetBook (asset);
+  if (book == nullptr)
+    {
+      res.set_asset (asset);
+      return res;
+    }
+
+  res = book->GetForAsset (asset);
+  if (impl->shared)
+    impl->RemoveOwnOrders (res);
+
+  return res;
 }
 
 proto::OrderbookByAsset
 Daemon::GetOrdersByAsset () const
 {
-  return impl->allOrders.GetByAsset ();
+  proto::OrderbookByAsset res;
+  for (const auto& entry : impl->market.books)
+    {
+      auto part = entry.second->GetByAsset ();
+      for (auto& a : *part.mutable_assets ())
+        (*res.mutable_assets ())[a.first].Swap (&a.second);
+    }
+
+  if (impl->shared)
+    {
+      auto& assetMap = *res.mutable_assets ();
+      for (auto it = assetMap.begin (); it != assetMap.end (); )
+        {
+          impl->RemoveOwnOrders (it->second);
+          if (it->second.bids ().empty () && it->second.asks ().empty ())
+            it = assetMap.erase (it);
+          else
+            ++it;
+        }
+    }
+
+  return res;
+}
+
+proto::DepthForAsset
+Daemon::GetDepthForAsset (const Asset& asset) const
+{
+  proto::DepthForAsset res;
+
+  const auto* book = impl->market.GetBook (asset);
+  if (book == nullptr)
+    {
+      res.set_asset (asset);
+      return res;
+    }
+
+  if (!impl->shared)
+    return book->GetDepthForAsset (asset);
+
+  /* In a shared market, the precomputed depth includes our own orders,
+     which the book corrects for at their price levels.  */
+  return book->GetDepthForAsset (asset, impl->myOrders.GetOrders ());
+}
+
+proto::OrderbookByAsset
+Daemon::GetBestOrders (const std::vector<Asset>& assets,
+                       const unsigned levels) const
+{
+  /* In a shared market, our own orders are part of the book.  They have
+     to be excluded before selecting the levels, so that we still get
+     the requested number of levels without them.  */
+  const std::string excluded = impl->shared ? impl->account : "";
+  return impl->market.QueryBooks (assets,
+      [levels, &excluded] (const OrderBook& book,
+                           const std::vector<Asset>& part)
+      {
+        return book.GetBestForAssets (part, levels, excluded);
+      });
+}
+
+proto::OrderbookByAsset
+Daemon::GetOrdersInRange (const std::vector<Asset>& assets,
+                          const uint64_t minPrice,
+                          const uint64_t maxPrice) const
+{
+  auto res = impl->market.QueryBooks (assets,
+      [minPrice, maxPrice] (const OrderBook& book,
+                            const std::vector<Asset>& part)
+      {
+        return book.GetRangeForAssets (part, minPrice, maxPrice);
+      });
+
+  if (impl->shared)
+    for (auto& entry : *res.mutable_assets ())
+      impl->RemoveOwnOrders (entry.second);
+
+  return res;
 }
 
 bool
@@ -391,6 +1591,27 @@ Daemon::CancelOrder (const uint64_t id)
   impl->myOrders.RemoveById (id);
 }
 
+std::vector<bool>
+Daemon::AddOrders (std::vector<proto::Order>&& orders)
+{
+  return impl->myOrders.Update ({}, std::move (orders), false);
+}
+
+void
+Daemon::CancelOrders (const std::vector<uint64_t>& ids)
+{
+  impl->myOrders.Update (ids, {}, false);
+}
+
+bool
+Daemon::ReplaceOrders (const std::vector<uint64_t>& cancel,
+                       std::vector<proto::Order>&& orders)
+{
+  const auto res = impl->myOrders.Update (cancel, std::move (orders), true);
+  return std::all_of (res.begin (), res.end (),
+                      [] (const bool b) { return b; });
+}
+
 proto::OrdersOfAccount
 Daemon::GetOwnOrders () const
 {
@@ -403,6 +1624,44 @@ Daemon::GetTrades () const
   return impl->trades.GetTrades ();
 }
 
+const VersionCounter&
+Daemon::Impl::GetVersionCounter (const DataKind kind) const
+{
+  switch (kind)
+    {
+    case DataKind::ORDERBOOK:
+      return market.booksVersion;
+    case DataKind::OWN_ORDERS:
+      return myOrders.GetVersion ();
+    case DataKind::TRADES:
+      break;
+    }
+
+  CHECK (kind == DataKind::TRADES)
+      << "Unexpected data kind: " << static_cast<int> (kind);
+  return trades.GetVersion ();
+}
+
+uint64_t
+Daemon::GetDataVersion (const DataKind kind) const
+{
+  return impl->GetVersionCounter (kind).Get ();
+}
+
+uint64_t
+Daemon::WaitForChange (const DataKind kind, const uint64_t known,
+                       const std::chrono::milliseconds timeout) const
+{
+  return impl->GetVersionCounter (kind).WaitForChange (known, timeout);
+}
+
+std::vector<proto::Trade>
+Daemon::QueryTrades (const proto::TradeFilter& filter,
+                     const size_t offset, const size_t limit) const
+{
+  return impl->trades.QueryTrades (filter, offset, limit);
+}
+
 bool
 Daemon::TakeOrder (const proto::Order& o, const Amount units)
 {
@@ -414,6 +1673,20 @@ Daemon::TakeOrder (const proto::Order& o, const Amount units)
   return true;
 }
 
+std::vector<proto::Trade>
+Daemon::SweepOrders (const Asset& asset, const proto::Order::Type type,
+                     const Amount units, const Amount limitPrice)
+{
+  std::vector<proto::ProcessingMessage> msgs;
+  auto res = impl->trades.SweepOrders (GetOrdersForAsset (asset),
+                                       type, units, limitPrice, msgs);
+
+  for (auto& m : msgs)
+    impl->SendProcessingMessage (std::move (m));
+
+  return res;
+}
+
 std::string
 Daemon::GetAccount () const
 {
@@ -429,7 +1702,7 @@ Daemon::GetAccount () const
 const AssetSpec&
 Daemon::GetAssetSpec () const
 {
-  return impl->spec;
+  return impl->market.spec;
 }
 
 bool
@@ -438,6 +1711,21 @@ Daemon::IsConnected () const
   return impl->IsConnected ();
 }
 
+Daemon::OrderUpdateStats
+Daemon::GetOrderUpdateStats () const
+{
+  const auto& ingress = impl->market.ingress;
+  const auto stats = ingress.GetStats ();
+
+  OrderUpdateStats res;
+  res.pending = ingress.GetNumPending ();
+  res.received = stats.received;
+  res.coalesced = stats.coalesced;
+  res.dropped = stats.dropped;
+
+  return res;
+}
+
 /* ************************************************************************** */
 
 } // namespace democrit
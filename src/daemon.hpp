@@ -23,19 +23,66 @@
 #include "proto/orders.pb.h"
 #include "proto/trades.pb.h"
 
+#include <chrono>
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace democrit
 {
 
 class State;
 
+/**
+ * Market data that can be shared between the Daemon instances of multiple
+ * accounts running in the same process.  It holds the orderbooks of
+ * the room(s), the pipeline for processing received order broadcasts,
+ * the validation cache and the RPC connections used for validation.
+ *
+ * Of all attached daemons, only one (the "listener") hands the order
+ * broadcasts it receives from the room to the shared market.  The others
+ * ignore them, as they would be duplicates.  Orders of the attached
+ * accounts themselves are fed into the market directly when broadcast.
+ *
+ * The SharedMarket instance must outlive all daemons attached to it.
+ */
+class SharedMarket
+{
+
+private:
+
+  class Impl;
+
+  /** The actual implementation.  */
+  std::unique_ptr<Impl> impl;
+
+  friend class Daemon;
+
+public:
+
+  explicit SharedMarket (const AssetSpec& spec,
+                         const std::string& xayaRpc,
+                         const std::string& demGspRpc,
+                         const std::string& mucRoom);
+
+  ~SharedMarket ();
+
+  SharedMarket () = delete;
+  SharedMarket (const SharedMarket&) = delete;
+  void operator= (const SharedMarket&) = delete;
+
+};
+
 /**
  * The main class for running a Democrit daemon.  It manages all the things
  * needed for it, like the underlying XMPP client connection, the processes
  * to listen to and update the order book and broadcast our own orders
  * regularly, and the handler of ongoing one-to-one trade negotiations.
+ *
+ * A daemon can either have a market of its own, or be attached to
+ * a SharedMarket together with daemons for other accounts.  The own
+ * state, orders and trades are always per daemon.
  */
 class Daemon
 {
@@ -45,6 +92,13 @@ private:
   class Impl;
   class MyOrdersImpl;
 
+  /**
+   * The market owned by this instance, if it has not been constructed
+   * for a SharedMarket.  This is declared before impl, so that it
+   * is destructed after it.
+   */
+  std::unique_ptr<SharedMarket> ownMarket;
+
   /**
    * The actual implementation, whose definition is hidden in the .cpp
    * file to decouple the public interface from internal stuff.
@@ -66,6 +120,15 @@ public:
                    const std::string& jid, const std::string& password,
                    const std::string& mucRoom);
 
+  /**
+   * Constructs a daemon for the given account that uses a shared market.
+   * Persisted state (if enabled) is stored in a subdirectory named after
+   * the account.
+   */
+  explicit Daemon (SharedMarket& market, const std::string& account,
+                   const std::string& xayaRpc,
+                   const std::string& jid, const std::string& password);
+
   ~Daemon ();
 
   Daemon () = delete;
@@ -97,6 +160,27 @@ public:
    */
   proto::OrderbookByAsset GetOrdersByAsset () const;
 
+  /**
+   * Returns the aggregated depth (total units per price level) of the
+   * known orderbook for a given asset.
+   */
+  proto::DepthForAsset GetDepthForAsset (const Asset& asset) const;
+
+  /**
+   * Returns the known orderbooks for the given assets, restricted to
+   * the best (up to) "levels" price levels on each side.
+   */
+  proto::OrderbookByAsset GetBestOrders (const std::vector<Asset>& assets,
+                                         unsigned levels) const;
+
+  /**
+   * Returns the known orderbooks for the given assets, restricted to
+   * orders whose price is in the given (inclusive) range.
+   */
+  proto::OrderbookByAsset GetOrdersInRange (const std::vector<Asset>& assets,
+                                            uint64_t minPrice,
+                                            uint64_t maxPrice) const;
+
   /**
    * Adds a new order to the list of own orders.  Returns false if the
    * given order seems invalid for our account.
@@ -108,6 +192,25 @@ public:
    */
   void CancelOrder (uint64_t id);
 
+  /**
+   * Adds a batch of new orders at once, resulting in only a single
+   * broadcast.  Returns for each order whether it was valid and added.
+   */
+  std::vector<bool> AddOrders (std::vector<proto::Order>&& orders);
+
+  /**
+   * Cancels a batch of own orders by ID at once.
+   */
+  void CancelOrders (const std::vector<uint64_t>& ids);
+
+  /**
+   * Atomically cancels the orders with the given IDs and adds the new
+   * orders instead (e.g. for re-quoting).  If any of the new orders is
+   * invalid, nothing is changed and false is returned.
+   */
+  bool ReplaceOrders (const std::vector<uint64_t>& cancel,
+                      std::vector<proto::Order>&& orders);
+
   /**
    * Returns the own orders currently being advertised.
    */
@@ -118,6 +221,14 @@ public:
    */
   std::vector<proto::Trade> GetTrades () const;
 
+  /**
+   * Returns a page of trades matching the given filter, including
+   * old trades that have been moved to the on-disk archive.  Trades are
+   * returned newest first, skipping the first offset matches.
+   */
+  std::vector<proto::Trade> QueryTrades (const proto::TradeFilter& filter,
+                                         size_t offset, size_t limit) const;
+
   /**
    * Requests to take another's order for the given number of units.
    * Returns true on success (if the process could at least be started)
@@ -125,6 +236,19 @@ public:
    */
   bool TakeOrder (const proto::Order& o, Amount units);
 
+  /**
+   * Takes the best known orders for the given asset (asks if type is BID,
+   * i.e. we want to buy, and bids otherwise) at or better than the limit
+   * price until the given number of units is covered, starting trades with
+   * all of them at once.  Returns the trades that were started.
+   *
+   * When selling, only the single best order is taken, since trades where
+   * we sell cannot be done in parallel (they all spend our name output).
+   */
+  std::vector<proto::Trade> SweepOrders (const Asset& asset,
+                                         proto::Order::Type type,
+                                         Amount units, Amount limitPrice);
+
   /**
    * Returns the account name this is running for.
    */
@@ -135,6 +259,33 @@ public:
    */
   const AssetSpec& GetAssetSpec () const;
 
+  /**
+   * Kinds of data exposed by the daemon that are versioned, i.e. that have
+   * a number which increases whenever the data changes.
+   */
+  enum class DataKind
+  {
+    /** The known orderbook of other accounts.  */
+    ORDERBOOK,
+    /** Our own orders.  */
+    OWN_ORDERS,
+    /** Our trades as per GetTrades.  */
+    TRADES,
+  };
+
+  /**
+   * Returns the current version of the given kind of data.  This can be
+   * used as cache key for data derived from it.
+   */
+  uint64_t GetDataVersion (DataKind kind) const;
+
+  /**
+   * Blocks until the version of the given kind of data differs from
+   * the known one, or the timeout expires.  Returns the current version.
+   */
+  uint64_t WaitForChange (DataKind kind, uint64_t known,
+                          std::chrono::milliseconds timeout) const;
+
   /**
    * Returns true if the client is currently connected to the XMPP network.
    * It will try to reconnect periodically, but this can be used to give
@@ -142,6 +293,33 @@ public:
    */
   bool IsConnected () const;
 
+  /**
+   * Counters about received order updates and the queue in which they
+   * wait for validation.  With a shared market, they are for all attached
+   * daemons together.
+   */
+  struct OrderUpdateStats
+  {
+
+    /** Number of updates currently waiting for validation.  */
+    uint64_t pending = 0;
+
+    /** Number of updates received in total.  */
+    uint64_t received = 0;
+
+    /** Number of updates that replaced an older pending one.  */
+    uint64_t coalesced = 0;
+
+    /** Number of updates dropped because the queue was full.  */
+    uint64_t dropped = 0;
+
+  };
+
+  /**
+   * Returns the current statistics about received order updates.
+   */
+  OrderUpdateStats GetOrderUpdateStats () const;
+
 };
 
 } // namespace democrit
@@ -36,6 +36,10 @@ namespace democrit
 
 DECLARE_string (democrit_xid_servers);
 DECLARE_int64 (democrit_order_timeout_ms);
+DECLARE_int64 (democrit_order_broadcast_delay_ms);
+DECLARE_int64 (democrit_validation_block_ms);
+DECLARE_int32 (democrit_room_shards);
+DECLARE_string (democrit_room_shard_subscriptions);
 
 extern bool useLegacyXayaRpcInDaemon;
 
@@ -68,10 +72,21 @@ protected:
 
     const std::chrono::milliseconds timeoutMs(TIMEOUT);
     FLAGS_democrit_order_timeout_ms = timeoutMs.count ();
+    FLAGS_democrit_order_broadcast_delay_ms = 0;
+    FLAGS_democrit_validation_block_ms = 1;
+
+    FLAGS_democrit_room_shards = 0;
+    FLAGS_democrit_room_shard_subscriptions = "";
 
     useLegacyXayaRpcInDaemon = false;
   }
 
+  ~DaemonTests ()
+  {
+    FLAGS_democrit_room_shards = 0;
+    FLAGS_democrit_room_shard_subscriptions = "";
+  }
+
 };
 
 } // anonymous namespace
@@ -115,6 +130,21 @@ public:
     CHECK (IsConnected ());
   }
 
+  /**
+   * Constructs the instance based on the n-th test account, attached
+   * to a shared market.
+   */
+  explicit TestDaemon (SharedMarket& market,
+                       TestEnvironment<MockXayaRpcServer>& env,
+                       const unsigned n)
+    : Daemon(market, GetTestAccount (n), env.GetXayaEndpoint (),
+             GetTestJid (n).full (), GetPassword (n))
+  {
+    SetRootCA (GetTestCA ());
+    Connect ();
+    CHECK (IsConnected ());
+  }
+
   /**
    * Adds a new order to the daemon's own orders from the given text
    * proto.
@@ -162,6 +192,19 @@ public:
     PublishMessage (std::move (ext));
   }
 
+  /**
+   * Sends an orders delta from text proto.
+   */
+  void
+  SendDelta (const std::string& str)
+  {
+    const auto delta = ParseTextProto<proto::OrdersDelta> (str);
+
+    ExtensionData ext;
+    ext.push_back (std::make_unique<OrdersDeltaStanza> (delta));
+    PublishMessage (std::move (ext));
+  }
+
 };
 
 /* ************************************************************************** */
@@ -232,6 +275,121 @@ TEST_F (DaemonTests, BasicOrderExchange)
   )"));
 }
 
+TEST_F (DaemonTests, RoomShards)
+{
+  /* With two shards, "gold" is in shard 1 and "silver" in shard 0.  */
+  FLAGS_democrit_room_shards = 2;
+  TestDaemon d1(assets, env, 0);
+  FLAGS_democrit_room_shard_subscriptions = "0";
+  TestDaemon d2(assets, env, 1);
+
+  assets.SetBalance ("xmpptest1", "gold", 10);
+  assets.SetBalance ("xmpptest1", "silver", 10);
+  assets.SetBalance ("xmpptest2", "gold", 10);
+  assets.SetBalance ("xmpptest2", "silver", 10);
+
+  d1.AddFromText (R"(
+    asset: "gold" type: ASK price_sat: 10 max_units: 1
+  )");
+  d1.AddFromText (R"(
+    asset: "silver" type: ASK price_sat: 20 max_units: 1
+  )");
+  d2.AddFromText (R"(
+    asset: "silver" type: BID price_sat: 5 max_units: 1
+  )");
+
+  /* Orders are not possible in shards we do not subscribe to.  */
+  EXPECT_FALSE (d2.AddOrder (ParseTextProto<proto::Order> (R"(
+    asset: "gold" type: ASK price_sat: 10 max_units: 1
+  )")));
+
+  SleepSome ();
+  EXPECT_THAT (d1.GetOrdersForAsset ("silver"), EqualsOrdersForAsset (R"(
+    asset: "silver"
+    bids: { account: "xmpptest2" id: 0 price_sat: 5 max_units: 1 }
+  )"));
+  EXPECT_THAT (d2.GetOrdersForAsset ("silver"), EqualsOrdersForAsset (R"(
+    asset: "silver"
+    asks: { account: "xmpptest1" id: 1 price_sat: 20 max_units: 1 }
+  )"));
+  EXPECT_THAT (d2.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+  )"));
+
+  const auto byAsset = d2.GetOrdersByAsset ();
+  EXPECT_EQ (byAsset.assets ().size (), 1);
+  EXPECT_EQ (byAsset.assets ().count ("silver"), 1);
+
+  d1.CancelOrder (1);
+  SleepSome ();
+  EXPECT_THAT (d2.GetOrdersForAsset ("silver"), EqualsOrdersForAsset (R"(
+    asset: "silver"
+  )"));
+}
+
+TEST_F (DaemonTests, SharedMarket)
+{
+  SharedMarket market(assets, env.GetXayaEndpoint (), env.GetGspEndpoint (),
+                      GetRoom ("room").full ());
+  TestDaemon d1(market, env, 0);
+  auto d2 = std::make_unique<TestDaemon> (market, env, 1);
+  TestDaemon d3(assets, env, 2);
+
+  assets.SetBalance ("xmpptest1", "gold", 10);
+  assets.InitialiseAccount ("xmpptest2");
+  assets.InitialiseAccount ("xmpptest3");
+
+  d1.AddFromText (R"(
+    asset: "gold" type: ASK price_sat: 10 max_units: 1
+  )");
+  d2->AddFromText (R"(
+    asset: "gold" type: BID price_sat: 5 max_units: 1
+  )");
+  d3.AddFromText (R"(
+    asset: "gold" type: BID price_sat: 7 max_units: 2
+  )");
+
+  /* Each of the attached daemons sees the other's orders as well as
+     the outside ones, but not its own.  */
+  SleepSome ();
+  EXPECT_THAT (d1.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest3" id: 0 price_sat: 7 max_units: 2 }
+    bids: { account: "xmpptest2" id: 0 price_sat: 5 max_units: 1 }
+  )"));
+  EXPECT_THAT (d2->GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest3" id: 0 price_sat: 7 max_units: 2 }
+    asks: { account: "xmpptest1" id: 0 price_sat: 10 max_units: 1 }
+  )"));
+  EXPECT_THAT (d3.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest2" id: 0 price_sat: 5 max_units: 1 }
+    asks: { account: "xmpptest1" id: 0 price_sat: 10 max_units: 1 }
+  )"));
+
+  EXPECT_THAT (d2->GetDepthForAsset ("gold"), EqualsDepthForAsset (R"(
+    asset: "gold"
+    bids: { price_sat: 7 units: 2 orders: 1 }
+    asks: { price_sat: 10 units: 1 orders: 1 }
+  )"));
+  const auto byAsset = d1.GetOrdersByAsset ();
+  ASSERT_EQ (byAsset.assets ().count ("gold"), 1);
+  EXPECT_EQ (byAsset.assets ().at ("gold").bids ().size (), 2);
+  EXPECT_EQ (byAsset.assets ().at ("gold").asks ().size (), 0);
+
+  d2.reset ();
+  SleepSome ();
+  EXPECT_THAT (d1.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest3" id: 0 price_sat: 7 max_units: 2 }
+  )"));
+  EXPECT_THAT (d3.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    asks: { account: "xmpptest1" id: 0 price_sat: 10 max_units: 1 }
+  )"));
+}
+
 TEST_F (DaemonTests, WrongAccountSent)
 {
   TestDaemon d(assets, env, 0);
@@ -255,6 +413,55 @@ TEST_F (DaemonTests, WrongAccountSent)
   )"));
 }
 
+TEST_F (DaemonTests, DeltaAfterFullUpdate)
+{
+  TestDaemon d(assets, env, 0);
+  DirectOrderSender sender(1);
+
+  assets.InitialiseAccount ("xmpptest2");
+
+  sender.SendOrders (R"(
+    account: "xmpptest2"
+    sequence: 5
+    orders:
+      {
+        key: 0
+        value: { asset: "gold" type: BID price_sat: 10 max_units: 1 }
+      }
+  )");
+  SleepSome ();
+
+  /* The delta only applies if the receiver kept the sequence number
+     of the full update.  */
+  sender.SendDelta (R"(
+    sequence: 6
+    upserted:
+      {
+        key: 1
+        value: { asset: "gold" type: BID price_sat: 20 max_units: 2 }
+      }
+    removed: 0
+  )");
+  SleepSome ();
+
+  EXPECT_THAT (d.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest2" id: 1 price_sat: 20 max_units: 2 }
+  )"));
+
+  /* A delta that does not follow on the current sequence is ignored.  */
+  sender.SendDelta (R"(
+    sequence: 8
+    removed: 1
+  )");
+  SleepSome ();
+
+  EXPECT_THAT (d.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    bids: { account: "xmpptest2" id: 1 price_sat: 20 max_units: 2 }
+  )"));
+}
+
 TEST_F (DaemonTests, Timeout)
 {
   TestDaemon d1(assets, env, 0), d2(assets, env, 1);
@@ -375,6 +582,72 @@ TEST_F (DaemonTests, OrderValidation)
   )"));
 }
 
+TEST_F (DaemonTests, ValidationCachedPerBlock)
+{
+  TestDaemon d(assets, env, 0);
+  DirectOrderSender sender(1);
+
+  assets.SetBalance ("xmpptest2", "gold", 10);
+  assets.SetBlock (MockXayaRpcServer::GetBlockHash (1));
+  env.GetXayaServer ().SetBestBlock (MockXayaRpcServer::GetBlockHash (1));
+  SleepSome ();
+
+  const std::string orders = R"(
+    orders:
+      {
+        key: 0
+        value: { asset: "gold" type: ASK price_sat: 10 max_units: 5 }
+      }
+  )";
+  const std::string expected = R"(
+    asset: "gold"
+    asks: { account: "xmpptest2" id: 0 price_sat: 10 max_units: 5 }
+  )";
+
+  sender.SendOrders (orders);
+  SleepSome ();
+  EXPECT_THAT (d.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (expected));
+
+  /* Without a new block, the cached validation result is used.  */
+  assets.SetBalance ("xmpptest2", "gold", 0);
+  sender.SendOrders (orders);
+  SleepSome ();
+  EXPECT_THAT (d.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (expected));
+
+  /* With a new block, the order is checked again.  */
+  assets.SetBlock (MockXayaRpcServer::GetBlockHash (2));
+  env.GetXayaServer ().SetBestBlock (MockXayaRpcServer::GetBlockHash (2));
+  SleepSome ();
+  sender.SendOrders (orders);
+  SleepSome ();
+  EXPECT_THAT (d.GetOrdersForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+  )"));
+}
+
+TEST_F (DaemonTests, OwnOrdersSurviveBlockChange)
+{
+  TestDaemon d(assets, env, 0);
+
+  assets.SetBalance ("xmpptest1", "gold", 10);
+  d.AddFromText (R"(
+    asset: "gold" type: ASK price_sat: 10 max_units: 5
+  )");
+  d.AddFromText (R"(
+    asset: "gold" type: ASK price_sat: 20 max_units: 5
+  )");
+
+  /* The block changes between the checks of both orders during the
+     next refresh.  This must not make the first order invalid.  */
+  assets.QueueBlocks ({
+    MockXayaRpcServer::GetBlockHash (1),
+    MockXayaRpcServer::GetBlockHash (2),
+  });
+  std::this_thread::sleep_for (3 * TIMEOUT);
+
+  EXPECT_EQ (d.GetOwnOrders ().orders_size (), 2);
+}
+
 TEST_F (DaemonTests, TradeMessages)
 {
   /* In this test, we ensure that the integration for exchanging trade
@@ -0,0 +1,56 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/headercache.hpp"
+
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+BlockHeaderCache::Header
+BlockHeaderCache::Header::FromJson (const Json::Value& val)
+{
+  CHECK (val.isObject ()) << "Invalid block header: " << val;
+
+  const auto& hashVal = val["hash"];
+  const auto& heightVal = val["height"];
+  CHECK (hashVal.isString () && heightVal.isUInt ())
+      << "Invalid block header: " << val;
+
+  Header res;
+  CHECK (res.hash.FromHex (hashVal.asString ()))
+      << "Invalid block header: " << val;
+  res.height = heightVal.asUInt ();
+
+  const auto& prevVal = val["previousblockhash"];
+  if (prevVal.isNull ())
+    {
+      CHECK_EQ (res.height, 0) << "Missing parent block: " << val;
+      res.parent.SetNull ();
+    }
+  else
+    {
+      CHECK (prevVal.isString () && res.parent.FromHex (prevVal.asString ()))
+          << "Invalid block header: " << val;
+    }
+
+  return res;
+}
+
+} // namespace democrit
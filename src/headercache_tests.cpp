@@ -0,0 +1,134 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/headercache.hpp"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace democrit
+{
+namespace
+{
+
+/**
+ * Returns a block hash for testing, based on a single-byte number.
+ */
+xaya::uint256
+TestHash (const unsigned n)
+{
+  CHECK_LT (n, 256);
+
+  std::string hex(64, '0');
+  const char* digits = "0123456789abcdef";
+  hex[0] = digits[n / 16];
+  hex[1] = digits[n % 16];
+
+  xaya::uint256 res;
+  CHECK (res.FromHex (hex));
+  return res;
+}
+
+/**
+ * Constructs a header entry for block n with parent n - 1.
+ */
+BlockHeaderCache::Header
+TestHeader (const unsigned n)
+{
+  BlockHeaderCache::Header res;
+  res.hash = TestHash (n);
+  res.height = n;
+  res.parent = TestHash (n - 1);
+  return res;
+}
+
+TEST (BlockHeaderFromJsonTests, Valid)
+{
+  Json::Value val(Json::objectValue);
+  val["hash"] = TestHash (5).ToHex ();
+  val["height"] = 5;
+  val["previousblockhash"] = TestHash (4).ToHex ();
+
+  const auto h = BlockHeaderCache::Header::FromJson (val);
+  EXPECT_TRUE (h.hash == TestHash (5));
+  EXPECT_EQ (h.height, 5);
+  EXPECT_TRUE (h.parent == TestHash (4));
+}
+
+TEST (BlockHeaderFromJsonTests, Genesis)
+{
+  Json::Value val(Json::objectValue);
+  val["hash"] = TestHash (42).ToHex ();
+  val["height"] = 0;
+
+  const auto h = BlockHeaderCache::Header::FromJson (val);
+  EXPECT_TRUE (h.hash == TestHash (42));
+  EXPECT_EQ (h.height, 0);
+  EXPECT_TRUE (h.parent.IsNull ());
+}
+
+TEST (BlockHeaderCacheTests, LookupAndInsert)
+{
+  BlockHeaderCache cache(10);
+
+  BlockHeaderCache::Header h;
+  EXPECT_FALSE (cache.Lookup (TestHash (1), h));
+
+  cache.Insert (TestHeader (1));
+  cache.Insert (TestHeader (2));
+  cache.Insert (TestHeader (1));
+  EXPECT_EQ (cache.GetSize (), 2);
+
+  ASSERT_TRUE (cache.Lookup (TestHash (2), h));
+  EXPECT_TRUE (h.hash == TestHash (2));
+  EXPECT_EQ (h.height, 2);
+  EXPECT_TRUE (h.parent == TestHash (1));
+}
+
+TEST (BlockHeaderCacheTests, EvictsLeastRecentlyUsed)
+{
+  BlockHeaderCache cache(3);
+  for (unsigned i = 1; i <= 3; ++i)
+    cache.Insert (TestHeader (i));
+
+  /* Using block 1 makes block 2 the least recently used.  */
+  BlockHeaderCache::Header h;
+  ASSERT_TRUE (cache.Lookup (TestHash (1), h));
+
+  cache.Insert (TestHeader (4));
+  EXPECT_EQ (cache.GetSize (), 3);
+  EXPECT_TRUE (cache.Lookup (TestHash (1), h));
+  EXPECT_FALSE (cache.Lookup (TestHash (2), h));
+  EXPECT_TRUE (cache.Lookup (TestHash (3), h));
+  EXPECT_TRUE (cache.Lookup (TestHash (4), h));
+}
+
+TEST (BlockHeaderCacheTests, ZeroSize)
+{
+  BlockHeaderCache cache(0);
+  cache.Insert (TestHeader (1));
+  EXPECT_EQ (cache.GetSize (), 0);
+
+  BlockHeaderCache::Header h;
+  EXPECT_FALSE (cache.Lookup (TestHash (1), h));
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -0,0 +1,200 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/inputpool.hpp"
+
+#include <xayautil/jsonutils.hpp>
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <set>
+#include <utility>
+
+namespace democrit
+{
+
+namespace
+{
+
+/**
+ * Converts an outpoint to the JSON format used by lockunspent.
+ */
+Json::Value
+OutPointToJson (const proto::OutPoint& out)
+{
+  Json::Value res(Json::objectValue);
+  res["txid"] = out.hash ();
+  res["vout"] = static_cast<Json::Int> (out.n ());
+  return res;
+}
+
+} // anonymous namespace
+
+InputPool::InputPool (RpcClient<XayaRpcClient>& r,
+                      const std::vector<Amount>& denoms,
+                      const unsigned perDenom)
+  : rpc(r), denominations(denoms), perDenomination(perDenom)
+{
+  std::sort (denominations.begin (), denominations.end ());
+  for (const auto d : denominations)
+    CHECK_GT (d, 0) << "Invalid input pool denomination";
+}
+
+InputPool::~InputPool ()
+{
+  refiller.reset ();
+
+  std::lock_guard<std::mutex> lock(mut);
+  if (available.empty ())
+    return;
+
+  Json::Value outputs(Json::arrayValue);
+  for (const auto& entry : available)
+    outputs.append (OutPointToJson (entry.second));
+
+  LOG (INFO) << "Unlocking " << outputs.size () << " pooled inputs";
+  try
+    {
+      rpc->lockunspent (true, outputs);
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      LOG (WARNING) << "Failed to unlock pooled inputs: " << exc.what ();
+    }
+}
+
+void
+InputPool::StartRefills (const std::chrono::milliseconds intv)
+{
+  CHECK (refiller == nullptr) << "Refills have already been started";
+  refiller = std::make_unique<IntervalJob> (intv, [this] ()
+    {
+      try
+        {
+          Refill ();
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          LOG (WARNING) << "Failed to refill input pool: " << exc.what ();
+        }
+    });
+}
+
+int
+InputPool::GetDenomination (const Amount value) const
+{
+  const auto it = std::upper_bound (denominations.begin (),
+                                    denominations.end (), value);
+  return static_cast<int> (it - denominations.begin ()) - 1;
+}
+
+void
+InputPool::Refill ()
+{
+  std::vector<unsigned> missing(denominations.size (), perDenomination);
+  std::set<std::pair<std::string, unsigned>> pooled;
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    for (const auto& entry : available)
+      {
+        const int d = GetDenomination (entry.first);
+        CHECK_GE (d, 0);
+        if (missing[d] > 0)
+          --missing[d];
+        pooled.emplace (entry.second.hash (), entry.second.n ());
+      }
+  }
+
+  if (std::all_of (missing.begin (), missing.end (),
+                   [] (const unsigned m) { return m == 0; }))
+    return;
+
+  /* listunspent does not return coins locked in the wallet, so this
+     excludes coins already in the pool or used by trades.  */
+  const auto unspent = rpc->listunspent (1);
+  CHECK (unspent.isArray ());
+
+  unsigned added = 0;
+  for (const auto& entry : unspent)
+    {
+      CHECK (entry.isObject ());
+      if (entry.isMember ("nameOp"))
+        continue;
+      if (entry.isMember ("spendable") && !entry["spendable"].asBool ())
+        continue;
+
+      Amount value;
+      CHECK (xaya::ChiAmountFromJson (entry["amount"], value));
+      const int d = GetDenomination (value);
+      if (d < 0 || missing[d] == 0)
+        continue;
+
+      proto::OutPoint out;
+      out.set_hash (entry["txid"].asString ());
+      out.set_n (entry["vout"].asUInt ());
+      if (pooled.count (std::make_pair (out.hash (), out.n ())) > 0)
+        continue;
+
+      /* The coin may have been locked by the wallet (e.g. funding a trade)
+         since we listed it, in which case locking fails and we skip it.  */
+      Json::Value outputs(Json::arrayValue);
+      outputs.append (OutPointToJson (out));
+      try
+        {
+          rpc->lockunspent (false, outputs);
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          VLOG (1) << "Could not lock coin for the pool: " << exc.what ();
+          continue;
+        }
+
+      --missing[d];
+      ++added;
+
+      std::lock_guard<std::mutex> lock(mut);
+      available.emplace (value, std::move (out));
+    }
+
+  VLOG_IF (1, added > 0) << "Added " << added << " coins to the input pool";
+}
+
+bool
+InputPool::Take (const Amount minValue, proto::OutPoint& out)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto it = available.lower_bound (minValue);
+  if (it == available.end ())
+    return false;
+
+  out = std::move (it->second);
+  available.erase (it);
+
+  return true;
+}
+
+size_t
+InputPool::GetSize () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return available.size ();
+}
+
+} // namespace democrit
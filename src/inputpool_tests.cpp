@@ -0,0 +1,160 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/inputpool.hpp"
+
+#include "mockxaya.hpp"
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <memory>
+#include <string>
+
+namespace democrit
+{
+namespace
+{
+
+/** One CHI in satoshi.  */
+constexpr Amount COIN = 100'000'000;
+
+class InputPoolTests : public testing::Test
+{
+
+protected:
+
+  TestEnvironment<MockXayaRpcServer> env;
+
+  /** The pool being tested (so we can destruct it explicitly).  */
+  std::unique_ptr<InputPool> pool;
+
+  InputPoolTests ()
+    : pool(std::make_unique<InputPool> (env.GetXayaRpc (),
+                                        std::vector<Amount> {10 * COIN,
+                                                             COIN},
+                                        2))
+  {}
+
+  /**
+   * Returns true if the given output is locked in the mock wallet.
+   */
+  bool
+  IsLocked (const std::string& txid, const unsigned vout)
+  {
+    const auto locked = env.GetXayaRpc ()->listlockunspent ();
+    CHECK (locked.isArray ());
+    for (const auto& e : locked)
+      if (e["txid"].asString () == txid && e["vout"].asUInt () == vout)
+        return true;
+    return false;
+  }
+
+};
+
+TEST_F (InputPoolTests, RefillsPerDenomination)
+{
+  auto& srv = env.GetXayaServer ();
+  srv.AddSpendable ("small", 0, COIN / 2);
+  for (unsigned i = 0; i < 3; ++i)
+    srv.AddSpendable ("one", i, COIN + i);
+  srv.AddSpendable ("ten", 0, 10 * COIN);
+
+  pool->Refill ();
+  EXPECT_EQ (pool->GetSize (), 3);
+  EXPECT_FALSE (IsLocked ("small", 0));
+  EXPECT_TRUE (IsLocked ("one", 0));
+  EXPECT_TRUE (IsLocked ("one", 1));
+  EXPECT_FALSE (IsLocked ("one", 2));
+  EXPECT_TRUE (IsLocked ("ten", 0));
+
+  /* Refilling again does not add anything for the full denomination.  */
+  pool->Refill ();
+  EXPECT_EQ (pool->GetSize (), 3);
+  EXPECT_FALSE (IsLocked ("one", 2));
+}
+
+TEST_F (InputPoolTests, Take)
+{
+  auto& srv = env.GetXayaServer ();
+  srv.AddSpendable ("one", 0, COIN);
+  srv.AddSpendable ("one", 1, 2 * COIN);
+  srv.AddSpendable ("ten", 0, 10 * COIN);
+  pool->Refill ();
+  ASSERT_EQ (pool->GetSize (), 3);
+
+  proto::OutPoint out;
+  ASSERT_TRUE (pool->Take (COIN + 1, out));
+  EXPECT_EQ (out.hash (), "one");
+  EXPECT_EQ (out.n (), 1);
+
+  ASSERT_TRUE (pool->Take (COIN, out));
+  EXPECT_EQ (out.hash (), "one");
+  EXPECT_EQ (out.n (), 0);
+
+  EXPECT_FALSE (pool->Take (20 * COIN, out));
+  EXPECT_EQ (pool->GetSize (), 1);
+
+  /* Taken coins stay locked, even when the pool is destructed.  */
+  pool.reset ();
+  EXPECT_TRUE (IsLocked ("one", 0));
+  EXPECT_TRUE (IsLocked ("one", 1));
+  EXPECT_FALSE (IsLocked ("ten", 0));
+}
+
+TEST_F (InputPoolTests, SkipsAlreadyLocked)
+{
+  auto& srv = env.GetXayaServer ();
+  srv.AddSpendable ("one", 0, COIN);
+  srv.AddSpendable ("one", 1, COIN);
+  pool->Refill ();
+  ASSERT_EQ (pool->GetSize (), 2);
+
+  /* Another coin is added and locked by someone else in between, and
+     one of the pooled coins is taken.  */
+  srv.AddSpendable ("one", 2, COIN);
+  Json::Value outputs(Json::arrayValue);
+  Json::Value cur(Json::objectValue);
+  cur["txid"] = "one";
+  cur["vout"] = 2;
+  outputs.append (cur);
+  env.GetXayaRpc ()->lockunspent (false, outputs);
+
+  proto::OutPoint out;
+  ASSERT_TRUE (pool->Take (COIN, out));
+  pool->Refill ();
+  EXPECT_EQ (pool->GetSize (), 1);
+}
+
+TEST_F (InputPoolTests, UnlocksOnDestruction)
+{
+  auto& srv = env.GetXayaServer ();
+  srv.AddSpendable ("one", 0, COIN);
+  srv.AddSpendable ("ten", 0, 10 * COIN);
+  pool->Refill ();
+  ASSERT_EQ (pool->GetSize (), 2);
+
+  pool.reset ();
+  EXPECT_FALSE (IsLocked ("one", 0));
+  EXPECT_FALSE (IsLocked ("ten", 0));
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -23,30 +23,24 @@ namespace democrit
 
 IntervalJob::~IntervalJob ()
 {
-  {
-    std::lock_guard<std::mutex> lock(mut);
-    stop = true;
-    cv.notify_all ();
-  }
+  scheduler.Remove (id);
+}
+
+void
+IntervalJob::TriggerNow ()
+{
+  scheduler.TriggerNow (id);
+}
 
-  worker.join ();
+DelayedJob::~DelayedJob ()
+{
+  scheduler.Remove (id);
 }
 
 void
-IntervalJob::StartWorker ()
+DelayedJob::Trigger ()
 {
-  std::lock_guard<std::mutex> lock(mut);
-  stop = false;
-
-  worker = std::thread ([this] ()
-    {
-      std::unique_lock<std::mutex> lock(mut);
-      while (!stop)
-        {
-          job ();
-          cv.wait_for (lock, intv);
-        }
-    });
+  scheduler.TriggerAfter (id, delay);
 }
 
 } // namespace democrit
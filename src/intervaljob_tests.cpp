@@ -95,5 +95,53 @@ TEST_F (IntervalJobTests, QuickShutdown)
   EXPECT_LT (after - before, 2 * INTV);
 }
 
+TEST_F (IntervalJobTests, TriggerNow)
+{
+  auto job = StartJob (10 * INTV);
+  std::this_thread::sleep_for (INTV);
+  ExpectCount (1);
+
+  job->TriggerNow ();
+  std::this_thread::sleep_for (INTV);
+  ExpectCount (2);
+}
+
+TEST_F (IntervalJobTests, WithJitter)
+{
+  std::atomic<unsigned> cnt(0);
+  auto job = std::make_unique<IntervalJob> (INTV, INTV, [&cnt] ()
+    {
+      ++cnt;
+    });
+  std::this_thread::sleep_for (5 * INTV);
+  job.reset ();
+
+  EXPECT_GE (cnt, 3);
+  EXPECT_LE (cnt, 6);
+}
+
+TEST_F (IntervalJobTests, DelayedJob)
+{
+  std::atomic<unsigned> cnt(0);
+  DelayedJob job(2 * INTV, [&cnt] ()
+    {
+      ++cnt;
+    });
+
+  std::this_thread::sleep_for (INTV);
+  EXPECT_EQ (cnt, 0);
+
+  job.Trigger ();
+  job.Trigger ();
+  std::this_thread::sleep_for (INTV);
+  job.Trigger ();
+  EXPECT_EQ (cnt, 0);
+
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 1);
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 1);
+}
+
 } // anonymous namespace
 } // namespace democrit
@@ -25,6 +25,8 @@
 
 #include <google/protobuf/repeated_field.h>
 
+#include <map>
+
 namespace democrit
 {
 
@@ -44,10 +46,10 @@ IntToJson (const int64_t val)
 }
 
 /**
- * Converts an order type enum value to a JSON value (string).
+ * Returns the string representation of an order type.
  */
-Json::Value
-OrderTypeToJson (const proto::Order::Type t)
+const char*
+OrderTypeToString (const proto::Order::Type t)
 {
   switch (t)
     {
@@ -60,6 +62,55 @@ OrderTypeToJson (const proto::Order::Type t)
     }
 }
 
+/**
+ * Converts an order type enum value to a JSON value (string).
+ */
+Json::Value
+OrderTypeToJson (const proto::Order::Type t)
+{
+  return OrderTypeToString (t);
+}
+
+/**
+ * Returns the string representation of a trade's state.
+ */
+const char*
+TradeStateToString (const proto::Trade::State s)
+{
+  switch (s)
+    {
+    case proto::Trade::INITIATED:
+      return "initiated";
+    case proto::Trade::PENDING:
+      return "pending";
+    case proto::Trade::SUCCESS:
+      return "success";
+    case proto::Trade::FAILED:
+      return "failed";
+    case proto::Trade::ABANDONED:
+      return "abandoned";
+    default:
+      LOG (FATAL) << "Unexpected state: " << s;
+    }
+}
+
+/**
+ * Returns the string representation of our role in a trade.
+ */
+const char*
+TradeRoleToString (const proto::Trade::Role r)
+{
+  switch (r)
+    {
+    case proto::Trade::MAKER:
+      return "maker";
+    case proto::Trade::TAKER:
+      return "taker";
+    default:
+      LOG (FATAL) << "Unexpected role: " << r;
+    }
+}
+
 } // anonymous namespace
 
 template <>
@@ -229,6 +280,42 @@ template <>
   return res;
 }
 
+namespace
+{
+
+/**
+ * Converts one side of an aggregated depth view to JSON.
+ */
+Json::Value
+DepthSideToJson (const RepeatedPtrField<proto::PriceLevel>& levels)
+{
+  Json::Value res(Json::arrayValue);
+  for (const auto& l : levels)
+    {
+      Json::Value cur(Json::objectValue);
+      cur["price_sat"] = IntToJson (l.price_sat ());
+      cur["units"] = IntToJson (l.units ());
+      cur["orders"] = IntToJson (l.orders ());
+      res.append (cur);
+    }
+
+  return res;
+}
+
+} // anonymous namespace
+
+template <>
+  Json::Value
+  ProtoToJson<proto::DepthForAsset> (const proto::DepthForAsset& pb)
+{
+  Json::Value res(Json::objectValue);
+  res["asset"] = pb.asset ();
+  res["bids"] = DepthSideToJson (pb.bids ());
+  res["asks"] = DepthSideToJson (pb.asks ());
+
+  return res;
+}
+
 template <>
   Json::Value
   ProtoToJson<proto::Trade> (const proto::Trade& pb)
@@ -241,40 +328,375 @@ template <>
   res["units"] = IntToJson (pb.units ());
   res["price_sat"] = IntToJson (pb.price_sat ());
 
-  switch (pb.state ())
+  res["state"] = TradeStateToString (pb.state ());
+  res["role"] = TradeRoleToString (pb.role ());
+
+  return res;
+}
+
+template <>
+  bool
+  ProtoFromJson<proto::TradeFilter> (const Json::Value& val,
+                                     proto::TradeFilter& pb)
+{
+  pb.Clear ();
+
+  if (!val.isObject ())
+    return false;
+
+  if (val.isMember ("min_start_time"))
     {
-    case proto::Trade::INITIATED:
-      res["state"] = "initiated";
-      break;
-    case proto::Trade::PENDING:
-      res["state"] = "pending";
-      break;
-    case proto::Trade::SUCCESS:
-      res["state"] = "success";
-      break;
-    case proto::Trade::FAILED:
-      res["state"] = "failed";
-      break;
-    case proto::Trade::ABANDONED:
-      res["state"] = "abandoned";
-      break;
-    default:
-      LOG (FATAL) << "Unexpected state: " << pb.state ();
+      if (!val["min_start_time"].isInt64 ())
+        return false;
+      pb.set_min_start_time (val["min_start_time"].asInt64 ());
     }
 
-  switch (pb.role ())
+  if (val.isMember ("max_start_time"))
     {
-    case proto::Trade::MAKER:
-      res["role"] = "maker";
-      break;
-    case proto::Trade::TAKER:
-      res["role"] = "taker";
-      break;
-    default:
-      LOG (FATAL) << "Unexpected role: " << pb.role ();
+      if (!val["max_start_time"].isInt64 ())
+        return false;
+      pb.set_max_start_time (val["max_start_time"].asInt64 ());
     }
 
-  return res;
+  if (val.isMember ("state"))
+    {
+      if (!val["state"].isString ())
+        return false;
+      const std::string state = val["state"].asString ();
+      if (state == "initiated")
+        pb.set_state (proto::Trade::INITIATED);
+      else if (state == "pending")
+        pb.set_state (proto::Trade::PENDING);
+      else if (state == "success")
+        pb.set_state (proto::Trade::SUCCESS);
+      else if (state == "failed")
+        pb.set_state (proto::Trade::FAILED);
+      else if (state == "abandoned")
+        pb.set_state (proto::Trade::ABANDONED);
+      else
+        return false;
+    }
+
+  if (val.isMember ("asset"))
+    {
+      if (!val["asset"].isString ())
+        return false;
+      pb.set_asset (val["asset"].asString ());
+    }
+
+  if (val.isMember ("counterparty"))
+    {
+      if (!val["counterparty"].isString ())
+        return false;
+      pb.set_counterparty (val["counterparty"].asString ());
+    }
+
+  return true;
+}
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/**
+ * Simple helper for writing JSON text into a string buffer.  It takes care
+ * of the comma separators between elements of objects and arrays.  Callers
+ * are responsible for writing object keys in sorted order, so that the
+ * output matches what Json::FastWriter produces for a Json::Value.
+ */
+class JsonTextWriter
+{
+
+private:
+
+  /** The buffer we append to.  */
+  std::string& out;
+
+  /** Whether the next element needs a comma before it.  */
+  bool needComma = false;
+
+  /**
+   * Writes the comma separator if needed.
+   */
+  void
+  Separator ()
+  {
+    if (needComma)
+      out += ',';
+  }
+
+public:
+
+  explicit JsonTextWriter (std::string& o)
+    : out(o)
+  {}
+
+  JsonTextWriter () = delete;
+  JsonTextWriter (const JsonTextWriter&) = delete;
+  void operator= (const JsonTextWriter&) = delete;
+
+  void
+  BeginObject ()
+  {
+    Separator ();
+    out += '{';
+    needComma = false;
+  }
+
+  void
+  EndObject ()
+  {
+    out += '}';
+    needComma = true;
+  }
+
+  void
+  BeginArray ()
+  {
+    Separator ();
+    out += '[';
+    needComma = false;
+  }
+
+  void
+  EndArray ()
+  {
+    out += ']';
+    needComma = true;
+  }
+
+  /**
+   * Writes an object key that is a string literal, i.e. does not need
+   * any escaping.
+   */
+  void
+  Key (const char* key)
+  {
+    Separator ();
+    out += '"';
+    out += key;
+    out += "\":";
+    needComma = false;
+  }
+
+  /**
+   * Writes an object key that is arbitrary data and gets escaped.
+   */
+  void
+  Key (const std::string& key)
+  {
+    Separator ();
+    out += Json::valueToQuotedString (key.c_str ());
+    out += ':';
+    needComma = false;
+  }
+
+  void
+  String (const std::string& val)
+  {
+    Separator ();
+    out += Json::valueToQuotedString (val.c_str ());
+    needComma = true;
+  }
+
+  /**
+   * Writes a string value that does not need any escaping.
+   */
+  void
+  Literal (const char* val)
+  {
+    Separator ();
+    out += '"';
+    out += val;
+    out += '"';
+    needComma = true;
+  }
+
+  void
+  Int (const int64_t val)
+  {
+    Separator ();
+    out += std::to_string (val);
+    needComma = true;
+  }
+
+  void
+  Bool (const bool val)
+  {
+    Separator ();
+    out += (val ? "true" : "false");
+    needComma = true;
+  }
+
+};
+
+/**
+ * Writes an order as JSON text.  This matches ProtoToJson<Order>, except
+ * that some of the fields can be left out and the ID can be overridden,
+ * as is done when the order is part of an OrdersOfAccount or orderbook.
+ * The keys are written in sorted order.
+ */
+void
+WriteOrder (JsonTextWriter& w, const proto::Order& pb,
+            const bool withAccount, const bool withAssetAndType,
+            const uint64_t* idOverride)
+{
+  w.BeginObject ();
+
+  if (withAccount && pb.has_account ())
+    {
+      w.Key ("account");
+      w.String (pb.account ());
+    }
+
+  if (withAssetAndType && pb.has_asset ())
+    {
+      w.Key ("asset");
+      w.String (pb.asset ());
+    }
+
+  if (idOverride != nullptr)
+    {
+      w.Key ("id");
+      w.Int (*idOverride);
+    }
+  else if (pb.has_id ())
+    {
+      w.Key ("id");
+      w.Int (pb.id ());
+    }
+
+  if (pb.locked ())
+    {
+      w.Key ("locked");
+      w.Bool (true);
+    }
+
+  CHECK_GE (pb.max_units (), std::max<int64_t> (1, pb.min_units ()));
+  w.Key ("max_units");
+  w.Int (pb.max_units ());
+  w.Key ("min_units");
+  w.Int (pb.has_min_units () ? pb.min_units () : 1);
+  w.Key ("price_sat");
+  w.Int (pb.price_sat ());
+
+  if (withAssetAndType && pb.has_type ())
+    {
+      w.Key ("type");
+      w.Literal (OrderTypeToString (pb.type ()));
+    }
+
+  w.EndObject ();
+}
+
+/**
+ * Writes one side of an orderbook as JSON text.
+ */
+void
+WriteOrderbookSide (JsonTextWriter& w,
+                    const RepeatedPtrField<proto::Order>& orders)
+{
+  w.BeginArray ();
+  for (const auto& o : orders)
+    WriteOrder (w, o, true, false, nullptr);
+  w.EndArray ();
+}
+
+/**
+ * Writes the orderbook for an asset as JSON text, with the asset name
+ * given explicitly (as it is done for the entries of OrderbookByAsset).
+ */
+void
+WriteOrderbook (JsonTextWriter& w, const proto::OrderbookForAsset& pb,
+                const std::string& asset)
+{
+  w.BeginObject ();
+  w.Key ("asks");
+  WriteOrderbookSide (w, pb.asks ());
+  w.Key ("asset");
+  w.String (asset);
+  w.Key ("bids");
+  WriteOrderbookSide (w, pb.bids ());
+  w.EndObject ();
+}
+
+} // anonymous namespace
+
+template <>
+  void
+  ProtoToJsonText<proto::OrdersOfAccount> (const proto::OrdersOfAccount& pb,
+                                           std::string& out)
+{
+  std::map<uint64_t, const proto::Order*> ordersById;
+  for (const auto& entry : pb.orders ())
+    ordersById.emplace (entry.first, &entry.second);
+
+  JsonTextWriter w(out);
+  w.BeginObject ();
+  w.Key ("account");
+  w.String (pb.account ());
+  w.Key ("orders");
+  w.BeginArray ();
+  for (const auto& entry : ordersById)
+    WriteOrder (w, *entry.second, false, true, &entry.first);
+  w.EndArray ();
+  w.EndObject ();
+}
+
+template <>
+  void
+  ProtoToJsonText<proto::OrderbookForAsset> (
+      const proto::OrderbookForAsset& pb, std::string& out)
+{
+  JsonTextWriter w(out);
+  WriteOrderbook (w, pb, pb.asset ());
+}
+
+template <>
+  void
+  ProtoToJsonText<proto::OrderbookByAsset> (const proto::OrderbookByAsset& pb,
+                                            std::string& out)
+{
+  /* The proto map is unordered, while JSON objects have their keys
+     sorted.  */
+  std::map<std::string, const proto::OrderbookForAsset*> byAsset;
+  for (const auto& entry : pb.assets ())
+    byAsset.emplace (entry.first, &entry.second);
+
+  JsonTextWriter w(out);
+  w.BeginObject ();
+  for (const auto& entry : byAsset)
+    {
+      w.Key (entry.first);
+      WriteOrderbook (w, *entry.second, entry.first);
+    }
+  w.EndObject ();
+}
+
+template <>
+  void
+  ProtoToJsonText<proto::Trade> (const proto::Trade& pb, std::string& out)
+{
+  JsonTextWriter w(out);
+  w.BeginObject ();
+  w.Key ("asset");
+  w.String (pb.asset ());
+  w.Key ("counterparty");
+  w.String (pb.counterparty ());
+  w.Key ("price_sat");
+  w.Int (pb.price_sat ());
+  w.Key ("role");
+  w.Literal (TradeRoleToString (pb.role ()));
+  w.Key ("start_time");
+  w.Int (pb.start_time ());
+  w.Key ("state");
+  w.Literal (TradeStateToString (pb.state ()));
+  w.Key ("type");
+  w.Literal (OrderTypeToString (pb.type ()));
+  w.Key ("units");
+  w.Int (pb.units ());
+  w.EndObject ();
 }
 
 } // namespace democrit
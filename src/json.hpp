@@ -21,6 +21,8 @@
 
 #include <json/json.h>
 
+#include <string>
+
 namespace democrit
 {
 
@@ -32,6 +34,20 @@ namespace democrit
 template <typename Proto>
   Json::Value ProtoToJson (const Proto& pb);
 
+/**
+ * Writes the JSON form of a proto directly as text, without building up
+ * a Json::Value tree first.  The result is appended to the given buffer,
+ * so that callers can reuse the same buffer (and its allocated capacity)
+ * for many calls.
+ *
+ * The text is byte-for-byte the same as what Json::FastWriter produces
+ * for ProtoToJson (without the final line feed).  This is implemented
+ * for the protos returned by the "heavy" RPC methods, i.e. OrdersOfAccount,
+ * OrderbookForAsset, OrderbookByAsset and Trade.
+ */
+template <typename Proto>
+  void ProtoToJsonText (const Proto& pb, std::string& out);
+
 /**
  * Tries to convert a JSON representation into the corresponding protocol
  * buffer message.  This is implemented for protos that are used as inputs
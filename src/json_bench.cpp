@@ -0,0 +1,76 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "json.hpp"
+
+#include "benchutils.hpp"
+#include "proto/orders.pb.h"
+
+#include <benchmark/benchmark.h>
+
+#include <json/json.h>
+
+#include <string>
+
+namespace democrit
+{
+namespace
+{
+
+/**
+ * Converts a full orderbook to JSON with ProtoToJson, and serialises that
+ * to text in the same way as the JSON-RPC server does.
+ */
+void
+ProtoToJsonOrderbook (benchmark::State& state)
+{
+  BenchOrderbook ob;
+  FillOrderbook (ob, state.range (0));
+  const auto book = ob.GetByAsset ();
+
+  Json::FastWriter writer;
+  for (auto _ : state)
+    benchmark::DoNotOptimize (writer.write (ProtoToJson (book)));
+}
+BENCHMARK (ProtoToJsonOrderbook)->RangeMultiplier (10)->Range (1'000, 100'000);
+
+/**
+ * Writes a full orderbook directly as JSON text with ProtoToJsonText,
+ * reusing the same buffer.
+ */
+void
+ProtoToJsonTextOrderbook (benchmark::State& state)
+{
+  BenchOrderbook ob;
+  FillOrderbook (ob, state.range (0));
+  const auto book = ob.GetByAsset ();
+
+  std::string buf;
+  for (auto _ : state)
+    {
+      buf.clear ();
+      ProtoToJsonText (book, buf);
+      benchmark::DoNotOptimize (buf.data ());
+    }
+  state.SetBytesProcessed (state.iterations () * buf.size ());
+}
+BENCHMARK (ProtoToJsonTextOrderbook)
+    ->RangeMultiplier (10)->Range (1'000, 100'000);
+
+} // anonymous namespace
+} // namespace democrit
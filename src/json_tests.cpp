@@ -70,6 +70,26 @@ protected:
         << "\nExpected: " << expected.DebugString ();
   }
 
+  /**
+   * Expects that ProtoToJsonText for the given text proto produces exactly
+   * the same string as Json::FastWriter does for ProtoToJson.  The text
+   * is written into a buffer that already has some content, to verify
+   * that it gets appended.
+   */
+  template <typename Proto>
+    static void
+    ExpectTextMatchesWriter (const std::string& pb)
+  {
+    const auto obj = ParseTextProto<Proto> (pb);
+
+    Json::FastWriter writer;
+    writer.omitEndingLineFeed ();
+
+    std::string actual = "prefix";
+    ProtoToJsonText (obj, actual);
+    EXPECT_EQ (actual, "prefix" + writer.write (ProtoToJson (obj)));
+  }
+
 };
 
 TEST_F (JsonTests, OrderToJson)
@@ -299,6 +319,23 @@ TEST_F (JsonTests, OrderbookByAssetToJson)
   })");
 }
 
+TEST_F (JsonTests, DepthForAssetToJson)
+{
+  ExpectProtoToJson<proto::DepthForAsset> (R"(
+    asset: "gold"
+    bids: { price_sat: 10 units: 5 orders: 2 }
+    bids: { price_sat: 8 units: 1 orders: 1 }
+  )", R"({
+    "asset": "gold",
+    "bids":
+      [
+        {"price_sat": 10, "units": 5, "orders": 2},
+        {"price_sat": 8, "units": 1, "orders": 1}
+      ],
+    "asks": []
+  })");
+}
+
 TEST_F (JsonTests, TradeToJson)
 {
   ExpectProtoToJson<proto::Trade> (R"(
@@ -342,6 +379,118 @@ TEST_F (JsonTests, TradeToJson)
   })");
 }
 
+TEST_F (JsonTests, OrdersOfAccountToJsonText)
+{
+  ExpectTextMatchesWriter<proto::OrdersOfAccount> (R"(
+    account: "domob"
+  )");
+
+  ExpectTextMatchesWriter<proto::OrdersOfAccount> (R"(
+    account: "quote\"and\\slash\n"
+    orders:
+      {
+        key: 12
+        value:
+          {
+            account: "wrong"
+            id: 12345
+            asset: "g\303\266ld"
+            max_units: 5
+            min_units: 2
+            price_sat: 2
+            type: BID
+            locked: true
+          }
+      }
+    orders:
+      {
+        key: 3
+        value: { max_units: 1 price_sat: 10 }
+      }
+    orders:
+      {
+        key: 18446744073709551615
+        value: { asset: "gold" max_units: 1 price_sat: 0 type: ASK }
+      }
+  )");
+}
+
+TEST_F (JsonTests, OrderbookForAssetToJsonText)
+{
+  ExpectTextMatchesWriter<proto::OrderbookForAsset> (R"(
+    asset: "gold"
+  )");
+
+  ExpectTextMatchesWriter<proto::OrderbookForAsset> (R"(
+    asset: "gold"
+    bids:
+      {
+        account: "domob"
+        id: 10
+        asset: "silver"
+        type: ASK
+        max_units: 1
+        price_sat: 2
+      }
+    bids: { account: "domob" id: 20 max_units: 10 min_units: 5 price_sat: 1 }
+    asks: { account: "tab\there" id: 10 max_units: 2 price_sat: 10 }
+    asks: { max_units: 1 price_sat: 11 locked: true }
+  )");
+}
+
+TEST_F (JsonTests, OrderbookByAssetToJsonText)
+{
+  ExpectTextMatchesWriter<proto::OrderbookByAsset> ("");
+
+  ExpectTextMatchesWriter<proto::OrderbookByAsset> (R"(
+    assets:
+      {
+        key: "silver"
+        value:
+          {
+            asks: { account: "domob" id: 2 max_units: 1 price_sat: 1 }
+          }
+      }
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "wrong"
+            bids: { account: "domob" id: 1 max_units: 1 price_sat: 10 }
+          }
+      }
+    assets: { key: "Zinc" value: {} }
+    assets: { key: "g\"old" value: {} }
+    assets: { key: "gold2" value: {} }
+  )");
+}
+
+TEST_F (JsonTests, TradeToJsonText)
+{
+  ExpectTextMatchesWriter<proto::Trade> (R"(
+    state: PENDING
+    start_time: 123
+    counterparty: "domob"
+    type: BID
+    asset: "gold"
+    units: 42
+    price_sat: 10
+    role: MAKER
+  )");
+
+  ExpectTextMatchesWriter<proto::Trade> (R"(
+    state: ABANDONED
+    start_time: -5
+    counterparty: "\001odd"
+    type: ASK
+    asset: "g\303\266ld"
+    units: 1
+    price_sat: 0
+    role: TAKER
+  )");
+}
+
 TEST_F (JsonTests, InvalidOrderFromJson)
 {
   const auto invalidOrders = ParseJson (R"([
@@ -408,5 +557,52 @@ TEST_F (JsonTests, ValidOrderFromJson)
   )");
 }
 
+TEST_F (JsonTests, InvalidTradeFilterFromJson)
+{
+  const auto invalidFilters = ParseJson (R"([
+    42,
+    [1, 2, 3],
+    "filter",
+    null,
+    {"min_start_time": "x"},
+    {"max_start_time": 1.5},
+    {"state": 1},
+    {"state": "invalid"},
+    {"asset": false},
+    {"counterparty": 10}
+  ])");
+
+  for (const auto& f : invalidFilters)
+    {
+      proto::TradeFilter dummy;
+      ASSERT_FALSE (ProtoFromJson (f, dummy));
+    }
+}
+
+TEST_F (JsonTests, ValidTradeFilterFromJson)
+{
+  ExpectProtoFromJson<proto::TradeFilter> ("{}", "");
+
+  ExpectProtoFromJson<proto::TradeFilter> (R"({
+    "min_start_time": 10,
+    "max_start_time": 20,
+    "state": "success",
+    "asset": "gold",
+    "counterparty": "domob"
+  })", R"(
+    min_start_time: 10
+    max_start_time: 20
+    state: SUCCESS
+    asset: "gold"
+    counterparty: "domob"
+  )");
+
+  ExpectProtoFromJson<proto::TradeFilter> (R"({
+    "state": "abandoned"
+  })", R"(
+    state: ABANDONED
+  )");
+}
+
 } // anonymous namespace
 } // namespace democrit
@@ -0,0 +1,1311 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Multi-daemon end-to-end load test.  This starts one Daemon per configured
+   XMPP account (either standalone or attached to a single SharedMarket),
+   each with its own mocked Xaya wallet, and lets them churn orders and take
+   each other's orders.  At the end, a JSON report with throughput, latency,
+   broadcast and RPC statistics is printed.
+
+   The XMPP side is real and needs the local test environment (as set up
+   e.g. by Charon's test/env scripts), just like the daemon unit tests.  */
+
+#include "daemon.hpp"
+
+#include "mockxaya.hpp"
+#include "private/authenticator.hpp"
+#include "private/metrics.hpp"
+#include "proto/orders.pb.h"
+#include "proto/trades.pb.h"
+#include "testutils.hpp"
+
+#include <jsonrpccpp/common/exception.h>
+#include <jsonrpccpp/server/connectors/httpserver.h>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+DECLARE_string (democrit_xid_servers);
+DECLARE_int32 (democrit_trade_timeout_ms);
+
+extern bool useLegacyXayaRpcInDaemon;
+
+namespace
+{
+
+DEFINE_string (accounts, "",
+               "comma-separated list of user:password XMPP accounts to run"
+               " traders for (default: the test environment's accounts)");
+DEFINE_string (room, "loadtest",
+               "local name of the MUC room used for the order exchange");
+DEFINE_bool (shared_market, false,
+             "if set, attach all traders to a single SharedMarket");
+
+DEFINE_int32 (duration_s, 60, "how long to run the load for");
+DEFINE_int32 (orders_per_trader, 10,
+              "number of orders each trader keeps on the book");
+DEFINE_int64 (churn_ms, 1'000,
+              "interval at which each trader replaces all its orders"
+              " (zero to never replace them)");
+DEFINE_int64 (take_ms, 500,
+              "pause between a trader's order takes (zero to disable taking)");
+DEFINE_uint64 (seed, 42, "seed for the random order generation");
+
+/**
+ * Exception thrown for usage errors (won't be logged).
+ */
+class UsageError : public std::runtime_error
+{
+public:
+  using std::runtime_error::runtime_error;
+};
+
+} // anonymous namespace
+
+namespace democrit
+{
+namespace
+{
+
+using testing::_;
+using testing::Invoke;
+
+/** Block height at which the mock chain and GSP are.  */
+constexpr unsigned BLOCK_HEIGHT = 10;
+
+/** Assets the traders place orders for.  */
+const char* const ASSETS[] = {"gold", "silver", "bronze"};
+/** Number of entries in ASSETS.  */
+constexpr size_t NUM_ASSETS = sizeof (ASSETS) / sizeof (ASSETS[0]);
+
+/** Balance every trader has of every asset.  */
+constexpr Amount ASSET_BALANCE = 1'000'000;
+
+/** Number of units per order.  */
+constexpr Amount ORDER_UNITS = 10;
+
+/** Prefix of the self-describing PSBT strings the mock wallets use.  */
+constexpr const char* PSBT_PREFIX = "psbt:";
+
+/** Prefix of the "raw transactions" returned from finalizepsbt.  */
+constexpr const char* RAWTX_PREFIX = "rawtx:";
+
+/** Extra time we wait for a take over the trade timeout.  */
+constexpr auto TAKE_TIMEOUT_SLACK = std::chrono::seconds (5);
+
+/** Time to let the initial orders propagate before measuring.  */
+constexpr auto SETTLE_TIME = std::chrono::seconds (2);
+
+/**
+ * Returns the JSON value with the given prefix (PSBT or raw tx) encoded
+ * into a string.
+ */
+std::string
+EncodeJson (const std::string& prefix, const Json::Value& val)
+{
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["commentStyle"] = "None";
+  wbuilder["indentation"] = "";
+
+  return prefix + Json::writeString (wbuilder, val);
+}
+
+/**
+ * Decodes a string encoded with EncodeJson, throwing a JSON-RPC error
+ * like Xaya Core if it is invalid.
+ */
+Json::Value
+DecodeJson (const std::string& prefix, const std::string& str)
+{
+  if (str.compare (0, prefix.size (), prefix) != 0)
+    throw jsonrpc::JsonRpcException (-22, "TX decode failed");
+
+  return ParseJson (str.substr (prefix.size ()));
+}
+
+/* ************************************************************************** */
+
+/**
+ * The simulated blockchain shared by all mock wallets.  It knows which
+ * outputs have been spent and where each account's name currently is.
+ * Broadcast transactions are "mined" right away and marked as final
+ * in the mock g/dem GSP.  This class is thread-safe.
+ */
+class LoadTestChain
+{
+
+private:
+
+  /** The GSP which we inform about broadcast trades.  */
+  MockDemGsp& gsp;
+
+  /** For the current name outputs (by txid), the account they are for.  */
+  std::map<std::string, std::string> nameOwners;
+
+  /** The vout of each account's current name output.  */
+  std::map<std::string, unsigned> nameVouts;
+
+  /** All outputs that have been spent.  */
+  std::set<std::pair<std::string, unsigned>> spent;
+
+  /** Number of btxids handed out.  */
+  unsigned numBtxids = 0;
+
+  /** Number of transactions accepted.  */
+  unsigned numTransactions = 0;
+
+  /** Number of transactions rejected because of double spends.  */
+  unsigned numConflicts = 0;
+
+  /** Lock for the data.  */
+  mutable std::mutex mut;
+
+public:
+
+  explicit LoadTestChain (MockDemGsp& g)
+    : gsp(g)
+  {}
+
+  LoadTestChain () = delete;
+  LoadTestChain (const LoadTestChain&) = delete;
+  void operator= (const LoadTestChain&) = delete;
+
+  /**
+   * Returns the txid of the (fake) transactions that hold an
+   * account's name.
+   */
+  static std::string
+  GetNameTxid (const std::string& account)
+  {
+    return account + " name";
+  }
+
+  /**
+   * Returns the txid of the (fake) transactions that hold an
+   * account's CHI coins.
+   */
+  static std::string
+  GetCoinTxid (const std::string& account)
+  {
+    return account + " coin";
+  }
+
+  /**
+   * Returns the current name output of the given account in the form
+   * returned by name_show.
+   */
+  Json::Value
+  GetNameOutput (const std::string& account)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    const auto txid = GetNameTxid (account);
+    nameOwners.emplace (txid, account);
+
+    Json::Value res(Json::objectValue);
+    res["name"] = "p/" + account;
+    res["txid"] = txid;
+    res["vout"] = static_cast<Json::Int> (nameVouts[account]);
+
+    return res;
+  }
+
+  /**
+   * Returns true if the given output has not been spent yet.
+   */
+  bool
+  IsUnspent (const std::string& txid, const unsigned vout) const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return spent.count (std::make_pair (txid, vout)) == 0;
+  }
+
+  /**
+   * Returns a fresh btxid for a new transaction.
+   */
+  std::string
+  NewBtxid ()
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return "btxid " + std::to_string (++numBtxids);
+  }
+
+  /**
+   * Processes a broadcast transaction (the "tx" field of a decoded PSBT).
+   * This spends its inputs and moves names, and marks the trade final
+   * in the GSP.  Returns false if one of the inputs is already spent.
+   */
+  bool Broadcast (const Json::Value& tx);
+
+  unsigned
+  GetNumTransactions () const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return numTransactions;
+  }
+
+  unsigned
+  GetNumConflicts () const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return numConflicts;
+  }
+
+};
+
+bool
+LoadTestChain::Broadcast (const Json::Value& tx)
+{
+  const auto& vin = tx["vin"];
+  CHECK (vin.isArray ());
+  const auto& btxidVal = tx["btxid"];
+  CHECK (btxidVal.isString ());
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    for (const auto& in : vin)
+      if (spent.count (std::make_pair (in["txid"].asString (),
+                                       in["vout"].asUInt ())) > 0)
+        {
+          LOG (WARNING) << "Double spend in transaction:\n" << tx;
+          ++numConflicts;
+          return false;
+        }
+
+    for (const auto& in : vin)
+      {
+        const auto txid = in["txid"].asString ();
+        const auto n = in["vout"].asUInt ();
+        spent.emplace (txid, n);
+
+        /* The name is sent back to the same account (since it just does
+           a name_update), but in a new output.  */
+        const auto mit = nameOwners.find (txid);
+        if (mit != nameOwners.end () && nameVouts[mit->second] == n)
+          ++nameVouts[mit->second];
+      }
+
+    ++numTransactions;
+  }
+
+  gsp.SetFinal (btxidVal.asString ());
+  return true;
+}
+
+/* ************************************************************************** */
+
+/**
+ * Mock Xaya wallet of one trader.  It builds on MockXayaRpcServer, but
+ * instead of fixed expectations it implements the PSBT flow generically:
+ * PSBT strings are just their decoded JSON form with a prefix, and
+ * "signing" marks those inputs as signed that belong to the wallet's
+ * account.  All chain state is taken from the shared LoadTestChain.
+ *
+ * The instance itself is not thread-safe, so it should be served
+ * from a single-threaded HTTP server (like Xaya Core with -rpcthreads=1).
+ */
+class LoadTestWallet : public MockXayaRpcServer
+{
+
+private:
+
+  /** The shared chain state.  */
+  LoadTestChain& chain;
+
+  /** The account whose wallet this is.  */
+  const std::string account;
+
+  /** Number of addresses created.  */
+  unsigned numAddresses = 0;
+
+  /** Number of coins created for funding.  */
+  unsigned numCoins = 0;
+
+  /**
+   * Returns true if the given input (with txid and vout) belongs
+   * to our wallet.
+   */
+  bool
+  IsOurs (const Json::Value& in) const
+  {
+    const auto txid = in["txid"].asString ();
+    return txid == LoadTestChain::GetNameTxid (account)
+            || txid == LoadTestChain::GetCoinTxid (account);
+  }
+
+  /**
+   * Returns the "decoded PSBT" for an unsigned transaction with the
+   * given inputs and (createpsbt-style) outputs.
+   */
+  static Json::Value
+  BuildPsbt (const Json::Value& inputs, const Json::Value& outputs)
+  {
+    CHECK (inputs.isArray ());
+    CHECK (outputs.isArray ());
+
+    Json::Value res(Json::objectValue);
+    auto& tx = res["tx"];
+    tx = Json::Value (Json::objectValue);
+    tx["vin"] = Json::Value (Json::arrayValue);
+    tx["vout"] = Json::Value (Json::arrayValue);
+    res["inputs"] = Json::Value (Json::arrayValue);
+    res["outputs"] = Json::Value (Json::arrayValue);
+
+    for (const auto& in : inputs)
+      {
+        Json::Value cur(Json::objectValue);
+        cur["txid"] = in["txid"];
+        cur["vout"] = in["vout"];
+        tx["vin"].append (cur);
+        res["inputs"].append (Json::Value (Json::objectValue));
+      }
+
+    for (const auto& out : outputs)
+      for (const auto& addr : out.getMemberNames ())
+        {
+          Json::Value cur(Json::objectValue);
+          cur["value"] = out[addr];
+          cur["scriptPubKey"]["addresses"].append (addr);
+          tx["vout"].append (cur);
+          res["outputs"].append (Json::Value (Json::objectValue));
+        }
+
+    return res;
+  }
+
+  std::string FundPsbt (const Json::Value& inputs, const Json::Value& outputs,
+                        const Json::Value& options);
+  std::string CreatePsbt (const Json::Value& inputs,
+                          const Json::Value& outputs);
+  std::string AddNameOp (const std::string& psbt, int vout,
+                         const std::string& name, const std::string& value);
+  std::string JoinPsbts (const Json::Value& psbts);
+  Json::Value SignPsbt (const std::string& psbt);
+  std::string SendTransaction (const std::string& hex);
+
+public:
+
+  explicit LoadTestWallet (jsonrpc::AbstractServerConnector& conn,
+                           LoadTestChain& c, const std::string& a);
+
+  std::string getnewaddress () override;
+  Json::Value name_show (const std::string& name) override;
+  Json::Value gettxout (const std::string& txid, int vout) override;
+  Json::Value decodepsbt (const std::string& psbt) override;
+  std::string combinepsbt (const Json::Value& inputPsbts) override;
+  Json::Value finalizepsbt (const std::string& psbt) override;
+
+};
+
+LoadTestWallet::LoadTestWallet (jsonrpc::AbstractServerConnector& conn,
+                                LoadTestChain& c, const std::string& a)
+  : MockXayaRpcServer(conn), chain(c), account(a)
+{
+  SetBestBlock (GetBlockHash (BLOCK_HEIGHT));
+
+  /* These take precedence over the base class' "never called"
+     expectations, as they are newer.  */
+  EXPECT_CALL (*this, CreateFundedPsbt (_, _, _))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::FundPsbt));
+  EXPECT_CALL (*this, createpsbt (_, _))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::CreatePsbt));
+  EXPECT_CALL (*this, NamePsbt (_, _, _, _))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::AddNameOp));
+  EXPECT_CALL (*this, joinpsbts (_))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::JoinPsbts));
+  EXPECT_CALL (*this, walletprocesspsbt (_))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::SignPsbt));
+  EXPECT_CALL (*this, sendrawtransaction (_))
+      .WillRepeatedly (Invoke (this, &LoadTestWallet::SendTransaction));
+}
+
+std::string
+LoadTestWallet::FundPsbt (const Json::Value& inputs, const Json::Value& outputs,
+                          const Json::Value& options)
+{
+  /* We always add a fresh coin of our own, plus a change output.  */
+  Json::Value coin(Json::objectValue);
+  coin["txid"] = LoadTestChain::GetCoinTxid (account);
+  coin["vout"] = static_cast<Json::Int> (++numCoins);
+
+  Json::Value allInputs = inputs;
+  allInputs.append (coin);
+
+  Json::Value allOutputs = outputs;
+  Json::Value change(Json::objectValue);
+  change[getnewaddress ()] = 1.0;
+  allOutputs.append (change);
+
+  if (options["lockUnspents"].asBool ())
+    {
+      Json::Value toLock(Json::arrayValue);
+      toLock.append (coin);
+      lockunspent (false, toLock);
+    }
+
+  return EncodeJson (PSBT_PREFIX, BuildPsbt (allInputs, allOutputs));
+}
+
+std::string
+LoadTestWallet::CreatePsbt (const Json::Value& inputs,
+                            const Json::Value& outputs)
+{
+  return EncodeJson (PSBT_PREFIX, BuildPsbt (inputs, outputs));
+}
+
+std::string
+LoadTestWallet::AddNameOp (const std::string& psbt, const int vout,
+                           const std::string& name, const std::string& value)
+{
+  auto decoded = DecodeJson (PSBT_PREFIX, psbt);
+  auto& outputs = decoded["tx"]["vout"];
+  if (vout < 0 || static_cast<unsigned> (vout) >= outputs.size ())
+    throw jsonrpc::JsonRpcException (-8, "vout is out of range");
+
+  auto& nameOp = outputs[vout]["scriptPubKey"]["nameOp"];
+  nameOp["op"] = "name_update";
+  nameOp["name"] = name;
+  nameOp["value"] = value;
+  nameOp["name_encoding"] = "utf8";
+  nameOp["value_encoding"] = "utf8";
+
+  return EncodeJson (PSBT_PREFIX, decoded);
+}
+
+std::string
+LoadTestWallet::JoinPsbts (const Json::Value& psbts)
+{
+  CHECK (psbts.isArray ());
+
+  Json::Value res;
+  for (const auto& part : psbts)
+    {
+      const auto decoded = DecodeJson (PSBT_PREFIX, part.asString ());
+      if (res.isNull ())
+        {
+          res = decoded;
+          continue;
+        }
+
+      for (const auto& in : decoded["tx"]["vin"])
+        res["tx"]["vin"].append (in);
+      for (const auto& out : decoded["tx"]["vout"])
+        res["tx"]["vout"].append (out);
+      for (const auto& in : decoded["inputs"])
+        res["inputs"].append (in);
+      for (const auto& out : decoded["outputs"])
+        res["outputs"].append (out);
+    }
+
+  res["tx"]["btxid"] = chain.NewBtxid ();
+  return EncodeJson (PSBT_PREFIX, res);
+}
+
+Json::Value
+LoadTestWallet::SignPsbt (const std::string& psbt)
+{
+  auto decoded = DecodeJson (PSBT_PREFIX, psbt);
+  const auto& vin = decoded["tx"]["vin"];
+  auto& inputs = decoded["inputs"];
+  CHECK_EQ (vin.size (), inputs.size ());
+
+  bool complete = true;
+  for (unsigned i = 0; i < vin.size (); ++i)
+    {
+      /* Inputs we do not sign must stay exactly as they are, so we must
+         not add any (null) fields to them by accident.  */
+      if (IsOurs (vin[i]))
+        inputs[i]["signed"] = true;
+      if (!inputs[i].get ("signed", false).asBool ())
+        complete = false;
+    }
+
+  Json::Value res(Json::objectValue);
+  res["psbt"] = EncodeJson (PSBT_PREFIX, decoded);
+  res["complete"] = complete;
+
+  return res;
+}
+
+std::string
+LoadTestWallet::SendTransaction (const std::string& hex)
+{
+  const auto tx = DecodeJson (RAWTX_PREFIX, hex);
+  if (!chain.Broadcast (tx))
+    throw jsonrpc::JsonRpcException (-26, "bad-txns-inputs-missingorspent");
+
+  return tx["btxid"].asString ();
+}
+
+std::string
+LoadTestWallet::getnewaddress ()
+{
+  return account + " addr " + std::to_string (++numAddresses);
+}
+
+Json::Value
+LoadTestWallet::name_show (const std::string& name)
+{
+  if (name.substr (0, 2) != "p/")
+    throw jsonrpc::JsonRpcException (-4, "name not found");
+
+  return chain.GetNameOutput (name.substr (2));
+}
+
+Json::Value
+LoadTestWallet::gettxout (const std::string& txid, const int vout)
+{
+  if (vout < 0 || !chain.IsUnspent (txid, vout))
+    return Json::Value ();
+
+  Json::Value res(Json::objectValue);
+  res["bestblock"] = getbestblockhash ();
+
+  return res;
+}
+
+Json::Value
+LoadTestWallet::decodepsbt (const std::string& psbt)
+{
+  return DecodeJson (PSBT_PREFIX, psbt);
+}
+
+std::string
+LoadTestWallet::combinepsbt (const Json::Value& inputPsbts)
+{
+  CHECK (inputPsbts.isArray ());
+  CHECK_GT (inputPsbts.size (), 0);
+
+  auto res = DecodeJson (PSBT_PREFIX, inputPsbts[0].asString ());
+  for (unsigned i = 1; i < inputPsbts.size (); ++i)
+    {
+      const auto cur = DecodeJson (PSBT_PREFIX, inputPsbts[i].asString ());
+      if (cur["tx"] != res["tx"])
+        throw jsonrpc::JsonRpcException (-8, "PSBTs do not refer to same tx");
+
+      auto& inputs = res["inputs"];
+      for (unsigned j = 0; j < inputs.size (); ++j)
+        if (cur["inputs"][j]["signed"].asBool ())
+          inputs[j] = cur["inputs"][j];
+    }
+
+  return EncodeJson (PSBT_PREFIX, res);
+}
+
+Json::Value
+LoadTestWallet::finalizepsbt (const std::string& psbt)
+{
+  const auto decoded = DecodeJson (PSBT_PREFIX, psbt);
+
+  bool complete = true;
+  for (const auto& in : decoded["inputs"])
+    if (!in["signed"].asBool ())
+      complete = false;
+
+  Json::Value res(Json::objectValue);
+  res["complete"] = complete;
+  if (complete)
+    res["hex"] = EncodeJson (RAWTX_PREFIX, decoded["tx"]);
+  else
+    res["psbt"] = psbt;
+
+  return res;
+}
+
+/**
+ * A mock wallet together with the single-threaded HTTP server it runs on.
+ */
+class WalletNode
+{
+
+private:
+
+  /** The port of the server.  */
+  const int port;
+
+  /** The HTTP server.  */
+  jsonrpc::HttpServer http;
+
+  /** The wallet.  */
+  LoadTestWallet wallet;
+
+public:
+
+  explicit WalletNode (LoadTestChain& chain, const std::string& account)
+    : port(GetPortForMockServer ()), http(port, "", "", 1),
+      wallet(http, chain, account)
+  {
+    wallet.StartListening ();
+  }
+
+  ~WalletNode ()
+  {
+    wallet.StopListening ();
+  }
+
+  WalletNode () = delete;
+  WalletNode (const WalletNode&) = delete;
+  void operator= (const WalletNode&) = delete;
+
+  std::string
+  GetEndpoint () const
+  {
+    return "http://localhost:" + std::to_string (port);
+  }
+
+};
+
+/* ************************************************************************** */
+
+/**
+ * Statistics collected by the traders.  This is thread-safe.
+ */
+class LoadStats
+{
+
+private:
+
+  /** Observed times from taking an order until the trade was pending.  */
+  std::vector<double> pendingMs;
+
+  /** Counters for the various outcomes.  */
+  std::map<std::string, unsigned> counters;
+
+  /** Lock for the data.  */
+  mutable std::mutex mut;
+
+public:
+
+  LoadStats () = default;
+
+  LoadStats (const LoadStats&) = delete;
+  void operator= (const LoadStats&) = delete;
+
+  void
+  Increment (const std::string& name)
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ++counters[name];
+  }
+
+  void
+  RecordPending (const std::chrono::steady_clock::duration dur)
+  {
+    const double ms
+        = std::chrono::duration_cast<
+            std::chrono::duration<double, std::milli>> (dur).count ();
+
+    std::lock_guard<std::mutex> lock(mut);
+    pendingMs.push_back (ms);
+    ++counters["pending"];
+  }
+
+  /**
+   * Returns the data as JSON, for inclusion into the report.
+   */
+  Json::Value ToJson () const;
+
+};
+
+Json::Value
+LoadStats::ToJson () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  for (const auto& entry : counters)
+    res[entry.first] = entry.second;
+
+  std::vector<double> sorted = pendingMs;
+  std::sort (sorted.begin (), sorted.end ());
+
+  Json::Value latency(Json::objectValue);
+  if (!sorted.empty ())
+    {
+      /* Nearest-rank percentiles.  */
+      const auto percentile = [&sorted] (const double q)
+        {
+          size_t rank = static_cast<size_t> (q * sorted.size () + 0.999999);
+          rank = std::max<size_t> (rank, 1);
+          return sorted[std::min (rank, sorted.size ()) - 1];
+        };
+
+      latency["p50"] = percentile (0.50);
+      latency["p99"] = percentile (0.99);
+      latency["max"] = sorted.back ();
+    }
+  res["time_to_pending_ms"] = latency;
+
+  return res;
+}
+
+/**
+ * A trader driving one Daemon:  It periodically replaces all its orders
+ * with random new ones, and (in a closed loop on a second thread) takes
+ * the best order on some side of the book and waits until the trade is
+ * pending or abandoned.
+ */
+class Trader
+{
+
+private:
+
+  /** The daemon we use.  */
+  Daemon& daemon;
+
+  /** Statistics to record in.  */
+  LoadStats& stats;
+
+  /** Seed for the random generators of our threads.  */
+  const uint64_t seed;
+
+  /** Set to true when the threads should stop.  */
+  bool stop = false;
+
+  /** Lock for stop.  */
+  std::mutex mut;
+
+  /** Condition variable signalled when stop is set.  */
+  std::condition_variable cv;
+
+  /** The churning thread.  */
+  std::thread churner;
+
+  /** The taking thread.  */
+  std::thread taker;
+
+  /**
+   * Sleeps for the given duration or until we should stop.  Returns
+   * false if we should stop.
+   */
+  bool
+  Sleep (const std::chrono::milliseconds dur)
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait_for (lock, dur, [this] () { return stop; });
+    return !stop;
+  }
+
+  /**
+   * Returns true if the trade matches the order we took (as far as we
+   * can tell from the public trade data) and is at least pending.
+   */
+  static bool
+  IsPendingFor (const proto::Trade& t, const proto::Order& o)
+  {
+    if (t.role () != proto::Trade::TAKER)
+      return false;
+    if (t.counterparty () != o.account () || t.asset () != o.asset ()
+          || t.price_sat () != o.price_sat ())
+      return false;
+
+    switch (t.state ())
+      {
+      case proto::Trade::PENDING:
+      case proto::Trade::SUCCESS:
+      case proto::Trade::FAILED:
+        return true;
+      default:
+        return false;
+      }
+  }
+
+  /**
+   * Returns the number of our trades matching the order that
+   * are at least pending.
+   */
+  unsigned
+  CountPending (const proto::Order& o) const
+  {
+    const auto trades = daemon.GetTrades ();
+    return std::count_if (trades.begin (), trades.end (),
+                          [&o] (const proto::Trade& t)
+                            {
+                              return IsPendingFor (t, o);
+                            });
+  }
+
+  /**
+   * Returns a random set of orders to put on the book.
+   */
+  std::vector<proto::Order> RandomOrders (std::mt19937_64& rnd) const;
+
+  /**
+   * Takes one order and waits for the outcome.
+   */
+  void TakeOne (std::mt19937_64& rnd);
+
+  void RunChurn ();
+  void RunTakes ();
+
+public:
+
+  explicit Trader (Daemon& d, LoadStats& s, const uint64_t sd)
+    : daemon(d), stats(s), seed(sd)
+  {}
+
+  ~Trader ();
+
+  Trader () = delete;
+  Trader (const Trader&) = delete;
+  void operator= (const Trader&) = delete;
+
+  /**
+   * Puts the initial orders onto the book.
+   */
+  void PlaceInitialOrders ();
+
+  /**
+   * Starts the threads.
+   */
+  void Start ();
+
+  /**
+   * Signals the threads to stop and waits for them.
+   */
+  void Stop ();
+
+};
+
+Trader::~Trader ()
+{
+  Stop ();
+}
+
+std::vector<proto::Order>
+Trader::RandomOrders (std::mt19937_64& rnd) const
+{
+  std::uniform_int_distribution<size_t> asset(0, NUM_ASSETS - 1);
+  std::uniform_int_distribution<Amount> offset(1, 10);
+
+  std::vector<proto::Order> res;
+  for (int i = 0; i < FLAGS_orders_per_trader; ++i)
+    {
+      proto::Order o;
+      o.set_asset (ASSETS[asset (rnd)]);
+      if (i % 2 == 0)
+        {
+          o.set_type (proto::Order::BID);
+          o.set_price_sat (100 - offset (rnd));
+        }
+      else
+        {
+          o.set_type (proto::Order::ASK);
+          o.set_price_sat (100 + offset (rnd));
+        }
+      o.set_max_units (ORDER_UNITS);
+      res.push_back (std::move (o));
+    }
+
+  return res;
+}
+
+void
+Trader::PlaceInitialOrders ()
+{
+  std::mt19937_64 rnd(seed);
+  CHECK (daemon.ReplaceOrders ({}, RandomOrders (rnd)));
+}
+
+void
+Trader::TakeOne (std::mt19937_64& rnd)
+{
+  const Asset asset = ASSETS[rnd () % NUM_ASSETS];
+  const auto book = daemon.GetOrdersForAsset (asset);
+  const bool buy = rnd () % 2 == 0;
+  const auto& side = buy ? book.asks () : book.bids ();
+  if (side.empty ())
+    {
+      stats.Increment ("no_orders");
+      return;
+    }
+  const auto& o = side.Get (0);
+
+  const unsigned before = CountPending (o);
+  const auto start = std::chrono::steady_clock::now ();
+  const auto deadline = start + TAKE_TIMEOUT_SLACK
+      + std::chrono::milliseconds (FLAGS_democrit_trade_timeout_ms);
+
+  if (!daemon.TakeOrder (o, 1))
+    {
+      stats.Increment ("rejected");
+      return;
+    }
+  stats.Increment ("taken");
+
+  /* Since each trader has only one take active at a time, the trade we
+     started is the only one of ours that is initiated and where we are
+     the taker.  */
+  auto version = daemon.GetDataVersion (Daemon::DataKind::TRADES);
+  while (true)
+    {
+      const auto trades = daemon.GetTrades ();
+
+      unsigned pending = 0;
+      bool initiated = false;
+      for (const auto& t : trades)
+        {
+          if (IsPendingFor (t, o))
+            ++pending;
+          if (t.role () == proto::Trade::TAKER
+                && t.state () == proto::Trade::INITIATED)
+            initiated = true;
+        }
+
+      if (pending > before)
+        {
+          stats.RecordPending (std::chrono::steady_clock::now () - start);
+          return;
+        }
+      if (!initiated)
+        {
+          stats.Increment ("abandoned");
+          return;
+        }
+      if (std::chrono::steady_clock::now () > deadline)
+        {
+          stats.Increment ("timed_out");
+          return;
+        }
+
+      {
+        std::lock_guard<std::mutex> lock(mut);
+        if (stop)
+          {
+            stats.Increment ("unfinished");
+            return;
+          }
+      }
+
+      version = daemon.WaitForChange (Daemon::DataKind::TRADES, version,
+                                      std::chrono::milliseconds (100));
+    }
+}
+
+void
+Trader::RunChurn ()
+{
+  std::mt19937_64 rnd(seed + 1);
+  while (Sleep (std::chrono::milliseconds (FLAGS_churn_ms)))
+    {
+      std::vector<uint64_t> cancel;
+      for (const auto& entry : daemon.GetOwnOrders ().orders ())
+        cancel.push_back (entry.first);
+
+      if (daemon.ReplaceOrders (cancel, RandomOrders (rnd)))
+        stats.Increment ("churns");
+      else
+        stats.Increment ("churns_rejected");
+    }
+}
+
+void
+Trader::RunTakes ()
+{
+  std::mt19937_64 rnd(seed + 2);
+  while (Sleep (std::chrono::milliseconds (FLAGS_take_ms)))
+    TakeOne (rnd);
+}
+
+void
+Trader::Start ()
+{
+  CHECK (!churner.joinable () && !taker.joinable ());
+
+  if (FLAGS_churn_ms > 0)
+    churner = std::thread ([this] () { RunChurn (); });
+  if (FLAGS_take_ms > 0)
+    taker = std::thread ([this] () { RunTakes (); });
+}
+
+void
+Trader::Stop ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stop = true;
+  }
+  cv.notify_all ();
+
+  if (churner.joinable ())
+    churner.join ();
+  if (taker.joinable ())
+    taker.join ();
+}
+
+/* ************************************************************************** */
+
+/**
+ * An XMPP account the load test runs a trader for.
+ */
+struct LoadTestAccount
+{
+  std::string user;
+  std::string password;
+};
+
+/**
+ * Parses the --accounts flag.
+ */
+std::vector<LoadTestAccount>
+ParseAccounts ()
+{
+  std::vector<LoadTestAccount> res;
+
+  if (FLAGS_accounts.empty ())
+    {
+      for (const auto& a : GetServerConfig ().accounts)
+        res.push_back ({a.name, a.password});
+      return res;
+    }
+
+  std::istringstream in(FLAGS_accounts);
+  std::string cur;
+  while (std::getline (in, cur, ','))
+    {
+      const size_t sep = cur.find (':');
+      if (sep == std::string::npos)
+        throw UsageError ("invalid account (expected user:password): " + cur);
+      res.push_back ({cur.substr (0, sep), cur.substr (sep + 1)});
+    }
+
+  return res;
+}
+
+/**
+ * Returns the difference in the global metrics between the two
+ * given snapshots, as the report's "broadcasts" and "rpc" sections.
+ * Per-trade RPC counts are relative to the number of transactions.
+ */
+void
+AddMetricsToReport (const Json::Value& before, const Json::Value& after,
+                    const unsigned numTransactions, Json::Value& report)
+{
+  const auto counter = [&] (const std::string& name)
+    {
+      return after["counters"][name].asUInt64 ()
+                - before["counters"][name].asUInt64 ();
+    };
+
+  Json::Value broadcasts(Json::objectValue);
+  const auto sent = counter ("orders.broadcasts");
+  const auto received = counter ("orders.received");
+  broadcasts["sent"] = static_cast<Json::UInt64> (sent);
+  broadcasts["received"] = static_cast<Json::UInt64> (received);
+  if (sent > 0)
+    broadcasts["fanout"] = static_cast<double> (received) / sent;
+  report["broadcasts"] = broadcasts;
+
+  Json::Value rpc(Json::objectValue);
+  const auto& histograms = after["histograms"];
+  for (const auto& name : histograms.getMemberNames ())
+    {
+      if (name.compare (0, 4, "rpc.") != 0)
+        continue;
+
+      const auto calls = histograms[name]["count"].asUInt64 ()
+          - before["histograms"][name]["count"].asUInt64 ();
+      if (calls == 0)
+        continue;
+
+      Json::Value cur(Json::objectValue);
+      cur["calls"] = static_cast<Json::UInt64> (calls);
+      if (numTransactions > 0)
+        cur["per_trade"] = static_cast<double> (calls) / numTransactions;
+      rpc[name.substr (4)] = cur;
+    }
+  report["rpc"] = rpc;
+}
+
+/**
+ * Runs the load test and prints the report.
+ */
+void
+RunLoadTest ()
+{
+  const auto accounts = ParseAccounts ();
+  if (accounts.size () < 2)
+    throw UsageError ("at least two accounts are needed");
+  if (FLAGS_duration_s <= 0)
+    throw UsageError ("--duration_s must be positive");
+  if (FLAGS_orders_per_trader < 0 || FLAGS_churn_ms < 0 || FLAGS_take_ms < 0)
+    throw UsageError ("order counts and intervals must not be negative");
+
+  const auto& cfg = GetServerConfig ();
+  FLAGS_democrit_xid_servers = cfg.server;
+  useLegacyXayaRpcInDaemon = false;
+
+  TestAssets assets;
+  assets.SetBlock (MockXayaRpcServer::GetBlockHash (BLOCK_HEIGHT));
+
+  const int gspPort = GetPortForMockServer ();
+  jsonrpc::HttpServer gspHttp(gspPort);
+  MockDemGsp gsp(gspHttp);
+  gsp.SetCurrentHeight (BLOCK_HEIGHT);
+  gsp.StartListening ();
+  const std::string gspEndpoint
+      = "http://localhost:" + std::to_string (gspPort);
+
+  LoadTestChain chain(gsp);
+
+  std::vector<std::string> names;
+  std::vector<gloox::JID> jids;
+  std::vector<std::unique_ptr<WalletNode>> wallets;
+  Authenticator auth;
+  for (const auto& a : accounts)
+    {
+      gloox::JID jid;
+      jid.setUsername (a.user);
+      jid.setServer (cfg.server);
+
+      std::string name;
+      CHECK (auth.Authenticate (jid, name))
+          << "Failed to get account name for " << jid.full ();
+
+      for (const auto* asset : ASSETS)
+        assets.SetBalance (name, asset, ASSET_BALANCE);
+
+      names.push_back (name);
+      jids.push_back (jid);
+      wallets.push_back (std::make_unique<WalletNode> (chain, name));
+    }
+
+  const std::string room = GetRoom (FLAGS_room).full ();
+  std::unique_ptr<WalletNode> marketWallet;
+  std::unique_ptr<SharedMarket> market;
+  if (FLAGS_shared_market)
+    {
+      marketWallet = std::make_unique<WalletNode> (chain, "market");
+      market = std::make_unique<SharedMarket> (
+          assets, marketWallet->GetEndpoint (), gspEndpoint, room);
+    }
+
+  std::vector<std::unique_ptr<Daemon>> daemons;
+  for (size_t i = 0; i < accounts.size (); ++i)
+    {
+      std::unique_ptr<Daemon> d;
+      if (market != nullptr)
+        d = std::make_unique<Daemon> (*market, names[i],
+                                      wallets[i]->GetEndpoint (),
+                                      jids[i].full (), accounts[i].password);
+      else
+        d = std::make_unique<Daemon> (assets, names[i],
+                                      wallets[i]->GetEndpoint (), gspEndpoint,
+                                      jids[i].full (), accounts[i].password,
+                                      room);
+
+      d->SetRootCA (GetTestCA ());
+      d->Connect ();
+      CHECK (d->IsConnected ()) << "Failed to connect " << jids[i].full ();
+      daemons.push_back (std::move (d));
+    }
+  LOG (INFO) << "Connected " << daemons.size () << " daemons";
+
+  LoadStats stats;
+  std::vector<std::unique_ptr<Trader>> traders;
+  for (size_t i = 0; i < daemons.size (); ++i)
+    traders.push_back (std::make_unique<Trader> (*daemons[i], stats,
+                                                 FLAGS_seed + 3 * i));
+
+  for (auto& t : traders)
+    t->PlaceInitialOrders ();
+  std::this_thread::sleep_for (SETTLE_TIME);
+
+  const auto metricsBefore = Metrics::Global ().ToJson ();
+  const unsigned txBefore = chain.GetNumTransactions ();
+  const auto start = std::chrono::steady_clock::now ();
+
+  for (auto& t : traders)
+    t->Start ();
+  std::this_thread::sleep_for (std::chrono::seconds (FLAGS_duration_s));
+  for (auto& t : traders)
+    t->Stop ();
+
+  const auto elapsed = std::chrono::duration_cast<
+      std::chrono::duration<double>> (
+          std::chrono::steady_clock::now () - start).count ();
+  const unsigned numTransactions = chain.GetNumTransactions () - txBefore;
+  const auto metricsAfter = Metrics::Global ().ToJson ();
+
+  Json::Value report(Json::objectValue);
+  report["daemons"] = static_cast<Json::UInt64> (daemons.size ());
+  report["shared_market"] = FLAGS_shared_market;
+  report["duration_s"] = elapsed;
+
+  auto takes = stats.ToJson ();
+  takes["transactions"] = numTransactions;
+  takes["conflicts"] = chain.GetNumConflicts ();
+  takes["per_second"] = numTransactions / elapsed;
+  report["trades"] = takes;
+
+  AddMetricsToReport (metricsBefore, metricsAfter, numTransactions, report);
+
+  std::cout << report << std::endl;
+
+  traders.clear ();
+  daemons.clear ();
+  gsp.StopListening ();
+}
+
+} // anonymous namespace
+} // namespace democrit
+
+int
+main (int argc, char** argv)
+{
+  google::InitGoogleLogging (argv[0]);
+
+  /* Trades that get stuck (e.g. because the seller's name is already locked
+     in another trade) should be abandoned quickly in a load test.  This just
+     changes the default, so it can still be set on the command line.  */
+  FLAGS_democrit_trade_timeout_ms = 5'000;
+
+  gflags::SetUsageMessage ("Run an end-to-end load test of Democrit daemons"
+                           " against mock Xaya and GSP servers");
+  gflags::ParseCommandLineFlags (&argc, &argv, true);
+
+  try
+    {
+      democrit::RunLoadTest ();
+      return EXIT_SUCCESS;
+    }
+  catch (const UsageError& exc)
+    {
+      std::cerr << "Error: " << exc.what () << std::endl;
+      return EXIT_FAILURE;
+    }
+}
@@ -0,0 +1,173 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/metrics.hpp"
+
+#include <sstream>
+
+namespace democrit
+{
+
+constexpr size_t Histogram::NUM_BUCKETS;
+
+const std::array<double, Histogram::NUM_BUCKETS> Histogram::BOUNDS = {
+  1, 2, 5, 10, 20, 50, 100, 200, 500,
+  1'000, 2'000, 5'000, 10'000, 30'000, 60'000, 300'000,
+};
+
+void
+Histogram::Record (const std::chrono::nanoseconds dur)
+{
+  const double ms
+      = std::chrono::duration_cast<std::chrono::duration<double, std::milli>> (
+          dur).count ();
+
+  size_t bucket = 0;
+  while (bucket < NUM_BUCKETS && ms > BOUNDS[bucket])
+    ++bucket;
+
+  ++counts[bucket];
+  ++count;
+  sumMs += ms;
+}
+
+Json::Value
+Histogram::ToJson () const
+{
+  Json::Value res(Json::objectValue);
+  res["count"] = static_cast<Json::UInt64> (count);
+  res["sum_ms"] = sumMs;
+
+  Json::Value buckets(Json::arrayValue);
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+      cumulative += counts[i];
+      Json::Value cur(Json::objectValue);
+      cur["le_ms"] = BOUNDS[i];
+      cur["count"] = static_cast<Json::UInt64> (cumulative);
+      buckets.append (cur);
+    }
+  res["buckets"] = buckets;
+
+  return res;
+}
+
+void
+Histogram::ToPrometheus (const std::string& name, std::string& out) const
+{
+  std::ostringstream str;
+  str << "# TYPE " << name << " histogram\n";
+
+  uint64_t cumulative = 0;
+  for (size_t i = 0; i < NUM_BUCKETS; ++i)
+    {
+      cumulative += counts[i];
+      str << name << "_bucket{le=\"" << BOUNDS[i] / 1'000 << "\"} "
+          << cumulative << '\n';
+    }
+  str << name << "_bucket{le=\"+Inf\"} " << count << '\n';
+  str << name << "_sum " << sumMs / 1'000 << '\n';
+  str << name << "_count " << count << '\n';
+
+  out += str.str ();
+}
+
+Metrics&
+Metrics::Global ()
+{
+  static Metrics instance;
+  return instance;
+}
+
+void
+Metrics::Increment (const std::string& name, const uint64_t n)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  counters[name] += n;
+}
+
+void
+Metrics::Record (const std::string& name, const std::chrono::nanoseconds dur)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  histograms[name].Record (dur);
+}
+
+Json::Value
+Metrics::ToJson () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value c(Json::objectValue);
+  for (const auto& entry : counters)
+    c[entry.first] = static_cast<Json::UInt64> (entry.second);
+
+  Json::Value h(Json::objectValue);
+  for (const auto& entry : histograms)
+    h[entry.first] = entry.second.ToJson ();
+
+  Json::Value res(Json::objectValue);
+  res["counters"] = c;
+  res["histograms"] = h;
+
+  return res;
+}
+
+namespace
+{
+
+/**
+ * Converts a metric name to a valid Prometheus metric name.
+ */
+std::string
+PrometheusName (const std::string& name, const std::string& suffix)
+{
+  std::string res = "democrit_";
+  for (const char c : name)
+    {
+      const bool valid = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+                            || (c >= '0' && c <= '9') || c == '_';
+      res.push_back (valid ? c : '_');
+    }
+
+  return res + suffix;
+}
+
+} // anonymous namespace
+
+std::string
+Metrics::ToPrometheus () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  std::string res;
+  for (const auto& entry : counters)
+    {
+      const std::string name = PrometheusName (entry.first, "_total");
+      res += "# TYPE " + name + " counter\n";
+      res += name + " " + std::to_string (entry.second) + "\n";
+    }
+
+  for (const auto& entry : histograms)
+    entry.second.ToPrometheus (PrometheusName (entry.first, "_seconds"), res);
+
+  return res;
+}
+
+} // namespace democrit
@@ -0,0 +1,133 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/metrics.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+namespace democrit
+{
+namespace
+{
+
+using std::chrono::milliseconds;
+
+class MetricsTests : public testing::Test
+{
+
+protected:
+
+  Metrics metrics;
+
+};
+
+TEST_F (MetricsTests, Counters)
+{
+  metrics.Increment ("foo");
+  metrics.Increment ("bar", 5);
+  metrics.Increment ("foo");
+
+  const auto counters = metrics.ToJson ()["counters"];
+  EXPECT_EQ (counters.size (), 2);
+  EXPECT_EQ (counters["foo"].asInt (), 2);
+  EXPECT_EQ (counters["bar"].asInt (), 5);
+}
+
+TEST_F (MetricsTests, HistogramBuckets)
+{
+  metrics.Record ("x", milliseconds (1));
+  metrics.Record ("x", milliseconds (3));
+  metrics.Record ("x", milliseconds (4));
+  metrics.Record ("x", milliseconds (1'000'000));
+
+  const auto h = metrics.ToJson ()["histograms"]["x"];
+  EXPECT_EQ (h["count"].asInt (), 4);
+  EXPECT_DOUBLE_EQ (h["sum_ms"].asDouble (), 1'000'008.0);
+
+  const auto& buckets = h["buckets"];
+  ASSERT_EQ (buckets.size (), Histogram::NUM_BUCKETS);
+  EXPECT_EQ (buckets[0]["le_ms"].asDouble (), 1.0);
+  EXPECT_EQ (buckets[0]["count"].asInt (), 1);
+  EXPECT_EQ (buckets[1]["le_ms"].asDouble (), 2.0);
+  EXPECT_EQ (buckets[1]["count"].asInt (), 1);
+  EXPECT_EQ (buckets[2]["le_ms"].asDouble (), 5.0);
+  EXPECT_EQ (buckets[2]["count"].asInt (), 3);
+  EXPECT_EQ (buckets[static_cast<int> (Histogram::NUM_BUCKETS) - 1]["count"].asInt (), 3);
+}
+
+TEST_F (MetricsTests, Prometheus)
+{
+  metrics.Increment ("trades.success", 2);
+  metrics.Record ("rpc.get-tx", milliseconds (1));
+
+  const std::string text = metrics.ToPrometheus ();
+  EXPECT_NE (text.find ("# TYPE democrit_trades_success_total counter\n"
+                        "democrit_trades_success_total 2\n"),
+             std::string::npos);
+  EXPECT_NE (text.find ("# TYPE democrit_rpc_get_tx_seconds histogram\n"),
+             std::string::npos);
+  EXPECT_NE (text.find ("democrit_rpc_get_tx_seconds_bucket{le=\"0.001\"} 1\n"),
+             std::string::npos);
+  EXPECT_NE (text.find ("democrit_rpc_get_tx_seconds_bucket{le=\"+Inf\"} 1\n"),
+             std::string::npos);
+  EXPECT_NE (text.find ("democrit_rpc_get_tx_seconds_count 1\n"),
+             std::string::npos);
+}
+
+TEST_F (MetricsTests, ScopedTimer)
+{
+  {
+    ScopedTimer timer(metrics, "timed");
+    std::this_thread::sleep_for (milliseconds (10));
+  }
+
+  const auto h = metrics.ToJson ()["histograms"]["timed"];
+  EXPECT_EQ (h["count"].asInt (), 1);
+  EXPECT_GE (h["sum_ms"].asDouble (), 10.0);
+}
+
+TEST_F (MetricsTests, ThreadSafety)
+{
+  constexpr int threads = 10;
+  constexpr int perThread = 1'000;
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i)
+    workers.emplace_back ([this] ()
+      {
+        for (int j = 0; j < perThread; ++j)
+          {
+            metrics.Increment ("counter");
+            metrics.Record ("hist", milliseconds (j));
+          }
+      });
+  for (auto& w : workers)
+    w.join ();
+
+  const auto data = metrics.ToJson ();
+  EXPECT_EQ (data["counters"]["counter"].asInt (), threads * perThread);
+  EXPECT_EQ (data["histograms"]["hist"]["count"].asInt (),
+             threads * perThread);
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -26,7 +26,9 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <chrono>
 #include <sstream>
+#include <thread>
 
 namespace democrit
 {
@@ -48,7 +50,7 @@ GetPortForMockServer ()
 /* ************************************************************************** */
 
 MockXayaRpcServer::MockXayaRpcServer (jsonrpc::AbstractServerConnector& conn)
-  : XayaRpcServerStub(conn)
+  : XayaRpcServerStub(conn), numBlockHeaderCalls(0), numDecodePsbtCalls(0)
 {
   bestBlock.SetNull ();
 
@@ -293,9 +295,17 @@ MockXayaRpcServer::gettxout (const std::string& txid, const int vout)
   return res;
 }
 
+std::string
+MockXayaRpcServer::getbestblockhash ()
+{
+  return bestBlock.ToHex ();
+}
+
 Json::Value
 MockXayaRpcServer::getblockheader (const std::string& hashStr)
 {
+  ++numBlockHeaderCalls;
+
   xaya::uint256 hash;
   if (!hash.FromHex (hashStr))
     throw jsonrpc::JsonRpcException (-8, "block hash is not uint256");
@@ -320,6 +330,8 @@ MockXayaRpcServer::getblockheader (const std::string& hashStr)
 Json::Value
 MockXayaRpcServer::decodepsbt (const std::string& psbt)
 {
+  ++numDecodePsbtCalls;
+
   const auto mit = psbts.find (psbt);
   if (mit == psbts.end ())
     throw jsonrpc::JsonRpcException (-22, "unknown psbt: " + psbt);
@@ -406,6 +418,27 @@ MockXayaRpcServer::listlockunspent ()
   return res;
 }
 
+Json::Value
+MockXayaRpcServer::listunspent (const int minConf)
+{
+  CHECK_GE (minConf, 0);
+
+  Json::Value res(Json::arrayValue);
+  for (const auto& entry : spendable)
+    {
+      if (locked.count (entry.first) > 0)
+        continue;
+
+      Json::Value cur(Json::objectValue);
+      cur["txid"] = entry.first.first;
+      cur["vout"] = static_cast<Json::Int> (entry.first.second);
+      cur["amount"] = xaya::ChiAmountToJson (entry.second);
+      cur["spendable"] = true;
+      res.append (cur);
+    }
+  return res;
+}
+
 std::string
 MockXayaRpcServer::combinepsbt (const Json::Value& inputPsbts)
 {
@@ -472,12 +505,44 @@ MockXayaRpcServer::finalizepsbt (const std::string& psbt)
 
 /* ************************************************************************** */
 
+namespace
+{
+
+/** Timeout for the mocked waitforchange and waitforpendingchange.  */
+constexpr auto MOCK_WAIT_TIMEOUT = std::chrono::milliseconds (100);
+
+/** Interval at which the mocked wait methods check for changes.  */
+constexpr auto MOCK_WAIT_STEP = std::chrono::milliseconds (5);
+
+/**
+ * Waits until the given predicate is true or the mock timeout
+ * has passed.
+ */
+template <typename Fcn>
+  void
+  MockWait (const Fcn& changed)
+{
+  const auto end = std::chrono::steady_clock::now () + MOCK_WAIT_TIMEOUT;
+  while (!changed () && std::chrono::steady_clock::now () < end)
+    std::this_thread::sleep_for (MOCK_WAIT_STEP);
+}
+
+} // anonymous namespace
+
+std::string
+MockDemGsp::GetBlockHash (const unsigned h)
+{
+  return "block " + std::to_string (h);
+}
+
 void
 MockDemGsp::SetPending (const std::string& btxid)
 {
+  std::lock_guard<std::mutex> lock(mut);
   btxids[btxid] = ParseJson (R"({
     "state": "pending"
   })");
+  ++pendingVersion;
 }
 
 void
@@ -487,15 +552,29 @@ MockDemGsp::SetConfirmed (const std::string& btxid, const unsigned h)
     "state": "confirmed"
   })");
   data["height"] = static_cast<Json::Int> (h);
+
+  std::lock_guard<std::mutex> lock(mut);
   btxids[btxid] = data;
 }
 
+void
+MockDemGsp::SetFinal (const std::string& btxid)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  btxids[btxid] = ParseJson (R"({
+    "state": "final"
+  })");
+}
+
 Json::Value
 MockDemGsp::checktrade (const std::string& btxid)
 {
+  ++numSingleChecks;
+
   Json::Value res(Json::objectValue);
   res["height"] = static_cast<Json::Int> (currentHeight);
 
+  std::lock_guard<std::mutex> lock(mut);
   const auto mit = btxids.find (btxid);
   if (mit != btxids.end ())
     res["data"] = mit->second;
@@ -507,6 +586,66 @@ MockDemGsp::checktrade (const std::string& btxid)
   return res;
 }
 
+Json::Value
+MockDemGsp::checktrades (const Json::Value& ids)
+{
+  if (!batchSupported)
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_METHOD_NOT_FOUND);
+
+  ++numBatchChecks;
+
+  Json::Value res(Json::objectValue);
+  res["height"] = static_cast<Json::Int> (currentHeight);
+
+  CHECK (ids.isArray ());
+  Json::Value data(Json::arrayValue);
+
+  std::lock_guard<std::mutex> lock(mut);
+  for (const auto& id : ids)
+    {
+      CHECK (id.isString ());
+      const auto mit = btxids.find (id.asString ());
+      if (mit != btxids.end ())
+        data.append (mit->second);
+      else
+        data.append (ParseJson (R"({
+          "state": "unknown"
+        })"));
+    }
+  res["data"] = data;
+
+  return res;
+}
+
+std::string
+MockDemGsp::waitforchange (const std::string& knownBlock)
+{
+  /* Like the real GSP, an empty known block means that we wait for the
+     next change from the current state.  */
+  const std::string known
+      = knownBlock.empty () ? GetBlockHash (currentHeight) : knownBlock;
+
+  MockWait ([&] ()
+    {
+      return GetBlockHash (currentHeight) != known;
+    });
+  return GetBlockHash (currentHeight);
+}
+
+Json::Value
+MockDemGsp::waitforpendingchange (const int oldVersion)
+{
+  MockWait ([&] ()
+    {
+      return pendingVersion != oldVersion;
+    });
+
+  Json::Value res(Json::objectValue);
+  res["version"] = pendingVersion.load ();
+  return res;
+}
+
 /* ************************************************************************** */
 
 } // namespace democrit
@@ -35,6 +35,9 @@
 
 #include <gmock/gmock.h>
 
+#include <atomic>
+#include <map>
+#include <mutex>
 #include <set>
 #include <string>
 #include <utility>
@@ -80,9 +83,18 @@ private:
   /** Locked outputs in the wallet.  */
   std::set<std::pair<std::string, unsigned>> locked;
 
+  /** Spendable coins in the wallet (with their value) for listunspent.  */
+  std::map<std::pair<std::string, unsigned>, Amount> spendable;
+
   /** The current best block, e.g. returned as part of gettxout.  */
   xaya::uint256 bestBlock;
 
+  /** Number of getblockheader calls received.  */
+  std::atomic<unsigned> numBlockHeaderCalls;
+
+  /** Number of decodepsbt calls received.  */
+  std::atomic<unsigned> numDecodePsbtCalls;
+
 public:
 
   explicit MockXayaRpcServer (jsonrpc::AbstractServerConnector& conn);
@@ -105,6 +117,17 @@ public:
     utxos.emplace (txid, vout);
   }
 
+  /**
+   * Adds a spendable coin with the given value to the wallet, which will
+   * be returned from listunspent (unless it is locked).
+   */
+  void
+  AddSpendable (const std::string& txid, const unsigned vout,
+                const Amount value)
+  {
+    spendable[std::make_pair (txid, vout)] = value;
+  }
+
   /**
    * Sets the JSON value that should be returned as "decoded" form
    * of a given PSBT.  The psbt string itself is just used as lookup key,
@@ -164,6 +187,18 @@ public:
    */
   static xaya::uint256 GetBlockHash (unsigned height);
 
+  unsigned
+  GetNumBlockHeaderCalls () const
+  {
+    return numBlockHeaderCalls;
+  }
+
+  unsigned
+  GetNumDecodePsbtCalls () const
+  {
+    return numDecodePsbtCalls;
+  }
+
   /**
    * The addresses returned are of the form "addr N", which N counting
    * how many have been created already.
@@ -184,11 +219,17 @@ public:
    */
   Json::Value gettxout (const std::string& txid, int vout) override;
 
+  /**
+   * Returns the currently set best block hash.
+   */
+  std::string getbestblockhash () override;
+
   /**
    * The server has a static list of block hashes corresponding to fixed heights
    * (as per GetBlockHash).  This method checks if the given hash is one
    * of the first couple of them; if it is, the method returns a base result
-   * with just the "previousblockhash" set.  If it is not in there, then the
+   * with just the basic fields like "height" and "previousblockhash" set.
+   * All those blocks are considered to be on the main chain.  If it is not in there, then the
    * method throws.
    */
   Json::Value getblockheader (const std::string& hashStr) override;
@@ -234,6 +275,11 @@ public:
    */
   Json::Value listlockunspent () override;
 
+  /**
+   * Returns the coins added with AddSpendable that are not locked.
+   */
+  Json::Value listunspent (int minConf) override;
+
   /**
    * Combines signatures in the given PSBTs.  It expects that we have a decoded
    * form for all of them; based on that, it will produce a combined
@@ -279,8 +325,14 @@ class MockDemGsp : public DemGspRpcServerStub
 
 private:
 
-  /** Current block height returned with RPC calls.  */
-  unsigned currentHeight = 0;
+  /**
+   * Current block height returned with RPC calls.  This also determines
+   * the "best block hash" for waitforchange.
+   */
+  std::atomic<unsigned> currentHeight;
+
+  /** Version of the pending state for waitforpendingchange.  */
+  std::atomic<int> pendingVersion;
 
   /**
    * JSON data associated to given btxid's.  If a btxid is not contained
@@ -288,10 +340,27 @@ private:
    */
   std::map<std::string, Json::Value> btxids;
 
+  /**
+   * Lock for btxids.  RPC calls may come in from multiple threads (e.g. the
+   * trade watchers) while a test is updating the data.
+   */
+  std::mutex mut;
+
+  /** Number of checktrade and checktrades calls received so far.  */
+  std::atomic<unsigned> numSingleChecks;
+  std::atomic<unsigned> numBatchChecks;
+
+  /**
+   * If set to false, checktrades fails with "method not found" like
+   * an older GSP that does not support it yet.
+   */
+  std::atomic<bool> batchSupported;
+
 public:
 
   explicit MockDemGsp (jsonrpc::AbstractServerConnector& conn)
-    : DemGspRpcServerStub(conn)
+    : DemGspRpcServerStub(conn), currentHeight(0), pendingVersion(0),
+      numSingleChecks(0), numBatchChecks(0), batchSupported(true)
   {}
 
   /**
@@ -304,7 +373,14 @@ public:
   }
 
   /**
-   * Marks a given btxid as "pending".
+   * Returns the "best block hash" corresponding to the given height,
+   * as returned from waitforchange.
+   */
+  static std::string GetBlockHash (unsigned h);
+
+  /**
+   * Marks a given btxid as "pending".  This also bumps the version
+   * of the pending state.
    */
   void SetPending (const std::string& btxid);
 
@@ -313,7 +389,46 @@ public:
    */
   void SetConfirmed (const std::string& btxid, unsigned h);
 
+  /**
+   * Marks a given btxid as final (confirmed and pruned).
+   */
+  void SetFinal (const std::string& btxid);
+
+  /**
+   * Turns off support for checktrades, to simulate an older GSP.
+   */
+  void
+  DisableBatchChecks ()
+  {
+    batchSupported = false;
+  }
+
+  unsigned
+  GetNumSingleChecks () const
+  {
+    return numSingleChecks;
+  }
+
+  unsigned
+  GetNumBatchChecks () const
+  {
+    return numBatchChecks;
+  }
+
   Json::Value checktrade (const std::string& btxid) override;
+  Json::Value checktrades (const Json::Value& ids) override;
+
+  /**
+   * Waits for the current height to change from knownBlock, or from the
+   * current height if knownBlock is empty.  As with the real GSP, this
+   * returns after a (short) timeout even without a change.
+   */
+  std::string waitforchange (const std::string& knownBlock) override;
+
+  /**
+   * Waits for the pending version to change, with a timeout.
+   */
+  Json::Value waitforpendingchange (int oldVersion) override;
 
 };
 
@@ -22,24 +22,48 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+
 namespace democrit
 {
 
 MucClient::MucClient (const gloox::JID& j, const std::string& password,
                       const gloox::JID& rm)
-  : XmppClient(j, password), roomName(rm)
+  : MucClient(j, password, std::vector<gloox::JID> {rm})
+{}
+
+MucClient::MucClient (const gloox::JID& j, const std::string& password,
+                      const std::vector<gloox::JID>& rms)
+  : XmppClient(j, password)
 {
+  CHECK (!rms.empty ()) << "MucClient needs at least one room";
+  for (const auto& rm : rms)
+    rooms.emplace_back (rm);
+
   gloox::MessageHandler* handler = this;
   RunWithClient ([&] (gloox::Client& c)
     {
       c.registerMessageHandler (handler);
     });
+
+  writer = std::thread ([this] ()
+    {
+      RunWriter ();
+    });
 }
 
 MucClient::~MucClient ()
 {
   Disconnect ();
-  CHECK (room == nullptr);
+  for (const auto& r : rooms)
+    CHECK (r.handle == nullptr);
+
+  {
+    std::lock_guard<std::mutex> lock(mutQueue);
+    stopWriter = true;
+    cvQueue.notify_all ();
+  }
+  writer.join ();
 }
 
 void
@@ -61,9 +85,6 @@ MucClient::Connect ()
     return false;
 
   std::unique_lock<std::mutex> lock(mut);
-  nickToJid.clear ();
-
-  CHECK (room == nullptr) << "Did not fully disconnect previously";
 
   /* The nick names in the room are not used for anything, as they will be
      mapped to full JIDs instead for any communication.  But they have to be
@@ -71,19 +92,32 @@ MucClient::Connect ()
      a random value, which will be (almost) guaranteed to be unique.  */
   xaya::CryptoRand rnd;
   const auto nick = rnd.Get<xaya::uint256> ();
-  gloox::JID roomJid = roomName;
-  roomJid.setResource (nick.ToHex ());
 
-  joining = true;
+  {
+    std::lock_guard<std::shared_timed_mutex> lockNicks(mutNicks);
+    for (auto& r : rooms)
+      r.nickToJid.clear ();
+  }
+
+  pendingJoins = rooms.size ();
   gloox::MUCRoomHandler* handler = this;
   RunWithClient ([&] (gloox::Client& c)
     {
-      LOG (INFO) << "Attempting to join room " << roomJid.full ();
-      room = std::make_unique<gloox::MUCRoom> (&c, roomJid, handler);
-      room->join ();
+      for (auto& r : rooms)
+        {
+          CHECK (r.handle == nullptr) << "Did not fully disconnect previously";
+          r.joining = true;
+
+          gloox::JID roomJid = r.name;
+          roomJid.setResource (nick.ToHex ());
+
+          LOG (INFO) << "Attempting to join room " << roomJid.full ();
+          r.handle = std::make_unique<gloox::MUCRoom> (&c, roomJid, handler);
+          r.handle->join ();
+        }
     });
 
-  while (joining)
+  while (pendingJoins > 0)
     cvJoin.wait (lock);
 
   /* If an error occurs while joining, we get disconnected before
@@ -97,25 +131,36 @@ MucClient::DisconnectAsync ()
   if (disconnecting)
     return;
 
+  HandleOwnDisconnect ();
+
   if (disconnecter.joinable ())
     disconnecter.join ();
 
+  /* Anything still queued was meant for the old connection.  */
+  ClearQueues ();
+
   std::lock_guard<std::mutex> lock(mut);
-  nickToJid.clear ();
+  {
+    std::lock_guard<std::shared_timed_mutex> lockNicks(mutNicks);
+    for (auto& r : rooms)
+      r.nickToJid.clear ();
+  }
 
   disconnecting = true;
   std::thread worker([this] ()
     {
-      if (room != nullptr)
-        {
-          LOG (INFO) << "Leaving room " << room->name ();
-          room->leave ();
-        }
-
-      /* Disconnect first, and then destroy the room.  This ensures
-         it won't be accessed after being freed.  */
+      for (auto& r : rooms)
+        if (r.handle != nullptr)
+          {
+            LOG (INFO) << "Leaving room " << r.handle->name ();
+            r.handle->leave ();
+          }
+
+      /* Disconnect first, and then destroy the rooms.  This ensures
+         they won't be accessed after being freed.  */
       XmppClient::Disconnect ();
-      room.reset ();
+      for (auto& r : rooms)
+        r.handle.reset ();
 
       disconnecting = false;
     });
@@ -133,18 +178,30 @@ MucClient::Disconnect ()
 
   std::lock_guard<std::mutex> lock(mut);
   CHECK (!disconnecting);
-  CHECK (room == nullptr);
+  for (const auto& r : rooms)
+    CHECK (r.handle == nullptr);
   CHECK (!XmppClient::IsConnected ());
 }
 
+MucClient::Room&
+MucClient::FindRoom (const gloox::MUCRoom* r)
+{
+  for (auto& entry : rooms)
+    if (entry.handle.get () == r)
+      return entry;
+
+  LOG (FATAL) << "Callback for unknown MUC room";
+}
+
 bool
-MucClient::ResolveNickname (const std::string& nick, gloox::JID& jid) const
+MucClient::ResolveNickname (const Room& r, const std::string& nick,
+                            gloox::JID& jid) const
 {
-  std::lock_guard<std::mutex> lock(mut);
+  std::shared_lock<std::shared_timed_mutex> lock(mutNicks);
 
-  const auto mit = nickToJid.find (nick);
+  const auto mit = r.nickToJid.find (nick);
 
-  if (mit == nickToJid.end ())
+  if (mit == r.nickToJid.end ())
     return false;
 
   jid = mit->second;
@@ -161,37 +218,104 @@ MucClient::RegisterExtension (std::unique_ptr<gloox::StanzaExtension> ext)
 }
 
 void
-MucClient::SendMessage (gloox::Message&& msg, ExtensionData&& ext)
+MucClient::EnqueueMessage (std::unique_ptr<gloox::Message> msg,
+                           ExtensionData&& ext, const bool priv,
+                           const std::string& replaceableRoom)
 {
   CHECK (IsConnected ());
 
   for (auto& entry : ext)
-    msg.addExtension (entry.release ());
+    msg->addExtension (entry.release ());
 
-  RunWithClient ([&msg] (gloox::Client& c)
+  std::lock_guard<std::mutex> lock(mutQueue);
+  auto& queue = priv ? queuePrivate : queueBroadcast;
+
+  if (!replaceableRoom.empty ())
     {
-      c.send (msg);
-    });
+      const auto it = std::find_if (queue.begin (), queue.end (),
+          [&replaceableRoom] (const OutgoingMessage& m)
+          {
+            return m.replaceableRoom == replaceableRoom;
+          });
+      if (it != queue.end ())
+        {
+          VLOG (1) << "Replacing queued message to " << replaceableRoom;
+          queue.erase (it);
+        }
+    }
+
+  queue.push_back ({std::move (msg), replaceableRoom});
+  cvQueue.notify_all ();
+}
+
+void
+MucClient::ClearQueues ()
+{
+  std::lock_guard<std::mutex> lock(mutQueue);
+  LOG_IF (WARNING, !queuePrivate.empty () || !queueBroadcast.empty ())
+      << "Dropping " << queuePrivate.size () << " private and "
+      << queueBroadcast.size () << " public queued messages";
+  queuePrivate.clear ();
+  queueBroadcast.clear ();
+}
+
+void
+MucClient::RunWriter ()
+{
+  std::unique_lock<std::mutex> lock(mutQueue);
+  while (true)
+    {
+      while (!stopWriter && queuePrivate.empty () && queueBroadcast.empty ())
+        cvQueue.wait (lock);
+      if (stopWriter)
+        return;
+
+      auto& queue = queuePrivate.empty () ? queueBroadcast : queuePrivate;
+      auto msg = std::move (queue.front ().msg);
+      queue.pop_front ();
+
+      /* The actual sending is done without holding the lock, so that
+         others can queue more messages in the mean time.  */
+      lock.unlock ();
+      if (IsConnected ())
+        RunWithClient ([&msg] (gloox::Client& c)
+          {
+            c.send (*msg);
+          });
+      else
+        LOG (WARNING) << "Not connected, dropping queued message";
+      lock.lock ();
+    }
 }
 
 void
 MucClient::PublishMessage (ExtensionData&& ext)
 {
-  SendMessage (gloox::Message (gloox::Message::Groupchat, roomName),
-               std::move (ext));
+  PublishMessage (rooms.front ().name, std::move (ext));
+}
+
+void
+MucClient::PublishMessage (const gloox::JID& room, ExtensionData&& ext,
+                           const bool replaceable)
+{
+  auto msg = std::make_unique<gloox::Message> (gloox::Message::Groupchat,
+                                               room);
+  EnqueueMessage (std::move (msg), std::move (ext), false,
+                  replaceable ? room.bare () : "");
 }
 
 void
 MucClient::SendMessage (const gloox::JID& to, ExtensionData&& ext)
 {
-  SendMessage (gloox::Message (gloox::Message::Normal, to), std::move (ext));
+  auto msg = std::make_unique<gloox::Message> (gloox::Message::Normal, to);
+  EnqueueMessage (std::move (msg), std::move (ext), true, "");
 }
 
 bool
 MucClient::handleMUCRoomCreation (gloox::MUCRoom* r)
 {
-  CHECK_EQ (r, room.get ());
-  LOG (WARNING) << "Creating non-existing MUC room " << roomName.full ();
+  const Room& room = FindRoom (r);
+  LOG (WARNING) << "Creating non-existing MUC room " << room.name.full ();
   return true;
 }
 
@@ -200,11 +324,11 @@ MucClient::handleMUCParticipantPresence (
     gloox::MUCRoom* r, const gloox::MUCRoomParticipant participant,
     const gloox::Presence& presence)
 {
-  CHECK_EQ (r, room.get ());
+  Room& room = FindRoom (r);
   VLOG (1)
       << "Presence for " << participant.jid->full ()
       << " with flags " << participant.flags
-      << " on room " << room->name ()
+      << " on room " << r->name ()
       << ": " << presence.presence ();
 
   /* Nick changes also send an unavailable presence.  We want to not consider
@@ -219,15 +343,18 @@ MucClient::handleMUCParticipantPresence (
     {
       if (unavailable)
         {
-          LOG (WARNING) << "We have been disconnected from " << room->name ();
+          LOG (WARNING) << "We have been disconnected from " << r->name ();
           DisconnectAsync ();
         }
 
       std::lock_guard<std::mutex> lock(mut);
-      if (joining)
+      if (room.joining)
         {
-          joining = false;
-          cvJoin.notify_all ();
+          room.joining = false;
+          CHECK_GT (pendingJoins, 0);
+          --pendingJoins;
+          if (pendingJoins == 0)
+            cvJoin.notify_all ();
         }
 
       return;
@@ -239,11 +366,11 @@ MucClient::handleMUCParticipantPresence (
   /* If someone left the room, just clear their nick-map entry.  */
   if (unavailable)
     {
-      std::lock_guard<std::mutex> lock(mut);
+      std::lock_guard<std::shared_timed_mutex> lock(mutNicks);
 
       VLOG (1)
           << "Removing nick-map entry for " << participant.nick->resource ();
-      nickToJid.erase (participant.nick->resource ());
+      room.nickToJid.erase (participant.nick->resource ());
 
       if (participant.jid != nullptr)
         {
@@ -261,12 +388,12 @@ MucClient::handleMUCParticipantPresence (
     return;
 
   /* Otherwise, update or insert the nick-map entry.  */
-  std::lock_guard<std::mutex> lock(mut);
+  std::lock_guard<std::shared_timed_mutex> lock(mutNicks);
 
   std::string nick;
   if (participant.flags & gloox::UserNickChanged)
     {
-      nickToJid.erase (participant.nick->resource ());
+      room.nickToJid.erase (participant.nick->resource ());
       nick = participant.newNick;
     }
   else
@@ -274,32 +401,32 @@ MucClient::handleMUCParticipantPresence (
   CHECK_NE (nick, "");
 
   LOG (INFO)
-      << "Full jid for " << nick << " in room " << room->name ()
+      << "Full jid for " << nick << " in room " << r->name ()
       << ": " << participant.jid->full ();
-  nickToJid[nick] = *participant.jid;
+  room.nickToJid[nick] = *participant.jid;
 }
 
 void
 MucClient::handleMUCMessage (gloox::MUCRoom* r, const gloox::Message& msg,
                              const bool priv)
 {
-  CHECK_EQ (r, room.get ());
+  const Room& room = FindRoom (r);
 
   if (priv)
     {
       LOG (WARNING)
-          << "Ignoring private message on room " << room->name ()
+          << "Ignoring private message on room " << r->name ()
           << " from " << msg.from ().full ();
       return;
     }
 
   VLOG (1)
       << "Received message from " << msg.from ().full ()
-      << " on room " << room->name ();
-  CHECK_EQ (msg.from ().bareJID (), roomName);
+      << " on room " << r->name ();
+  CHECK_EQ (msg.from ().bareJID (), room.name);
 
   gloox::JID realJid;
-  if (ResolveNickname (msg.from ().resource (), realJid))
+  if (ResolveNickname (room, msg.from ().resource (), realJid))
     HandleMessage (realJid, msg);
   else
     {
@@ -315,16 +442,20 @@ MucClient::handleMUCMessage (gloox::MUCRoom* r, const gloox::Message& msg,
 void
 MucClient::handleMUCError (gloox::MUCRoom* r, const gloox::StanzaError error)
 {
-  CHECK_EQ (r, room.get ());
+  FindRoom (r);
 
   LOG (WARNING)
-      << "Received error for MUC room " << room->name () << ": " << error;
+      << "Received error for MUC room " << r->name () << ": " << error;
   DisconnectAsync ();
 
+  /* If we were still joining, we are not anymore since we are getting
+     disconnected in any case.  */
   std::lock_guard<std::mutex> lock(mut);
-  if (joining)
+  if (pendingJoins > 0)
     {
-      joining = false;
+      for (auto& room : rooms)
+        room.joining = false;
+      pendingJoins = 0;
       cvJoin.notify_all ();
     }
 }
@@ -28,6 +28,7 @@
 #include <gtest/gtest.h>
 
 #include <queue>
+#include <vector>
 
 using testing::_;
 using testing::AnyNumber;
@@ -44,35 +45,36 @@ protected:
 
   /**
    * Gives direct access to the MUCRoom instance insice a MucClient (which
-   * is normally private).
+   * is normally private).  This returns the client's first room.
    */
   static gloox::MUCRoom&
   AccessRoom (MucClient& c)
   {
-    CHECK (c.room != nullptr);
-    return *c.room;
+    CHECK (c.rooms.front ().handle != nullptr);
+    return *c.rooms.front ().handle;
   }
 
   /**
-   * Expects that the given nickname has no known full JID for the client.
+   * Expects that the given nickname has no known full JID for the client
+   * in its first room.
    */
   static void
   ExpectUnknownNick (const MucClient& c, const std::string& nick)
   {
     gloox::JID jid;
-    ASSERT_FALSE (c.ResolveNickname (nick, jid));
+    ASSERT_FALSE (c.ResolveNickname (c.rooms.front (), nick, jid));
   }
 
   /**
-   * Expects that the given nickname has a known full JID and that it matches
-   * the given expected one.
+   * Expects that the given nickname has a known full JID in the client's
+   * first room and that it matches the given expected one.
    */
   static void
   ExpectNickJid (const MucClient& c, const std::string& nick,
                  const gloox::JID& expected)
   {
     gloox::JID jid;
-    ASSERT_TRUE (c.ResolveNickname (nick, jid));
+    ASSERT_TRUE (c.ResolveNickname (c.rooms.front (), nick, jid));
     ASSERT_EQ (jid.full (), expected.full ());
   }
 
@@ -234,7 +236,12 @@ public:
 
   explicit TestClient (const gloox::JID& id, const std::string& pwd,
                        const gloox::JID& rm)
-    : MucClient(id, pwd, rm)
+    : TestClient(id, pwd, std::vector<gloox::JID> {rm})
+  {}
+
+  explicit TestClient (const gloox::JID& id, const std::string& pwd,
+                       const std::vector<gloox::JID>& rms)
+    : MucClient(id, pwd, rms)
   {
     SetRootCA (GetTestCA ());
     RegisterExtension (std::make_unique<TestExtension> ());
@@ -264,6 +271,39 @@ public:
     PublishMessage (std::move (ext));
   }
 
+  /**
+   * Publishes a message with test extension to a particular room.
+   */
+  void
+  PublishTo (const gloox::JID& room, const std::string& value,
+             const bool replaceable = false)
+  {
+    ExtensionData ext;
+    ext.push_back (std::make_unique<TestExtension> (value));
+    PublishMessage (room, std::move (ext), replaceable);
+  }
+
+  /**
+   * Waits for messages until one with the given value is received, and
+   * returns the values of all received messages (including the last one).
+   */
+  std::vector<std::string>
+  ReceiveUntil (const std::string& value)
+  {
+    std::vector<std::string> res;
+
+    std::unique_lock<std::mutex> lock(mut);
+    while (res.empty () || res.back () != value)
+      {
+        while (received.empty ())
+          cv.wait (lock);
+        res.push_back (received.front ().value);
+        received.pop ();
+      }
+
+    return res;
+  }
+
   /**
    * Sends a private message with test extension.
    */
@@ -546,6 +586,61 @@ TEST_F (MucMessagingTests, OtherRoom)
   inRoom2.ExpectMessages ({{jid1, "in room", false}});
 }
 
+TEST_F (MucMessagingTests, MultipleRooms)
+{
+  const gloox::JID room1 = GetRoom ("room1");
+  const gloox::JID room2 = GetRoom ("room2");
+
+  const auto multiJid = GetTestJid (0, "multi");
+  TestClient multi(multiJid, GetPassword (0), {room1, room2});
+  ASSERT_TRUE (multi.Connect ());
+
+  const auto jid1 = GetTestJid (1, "foo");
+  TestClient inRoom1(jid1, GetPassword (1), room1);
+  ASSERT_TRUE (inRoom1.Connect ());
+
+  const auto jid2 = GetTestJid (1, "bar");
+  TestClient inRoom2(jid2, GetPassword (1), room2);
+  ASSERT_TRUE (inRoom2.Connect ());
+
+  inRoom1.Publish ("room 1");
+  multi.ExpectMessages ({{jid1, "room 1", false}});
+  inRoom2.Publish ("room 2");
+  multi.ExpectMessages ({{jid2, "room 2", false}});
+
+  multi.PublishTo (room2, "to room 2");
+  inRoom2.ExpectMessages ({{multiJid, "to room 2", false}});
+  multi.Publish ("default room");
+  inRoom1.ExpectMessages ({{multiJid, "default room", false}});
+}
+
+TEST_F (MucMessagingTests, ReplaceableBroadcasts)
+{
+  const gloox::JID room = GetRoom ("foo");
+
+  const auto fooJid = GetTestJid (0, "foo");
+  TestClient foo(fooJid, GetPassword (0), room);
+  ASSERT_TRUE (foo.Connect ());
+
+  const auto barJid = GetTestJid (1, "bar");
+  TestClient bar(barJid, GetPassword (1), room);
+  ASSERT_TRUE (bar.Connect ());
+
+  constexpr unsigned num = 100;
+  for (unsigned i = 1; i <= num; ++i)
+    foo.PublishTo (room, std::to_string (i), true);
+  foo.Publish ("end");
+
+  /* Some of the replaceable messages may have been dropped from the queue,
+     but the ones we get must be in order and the last must be there.  */
+  const auto values = bar.ReceiveUntil ("end");
+  ASSERT_GE (values.size (), 2);
+  ASSERT_LE (values.size (), num + 1);
+  EXPECT_EQ (values[values.size () - 2], std::to_string (num));
+  for (unsigned i = 1; i + 1 < values.size (); ++i)
+    EXPECT_LT (std::stoi (values[i - 1]), std::stoi (values[i]));
+}
+
 TEST_F (MucMessagingTests, PrivateMessages)
 {
   const auto fooJid = GetTestJid (0, "foo");
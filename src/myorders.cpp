@@ -18,90 +18,198 @@
 
 #include "private/myorders.hpp"
 
+#include <google/protobuf/util/message_differencer.h>
+
 #include <glog/logging.h>
 
+#include <algorithm>
+
 namespace democrit
 {
 
 void
 MyOrders::StartRefresher (const std::chrono::milliseconds intv)
 {
-  refresher = std::make_unique<IntervalJob> (intv, [this] ()
+  /* The refreshes of many accounts (even in different processes) should
+     not all happen at the same moment.  Thus we add a random jitter
+     of up to 10% of the interval, but without exceeding it.  */
+  const auto jitter = intv / 10;
+  refresher = std::make_unique<IntervalJob> (intv - jitter, jitter, [this] ()
     {
-      RunRefresh ();
+      RunRefresh (false);
     });
 }
 
 void
-MyOrders::RunRefresh ()
+MyOrders::StartChangeNotifier (const std::chrono::milliseconds debounce)
 {
-  VLOG (2) << "Refreshing set of own orders...";
+  if (debounce == debounce.zero ())
+    {
+      changeNotifier.reset ();
+      return;
+    }
 
-  state.AccessState ([this] (proto::State& s)
+  changeNotifier = std::make_unique<DelayedJob> (debounce, [this] ()
     {
-      proto::OrdersOfAccount updated;
-      for (auto& o : *s.mutable_own_orders ()->mutable_orders ())
-        {
-          if (ValidateOrder (s.account (), o.second))
-            updated.mutable_orders ()->insert ({o.first, std::move (o.second)});
-          else
-            LOG (WARNING)
-                << "Dropping invalid own order:\n" << o.second.DebugString ();
-        }
-      s.mutable_own_orders ()->Swap (&updated);
+      RunRefresh (true);
     });
-
-  UpdateOrders (InternalGetOrders (false));
 }
 
-bool
-MyOrders::Add (proto::Order&& o)
+void
+MyOrders::RunRefresh (const bool changed)
 {
-  bool added = false;
-  state.AccessState ([this, &o, &added] (proto::State& s)
+  VLOG (2) << "Refreshing set of own orders...";
+  std::lock_guard<std::mutex> lock(mutRefresh);
+
+  /* Since new orders are validated when they are added and orders are
+     not modified (apart from locking) later on, we can validate a copy
+     and then just remove the invalid ones by ID.  */
+  const auto current = InternalGetOrders (true);
+  std::vector<uint64_t> ids;
+  std::vector<const proto::Order*> toValidate;
+  for (const auto& o : current.orders ())
     {
-      if (!ValidateOrder (s.account (), o))
-        {
-          LOG (WARNING) << "Added order is invalid:\n" << o.DebugString ();
-          return;
-        }
+      ids.push_back (o.first);
+      toValidate.push_back (&o.second);
+    }
+  const auto valid = ValidateOrders (current.account (), toValidate);
+  CHECK_EQ (valid.size (), toValidate.size ());
 
-      o.clear_account ();
-      o.clear_id ();
+  std::vector<uint64_t> invalid;
+  for (size_t i = 0; i < valid.size (); ++i)
+    if (!valid[i])
+      {
+        LOG (WARNING)
+            << "Dropping invalid own order:\n" << toValidate[i]->DebugString ();
+        invalid.push_back (ids[i]);
+      }
 
-      const auto id = s.next_free_id ();
-      s.set_next_free_id (id + 1);
+  if (!invalid.empty ())
+    {
+      state.ModifyState ([&invalid] (proto::State& s, StateChanges& changes)
+        {
+          auto& orders = *s.mutable_own_orders ()->mutable_orders ();
+          for (const auto id : invalid)
+            {
+              orders.erase (id);
+              changes.TouchOrder (id);
+            }
+        });
+      version.Bump ();
+    }
 
-      VLOG (1)
-          << "Adding new order with ID " << id << ":\n"
-          << o.DebugString ();
-      (*s.mutable_own_orders ()->mutable_orders ())[id].Swap (&o);
-      added = true;
-    });
+  auto broadcast = InternalGetOrders (false);
+  if (changed)
+    OrdersChanged (broadcast);
+  else
+    UpdateOrders (broadcast);
+}
 
-  if (added)
-    RunRefresh ();
+void
+MyOrders::MarkChanged ()
+{
+  version.Bump ();
 
-  return added;
+  if (changeNotifier == nullptr)
+    RunRefresh (true);
+  else
+    changeNotifier->Trigger ();
+}
+
+bool
+MyOrders::Add (proto::Order&& o)
+{
+  std::vector<proto::Order> add;
+  add.push_back (std::move (o));
+  return Update ({}, std::move (add), false)[0];
 }
 
 void
 MyOrders::RemoveById (const uint64_t id)
 {
-  state.AccessState ([this, id] (proto::State& s)
+  Update ({id}, {}, false);
+}
+
+std::vector<bool>
+MyOrders::Update (const std::vector<uint64_t>& cancel,
+                  std::vector<proto::Order>&& add, const bool atomic)
+{
+  std::string account;
+  state.ReadState ([&account] (const proto::State& s)
     {
-      VLOG (1) << "Removing order with ID " << id;
-      s.mutable_own_orders ()->mutable_orders ()->erase (id);
+      account = s.account ();
     });
 
-  RunRefresh ();
+  /* The validation may be slow, so do it before locking the state
+     for adding the orders.  */
+  std::vector<const proto::Order*> toValidate;
+  for (const auto& o : add)
+    toValidate.push_back (&o);
+  auto valid = ValidateOrders (account, toValidate);
+  CHECK_EQ (valid.size (), add.size ());
+
+  bool allValid = true;
+  for (size_t i = 0; i < add.size (); ++i)
+    if (!valid[i])
+      {
+        LOG (WARNING) << "Added order is invalid:\n" << add[i].DebugString ();
+        allValid = false;
+      }
+
+  if (atomic && !allValid)
+    {
+      LOG (WARNING) << "Not applying atomic update with invalid orders";
+      return std::vector<bool> (add.size (), false);
+    }
+
+  state.ModifyState ([&] (proto::State& s, StateChanges& changes)
+    {
+      auto& orders = *s.mutable_own_orders ()->mutable_orders ();
+
+      for (const auto id : cancel)
+        {
+          VLOG (1) << "Removing order with ID " << id;
+          orders.erase (id);
+          changes.TouchOrder (id);
+        }
+
+      for (size_t i = 0; i < add.size (); ++i)
+        {
+          if (!valid[i])
+            continue;
+
+          auto& o = add[i];
+          o.clear_account ();
+          o.clear_id ();
+
+          const auto id = s.next_free_id ();
+          s.set_next_free_id (id + 1);
+          changes.TouchNextFreeId ();
+          changes.TouchOrder (id);
+
+          VLOG (1)
+              << "Adding new order with ID " << id << ":\n"
+              << o.DebugString ();
+          orders[id].Swap (&o);
+        }
+    });
+
+  /* We notify whenever something may have changed; for cancelled orders
+     we do not bother to check whether they actually existed.  */
+  const bool anyAdded
+      = std::find (valid.begin (), valid.end (), true) != valid.end ();
+  if (anyAdded || !cancel.empty ())
+    MarkChanged ();
+
+  return valid;
 }
 
 bool
 MyOrders::TryLock (const uint64_t id, proto::Order& out)
 {
   bool res = false;
-  state.AccessState ([this, id, &res, &out] (proto::State& s)
+  state.ModifyState ([this, id, &res, &out] (proto::State& s,
+                                             StateChanges& changes)
     {
       auto mit = s.mutable_own_orders ()->mutable_orders ()->find (id);
       if (mit == s.mutable_own_orders ()->mutable_orders ()->end ())
@@ -121,28 +229,30 @@ MyOrders::TryLock (const uint64_t id, proto::Order& out)
       out.set_account (s.account ());
       out.set_id (id);
       mit->second.set_locked (true);
+      changes.TouchOrder (id);
       res = true;
       return;
     });
 
   if (res)
-    RunRefresh ();
+    MarkChanged ();
   return res;
 }
 
 void
 MyOrders::Unlock (const uint64_t id)
 {
-  state.AccessState ([this, id] (proto::State& s)
+  state.ModifyState ([this, id] (proto::State& s, StateChanges& changes)
     {
       auto mit = s.mutable_own_orders ()->mutable_orders ()->find (id);
       CHECK (mit != s.mutable_own_orders ()->mutable_orders ()->end ())
           << "Order with ID " << id << " doesn't exist";
       CHECK (mit->second.locked ()) << "Order " << id << " isn't locked";
       mit->second.clear_locked ();
+      changes.TouchOrder (id);
     });
 
-  RunRefresh ();
+  MarkChanged ();
 }
 
 proto::OrdersOfAccount
@@ -167,4 +277,41 @@ MyOrders::ValidateOrder (const std::string& account,
   return true;
 }
 
+std::vector<bool>
+MyOrders::ValidateOrders (const std::string& account,
+                          const std::vector<const proto::Order*>& orders) const
+{
+  std::vector<bool> res;
+  res.reserve (orders.size ());
+  for (const auto* o : orders)
+    res.push_back (ValidateOrder (account, *o));
+
+  return res;
+}
+
+bool
+ComputeOrdersDelta (const proto::OrdersOfAccount& from,
+                    const proto::OrdersOfAccount& to,
+                    proto::OrdersDelta& delta)
+{
+  using google::protobuf::util::MessageDifferencer;
+
+  delta.clear_upserted ();
+  delta.clear_removed ();
+
+  for (const auto& entry : from.orders ())
+    if (to.orders ().count (entry.first) == 0)
+      delta.add_removed (entry.first);
+
+  for (const auto& entry : to.orders ())
+    {
+      const auto mit = from.orders ().find (entry.first);
+      if (mit == from.orders ().end ()
+            || !MessageDifferencer::Equals (mit->second, entry.second))
+        delta.mutable_upserted ()->insert (entry);
+    }
+
+  return !delta.upserted ().empty () || delta.removed_size () > 0;
+}
+
 } // namespace democrit
@@ -25,6 +25,7 @@
 #include <google/protobuf/util/message_differencer.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
 
 namespace democrit
@@ -33,6 +34,7 @@ namespace
 {
 
 using google::protobuf::util::MessageDifferencer;
+using testing::ElementsAre;
 
 DEFINE_PROTO_MATCHER (EqualsOrder, Order)
 
@@ -61,6 +63,9 @@ private:
   /** Last time when UpdateOrders was called.  */
   Clock::time_point lastUpdate;
 
+  /** Number of calls to OrdersChanged.  */
+  std::atomic<unsigned> numChanged;
+
   /**
    * Assets that are considered "invalid" for order-validation purposes.
    * We use that to verify the order validation going on.
@@ -87,10 +92,22 @@ protected:
     lastUpdate = Clock::now ();
   }
 
+  void
+  OrdersChanged (const proto::OrdersOfAccount& ownOrders) override
+  {
+    ++numChanged;
+    MyOrders::OrdersChanged (ownOrders);
+  }
+
 public:
 
   explicit TestMyOrders (State& s, const std::chrono::milliseconds intv)
-    : MyOrders(s, intv)
+    : MyOrders(s, intv), numChanged(0)
+  {}
+
+  explicit TestMyOrders (State& s, const std::chrono::milliseconds intv,
+                         const std::chrono::milliseconds debounce)
+    : MyOrders(s, intv, debounce), numChanged(0)
   {}
 
   /**
@@ -114,6 +131,15 @@ public:
     return lastOrders;
   }
 
+  /**
+   * Returns how often OrdersChanged has been called.
+   */
+  unsigned
+  GetNumChanged () const
+  {
+    return numChanged;
+  }
+
   /**
    * Compares the actual orders (per GetOrders) with the ones pushed
    * last via UpdateOrders and expects them to be equal.
@@ -298,6 +324,130 @@ TEST_F (MyOrdersTests, Validation)
   )"));
 }
 
+TEST_F (MyOrdersTests, BatchUpdate)
+{
+  TestMyOrders mo(state, NO_REFRESH);
+  mo.AddInvalidAsset ("invalid");
+
+  AddOrder (mo, R"(asset: "gold" type: BID price_sat: 10)");
+  AddOrder (mo, R"(asset: "gold" type: ASK price_sat: 20)");
+  EXPECT_EQ (mo.GetNumChanged (), 2);
+
+  std::vector<proto::Order> add;
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    account: "foo" id: 42
+    asset: "gold" type: BID price_sat: 11
+  )"));
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "invalid" type: BID price_sat: 1
+  )"));
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "silver" type: ASK price_sat: 5
+  )"));
+  EXPECT_THAT (mo.Update ({101, 42}, std::move (add), false),
+               ElementsAre (true, false, true));
+  EXPECT_EQ (mo.GetNumChanged (), 3);
+
+  EXPECT_THAT (mo.GetOrders (), EqualsOrdersOfAccount (R"(
+    account: "domob"
+    orders:
+      {
+        key: 102
+        value: { asset: "gold" type: ASK price_sat: 20 }
+      }
+    orders:
+      {
+        key: 103
+        value: { asset: "gold" type: BID price_sat: 11 }
+      }
+    orders:
+      {
+        key: 104
+        value: { asset: "silver" type: ASK price_sat: 5 }
+      }
+  )"));
+  mo.ExpectOrdersUpdated ();
+
+  add.clear ();
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "invalid" type: BID price_sat: 1
+  )"));
+  EXPECT_THAT (mo.Update ({}, std::move (add), false), ElementsAre (false));
+  EXPECT_EQ (mo.GetNumChanged (), 3);
+}
+
+TEST_F (MyOrdersTests, AtomicReplace)
+{
+  TestMyOrders mo(state, NO_REFRESH);
+  mo.AddInvalidAsset ("invalid");
+
+  AddOrder (mo, R"(asset: "gold" type: BID price_sat: 10)");
+  AddOrder (mo, R"(asset: "gold" type: ASK price_sat: 20)");
+
+  std::vector<proto::Order> add;
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "gold" type: BID price_sat: 11
+  )"));
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "invalid" type: ASK price_sat: 21
+  )"));
+  EXPECT_THAT (mo.Update ({101, 102}, std::move (add), true),
+               ElementsAre (false, false));
+  EXPECT_EQ (mo.GetNumChanged (), 2);
+
+  add.clear ();
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "gold" type: BID price_sat: 11
+  )"));
+  add.push_back (ParseTextProto<proto::Order> (R"(
+    asset: "gold" type: ASK price_sat: 21
+  )"));
+  EXPECT_THAT (mo.Update ({101, 102}, std::move (add), true),
+               ElementsAre (true, true));
+  EXPECT_EQ (mo.GetNumChanged (), 3);
+
+  EXPECT_THAT (mo.GetOrders (), EqualsOrdersOfAccount (R"(
+    account: "domob"
+    orders:
+      {
+        key: 103
+        value: { asset: "gold" type: BID price_sat: 11 }
+      }
+    orders:
+      {
+        key: 104
+        value: { asset: "gold" type: ASK price_sat: 21 }
+      }
+  )"));
+  mo.ExpectOrdersUpdated ();
+}
+
+TEST_F (MyOrdersTests, Version)
+{
+  TestMyOrders mo(state, NO_REFRESH);
+
+  auto v = mo.GetVersion ().Get ();
+  AddOrder (mo, R"(
+    asset: "gold"
+    type: BID
+    price_sat: 10
+  )");
+  EXPECT_GT (mo.GetVersion ().Get (), v);
+
+  v = mo.GetVersion ().Get ();
+  proto::Order o;
+  ASSERT_TRUE (mo.TryLock (101, o));
+  EXPECT_GT (mo.GetVersion ().Get (), v);
+
+  v = mo.GetVersion ().Get ();
+  mo.Unlock (101);
+  EXPECT_GT (mo.GetVersion ().Get (), v);
+
+  v = mo.GetVersion ().Get ();
+  mo.RemoveById (101);
+  EXPECT_GT (mo.GetVersion ().Get (), v);
+}
+
 TEST_F (MyOrdersTests, Locking)
 {
   TestMyOrders mo(state, NO_REFRESH);
@@ -376,6 +526,132 @@ TEST_F (MyOrdersTests, Locking)
   mo.ExpectOrdersUpdated ();
 }
 
+TEST_F (MyOrdersTests, ChangesNotified)
+{
+  TestMyOrders mo(state, NO_REFRESH);
+  EXPECT_EQ (mo.GetNumChanged (), 0);
+
+  AddOrder (mo, R"(
+    asset: "gold"
+    type: BID
+    price_sat: 10
+  )");
+  EXPECT_EQ (mo.GetNumChanged (), 1);
+
+  proto::Order o;
+  ASSERT_TRUE (mo.TryLock (101, o));
+  EXPECT_EQ (mo.GetNumChanged (), 2);
+  mo.Unlock (101);
+  EXPECT_EQ (mo.GetNumChanged (), 3);
+
+  mo.RemoveById (101);
+  EXPECT_EQ (mo.GetNumChanged (), 4);
+  mo.ExpectOrdersUpdated ();
+}
+
+TEST_F (MyOrdersTests, ChangesDebounced)
+{
+  constexpr auto DEBOUNCE = std::chrono::milliseconds (100);
+  TestMyOrders mo(state, NO_REFRESH, DEBOUNCE);
+
+  for (unsigned i = 0; i < 10; ++i)
+    AddOrder (mo, R"(
+      asset: "gold"
+      type: BID
+      price_sat: 10
+    )");
+  mo.RemoveById (105);
+
+  /* The debounce job might run in the middle of our changes, so it is
+     possible that they are split over two notifications.  */
+  std::this_thread::sleep_for (3 * DEBOUNCE);
+  EXPECT_GE (mo.GetNumChanged (), 1);
+  EXPECT_LE (mo.GetNumChanged (), 2);
+  EXPECT_EQ (mo.GetOrders ().orders_size (), 9);
+  mo.ExpectOrdersUpdated ();
+
+  const auto before = mo.GetNumChanged ();
+  std::this_thread::sleep_for (3 * DEBOUNCE);
+  EXPECT_EQ (mo.GetNumChanged (), before);
+}
+
+/* ************************************************************************** */
+
+using ComputeOrdersDeltaTests = testing::Test;
+
+TEST_F (ComputeOrdersDeltaTests, NoChanges)
+{
+  const auto orders = ParseTextProto<proto::OrdersOfAccount> (R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: BID price_sat: 10 }
+      }
+  )");
+
+  proto::OrdersDelta delta;
+  delta.set_sequence (5);
+  EXPECT_FALSE (ComputeOrdersDelta (orders, orders, delta));
+  EXPECT_THAT (delta, EqualsOrdersDelta ("sequence: 5"));
+}
+
+TEST_F (ComputeOrdersDeltaTests, Changes)
+{
+  const auto from = ParseTextProto<proto::OrdersOfAccount> (R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: BID price_sat: 10 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "gold" type: ASK price_sat: 20 }
+      }
+    orders:
+      {
+        key: 3
+        value: { asset: "silver" type: ASK price_sat: 30 }
+      }
+  )");
+  const auto to = ParseTextProto<proto::OrdersOfAccount> (R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: BID price_sat: 10 }
+      }
+    orders:
+      {
+        key: 3
+        value: { asset: "silver" type: ASK price_sat: 25 }
+      }
+    orders:
+      {
+        key: 4
+        value: { asset: "silver" type: BID price_sat: 5 }
+      }
+  )");
+
+  proto::OrdersDelta delta;
+  ASSERT_TRUE (ComputeOrdersDelta (from, to, delta));
+  EXPECT_THAT (delta, EqualsOrdersDelta (R"(
+    upserted:
+      {
+        key: 3
+        value: { asset: "silver" type: ASK price_sat: 25 }
+      }
+    upserted:
+      {
+        key: 4
+        value: { asset: "silver" type: BID price_sat: 5 }
+      }
+    removed: 2
+  )"));
+}
+
 /* ************************************************************************** */
 
 } // anonymous namespace
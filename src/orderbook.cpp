@@ -21,10 +21,80 @@
 #include <glog/logging.h>
 
 #include <algorithm>
+#include <iterator>
 
 namespace democrit
 {
 
+namespace
+{
+
+using OrderList = google::protobuf::RepeatedPtrField<proto::Order>;
+
+/**
+ * Appends the orders of all price levels (snapshots) in the given
+ * range to the output.
+ */
+template <typename It>
+  void
+  CopyLevels (It begin, const It end, OrderList& out)
+{
+  for (; begin != end; ++begin)
+    for (const auto& o : begin->second->orders)
+      *out.Add () = o;
+}
+
+/**
+ * Copies all orders at the first "levels" price levels from the given
+ * range of level snapshots to the output.  Orders of the excluded account
+ * are skipped, and levels with only such orders do not count.
+ */
+template <typename It>
+  void
+  CopyBestLevels (It begin, const It end, unsigned levels,
+                  const std::string& excluded, OrderList& out)
+{
+  for (; begin != end && levels > 0; ++begin)
+    {
+      bool copied = false;
+      for (const auto& o : begin->second->orders)
+        if (o.account () != excluded)
+          {
+            *out.Add () = o;
+            copied = true;
+          }
+
+      if (copied)
+        --levels;
+    }
+}
+
+/**
+ * Copies all orders in the given (inclusive) price range from the level
+ * snapshots of one side to the output.  If the orders should be returned
+ * by decreasing price (as bids are), then descending must be set to true.
+ */
+template <typename Side>
+  void
+  CopyPriceRange (const Side& side, const bool descending,
+                  const uint64_t minPrice, const uint64_t maxPrice,
+                  OrderList& out)
+{
+  if (minPrice > maxPrice)
+    return;
+
+  const auto begin = side.lower_bound (minPrice);
+  const auto end = side.upper_bound (maxPrice);
+
+  if (descending)
+    CopyLevels (std::make_reverse_iterator (end),
+                std::make_reverse_iterator (begin), out);
+  else
+    CopyLevels (begin, end, out);
+}
+
+} // anonymous namespace
+
 void
 OrderBook::StartTimeouter ()
 {
@@ -34,29 +104,149 @@ OrderBook::StartTimeouter ()
     });
 }
 
+bool
+OrderBook::OrderKey::operator< (const OrderKey& o) const
+{
+  if (price != o.price)
+    return price < o.price;
+  if (account != o.account)
+    return account < o.account;
+  return id < o.id;
+}
+
 void
 OrderBook::RunTimeout ()
 {
   VLOG (2) << "Running timeout tick...";
 
   std::lock_guard<std::mutex> lock(mut);
-  const auto timeoutBefore = Clock::now () - timeout;
+  const auto now = Clock::now ();
 
-  while (!updates.empty () && updates.front ().time < timeoutBefore)
+  while (!deadlines.empty () && deadlines.begin ()->first < now)
     {
-      const std::string account = std::move (updates.front ().account);
-      updates.pop ();
+      const auto mit = orders.find (deadlines.begin ()->second);
+      CHECK (mit != orders.end ());
 
-      auto mit = orders.find (account);
-      if (mit == orders.end ())
-        continue;
+      VLOG (1) << "Timing out orders of " << mit->first;
+      EraseAccount (mit);
+    }
 
-      if (mit->second.lastUpdate < timeoutBefore)
-        {
-          VLOG (1) << "Timing out orders of " << account;
-          orders.erase (mit);
-        }
+  PublishSnapshot ();
+}
+
+void
+OrderBook::MarkDirty (const IndexEntry& ref, const uint64_t price)
+{
+  auto& dirty = dirtyLevels[ref.asset->first];
+  if (ref.side == &ref.asset->second.bids)
+    dirty.bids.insert (price);
+  else
+    dirty.asks.insert (price);
+}
+
+void
+OrderBook::RemoveEntry (const IndexEntry& ref)
+{
+  const auto& o = ref.entry->second;
+  MarkDirty (ref, o.price_sat ());
+
+  auto lit = ref.levels->find (o.price_sat ());
+  CHECK (lit != ref.levels->end ());
+  CHECK_GE (lit->second.units, o.max_units ());
+  CHECK_GT (lit->second.orders, 0);
+  lit->second.units -= o.max_units ();
+  --lit->second.orders;
+  if (lit->second.orders == 0)
+    ref.levels->erase (lit);
+
+  ref.side->erase (ref.entry);
+
+  const auto& data = ref.asset->second;
+  if (data.bids.empty () && data.asks.empty ())
+    byAsset.erase (ref.asset);
+}
+
+void
+OrderBook::RemoveFromIndex (AccountOrders& acc)
+{
+  for (const auto& entry : acc.entries)
+    RemoveEntry (entry.second);
+  acc.entries.clear ();
+}
+
+void
+OrderBook::InsertOrder (const std::string& account, const uint64_t id,
+                        proto::Order&& o, AccountOrders& acc)
+{
+  /* Orders are validated before they are added to the orderbook, so it is
+     fine to intern their assets.  */
+  const AssetId asset = AssetInterner::Global ().Intern (o.asset ());
+  o.clear_asset ();
+
+  IndexEntry ref;
+  ref.asset = byAsset.find (asset);
+  if (ref.asset == byAsset.end ())
+    ref.asset = byAsset.emplace (asset, AssetOrders ()).first;
+
+  switch (o.type ())
+    {
+    case proto::Order::ASK:
+      ref.side = &ref.asset->second.asks;
+      ref.levels = &ref.asset->second.askLevels;
+      break;
+    case proto::Order::BID:
+      ref.side = &ref.asset->second.bids;
+      ref.levels = &ref.asset->second.bidLevels;
+      break;
+    default:
+      LOG (FATAL) << "Unexpected order type: " << static_cast<int> (o.type ());
     }
+  o.clear_type ();
+  MarkDirty (ref, o.price_sat ());
+
+  o.set_account (account);
+  o.set_id (id);
+
+  OrderKey key(o.price_sat (), account, id);
+  const auto ins = ref.side->emplace (std::move (key), proto::Order ());
+  CHECK (ins.second);
+  ref.entry = ins.first;
+  ref.entry->second.Swap (&o);
+
+  auto& level = (*ref.levels)[ref.entry->second.price_sat ()];
+  level.units += ref.entry->second.max_units ();
+  ++level.orders;
+
+  CHECK (acc.entries.emplace (id, ref).second);
+}
+
+void
+OrderBook::MarkUpdated (const std::string& account, AccountOrders& acc,
+                        const bool isNew)
+{
+  const auto deadline = Clock::now () + timeout;
+
+  if (isNew)
+    {
+      acc.deadline = deadlines.emplace (deadline, account);
+      return;
+    }
+
+  /* Move the existing entry with the account name (rather than copying it
+     again) to its new position at the end.  */
+  std::string name = std::move (acc.deadline->second);
+  deadlines.erase (acc.deadline);
+  acc.deadline = deadlines.emplace_hint (deadlines.end (), deadline,
+                                         std::move (name));
+}
+
+void
+OrderBook::EraseAccount (
+    const std::map<std::string, AccountOrders>::iterator mit)
+{
+  RemoveFromIndex (mit->second);
+  deadlines.erase (mit->second.deadline);
+  orders.erase (mit);
 }
 
 void
@@ -73,145 +263,349 @@ OrderBook::UpdateOrders (proto::OrdersOfAccount&& upd)
   upd.clear_account ();
 
   std::lock_guard<std::mutex> lock(mut);
-  const auto time = Clock::now ();
 
-  if (upd.orders ().empty ())
+  auto mit = orders.find (account);
+  if (mit != orders.end ())
+    RemoveFromIndex (mit->second);
+
+  /* If the update has a sequence number, we keep the account (even if
+     it has no orders at the moment), so that following deltas can be
+     applied to it.  */
+  if (upd.orders ().empty () && !upd.has_sequence ())
     {
       VLOG (1) << "Deleting all orders of " << account;
-      orders.erase (account);
+      if (mit != orders.end ())
+        EraseAccount (mit);
+      PublishSnapshot ();
       return;
     }
 
   VLOG (1) << "Updating orders of " << account;
-  updates.emplace (account, time);
-  orders[account] = AccountOrders (std::move (upd), time);
+
+  const bool isNew = (mit == orders.end ());
+  if (isNew)
+    mit = orders.emplace (account, AccountOrders ()).first;
+  auto& acc = mit->second;
+  MarkUpdated (account, acc, isNew);
+
+  acc.hasSequence = upd.has_sequence ();
+  acc.sequence = upd.sequence ();
+
+  for (auto& entry : *upd.mutable_orders ())
+    InsertOrder (account, entry.first, std::move (entry.second), acc);
+
+  PublishSnapshot ();
 }
 
-namespace
+bool
+OrderBook::UpdateOrdersDelta (const std::string& account,
+                              proto::OrdersDelta&& delta)
 {
+  for (const auto& entry : delta.upserted ())
+    {
+      const auto& o = entry.second;
+      CHECK (o.has_asset () && o.has_type () && o.has_price_sat ());
+    }
 
-/**
- * Updates an OrderbookByAsset proto with the given order.  This adds in
- * the order as bid or ask into the matching asset entry.  The bids and
- * asks fields are not kept sorted for now.
- *
- * The order itself is moved into this function, and should already be a copy
- * made prior from the orders-by-account map, with account and id added in.
- */
-void
-AddOrderForAsset (proto::OrderbookByAsset& orders, proto::Order&& o)
-{
-  CHECK (o.has_asset ());
+  std::lock_guard<std::mutex> lock(mut);
 
-  proto::OrderbookForAsset* forAsset = nullptr;
-  auto& assetMap = *orders.mutable_assets ();
-  auto mit = assetMap.find (o.asset ());
-  if (mit != assetMap.end ())
-    forAsset = &mit->second;
-  else
+  auto mit = orders.find (account);
+  if (mit == orders.end () || !mit->second.hasSequence
+        || mit->second.sequence + 1 != delta.sequence ())
     {
-      forAsset = &assetMap[o.asset ()];
-      forAsset->set_asset (o.asset ());
+      VLOG (1)
+          << "Ignoring delta " << delta.sequence () << " for " << account
+          << " not matching our state";
+      return false;
     }
-  o.clear_asset ();
 
-  const auto type = o.type ();
-  o.clear_type ();
-  switch (type)
+  VLOG (1)
+      << "Applying delta " << delta.sequence ()
+      << " to orders of " << account;
+
+  auto& acc = mit->second;
+  MarkUpdated (account, acc, false);
+  acc.sequence = delta.sequence ();
+
+  for (const auto id : delta.removed ())
     {
-    case proto::Order::ASK:
-      forAsset->add_asks ()->Swap (&o);
-      break;
-    case proto::Order::BID:
-      forAsset->add_bids ()->Swap (&o);
-      break;
-    default:
-      LOG (FATAL) << "Unexpected order type: " << static_cast<int> (type);
+      const auto eit = acc.entries.find (id);
+      if (eit == acc.entries.end ())
+        continue;
+      RemoveEntry (eit->second);
+      acc.entries.erase (eit);
+    }
+
+  for (auto& entry : *delta.mutable_upserted ())
+    {
+      const auto eit = acc.entries.find (entry.first);
+      if (eit != acc.entries.end ())
+        {
+          RemoveEntry (eit->second);
+          acc.entries.erase (eit);
+        }
+      InsertOrder (account, entry.first, std::move (entry.second), acc);
     }
+
+  PublishSnapshot ();
+  return true;
+}
+
+std::shared_ptr<const OrderBook::LevelSnapshot>
+OrderBook::BuildLevel (const SortedOrders& side, const Levels& levels,
+                       const uint64_t price, const bool reverse)
+{
+  const auto lit = levels.find (price);
+  if (lit == levels.end ())
+    return nullptr;
+
+  auto res = std::make_shared<LevelSnapshot> ();
+  res->level = lit->second;
+  res->orders.reserve (lit->second.orders);
+
+  for (auto it = side.lower_bound (OrderKey (price, "", 0));
+       it != side.end () && it->first.price == price; ++it)
+    res->orders.push_back (it->second);
+  CHECK_EQ (res->orders.size (), lit->second.orders);
+
+  /* Bids are returned by decreasing price, which corresponds to the
+     reverse order of the index keys also within a level.  */
+  if (reverse)
+    std::reverse (res->orders.begin (), res->orders.end ());
+
+  return res;
 }
 
-/**
- * Sorts all bids and asks in the order lists.  Ties are broken by
- * account and ID.
- */
 void
-SortByPrices (proto::OrderbookByAsset& orders)
+OrderBook::CopyForAsset (const AssetSnapshot& data,
+                         proto::OrderbookForAsset& res)
 {
-  const auto byPriceAsc = [] (const proto::Order& a, const proto::Order& b)
+  CopyLevels (data.bids.rbegin (), data.bids.rend (), *res.mutable_bids ());
+  CopyLevels (data.asks.begin (), data.asks.end (), *res.mutable_asks ());
+}
+
+void
+OrderBook::PublishSnapshot ()
+{
+  if (dirtyLevels.empty ())
+    return;
+
+  /* Only the touched price levels are rebuilt.  The other levels of the
+     dirty assets, as well as all other assets, are shared with the
+     previous snapshot.  */
+  const auto& interner = AssetInterner::Global ();
+  auto updated = std::make_shared<Snapshot> (*GetSnapshot ());
+  for (const auto& entry : dirtyLevels)
     {
-      CHECK (a.has_price_sat () && a.has_account () && a.has_id ());
-      CHECK (b.has_price_sat () && b.has_account () && b.has_id ());
+      const Asset& asset = interner.Get (entry.first);
+      const auto mit = byAsset.find (entry.first);
+      if (mit == byAsset.end ())
+        {
+          updated->erase (asset);
+          continue;
+        }
+      const auto& data = mit->second;
 
-      if (a.price_sat () != b.price_sat ())
-        return a.price_sat () < b.price_sat ();
-      if (a.account () != b.account ())
-        return a.account () < b.account ();
-      return a.id () < b.id ();
-    };
+      auto forAsset = std::make_shared<AssetSnapshot> ();
+      const auto sit = updated->find (asset);
+      if (sit != updated->end ())
+        *forAsset = *sit->second;
 
-  for (auto& entry : *orders.mutable_assets ())
-    {
-      auto& asks = *entry.second.mutable_asks ();
-      std::sort (asks.begin (), asks.end (), byPriceAsc);
-      auto& bids = *entry.second.mutable_bids ();
-      std::sort (bids.rbegin (), bids.rend (), byPriceAsc);
+      const auto updateSide = [] (const SortedOrders& side,
+                                  const Levels& levels,
+                                  const std::set<uint64_t>& prices,
+                                  const bool reverse, SideSnapshot& out)
+        {
+          for (const auto p : prices)
+            {
+              auto lvl = BuildLevel (side, levels, p, reverse);
+              if (lvl == nullptr)
+                out.erase (p);
+              else
+                out[p] = std::move (lvl);
+            }
+        };
+      updateSide (data.bids, data.bidLevels, entry.second.bids, true,
+                  forAsset->bids);
+      updateSide (data.asks, data.askLevels, entry.second.asks, false,
+                  forAsset->asks);
+
+      (*updated)[asset] = std::move (forAsset);
     }
+  dirtyLevels.clear ();
+
+  std::shared_ptr<const Snapshot> published = std::move (updated);
+  std::atomic_store (&snapshot, std::move (published));
+  version.Bump ();
 }
 
-} // anonymous namespace
+std::shared_ptr<const OrderBook::Snapshot>
+OrderBook::GetSnapshot () const
+{
+  return std::atomic_load (&snapshot);
+}
+
+proto::OrderbookForAsset
+OrderBook::GetForAsset (const Asset& asset) const
+{
+  proto::OrderbookForAsset res;
+  res.set_asset (asset);
+
+  const auto snap = GetSnapshot ();
+  const auto mit = snap->find (asset);
+  if (mit != snap->end ())
+    CopyForAsset (*mit->second, res);
+
+  return res;
+}
 
 proto::OrderbookByAsset
-OrderBook::InternalGetByAsset (const Asset* asset) const
+OrderBook::GetByAsset () const
 {
   proto::OrderbookByAsset res;
-  for (const auto& accounts : orders)
+  auto& assetMap = *res.mutable_assets ();
+
+  const auto snap = GetSnapshot ();
+  for (const auto& entry : *snap)
+    {
+      auto& forAsset = assetMap[entry.first];
+      forAsset.set_asset (entry.first);
+      CopyForAsset (*entry.second, forAsset);
+    }
+
+  return res;
+}
+
+proto::DepthForAsset
+OrderBook::GetDepthForAsset (const Asset& asset) const
+{
+  return GetDepthForAsset (asset, proto::OrdersOfAccount ());
+}
+
+proto::DepthForAsset
+OrderBook::GetDepthForAsset (const Asset& asset,
+                             const proto::OrdersOfAccount& excluded) const
+{
+  proto::DepthForAsset res;
+  res.set_asset (asset);
+
+  const auto snap = GetSnapshot ();
+  const auto mit = snap->find (asset);
+  if (mit == snap->end ())
+    return res;
+
+  /* Only the levels at which the excluded account has orders need to be
+     scanned and corrected, all others are taken from the aggregates.  */
+  std::set<uint64_t> excludedBids, excludedAsks;
+  for (const auto& entry : excluded.orders ())
     {
-      const std::string& acc = accounts.first;
-      for (const auto& order : accounts.second.orders.orders ())
+      const auto& o = entry.second;
+      if (o.asset () != asset)
+        continue;
+
+      switch (o.type ())
         {
-          CHECK (order.second.has_asset ());
-          if (asset != nullptr && order.second.asset () != *asset)
-            continue;
-
-          proto::Order o = order.second;
-          o.set_account (acc);
-          o.set_id (order.first);
-          AddOrderForAsset (res, std::move (o));
+        case proto::Order::BID:
+          excludedBids.insert (o.price_sat ());
+          break;
+        case proto::Order::ASK:
+          excludedAsks.insert (o.price_sat ());
+          break;
+        default:
+          break;
         }
     }
 
-  SortByPrices (res);
+  const auto copyLevel = [&excluded] (const SideSnapshot::value_type& entry,
+                                      const std::set<uint64_t>& toCorrect,
+                                      google::protobuf::RepeatedPtrField<
+                                          proto::PriceLevel>& out)
+    {
+      Level level = entry.second->level;
+      if (toCorrect.count (entry.first) > 0)
+        for (const auto& o : entry.second->orders)
+          if (o.account () == excluded.account ())
+            {
+              level.units -= o.max_units ();
+              --level.orders;
+            }
+
+      if (level.orders == 0)
+        return;
+
+      auto& l = *out.Add ();
+      l.set_price_sat (entry.first);
+      l.set_units (level.units);
+      l.set_orders (level.orders);
+    };
+
+  const auto& data = *mit->second;
+  for (auto it = data.bids.rbegin (); it != data.bids.rend (); ++it)
+    copyLevel (*it, excludedBids, *res.mutable_bids ());
+  for (const auto& entry : data.asks)
+    copyLevel (entry, excludedAsks, *res.mutable_asks ());
 
   return res;
 }
 
-proto::OrderbookForAsset
-OrderBook::GetForAsset (const Asset& asset) const
+proto::OrderbookByAsset
+OrderBook::SelectForAssets (const std::vector<Asset>& assets,
+                            const OrderSelector& select) const
 {
-  auto allAssets = InternalGetByAsset (&asset);
+  proto::OrderbookByAsset res;
+  auto& assetMap = *res.mutable_assets ();
 
-  if (allAssets.assets ().empty ())
+  const auto snap = GetSnapshot ();
+  for (const auto& a : assets)
     {
-      proto::OrderbookForAsset res;
-      res.set_asset (asset);
-      return res;
-    }
+      auto& forAsset = assetMap[a];
+      forAsset.set_asset (a);
 
-  CHECK_EQ (allAssets.assets_size (), 1);
-  auto mit = allAssets.mutable_assets ()->find (asset);
-  CHECK (mit != allAssets.mutable_assets ()->end ());
-  CHECK_EQ (mit->first, asset);
-  CHECK_EQ (mit->second.asset (), asset);
+      const auto mit = snap->find (a);
+      if (mit != snap->end ())
+        select (*mit->second, forAsset);
+    }
 
-  proto::OrderbookForAsset res;
-  res.Swap (&mit->second);
   return res;
 }
 
 proto::OrderbookByAsset
-OrderBook::GetByAsset () const
+OrderBook::GetBestForAssets (const std::vector<Asset>& assets,
+                             const unsigned levels) const
+{
+  return GetBestForAssets (assets, levels, "");
+}
+
+proto::OrderbookByAsset
+OrderBook::GetBestForAssets (const std::vector<Asset>& assets,
+                             const unsigned levels,
+                             const std::string& excluded) const
 {
-  return InternalGetByAsset (nullptr);
+  return SelectForAssets (assets,
+      [levels, &excluded] (const AssetSnapshot& full,
+                           proto::OrderbookForAsset& out)
+    {
+      CopyBestLevels (full.bids.rbegin (), full.bids.rend (), levels,
+                      excluded, *out.mutable_bids ());
+      CopyBestLevels (full.asks.begin (), full.asks.end (), levels,
+                      excluded, *out.mutable_asks ());
+    });
+}
+
+proto::OrderbookByAsset
+OrderBook::GetRangeForAssets (const std::vector<Asset>& assets,
+                              const uint64_t minPrice,
+                              const uint64_t maxPrice) const
+{
+  return SelectForAssets (assets,
+      [minPrice, maxPrice] (const AssetSnapshot& full,
+                            proto::OrderbookForAsset& out)
+    {
+      CopyPriceRange (full.bids, true, minPrice, maxPrice,
+                      *out.mutable_bids ());
+      CopyPriceRange (full.asks, false, minPrice, maxPrice,
+                      *out.mutable_asks ());
+    });
 }
 
 } // namespace democrit
@@ -0,0 +1,94 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/orderbook.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+namespace democrit
+{
+namespace
+{
+
+/**
+ * Applies argument ranges for the total number of orders in the book
+ * to a benchmark.
+ */
+void
+OrderbookSizes (benchmark::internal::Benchmark* b)
+{
+  b->RangeMultiplier (10)->Range (1'000, 100'000);
+}
+
+/**
+ * Updates the orders of one account in an orderbook filled with the
+ * given number of orders.  Each update changes the prices of all the
+ * account's orders, so that the affected assets are recomputed.
+ */
+void
+UpdateOrders (benchmark::State& state)
+{
+  BenchOrderbook ob;
+  FillOrderbook (ob, state.range (0));
+
+  unsigned seed = 0;
+  for (auto _ : state)
+    {
+      state.PauseTiming ();
+      auto upd = BenchOrders (GetBenchAccount (0), BENCH_ORDERS_PER_ACCOUNT,
+                              ++seed);
+      state.ResumeTiming ();
+
+      ob.UpdateOrders (std::move (upd));
+    }
+}
+BENCHMARK (UpdateOrders)->Apply (OrderbookSizes);
+
+/**
+ * Queries the full orderbook by asset.
+ */
+void
+GetByAsset (benchmark::State& state)
+{
+  BenchOrderbook ob;
+  FillOrderbook (ob, state.range (0));
+
+  for (auto _ : state)
+    benchmark::DoNotOptimize (ob.GetByAsset ());
+}
+BENCHMARK (GetByAsset)->Apply (OrderbookSizes);
+
+/**
+ * Queries the orderbook of a single asset.
+ */
+void
+GetForAsset (benchmark::State& state)
+{
+  BenchOrderbook ob;
+  FillOrderbook (ob, state.range (0));
+
+  const auto asset = GetBenchAsset (0);
+  for (auto _ : state)
+    benchmark::DoNotOptimize (ob.GetForAsset (asset));
+}
+BENCHMARK (GetForAsset)->Apply (OrderbookSizes);
+
+} // anonymous namespace
+} // namespace democrit
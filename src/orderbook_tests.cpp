@@ -23,7 +23,10 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
+#include <atomic>
 #include <chrono>
+#include <thread>
+#include <vector>
 
 namespace democrit
 {
@@ -46,6 +49,17 @@ protected:
     ob.UpdateOrders (ParseTextProto<proto::OrdersOfAccount> (str));
   }
 
+  /**
+   * Calls UpdateOrdersDelta with data given as text proto.
+   */
+  static bool
+  UpdateOrdersDelta (OrderBook& ob, const std::string& account,
+                     const std::string& str)
+  {
+    return ob.UpdateOrdersDelta (account,
+                                 ParseTextProto<proto::OrdersDelta> (str));
+  }
+
 };
 
 class OrderbookWithoutTimeout : public OrderBook
@@ -233,6 +247,548 @@ TEST_F (OrderbookTests, UpdatesForAccount)
   )"));
 }
 
+TEST_F (OrderbookTests, RemovingAccount)
+{
+  OrderbookWithoutTimeout o;
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "silver" type: BID price_sat: 5 }
+      }
+  )");
+  UpdateOrders (o, R"(
+    account: "andy"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+
+  UpdateOrders (o, R"(
+    account: "domob"
+  )");
+
+  EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            asks: { account: "andy" id: 1 price_sat: 100 }
+          }
+      }
+  )"));
+  EXPECT_THAT (o.GetForAsset ("silver"), EqualsOrdersForAsset (R"(
+    asset: "silver"
+  )"));
+}
+
+TEST_F (OrderbookTests, Deltas)
+{
+  OrderbookWithoutTimeout o;
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    sequence: 10
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "silver" type: BID price_sat: 5 }
+      }
+  )");
+
+  ASSERT_TRUE (UpdateOrdersDelta (o, "domob", R"(
+    sequence: 11
+    upserted:
+      {
+        key: 1
+        value: { asset: "gold" type: BID price_sat: 50 }
+      }
+    upserted:
+      {
+        key: 3
+        value: { asset: "gold" type: ASK price_sat: 200 }
+      }
+    removed: 2
+    removed: 42
+  )"));
+
+  EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            bids: { account: "domob" id: 1 price_sat: 50 }
+            asks: { account: "domob" id: 3 price_sat: 200 }
+          }
+      }
+  )"));
+
+  ASSERT_TRUE (UpdateOrdersDelta (o, "domob", R"(
+    sequence: 12
+    removed: 1
+    removed: 3
+  )"));
+  EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (""));
+
+  ASSERT_TRUE (UpdateOrdersDelta (o, "domob", R"(
+    sequence: 13
+    upserted:
+      {
+        key: 4
+        value: { asset: "silver" type: ASK price_sat: 7 }
+      }
+  )"));
+  EXPECT_THAT (o.GetForAsset ("silver"), EqualsOrdersForAsset (R"(
+    asset: "silver"
+    asks: { account: "domob" id: 4 price_sat: 7 }
+  )"));
+}
+
+TEST_F (OrderbookTests, DeltaSequenceMismatch)
+{
+  OrderbookWithoutTimeout o;
+
+  constexpr const char* delta = R"(
+    sequence: 6
+    removed: 1
+  )";
+
+  /* Unknown account.  */
+  EXPECT_FALSE (UpdateOrdersDelta (o, "domob", delta));
+
+  /* Account without sequence number.  */
+  UpdateOrders (o, R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+  EXPECT_FALSE (UpdateOrdersDelta (o, "domob", delta));
+
+  /* Gap in the sequence.  */
+  UpdateOrders (o, R"(
+    account: "domob"
+    sequence: 4
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+  EXPECT_FALSE (UpdateOrdersDelta (o, "domob", delta));
+
+  EXPECT_THAT (o.GetForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    asks: { account: "domob" id: 1 price_sat: 100 }
+  )"));
+
+  /* After a full update, it works.  */
+  UpdateOrders (o, R"(
+    account: "domob"
+    sequence: 5
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+  EXPECT_TRUE (UpdateOrdersDelta (o, "domob", delta));
+  EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (""));
+}
+
+class OrderbookPartialQueryTests : public OrderbookTests
+{
+
+protected:
+
+  OrderbookWithoutTimeout o;
+
+  OrderbookPartialQueryTests ()
+  {
+    UpdateOrders (o, R"(
+      account: "domob"
+      orders:
+        {
+          key: 1
+          value: { asset: "gold" type: ASK price_sat: 100 }
+        }
+      orders:
+        {
+          key: 2
+          value: { asset: "gold" type: ASK price_sat: 110 }
+        }
+      orders:
+        {
+          key: 3
+          value: { asset: "gold" type: BID price_sat: 50 }
+        }
+      orders:
+        {
+          key: 4
+          value: { asset: "silver" type: BID price_sat: 5 }
+        }
+    )");
+    UpdateOrders (o, R"(
+      account: "andy"
+      orders:
+        {
+          key: 1
+          value: { asset: "gold" type: ASK price_sat: 100 }
+        }
+      orders:
+        {
+          key: 2
+          value: { asset: "gold" type: BID price_sat: 60 }
+        }
+      orders:
+        {
+          key: 3
+          value: { asset: "gold" type: BID price_sat: 40 }
+        }
+    )");
+  }
+
+};
+
+TEST_F (OrderbookPartialQueryTests, BestLevels)
+{
+  EXPECT_THAT (o.GetBestForAssets ({"gold", "silver", "copper"}, 1),
+               EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            bids: { account: "andy" id: 2 price_sat: 60 }
+            asks: { account: "andy" id: 1 price_sat: 100 }
+            asks: { account: "domob" id: 1 price_sat: 100 }
+          }
+      }
+    assets:
+      {
+        key: "silver"
+        value:
+          {
+            asset: "silver"
+            bids: { account: "domob" id: 4 price_sat: 5 }
+          }
+      }
+    assets:
+      {
+        key: "copper"
+        value: { asset: "copper" }
+      }
+  )"));
+
+  EXPECT_THAT (o.GetBestForAssets ({"gold"}, 2), EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            bids: { account: "andy" id: 2 price_sat: 60 }
+            bids: { account: "domob" id: 3 price_sat: 50 }
+            asks: { account: "andy" id: 1 price_sat: 100 }
+            asks: { account: "domob" id: 1 price_sat: 100 }
+            asks: { account: "domob" id: 2 price_sat: 110 }
+          }
+      }
+  )"));
+
+  EXPECT_THAT (o.GetBestForAssets ({"gold"}, 0), EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value: { asset: "gold" }
+      }
+  )"));
+}
+
+TEST_F (OrderbookPartialQueryTests, BestLevelsExcludingAccount)
+{
+  /* The best bid level only has orders of andy, so it is skipped and
+     does not count as one of the levels.  */
+  EXPECT_THAT (o.GetBestForAssets ({"gold"}, 1, "andy"),
+               EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            bids: { account: "domob" id: 3 price_sat: 50 }
+            asks: { account: "domob" id: 1 price_sat: 100 }
+          }
+      }
+  )"));
+}
+
+TEST_F (OrderbookPartialQueryTests, PriceRange)
+{
+  EXPECT_THAT (o.GetRangeForAssets ({"gold", "silver"}, 50, 100),
+               EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            bids: { account: "andy" id: 2 price_sat: 60 }
+            bids: { account: "domob" id: 3 price_sat: 50 }
+            asks: { account: "andy" id: 1 price_sat: 100 }
+            asks: { account: "domob" id: 1 price_sat: 100 }
+          }
+      }
+    assets:
+      {
+        key: "silver"
+        value: { asset: "silver" }
+      }
+  )"));
+
+  EXPECT_THAT (o.GetRangeForAssets ({"gold"}, 105, 1'000),
+               EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value:
+          {
+            asset: "gold"
+            asks: { account: "domob" id: 2 price_sat: 110 }
+          }
+      }
+  )"));
+
+  EXPECT_THAT (o.GetRangeForAssets ({"gold"}, 70, 90),
+               EqualsOrdersByAsset (R"(
+    assets:
+      {
+        key: "gold"
+        value: { asset: "gold" }
+      }
+  )"));
+}
+
+TEST_F (OrderbookTests, Depth)
+{
+  OrderbookWithoutTimeout o;
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    sequence: 1
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 2 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "gold" type: BID price_sat: 50 max_units: 1 }
+      }
+    orders:
+      {
+        key: 3
+        value: { asset: "gold" type: BID price_sat: 60 max_units: 4 }
+      }
+  )");
+  UpdateOrders (o, R"(
+    account: "andy"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 3 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "silver" type: ASK price_sat: 1 max_units: 3 }
+      }
+  )");
+
+  EXPECT_THAT (o.GetDepthForAsset ("gold"), EqualsDepthForAsset (R"(
+    asset: "gold"
+    bids: { price_sat: 60 units: 4 orders: 1 }
+    bids: { price_sat: 50 units: 1 orders: 1 }
+    asks: { price_sat: 100 units: 5 orders: 2 }
+  )"));
+  EXPECT_THAT (o.GetDepthForAsset ("copper"), EqualsDepthForAsset (R"(
+    asset: "copper"
+  )"));
+
+  ASSERT_TRUE (UpdateOrdersDelta (o, "domob", R"(
+    sequence: 2
+    upserted:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 10 }
+      }
+    removed: 3
+  )"));
+  UpdateOrders (o, R"(
+    account: "andy"
+  )");
+
+  EXPECT_THAT (o.GetDepthForAsset ("gold"), EqualsDepthForAsset (R"(
+    asset: "gold"
+    bids: { price_sat: 50 units: 1 orders: 1 }
+    asks: { price_sat: 100 units: 10 orders: 1 }
+  )"));
+  EXPECT_THAT (o.GetDepthForAsset ("silver"), EqualsDepthForAsset (R"(
+    asset: "silver"
+  )"));
+}
+
+TEST_F (OrderbookTests, DepthExcludingAccount)
+{
+  OrderbookWithoutTimeout o;
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 2 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "gold" type: BID price_sat: 50 max_units: 1 }
+      }
+  )");
+  UpdateOrders (o, R"(
+    account: "andy"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 3 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "gold" type: BID price_sat: 40 max_units: 5 }
+      }
+  )");
+
+  const auto excluded = ParseTextProto<proto::OrdersOfAccount> (R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 max_units: 2 }
+      }
+    orders:
+      {
+        key: 2
+        value: { asset: "gold" type: BID price_sat: 50 max_units: 1 }
+      }
+    orders:
+      {
+        key: 3
+        value: { asset: "silver" type: BID price_sat: 40 max_units: 1 }
+      }
+  )");
+
+  EXPECT_THAT (o.GetDepthForAsset ("gold", excluded),
+               EqualsDepthForAsset (R"(
+    asset: "gold"
+    bids: { price_sat: 40 units: 5 orders: 1 }
+    asks: { price_sat: 100 units: 3 orders: 1 }
+  )"));
+  EXPECT_THAT (o.GetDepthForAsset ("copper", excluded),
+               EqualsDepthForAsset (R"(
+    asset: "copper"
+  )"));
+}
+
+TEST_F (OrderbookTests, Version)
+{
+  VersionCounter parent;
+  OrderBook o(std::chrono::seconds (1'000), &parent);
+
+  const auto v = o.GetVersion ().Get ();
+  const auto vParent = parent.Get ();
+
+  /* Removing an account that does not exist changes nothing.  */
+  UpdateOrders (o, R"(
+    account: "domob"
+  )");
+  EXPECT_EQ (o.GetVersion ().Get (), v);
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+  EXPECT_GT (o.GetVersion ().Get (), v);
+  EXPECT_GT (parent.Get (), vParent);
+}
+
+TEST_F (OrderbookTests, ConcurrentReads)
+{
+  OrderbookWithoutTimeout o;
+
+  std::atomic<bool> done(false);
+  std::vector<std::thread> readers;
+  for (unsigned i = 0; i < 4; ++i)
+    readers.emplace_back ([&o, &done] ()
+      {
+        while (!done)
+          {
+            /* Each snapshot must be consistent, i.e. contain either
+               both or none of the orders.  */
+            const auto book = o.GetForAsset ("gold");
+            ASSERT_EQ (book.bids_size (), book.asks_size ());
+          }
+      });
+
+  for (unsigned i = 0; i < 1'000; ++i)
+    UpdateOrders (o, i % 2 == 0 ? R"(
+      account: "domob"
+      orders:
+        {
+          key: 1
+          value: { asset: "gold" type: ASK price_sat: 100 }
+        }
+      orders:
+        {
+          key: 2
+          value: { asset: "gold" type: BID price_sat: 10 }
+        }
+    )" : R"(
+      account: "domob"
+    )");
+
+  done = true;
+  for (auto& t : readers)
+    t.join ();
+}
+
 TEST_F (OrderbookTests, Timeout)
 {
   constexpr auto TIMEOUT = std::chrono::milliseconds (100);
@@ -281,6 +837,51 @@ TEST_F (OrderbookTests, Timeout)
   EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (""));
 }
 
+TEST_F (OrderbookTests, DeltaRefreshesTimeout)
+{
+  constexpr auto TIMEOUT = std::chrono::milliseconds (100);
+  OrderBook o(TIMEOUT);
+
+  UpdateOrders (o, R"(
+    account: "domob"
+    sequence: 1
+    orders:
+      {
+        key: 1
+        value: { asset: "gold" type: ASK price_sat: 100 }
+      }
+  )");
+  for (unsigned i = 0; i < 10; ++i)
+    UpdateOrders (o, R"(
+      account: "andy"
+      orders:
+        {
+          key: 1
+          value: { asset: "gold" type: BID price_sat: 10 }
+        }
+    )");
+
+  std::this_thread::sleep_for (0.75 * TIMEOUT);
+  ASSERT_TRUE (UpdateOrdersDelta (o, "domob", R"(
+    sequence: 2
+    upserted:
+      {
+        key: 2
+        value: { asset: "gold" type: ASK price_sat: 200 }
+      }
+  )"));
+  std::this_thread::sleep_for (0.75 * TIMEOUT);
+
+  EXPECT_THAT (o.GetForAsset ("gold"), EqualsOrdersForAsset (R"(
+    asset: "gold"
+    asks: { account: "domob" id: 1 price_sat: 100 }
+    asks: { account: "domob" id: 2 price_sat: 200 }
+  )"));
+
+  std::this_thread::sleep_for (TIMEOUT);
+  EXPECT_THAT (o.GetByAsset (), EqualsOrdersByAsset (""));
+}
+
 /* ************************************************************************** */
 
 } // anonymous namespace
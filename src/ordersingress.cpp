@@ -0,0 +1,127 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/ordersingress.hpp"
+
+#include "private/metrics.hpp"
+
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+bool
+OrdersIngress::IsFull () const
+{
+  return full.size () + numDeltas >= maxPending;
+}
+
+OrdersIngress::Result
+OrdersIngress::AddFull (const std::string& account,
+                        proto::OrdersOfAccount&& data)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  ++stats.received;
+  Metrics::Global ().Increment ("orders.ingress.received");
+
+  auto mit = full.find (account);
+  if (mit != full.end ())
+    {
+      VLOG (1) << "Coalescing pending order update from " << account;
+      mit->second = std::move (data);
+      ++stats.coalesced;
+      Metrics::Global ().Increment ("orders.ingress.coalesced");
+      return Result::COALESCED;
+    }
+
+  if (IsFull ())
+    {
+      VLOG (1) << "Ingress queue is full, dropping update from " << account;
+      ++stats.dropped;
+      Metrics::Global ().Increment ("orders.ingress.dropped");
+      return Result::DROPPED;
+    }
+
+  full.emplace (account, std::move (data));
+  return Result::QUEUED;
+}
+
+bool
+OrdersIngress::TakeFull (const std::string& account,
+                         proto::OrdersOfAccount& data)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  auto mit = full.find (account);
+  if (mit == full.end ())
+    return false;
+
+  data = std::move (mit->second);
+  full.erase (mit);
+  return true;
+}
+
+void
+OrdersIngress::DropFull (const std::string& account)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  full.erase (account);
+}
+
+OrdersIngress::Result
+OrdersIngress::AddDelta ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  ++stats.received;
+  Metrics::Global ().Increment ("orders.ingress.received");
+
+  if (IsFull ())
+    {
+      VLOG (1) << "Ingress queue is full, dropping order delta";
+      ++stats.dropped;
+      Metrics::Global ().Increment ("orders.ingress.dropped");
+      return Result::DROPPED;
+    }
+
+  ++numDeltas;
+  return Result::QUEUED;
+}
+
+void
+OrdersIngress::FinishDelta ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  CHECK_GT (numDeltas, 0) << "No delta update is pending";
+  --numDeltas;
+}
+
+size_t
+OrdersIngress::GetNumPending () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return full.size () + numDeltas;
+}
+
+OrdersIngress::Stats
+OrdersIngress::GetStats () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return stats;
+}
+
+} // namespace democrit
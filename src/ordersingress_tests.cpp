@@ -0,0 +1,150 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/ordersingress.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+namespace democrit
+{
+namespace
+{
+
+class OrdersIngressTests : public testing::Test
+{
+
+protected:
+
+  OrdersIngress ingress;
+
+  OrdersIngressTests ()
+    : ingress(3)
+  {}
+
+  /**
+   * Adds a full update given as text proto.
+   */
+  OrdersIngress::Result
+  AddFull (const std::string& account, const std::string& str)
+  {
+    return ingress.AddFull (account,
+                            ParseTextProto<proto::OrdersOfAccount> (str));
+  }
+
+  /**
+   * Expects that the given stats counters are set.
+   */
+  void
+  ExpectStats (const uint64_t received, const uint64_t coalesced,
+               const uint64_t dropped) const
+  {
+    const auto stats = ingress.GetStats ();
+    EXPECT_EQ (stats.received, received);
+    EXPECT_EQ (stats.coalesced, coalesced);
+    EXPECT_EQ (stats.dropped, dropped);
+  }
+
+};
+
+TEST_F (OrdersIngressTests, TakeFull)
+{
+  proto::OrdersOfAccount data;
+  EXPECT_FALSE (ingress.TakeFull ("domob", data));
+
+  EXPECT_EQ (AddFull ("domob", "sequence: 1"),
+             OrdersIngress::Result::QUEUED);
+  EXPECT_EQ (ingress.GetNumPending (), 1);
+
+  EXPECT_FALSE (ingress.TakeFull ("andy", data));
+  ASSERT_TRUE (ingress.TakeFull ("domob", data));
+  EXPECT_THAT (data, EqualsOrdersOfAccount ("sequence: 1"));
+  EXPECT_EQ (ingress.GetNumPending (), 0);
+  EXPECT_FALSE (ingress.TakeFull ("domob", data));
+
+  ExpectStats (1, 0, 0);
+}
+
+TEST_F (OrdersIngressTests, LatestWins)
+{
+  EXPECT_EQ (AddFull ("domob", "sequence: 1"),
+             OrdersIngress::Result::QUEUED);
+  EXPECT_EQ (AddFull ("andy", "sequence: 10"),
+             OrdersIngress::Result::QUEUED);
+  EXPECT_EQ (AddFull ("domob", "sequence: 2"),
+             OrdersIngress::Result::COALESCED);
+  EXPECT_EQ (AddFull ("domob", "sequence: 3"),
+             OrdersIngress::Result::COALESCED);
+  EXPECT_EQ (ingress.GetNumPending (), 2);
+
+  proto::OrdersOfAccount data;
+  ASSERT_TRUE (ingress.TakeFull ("domob", data));
+  EXPECT_THAT (data, EqualsOrdersOfAccount ("sequence: 3"));
+  ASSERT_TRUE (ingress.TakeFull ("andy", data));
+  EXPECT_THAT (data, EqualsOrdersOfAccount ("sequence: 10"));
+
+  EXPECT_EQ (AddFull ("domob", "sequence: 4"),
+             OrdersIngress::Result::QUEUED);
+
+  ExpectStats (5, 2, 0);
+}
+
+TEST_F (OrdersIngressTests, Bounded)
+{
+  EXPECT_EQ (AddFull ("a", ""), OrdersIngress::Result::QUEUED);
+  EXPECT_EQ (ingress.AddDelta (), OrdersIngress::Result::QUEUED);
+  EXPECT_EQ (AddFull ("b", ""), OrdersIngress::Result::QUEUED);
+
+  EXPECT_EQ (AddFull ("c", ""), OrdersIngress::Result::DROPPED);
+  EXPECT_EQ (ingress.AddDelta (), OrdersIngress::Result::DROPPED);
+  EXPECT_EQ (AddFull ("a", "sequence: 5"), OrdersIngress::Result::COALESCED);
+  EXPECT_EQ (ingress.GetNumPending (), 3);
+
+  ingress.FinishDelta ();
+  EXPECT_EQ (AddFull ("c", ""), OrdersIngress::Result::QUEUED);
+
+  proto::OrdersOfAccount data;
+  ASSERT_TRUE (ingress.TakeFull ("b", data));
+  EXPECT_EQ (ingress.AddDelta (), OrdersIngress::Result::QUEUED);
+
+  ExpectStats (8, 1, 2);
+}
+
+TEST_F (OrdersIngressTests, DropFull)
+{
+  EXPECT_EQ (AddFull ("domob", "sequence: 1"),
+             OrdersIngress::Result::QUEUED);
+  ingress.DropFull ("andy");
+  EXPECT_EQ (ingress.GetNumPending (), 1);
+
+  ingress.DropFull ("domob");
+  EXPECT_EQ (ingress.GetNumPending (), 0);
+  proto::OrdersOfAccount data;
+  EXPECT_FALSE (ingress.TakeFull ("domob", data));
+
+  /* A new update after the drop is queued again, not coalesced.  */
+  EXPECT_EQ (AddFull ("domob", "sequence: 2"),
+             OrdersIngress::Result::QUEUED);
+  ASSERT_TRUE (ingress.TakeFull ("domob", data));
+  EXPECT_THAT (data, EqualsOrdersOfAccount ("sequence: 2"));
+  ExpectStats (2, 0, 0);
+}
+
+} // anonymous namespace
+} // namespace democrit
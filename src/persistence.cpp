@@ -0,0 +1,345 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/persistence.hpp"
+
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/util/delimited_message_util.h>
+
+#include <glog/logging.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace democrit
+{
+
+namespace
+{
+
+/**
+ * Fsyncs the given file descriptor, CHECK-failing if it does not work.
+ * If we can not persist the state, there is no safe way to continue.
+ */
+void
+FsyncOrDie (const int fd, const std::string& what)
+{
+  CHECK_EQ (fsync (fd), 0)
+      << "Failed to sync " << what << ": " << std::strerror (errno);
+}
+
+/**
+ * Returns the position of the trade matching the given one (by counterparty
+ * and order) in the state's active trades, or -1 if there is none.
+ */
+int
+FindTrade (const proto::State& s, const proto::TradeState& t)
+{
+  for (int i = 0; i < s.trades_size (); ++i)
+    {
+      const auto& cur = s.trades (i);
+      if (cur.counterparty () == t.counterparty ()
+            && cur.order ().account () == t.order ().account ()
+            && cur.order ().id () == t.order ().id ())
+        return i;
+    }
+
+  return -1;
+}
+
+} // anonymous namespace
+
+StatePersistence::~StatePersistence ()
+{
+  syncer.reset ();
+  Sync ();
+
+  std::lock_guard<std::mutex> lock(mut);
+  if (journal != -1)
+    close (journal);
+}
+
+std::string
+StatePersistence::GetSnapshotPath () const
+{
+  return dir + "/snapshot";
+}
+
+std::string
+StatePersistence::GetJournalPath () const
+{
+  return dir + "/journal";
+}
+
+void
+StatePersistence::OpenJournal (const bool truncate)
+{
+  if (journal != -1)
+    close (journal);
+
+  int flags = O_WRONLY | O_CREAT | O_APPEND;
+  if (truncate)
+    flags |= O_TRUNC;
+
+  const auto path = GetJournalPath ();
+  journal = open (path.c_str (), flags, 0600);
+  CHECK_NE (journal, -1)
+      << "Failed to open journal " << path << ": " << std::strerror (errno);
+
+  numEntries = 0;
+  dirty = false;
+}
+
+void
+StatePersistence::InternalWriteSnapshot (const proto::State& s)
+{
+  VLOG (1) << "Writing state snapshot to " << dir;
+
+  /* We write the new snapshot to a temporary file, sync it and only then
+     rename it over the old one.  This way, there is always a consistent
+     snapshot on disk, and the journal is only cleared afterwards.  */
+  const auto path = GetSnapshotPath ();
+  const auto tmpPath = path + ".tmp";
+
+  const int fd = open (tmpPath.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  CHECK_NE (fd, -1)
+      << "Failed to open " << tmpPath << ": " << std::strerror (errno);
+  CHECK (s.SerializeToFileDescriptor (fd))
+      << "Failed to write snapshot to " << tmpPath;
+  FsyncOrDie (fd, tmpPath);
+  close (fd);
+
+  CHECK_EQ (std::rename (tmpPath.c_str (), path.c_str ()), 0)
+      << "Failed to rename snapshot: " << std::strerror (errno);
+
+  const int dirFd = open (dir.c_str (), O_RDONLY);
+  CHECK_NE (dirFd, -1)
+      << "Failed to open " << dir << ": " << std::strerror (errno);
+  FsyncOrDie (dirFd, dir);
+  close (dirFd);
+
+  OpenJournal (true);
+}
+
+void
+StatePersistence::Sync ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  if (journal == -1 || !dirty)
+    return;
+
+  FsyncOrDie (journal, GetJournalPath ());
+  dirty = false;
+}
+
+bool
+StatePersistence::Load (proto::State& s)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  bool found = false;
+
+  const auto snapshotPath = GetSnapshotPath ();
+  const int snapFd = open (snapshotPath.c_str (), O_RDONLY);
+  if (snapFd != -1)
+    {
+      proto::State loaded;
+      CHECK (loaded.ParseFromFileDescriptor (snapFd))
+          << "Failed to parse state snapshot " << snapshotPath;
+      close (snapFd);
+
+      s = std::move (loaded);
+      found = true;
+    }
+  else
+    CHECK_EQ (errno, ENOENT)
+        << "Failed to open " << snapshotPath << ": " << std::strerror (errno);
+
+  const auto journalPath = GetJournalPath ();
+  const int journalFd = open (journalPath.c_str (), O_RDONLY);
+  if (journalFd != -1)
+    {
+      unsigned replayed = 0;
+      {
+        google::protobuf::io::FileInputStream in(journalFd);
+        while (true)
+          {
+            proto::StateJournalEntry entry;
+            bool clean;
+            if (!google::protobuf::util::ParseDelimitedFromZeroCopyStream (
+                    &entry, &in, &clean))
+              {
+                LOG_IF (WARNING, !clean)
+                    << "Ignoring incomplete entry at the end of the journal";
+                break;
+              }
+
+            ApplyJournalEntry (entry, s);
+            ++replayed;
+          }
+      }
+      close (journalFd);
+
+      LOG (INFO) << "Replayed " << replayed << " journal entries";
+      if (replayed > 0)
+        found = true;
+    }
+  else
+    CHECK_EQ (errno, ENOENT)
+        << "Failed to open " << journalPath << ": " << std::strerror (errno);
+
+  /* Compact everything into a fresh snapshot.  This also makes sure that
+     a potentially incomplete last journal entry is removed, so that new
+     entries can be appended safely.  */
+  InternalWriteSnapshot (s);
+
+  return found;
+}
+
+StateChanges::TradeId
+StateChanges::GetTradeId (const proto::TradeState& t)
+{
+  return TradeId (t.counterparty (), t.order ().account (), t.order ().id ());
+}
+
+bool
+StatePersistence::Record (const StateChanges& changes,
+                          const proto::State& after)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  CHECK_NE (journal, -1) << "Load has not been called";
+
+  proto::StateJournalEntry entry;
+  if (!ComputeJournalEntry (changes, after, entry))
+    {
+      InternalWriteSnapshot (after);
+      return false;
+    }
+
+  if (entry.ByteSizeLong () == 0)
+    return false;
+
+  google::protobuf::io::FileOutputStream out(journal);
+  CHECK (google::protobuf::util::SerializeDelimitedToZeroCopyStream (
+            entry, &out))
+      << "Failed to write journal entry";
+  CHECK (out.Flush ()) << "Failed to write journal entry";
+
+  dirty = true;
+  ++numEntries;
+
+  return numEntries >= snapshotInterval;
+}
+
+void
+StatePersistence::WriteSnapshot (const proto::State& s)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  if (numEntries >= snapshotInterval)
+    InternalWriteSnapshot (s);
+}
+
+bool
+ComputeJournalEntry (const StateChanges& changes, const proto::State& after,
+                     proto::StateJournalEntry& entry)
+{
+  entry.Clear ();
+
+  if (changes.unknown || after.trade_archive_size () < changes.archiveSize)
+    return false;
+
+  const auto& orders = after.own_orders ().orders ();
+  for (const auto id : changes.orders)
+    {
+      const auto mit = orders.find (id);
+      if (mit == orders.end ())
+        entry.add_removed_orders (id);
+      else
+        (*entry.mutable_upserted_orders ())[id] = mit->second;
+    }
+
+  if (changes.nextFreeId)
+    entry.set_next_free_id (after.next_free_id ());
+
+  /* Only the touched trades are looked up, which is typically just one.
+     The lookup itself does not copy or compare full trades.  */
+  for (const auto& id : changes.trades)
+    {
+      const proto::TradeState* found = nullptr;
+      for (const auto& t : after.trades ())
+        if (StateChanges::GetTradeId (t) == id)
+          {
+            found = &t;
+            break;
+          }
+
+      if (found != nullptr)
+        *entry.add_upserted_trades () = *found;
+      else
+        {
+          auto& removed = *entry.add_removed_trades ();
+          removed.set_counterparty (std::get<0> (id));
+          removed.mutable_order ()->set_account (std::get<1> (id));
+          removed.mutable_order ()->set_id (std::get<2> (id));
+        }
+    }
+
+  for (int i = changes.archiveSize; i < after.trade_archive_size (); ++i)
+    *entry.add_archived () = after.trade_archive (i);
+
+  return true;
+}
+
+void
+ApplyJournalEntry (const proto::StateJournalEntry& entry, proto::State& s)
+{
+  if (entry.has_next_free_id ())
+    s.set_next_free_id (entry.next_free_id ());
+
+  if (!entry.upserted_orders ().empty () || entry.removed_orders_size () > 0)
+    {
+      auto& orders = *s.mutable_own_orders ()->mutable_orders ();
+      for (const auto& o : entry.upserted_orders ())
+        orders[o.first] = o.second;
+      for (const auto id : entry.removed_orders ())
+        orders.erase (id);
+    }
+
+  for (const auto& t : entry.upserted_trades ())
+    {
+      const int pos = FindTrade (s, t);
+      if (pos == -1)
+        *s.add_trades () = t;
+      else
+        *s.mutable_trades (pos) = t;
+    }
+  for (const auto& t : entry.removed_trades ())
+    {
+      const int pos = FindTrade (s, t);
+      if (pos != -1)
+        s.mutable_trades ()->DeleteSubrange (pos, 1);
+    }
+
+  for (const auto& t : entry.archived ())
+    *s.add_trade_archive () = t;
+}
+
+} // namespace democrit
@@ -0,0 +1,367 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/persistence.hpp"
+
+#include "private/state.hpp"
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <google/protobuf/util/message_differencer.h>
+
+#include <glog/logging.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+namespace democrit
+{
+namespace
+{
+
+using google::protobuf::util::MessageDifferencer;
+
+DEFINE_PROTO_MATCHER (EqualsState, State)
+
+/** Sync interval used for the persistence in tests.  */
+constexpr auto SYNC_INTV = std::chrono::milliseconds (10);
+
+/* ************************************************************************** */
+
+using JournalEntryTests = testing::Test;
+
+TEST_F (JournalEntryTests, NoChanges)
+{
+  const auto state = ParseTextProto<proto::State> (R"(
+    account: "domob"
+    next_free_id: 5
+    own_orders: { orders: { key: 1 value: { asset: "gold" } } }
+    trades: { units: 10 }
+    trade_archive: { asset: "silver" }
+  )");
+
+  proto::StateJournalEntry entry;
+  ASSERT_TRUE (ComputeJournalEntry (StateChanges (state), state, entry));
+  EXPECT_EQ (entry.ByteSizeLong (), 0);
+}
+
+TEST_F (JournalEntryTests, Roundtrip)
+{
+  const auto before = ParseTextProto<proto::State> (R"(
+    account: "domob"
+    next_free_id: 5
+    own_orders:
+      {
+        orders: { key: 1 value: { asset: "gold" } }
+        orders: { key: 2 value: { asset: "silver" } }
+      }
+    trades: { units: 10 counterparty: "andy" }
+    trades: { units: 20 counterparty: "daniel" }
+    trade_archive: { asset: "silver" }
+  )");
+  const auto after = ParseTextProto<proto::State> (R"(
+    account: "domob"
+    next_free_id: 6
+    own_orders:
+      {
+        orders: { key: 2 value: { asset: "silver" } }
+        orders: { key: 5 value: { asset: "gold" } }
+      }
+    trades: { units: 10 counterparty: "andy" }
+    trades: { units: 30 counterparty: "daniel" }
+    trades: { units: 40 counterparty: "domob" }
+    trade_archive: { asset: "silver" }
+    trade_archive: { asset: "gold" }
+  )");
+
+  StateChanges changes(before);
+  changes.TouchNextFreeId ();
+  changes.TouchOrder (1);
+  changes.TouchOrder (5);
+  changes.TouchTrade (after.trades (1));
+  changes.TouchTrade (after.trades (2));
+
+  proto::StateJournalEntry entry;
+  ASSERT_TRUE (ComputeJournalEntry (changes, after, entry));
+  EXPECT_EQ (entry.upserted_orders ().size (), 1);
+  EXPECT_EQ (entry.removed_orders_size (), 1);
+  EXPECT_EQ (entry.upserted_trades_size (), 2);
+  EXPECT_EQ (entry.archived_size (), 1);
+
+  auto applied = before;
+  ApplyJournalEntry (entry, applied);
+  EXPECT_TRUE (MessageDifferencer::Equals (applied, after));
+}
+
+TEST_F (JournalEntryTests, TradesRemoved)
+{
+  const auto before = ParseTextProto<proto::State> (R"(
+    trades: { units: 10 counterparty: "andy" }
+    trades: { units: 20 counterparty: "daniel" }
+    trades: { units: 30 counterparty: "domob" }
+  )");
+  const auto after = ParseTextProto<proto::State> (R"(
+    trades: { units: 10 counterparty: "andy" }
+    trades: { units: 30 counterparty: "domob" }
+  )");
+
+  StateChanges changes(before);
+  changes.TouchTrade (before.trades (1));
+
+  proto::StateJournalEntry entry;
+  ASSERT_TRUE (ComputeJournalEntry (changes, after, entry));
+  EXPECT_EQ (entry.upserted_trades_size (), 0);
+  ASSERT_EQ (entry.removed_trades_size (), 1);
+  EXPECT_EQ (entry.removed_trades (0).counterparty (), "daniel");
+  EXPECT_FALSE (entry.removed_trades (0).has_units ());
+
+  auto applied = before;
+  ApplyJournalEntry (entry, applied);
+  EXPECT_TRUE (MessageDifferencer::Equals (applied, after));
+}
+
+TEST_F (JournalEntryTests, ArchiveShrunk)
+{
+  const auto before = ParseTextProto<proto::State> (R"(
+    trade_archive: { asset: "silver" }
+  )");
+  const proto::State after;
+
+  proto::StateJournalEntry entry;
+  EXPECT_FALSE (ComputeJournalEntry (StateChanges (before), after, entry));
+}
+
+TEST_F (JournalEntryTests, UnknownChanges)
+{
+  const proto::State state;
+  StateChanges changes(state);
+  changes.TouchAll ();
+
+  proto::StateJournalEntry entry;
+  EXPECT_FALSE (ComputeJournalEntry (changes, state, entry));
+}
+
+/* ************************************************************************** */
+
+class StatePersistenceTests : public testing::Test
+{
+
+protected:
+
+  /** The temporary directory used for the persisted data.  */
+  std::string dir;
+
+  StatePersistenceTests ()
+  {
+    std::string tmpl = testing::TempDir () + "/democrit-state-XXXXXX";
+    CHECK (mkdtemp (&tmpl[0]) != nullptr);
+    dir = tmpl;
+  }
+
+  ~StatePersistenceTests ()
+  {
+    std::remove ((dir + "/snapshot").c_str ());
+    std::remove ((dir + "/journal").c_str ());
+    std::remove (dir.c_str ());
+  }
+
+  /**
+   * Constructs a State instance persisted in our directory, with the
+   * given snapshot interval.
+   */
+  std::unique_ptr<State>
+  OpenState (const unsigned snapshotIntv = 1'000)
+  {
+    return std::make_unique<State> (
+        "domob",
+        std::make_unique<StatePersistence> (dir, snapshotIntv, SYNC_INTV));
+  }
+
+  /**
+   * Returns a copy of the data in a State.
+   */
+  static proto::State
+  GetData (const State& s)
+  {
+    proto::State res;
+    s.ReadState ([&res] (const proto::State& data)
+      {
+        res = data;
+      });
+    return res;
+  }
+
+  /**
+   * Returns the size of the given file in our directory.
+   */
+  size_t
+  GetFileSize (const std::string& name) const
+  {
+    struct stat st;
+    CHECK_EQ (stat ((dir + "/" + name).c_str (), &st), 0);
+    return st.st_size;
+  }
+
+  /**
+   * Performs some modifications of the state, as they might happen
+   * during normal operation.
+   */
+  static void
+  ModifyState (State& s)
+  {
+    s.ModifyState ([] (proto::State& data, StateChanges& changes)
+      {
+        data.set_next_free_id (2);
+        (*data.mutable_own_orders ()->mutable_orders ())[1]
+            = ParseTextProto<proto::Order> (R"(asset: "gold" max_units: 5)");
+        changes.TouchNextFreeId ();
+        changes.TouchOrder (1);
+      });
+    s.ModifyState ([] (proto::State& data, StateChanges& changes)
+      {
+        auto& t = *data.add_trades ();
+        t = ParseTextProto<proto::TradeState> (R"(
+          units: 10
+          counterparty: "andy"
+        )");
+        changes.TouchTrade (t);
+      });
+    s.ModifyState ([] (proto::State& data, StateChanges& changes)
+      {
+        data.mutable_trades ()->Mutable (0)->set_state (proto::Trade::PENDING);
+        (*data.mutable_own_orders ()->mutable_orders ())[1].set_locked (true);
+        changes.TouchTrade (data.trades (0));
+        changes.TouchOrder (1);
+      });
+  }
+
+};
+
+TEST_F (StatePersistenceTests, FreshState)
+{
+  auto s = OpenState ();
+  EXPECT_THAT (GetData (*s), EqualsState (R"(account: "domob")"));
+  s.reset ();
+
+  s = OpenState ();
+  EXPECT_THAT (GetData (*s), EqualsState (R"(account: "domob")"));
+}
+
+TEST_F (StatePersistenceTests, Restored)
+{
+  proto::State expected;
+  {
+    auto s = OpenState ();
+    ModifyState (*s);
+    expected = GetData (*s);
+  }
+
+  auto s = OpenState ();
+  EXPECT_TRUE (MessageDifferencer::Equals (GetData (*s), expected));
+
+  /* The journal has been compacted into the snapshot.  */
+  EXPECT_EQ (GetFileSize ("journal"), 0);
+}
+
+TEST_F (StatePersistenceTests, SnapshotInterval)
+{
+  proto::State expected;
+  {
+    auto s = OpenState (2);
+    ModifyState (*s);
+    expected = GetData (*s);
+
+    /* After the third modification, only one entry is in the journal.  */
+    EXPECT_GT (GetFileSize ("journal"), 0);
+    EXPECT_GT (GetFileSize ("snapshot"), 0);
+  }
+
+  auto s = OpenState ();
+  EXPECT_TRUE (MessageDifferencer::Equals (GetData (*s), expected));
+}
+
+TEST_F (StatePersistenceTests, UntrackedChangesSnapshot)
+{
+  proto::State expected;
+  {
+    auto s = OpenState ();
+    ModifyState (*s);
+    EXPECT_GT (GetFileSize ("journal"), 0);
+
+    s->AccessState ([] (proto::State& data)
+      {
+        data.set_next_free_id (42);
+      });
+    EXPECT_EQ (GetFileSize ("journal"), 0);
+    expected = GetData (*s);
+  }
+
+  auto s = OpenState ();
+  EXPECT_TRUE (MessageDifferencer::Equals (GetData (*s), expected));
+}
+
+TEST_F (StatePersistenceTests, IncompleteJournalEntry)
+{
+  proto::State expected;
+  {
+    auto s = OpenState ();
+    ModifyState (*s);
+    expected = GetData (*s);
+  }
+
+  /* Simulate a crash while writing a journal entry, by appending the start
+     of a length-delimited message that is not complete.  */
+  {
+    std::ofstream out(dir + "/journal", std::ios::binary | std::ios::app);
+    out.put (100);
+    out.put (1);
+  }
+
+  auto s = OpenState ();
+  EXPECT_TRUE (MessageDifferencer::Equals (GetData (*s), expected));
+
+  s->ModifyState ([] (proto::State& data, StateChanges& changes)
+    {
+      data.set_next_free_id (42);
+      changes.TouchNextFreeId ();
+    });
+  expected.set_next_free_id (42);
+  s.reset ();
+
+  s = OpenState ();
+  EXPECT_TRUE (MessageDifferencer::Equals (GetData (*s), expected));
+}
+
+TEST_F (StatePersistenceTests, WrongAccount)
+{
+  OpenState ();
+  EXPECT_DEATH (
+      State ("andy", std::make_unique<StatePersistence> (dir, 10, SYNC_INTV)),
+      "different account");
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace democrit
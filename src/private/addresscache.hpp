@@ -0,0 +1,104 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_ADDRESSCACHE_HPP
+#define DEMOCRIT_ADDRESSCACHE_HPP
+
+#include "private/intervaljob.hpp"
+#include "private/rpcclient.hpp"
+#include "rpc-stubs/xayarpcclient.h"
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace democrit
+{
+
+/**
+ * A cache of fresh wallet addresses, which is refilled in the background.
+ * This is used when we are the seller and need to send addresses to the
+ * buyer, so that we do not have to wait for getnewaddress calls while the
+ * counterparty is waiting for our reply.
+ *
+ * Each address is handed out exactly once.  If the cache is empty, a new
+ * address is requested from the wallet directly.
+ */
+class AddressCache
+{
+
+private:
+
+  /** RPC connection to the Xaya wallet.  */
+  RpcClient<XayaRpcClient>& rpc;
+
+  /** Number of addresses the cache is refilled to.  */
+  const size_t targetSize;
+
+  /** The cached addresses, in the order they were created.  */
+  std::deque<std::string> addresses;
+
+  /** Lock for addresses.  */
+  mutable std::mutex mut;
+
+  /** If started, the job refilling the cache periodically.  */
+  std::unique_ptr<IntervalJob> refiller;
+
+public:
+
+  /**
+   * Constructs an (initially empty) cache with the given target size.
+   */
+  explicit AddressCache (RpcClient<XayaRpcClient>& r, size_t target)
+    : rpc(r), targetSize(target)
+  {}
+
+  ~AddressCache ();
+
+  AddressCache () = delete;
+  AddressCache (const AddressCache&) = delete;
+  void operator= (const AddressCache&) = delete;
+
+  /**
+   * Starts a background job that refills the cache in the given interval.
+   */
+  void StartRefills (std::chrono::milliseconds intv);
+
+  /**
+   * Requests new addresses from the wallet (in a single batch) to fill
+   * up the cache to its target size.
+   */
+  void Refill ();
+
+  /**
+   * Returns a fresh address, taking it out of the cache if possible.
+   */
+  std::string Get ();
+
+  /**
+   * Returns the number of currently cached addresses.
+   */
+  size_t GetSize () const;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_ADDRESSCACHE_HPP
@@ -0,0 +1,107 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_ASSETINTERNER_HPP
+#define DEMOCRIT_ASSETINTERNER_HPP
+
+#include "assetspec.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace democrit
+{
+
+/**
+ * Compact handle for an interned asset string.  Handles are only meaningful
+ * for the AssetInterner that returned them.
+ */
+using AssetId = uint32_t;
+
+/**
+ * Table that maps asset strings to compact integer handles and back.  It is
+ * used by the internal indexes and caches, so that they do not need to hold
+ * (and compare) full copies of the asset strings; those are only converted
+ * back at the proto / JSON boundary.
+ *
+ * Entries are never removed, so that handles and the references returned by
+ * Get stay valid forever.  Thus only assets that have been validated should
+ * be interned, rather than arbitrary strings received from peers.
+ *
+ * This class is thread-safe.
+ */
+class AssetInterner
+{
+
+private:
+
+  /** Handles of all interned assets.  */
+  std::unordered_map<Asset, AssetId> ids;
+
+  /**
+   * The asset strings by handle.  A deque keeps references to existing
+   * elements valid when new ones are added.
+   */
+  std::deque<Asset> assets;
+
+  /** Lock for this instance.  */
+  mutable std::shared_timed_mutex mut;
+
+public:
+
+  AssetInterner () = default;
+
+  AssetInterner (const AssetInterner&) = delete;
+  void operator= (const AssetInterner&) = delete;
+
+  /**
+   * Returns the handle for the given asset, adding it to the table
+   * if it is not there yet.
+   */
+  AssetId Intern (const Asset& asset);
+
+  /**
+   * Looks up the handle of an asset without adding it.  Returns false
+   * if the asset has not been interned.
+   */
+  bool Find (const Asset& asset, AssetId& id) const;
+
+  /**
+   * Returns the asset string for a handle.  The reference stays valid
+   * for the lifetime of the interner.
+   */
+  const Asset& Get (AssetId id) const;
+
+  /**
+   * Returns the number of interned assets.
+   */
+  size_t Size () const;
+
+  /**
+   * Returns the process-wide interner instance.
+   */
+  static AssetInterner& Global ();
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_ASSETINTERNER_HPP
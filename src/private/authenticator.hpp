@@ -22,6 +22,7 @@
 #include <gloox/jid.h>
 
 #include <set>
+#include <shared_mutex>
 #include <string>
 #include <unordered_map>
 
@@ -33,6 +34,14 @@ namespace democrit
  * In particular, we have a list of XMPP servers / domains that we trust
  * to run XID authentication.  For any JID from those servers, we then
  * see if we can decode the username into a Xaya account.
+ *
+ * Since Authenticate is called for every received message, its results
+ * are memoised per full JID.  The cache is read-mostly, so it uses a
+ * shared lock for lookups.  Entries can be dropped explicitly (e.g. when
+ * the participant leaves the room), and the whole cache is cleared if it
+ * grows too large.
+ *
+ * This class is thread-safe.
  */
 class Authenticator
 {
@@ -50,6 +59,12 @@ private:
    */
   mutable std::unordered_map<std::string, gloox::JID> knownJids;
 
+  /** Memoised results of Authenticate, keyed by the full JID.  */
+  mutable std::unordered_map<std::string, std::string> accountForJid;
+
+  /** Lock for the maps.  */
+  mutable std::shared_timed_mutex mut;
+
   /**
    * Constructs an instance with the list of servers extracted from
    * a comma-separated list of strings.
@@ -76,6 +91,13 @@ public:
    */
   bool Authenticate (const gloox::JID& jid, std::string& account) const;
 
+  /**
+   * Drops the memoised authentication result for the given JID, e.g.
+   * because the participant disconnected.  The JID stays known for
+   * LookupJid until the account authenticates with a different one.
+   */
+  void Forget (const gloox::JID& jid);
+
   /**
    * Finds the JID corresponding to a Xaya account (i.e. the reverse of
    * Authenticate).  Since we do not know which of the servers the account
@@ -20,6 +20,8 @@
 #define DEMOCRIT_CHECKER_HPP
 
 #include "assetspec.hpp"
+#include "private/headercache.hpp"
+#include "private/psbtdecoder.hpp"
 #include "private/rpcclient.hpp"
 #include "proto/trades.pb.h"
 #include "rpc-stubs/xayarpcclient.h"
@@ -60,6 +62,12 @@ private:
   /** Xaya RPC connection for checking the blockchain state.  */
   RpcClient<XayaRpcClient>& xaya;
 
+  /** Cache of block headers used for the ancestry check.  */
+  BlockHeaderCache& headers;
+
+  /** Decoder (with cache) for the PSBTs we check.  */
+  PsbtDecoder& psbts;
+
   /** The buyer's account name.  */
   const std::string buyer;
 
@@ -78,9 +86,10 @@ private:
 public:
 
   explicit TradeChecker (const AssetSpec& as, RpcClient<XayaRpcClient>& x,
+                         BlockHeaderCache& h, PsbtDecoder& d,
                          const std::string& b, const std::string& s,
                          const Asset& a, const Amount p, const Amount u)
-    : spec(as), xaya(x),
+    : spec(as), xaya(x), headers(h), psbts(d),
       buyer(b), seller(s),
       asset(a), price(p), units(u)
   {}
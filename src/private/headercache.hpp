@@ -0,0 +1,112 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_HEADERCACHE_HPP
+#define DEMOCRIT_HEADERCACHE_HPP
+
+#include "private/lrucache.hpp"
+
+#include <xayautil/uint256.hpp>
+
+#include <json/json.h>
+
+namespace democrit
+{
+
+/**
+ * LRU cache of block headers (or rather, the parts of them that we need
+ * for checking block ancestry), keyed by block hash.  Since the header data
+ * of a block is determined by its hash, the cached entries never become
+ * invalid, not even in case of reorgs.  All methods are thread-safe.
+ */
+class BlockHeaderCache
+{
+
+public:
+
+  /**
+   * The data we keep about each block.
+   */
+  struct Header
+  {
+
+    /** The block's hash.  */
+    xaya::uint256 hash;
+
+    /** The block's height.  */
+    unsigned height;
+
+    /** The parent block's hash.  This is null for the genesis block.  */
+    xaya::uint256 parent;
+
+    /**
+     * Extracts the data from a getblockheader JSON result.  CHECK-fails if
+     * the data is invalid.
+     */
+    static Header FromJson (const Json::Value& val);
+
+  };
+
+private:
+
+  /** The underlying cache, keyed by block hash.  */
+  LruCache<xaya::uint256, Header> entries;
+
+public:
+
+  explicit BlockHeaderCache (const size_t m)
+    : entries(m)
+  {}
+
+  BlockHeaderCache () = delete;
+  BlockHeaderCache (const BlockHeaderCache&) = delete;
+  void operator= (const BlockHeaderCache&) = delete;
+
+  /**
+   * Looks up the given block hash.  Returns false if it is not cached.
+   */
+  bool
+  Lookup (const xaya::uint256& hash, Header& out)
+  {
+    return entries.Lookup (hash, out);
+  }
+
+  /**
+   * Adds a new entry, evicting the least-recently used one if the cache
+   * is full.
+   */
+  void
+  Insert (const Header& h)
+  {
+    entries.Insert (h.hash, h);
+  }
+
+  /**
+   * Returns the number of cached entries.
+   */
+  size_t
+  GetSize () const
+  {
+    return entries.GetSize ();
+  }
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_HEADERCACHE_HPP
@@ -0,0 +1,125 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_INPUTPOOL_HPP
+#define DEMOCRIT_INPUTPOOL_HPP
+
+#include "assetspec.hpp"
+#include "private/intervaljob.hpp"
+#include "private/rpcclient.hpp"
+#include "proto/trades.pb.h"
+#include "rpc-stubs/xayarpcclient.h"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace democrit
+{
+
+/**
+ * A pool of wallet UTXOs that have been selected and locked ahead of time,
+ * so that a buyer constructing a trade transaction can fund it from one
+ * of them directly instead of having the wallet run coin selection on
+ * all its coins while the counterparty is waiting.
+ *
+ * The pool keeps up to a configured number of coins for each of a list
+ * of denominations.  A coin belongs to the largest denomination that is
+ * not more than its value; coins smaller than all denominations are not
+ * used.  All coins in the pool are locked in the wallet; taking a coin
+ * from the pool transfers that lock to the caller.  When the pool is
+ * destructed, all coins still in it are unlocked again.
+ */
+class InputPool
+{
+
+private:
+
+  /** RPC connection to the Xaya wallet.  */
+  RpcClient<XayaRpcClient>& rpc;
+
+  /** The denominations (in satoshi), sorted in ascending order.  */
+  std::vector<Amount> denominations;
+
+  /** Target number of coins to keep per denomination.  */
+  const unsigned perDenomination;
+
+  /** The coins currently in the pool, keyed by their value.  */
+  std::multimap<Amount, proto::OutPoint> available;
+
+  /** Lock for available.  */
+  mutable std::mutex mut;
+
+  /** If started, the job refilling the pool periodically.  */
+  std::unique_ptr<IntervalJob> refiller;
+
+  /**
+   * Returns the index of the denomination a coin with the given value
+   * belongs to, or -1 if it is smaller than all of them.
+   */
+  int GetDenomination (Amount value) const;
+
+public:
+
+  /**
+   * Constructs an (initially empty) pool that will keep the given
+   * number of coins for each of the denominations.
+   */
+  explicit InputPool (RpcClient<XayaRpcClient>& r,
+                      const std::vector<Amount>& denoms, unsigned perDenom);
+
+  /**
+   * Stops refilling and unlocks all coins still in the pool.
+   */
+  ~InputPool ();
+
+  InputPool () = delete;
+  InputPool (const InputPool&) = delete;
+  void operator= (const InputPool&) = delete;
+
+  /**
+   * Starts a background job that refills the pool in the given interval.
+   */
+  void StartRefills (std::chrono::milliseconds intv);
+
+  /**
+   * Queries the wallet for unspent coins and locks and adds them to the
+   * pool where a denomination is below its target size.
+   */
+  void Refill ();
+
+  /**
+   * Removes the smallest coin with at least the given value from the pool
+   * and returns it.  The coin stays locked, and the caller is responsible
+   * for unlocking it when no longer needed.  Returns false if there is no
+   * suitable coin in the pool.
+   */
+  bool Take (Amount minValue, proto::OutPoint& out);
+
+  /**
+   * Returns the number of coins in the pool.
+   */
+  size_t GetSize () const;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_INPUTPOOL_HPP
@@ -19,76 +19,127 @@
 #ifndef DEMOCRIT_INTERVALJOB_HPP
 #define DEMOCRIT_INTERVALJOB_HPP
 
+#include "private/scheduler.hpp"
+
 #include <chrono>
-#include <condition_variable>
 #include <functional>
-#include <mutex>
-#include <thread>
 
 namespace democrit
 {
 
 /**
- * A generic thread that runs a given job at set intervals until it is
+ * A generic job that runs a given function at set intervals until it is
  * destructed.  This is used for things like broadcasting our own
  * orders and timing out other orders.
  *
  * The interval is not exactly guaranteed, but the job will be run approximately
  * with that frequency (it might be a bit earlier or later depending on
- * circumstances).
+ * circumstances).  Optionally, a random jitter can be added to each
+ * interval, so that many jobs with the same interval do not all fire at
+ * the same moment.
+ *
+ * The jobs are run on the shared Scheduler instead of a thread of their own.
  */
 class IntervalJob
 {
 
 private:
 
-  /** The interval for repeating the job.  */
-  const std::chrono::nanoseconds intv;
+  /** The scheduler this is running on.  */
+  Scheduler& scheduler;
 
-  /** The job to execute.  */
-  std::function<void ()> job;
+  /** The ID of our task in the scheduler.  */
+  const Scheduler::TaskId id;
 
-  /** Mutex for this instance and its condition variable.  */
-  std::mutex mut;
+public:
 
-  /** Set to true to signal that the worker thread should stop.  */
-  bool stop;
+  /**
+   * Constructs the job, which starts running it immediately.
+   */
+  template <typename Fcn, typename Rep, typename Period>
+    explicit IntervalJob (const std::chrono::duration<Rep, Period> i,
+                          const Fcn& j)
+    : IntervalJob(i, std::chrono::nanoseconds::zero (), j)
+  {}
 
   /**
-   * Used to signal the worker thread when it should stop, so that we can wake
-   * it up immediately without having to wait for a full interval sleep.
+   * Constructs the job with a maximum random jitter added to each
+   * interval.
    */
-  std::condition_variable cv;
+  template <typename Fcn, typename Rep, typename Period,
+            typename RepJ, typename PeriodJ>
+    explicit IntervalJob (const std::chrono::duration<Rep, Period> i,
+                          const std::chrono::duration<RepJ, PeriodJ> jitter,
+                          const Fcn& j)
+    : scheduler(Scheduler::Global ()),
+      id(scheduler.Add (i, jitter, std::function<void ()> (j)))
+  {}
 
-  /** The worker thread.  */
-  std::thread worker;
+  /**
+   * Destroys the job, which stops it.  If it is currently running, this
+   * waits for it to finish.
+   */
+  ~IntervalJob ();
+
+  IntervalJob () = delete;
+  IntervalJob (const IntervalJob&) = delete;
+  void operator= (const IntervalJob&) = delete;
 
   /**
-   * Starts the worker thread.
+   * Runs the job as soon as possible, instead of waiting for the rest
+   * of the current interval.
    */
-  void StartWorker ();
+  void TriggerNow ();
+
+};
+
+/**
+ * A job that is not run periodically, but once at a set delay after it
+ * has been triggered.  All triggers until that run are merged into it,
+ * which is useful e.g. for debouncing notifications.  Like IntervalJob,
+ * it runs on the shared Scheduler.
+ */
+class DelayedJob
+{
+
+private:
+
+  /** The scheduler this is running on.  */
+  Scheduler& scheduler;
+
+  /** The delay between triggering and running the job.  */
+  const std::chrono::nanoseconds delay;
+
+  /** The ID of our task in the scheduler.  */
+  const Scheduler::TaskId id;
 
 public:
 
   /**
-   * Constructs the job, which starts the worker immediately.
+   * Constructs the job.  It is not run until triggered.
    */
   template <typename Fcn, typename Rep, typename Period>
-    explicit IntervalJob (const std::chrono::duration<Rep, Period> i,
-                          const Fcn& j)
-    : intv(i), job(j)
-  {
-    StartWorker ();
-  }
+    explicit DelayedJob (const std::chrono::duration<Rep, Period> d,
+                         const Fcn& j)
+    : scheduler(Scheduler::Global ()), delay(d),
+      id(scheduler.AddTriggered (std::function<void ()> (j)))
+  {}
 
   /**
-   * Destroys the job, which stops the worker.
+   * Destroys the job.  If it is currently running, this waits for it
+   * to finish.  A pending triggered run is dropped.
    */
-  ~IntervalJob ();
+  ~DelayedJob ();
 
-  IntervalJob () = delete;
-  IntervalJob (const IntervalJob&) = delete;
-  void operator= (const IntervalJob&) = delete;
+  DelayedJob () = delete;
+  DelayedJob (const DelayedJob&) = delete;
+  void operator= (const DelayedJob&) = delete;
+
+  /**
+   * Requests a run of the job after the delay, unless one is already
+   * pending.
+   */
+  void Trigger ();
 
 };
 
@@ -0,0 +1,86 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_LRUCACHE_HPP
+#define DEMOCRIT_LRUCACHE_HPP
+
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace democrit
+{
+
+/**
+ * Simple thread-safe key/value cache that holds a bounded number of
+ * entries, evicting the least-recently used one when full.  It is meant
+ * for caching data that never changes for a given key, so there is no
+ * support for updating or invalidating entries.
+ */
+template <typename K, typename V>
+  class LruCache
+{
+
+private:
+
+  /** Maximum number of entries to keep.  */
+  const size_t maxSize;
+
+  /** Keys of the cached entries, with the most recently used first.  */
+  std::list<K> lru;
+
+  /** The cached entries, with their position in the LRU list.  */
+  std::map<K, std::pair<V, typename std::list<K>::iterator>> entries;
+
+  /** Lock for the data.  */
+  mutable std::mutex mut;
+
+public:
+
+  explicit LruCache (const size_t m)
+    : maxSize(m)
+  {}
+
+  LruCache () = delete;
+  LruCache (const LruCache&) = delete;
+  void operator= (const LruCache&) = delete;
+
+  /**
+   * Looks up the given key.  Returns false if it is not cached.
+   */
+  bool Lookup (const K& key, V& out);
+
+  /**
+   * Adds a new entry, evicting the least-recently used one if the cache
+   * is full.  If the key is already present, it is just marked as used.
+   */
+  void Insert (const K& key, const V& value);
+
+  /**
+   * Returns the number of cached entries.
+   */
+  size_t GetSize () const;
+
+};
+
+} // namespace democrit
+
+#include "lrucache.tpp"
+
+#endif // DEMOCRIT_LRUCACHE_HPP
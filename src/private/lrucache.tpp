@@ -0,0 +1,74 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Template implementation code for lrucache.hpp.  */
+
+namespace democrit
+{
+
+template <typename K, typename V>
+  bool
+  LruCache<K, V>::Lookup (const K& key, V& out)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = entries.find (key);
+  if (mit == entries.end ())
+    return false;
+
+  lru.splice (lru.begin (), lru, mit->second.second);
+  out = mit->second.first;
+
+  return true;
+}
+
+template <typename K, typename V>
+  void
+  LruCache<K, V>::Insert (const K& key, const V& value)
+{
+  if (maxSize == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = entries.find (key);
+  if (mit != entries.end ())
+    {
+      lru.splice (lru.begin (), lru, mit->second.second);
+      return;
+    }
+
+  while (!lru.empty () && entries.size () >= maxSize)
+    {
+      entries.erase (lru.back ());
+      lru.pop_back ();
+    }
+
+  lru.push_front (key);
+  entries.emplace (key, std::make_pair (value, lru.begin ()));
+}
+
+template <typename K, typename V>
+  size_t
+  LruCache<K, V>::GetSize () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return entries.size ();
+}
+
+} // namespace democrit
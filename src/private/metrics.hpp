@@ -0,0 +1,178 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_METRICS_HPP
+#define DEMOCRIT_METRICS_HPP
+
+#include <json/json.h>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace democrit
+{
+
+/**
+ * A histogram of durations, with fixed exponential buckets (in
+ * milliseconds).
+ */
+class Histogram
+{
+
+public:
+
+  /** Number of buckets (not counting the overflow bucket).  */
+  static constexpr size_t NUM_BUCKETS = 16;
+
+  /** Upper bounds of the buckets in milliseconds.  */
+  static const std::array<double, NUM_BUCKETS> BOUNDS;
+
+private:
+
+  /** Number of records in each bucket, where the last is for overflows.  */
+  std::array<uint64_t, NUM_BUCKETS + 1> counts = {};
+
+  /** Total number of records.  */
+  uint64_t count = 0;
+
+  /** Sum of all recorded durations in milliseconds.  */
+  double sumMs = 0.0;
+
+public:
+
+  Histogram () = default;
+
+  /**
+   * Adds a new duration to the histogram.
+   */
+  void Record (std::chrono::nanoseconds dur);
+
+  /**
+   * Returns the histogram data as JSON.  The bucket counts are cumulative
+   * (i.e. give the number of records less or equal to each bound).
+   */
+  Json::Value ToJson () const;
+
+  /**
+   * Appends the histogram in the Prometheus text exposition format
+   * with the given metric name to the output string.
+   */
+  void ToPrometheus (const std::string& name, std::string& out) const;
+
+};
+
+/**
+ * Collection of named counters and duration histograms, which are used
+ * to instrument trades and RPC calls.  All methods are thread-safe.
+ */
+class Metrics
+{
+
+private:
+
+  /** Counters by name.  */
+  std::map<std::string, uint64_t> counters;
+
+  /** Histograms by name.  */
+  std::map<std::string, Histogram> histograms;
+
+  /** Lock for the data.  */
+  mutable std::mutex mut;
+
+public:
+
+  Metrics () = default;
+
+  Metrics (const Metrics&) = delete;
+  void operator= (const Metrics&) = delete;
+
+  /**
+   * Returns the process-wide instance, which is used by the daemon.
+   */
+  static Metrics& Global ();
+
+  /**
+   * Increments the given counter.
+   */
+  void Increment (const std::string& name, uint64_t n = 1);
+
+  /**
+   * Records a duration in the given histogram.
+   */
+  void Record (const std::string& name, std::chrono::nanoseconds dur);
+
+  /**
+   * Returns all metrics as JSON object with "counters" and "histograms".
+   */
+  Json::Value ToJson () const;
+
+  /**
+   * Returns all metrics in the Prometheus text exposition format.  The
+   * names are prefixed with "democrit_", and characters not valid in
+   * Prometheus names are replaced by underscores.
+   */
+  std::string ToPrometheus () const;
+
+};
+
+/**
+ * RAII helper that records the time from its construction to destruction
+ * (measured with a monotonic clock) in a histogram.
+ */
+class ScopedTimer
+{
+
+private:
+
+  /** The metrics instance to record in.  */
+  Metrics& metrics;
+
+  /** The histogram's name.  */
+  const std::string name;
+
+  /** The start time.  */
+  const std::chrono::steady_clock::time_point start;
+
+public:
+
+  explicit ScopedTimer (const std::string& n)
+    : ScopedTimer(Metrics::Global (), n)
+  {}
+
+  explicit ScopedTimer (Metrics& m, const std::string& n)
+    : metrics(m), name(n), start(std::chrono::steady_clock::now ())
+  {}
+
+  ~ScopedTimer ()
+  {
+    metrics.Record (name, std::chrono::steady_clock::now () - start);
+  }
+
+  ScopedTimer () = delete;
+  ScopedTimer (const ScopedTimer&) = delete;
+  void operator= (const ScopedTimer&) = delete;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_METRICS_HPP
@@ -28,10 +28,13 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace democrit
@@ -40,12 +43,19 @@ namespace democrit
 /**
  * The main XMPP client class used in Democrit.  It wraps around Charon's
  * basic XmppClient (based on gloox) and adds in MUC functionality as needed
- * for Democrit.  The client joins a pre-defined room, and then handles
- * message broadcasts as well as private messages (although we use
+ * for Democrit.  The client joins one or more pre-defined rooms, and then
+ * handles message broadcasts as well as private messages (although we use
  * direct XMPP messages to the full JID instead of in-room private messages
  * for that).  The MucClient also takes care of mapping in-room nick names
  * to real JIDs, which we can then "soft rely on" as being authenticated
  * through XID.
+ *
+ * Outgoing messages are not sent on the calling thread.  Instead, they are
+ * put into a queue that is processed by a dedicated writer thread, so that
+ * callers never block on the connection.  Private messages are sent before
+ * broadcasts, and broadcasts can be marked as replaceable, in which case
+ * a newer replaceable broadcast to the same room supersedes one that is
+ * still waiting in the queue.
  */
 class MucClient : private charon::XmppClient,
                   private gloox::MUCRoomHandler,
@@ -63,11 +73,43 @@ private:
 
   friend class MucClientTests;
 
-  /** The name of the room (including the server) to join on connecting.  */
-  const gloox::JID roomName;
+  /**
+   * Data for one of the rooms we join.
+   */
+  struct Room
+  {
+
+    /** The name of the room (including the server) to join on connecting.  */
+    gloox::JID name;
+
+    /** The gloox MUC room handle (while connected).  */
+    std::unique_ptr<gloox::MUCRoom> handle;
+
+    /**
+     * Maps in-room nicknames to the corresponding full JIDs.  We need that
+     * so that we can know who a MUC message was "really" from, as we use
+     * the full JIDs (which e.g. may be XID-authenticated by the server)
+     * for identifying room participants.  Nicknames are only unique within
+     * one room, so each room has its own map.  It is looked up for every
+     * received message, and only changed on presence updates.
+     */
+    std::unordered_map<std::string, gloox::JID> nickToJid;
+
+    /** Set while we are still waiting for our own presence in the room.  */
+    bool joining = false;
 
-  /** The gloox MUC room handle (while connected).  */
-  std::unique_ptr<gloox::MUCRoom> room;
+    explicit Room (const gloox::JID& n)
+      : name(n)
+    {}
+
+  };
+
+  /**
+   * All rooms we join.  The first one is the default room used for
+   * PublishMessage without explicit room.  The list itself is fixed
+   * at construction.
+   */
+  std::vector<Room> rooms;
 
   /**
    * It may happen that we need to disconnect in response to a callback, e.g.
@@ -82,6 +124,38 @@ private:
   /** True if we are still in the progress of async disconnecting.  */
   std::atomic<bool> disconnecting;
 
+  /**
+   * A message waiting in the outbound queue.
+   */
+  struct OutgoingMessage
+  {
+
+    /** The message itself (including all the extensions).  */
+    std::unique_ptr<gloox::Message> msg;
+
+    /** For replaceable broadcasts, the room it is sent to.  */
+    std::string replaceableRoom;
+
+  };
+
+  /** Queued outgoing private messages, which take priority.  */
+  std::deque<OutgoingMessage> queuePrivate;
+
+  /** Queued outgoing broadcasts.  */
+  std::deque<OutgoingMessage> queueBroadcast;
+
+  /** Set to true when the writer thread should stop.  */
+  bool stopWriter = false;
+
+  /** Lock for the outbound queues.  */
+  std::mutex mutQueue;
+
+  /** Condition variable notified when something is queued or on stop.  */
+  std::condition_variable cvQueue;
+
+  /** The writer thread sending out queued messages.  */
+  std::thread writer;
+
   /**
    * Condition variable used to notify the thread waiting for complete
    * join of the room when we receive our own presence (or when an error
@@ -90,19 +164,11 @@ private:
   std::condition_variable cvJoin;
 
   /**
-   * Flag that indicates we are currently joining the room and still waiting
-   * for either our own presence (in which case it worked) or an error
-   * (in which case we disconnect again).
+   * Number of rooms we are currently joining and still waiting for either
+   * our own presence (in which case it worked) or an error (in which case
+   * we disconnect again).
    */
-  bool joining;
-
-  /**
-   * Maps in-room nicknames to the corresponding full JIDs.  We need that
-   * so that we can know who a MUC message was "really" from, as we use
-   * the full JIDs (which e.g. may be XID-authenticated by the server)
-   * for identifying room participants.
-   */
-  std::map<std::string, gloox::JID> nickToJid;
+  size_t pendingJoins;
 
   /**
    * Mutex used to lock for this instance (in particular, for syncing the
@@ -110,6 +176,12 @@ private:
    */
   mutable std::mutex mut;
 
+  /**
+   * Lock for the nick maps of the rooms.  They are read for every message
+   * but rarely written, so this is a shared lock.
+   */
+  mutable std::shared_timed_mutex mutNicks;
+
   /**
    * Disconnect asynchronously.  This can be done also from inside
    * gloox handlers.  The function will return immediately, but will
@@ -117,18 +189,38 @@ private:
    */
   void DisconnectAsync ();
 
+  /**
+   * Returns the room entry corresponding to a gloox room handle passed
+   * to one of the callbacks.
+   */
+  Room& FindRoom (const gloox::MUCRoom* r);
+
   /**
    * Resolves an in-room nick name to the corresponding full JID.
    * Returns false if we do not know that nick.
    */
-  bool ResolveNickname (const std::string& nick, gloox::JID& jid) const;
+  bool ResolveNickname (const Room& r, const std::string& nick,
+                        gloox::JID& jid) const;
+
+  /**
+   * Adds the given stanza extensions to the message and then puts it into
+   * the right outbound queue.  This code is shared between sending public
+   * and private messages.  If replaceableRoom is not empty, the message
+   * replaces any queued one marked with the same room.
+   */
+  void EnqueueMessage (std::unique_ptr<gloox::Message> msg,
+                       ExtensionData&& ext, bool priv,
+                       const std::string& replaceableRoom);
+
+  /**
+   * Drops all queued outgoing messages.
+   */
+  void ClearQueues ();
 
   /**
-   * Adds the given stanza extensions to the message and then broadcasts it
-   * using normal "send" functionality.  This code is shared between sending
-   * public and private messages.
+   * Main function of the writer thread.
    */
-  void SendMessage (gloox::Message&& msg, ExtensionData&& ext);
+  void RunWriter ();
 
   void handleMUCError (gloox::MUCRoom* r, gloox::StanzaError) override;
   bool handleMUCRoomCreation (gloox::MUCRoom* r) override;
@@ -167,7 +259,8 @@ protected:
   /**
    * Handler called for all published messages (not including private ones)
    * on the MUC channel, at least when we can identify the full JID of the
-   * sender from their nick.
+   * sender from their nick.  The room the message was published in is
+   * the bare JID of the message's "from" address.
    *
    * Subclasses can override it to process them.
    */
@@ -183,14 +276,23 @@ protected:
   {}
 
   /**
-   * Handler called when a participant leaves the room.  This can be used
-   * to then e.g. immediately remove their orders from the orderbook.  It is
-   * called with the full JID (not the nickname).
+   * Handler called when a participant leaves one of the rooms.  This can
+   * be used to then e.g. immediately remove their orders from the orderbook.
+   * It is called with the full JID (not the nickname).
    */
   virtual void
   HandleDisconnect (const gloox::JID& disconnected)
   {}
 
+  /**
+   * Handler called when we start disconnecting ourselves, e.g. because of
+   * an error or because we have been removed from a room.  No more
+   * messages will be handled until we connect again.
+   */
+  virtual void
+  HandleOwnDisconnect ()
+  {}
+
 public:
 
   /**
@@ -200,6 +302,13 @@ public:
   explicit MucClient (const gloox::JID& j, const std::string& password,
                       const gloox::JID& rm);
 
+  /**
+   * Sets up the client to join all of the given rooms (which must not
+   * be empty) when connecting.
+   */
+  explicit MucClient (const gloox::JID& j, const std::string& password,
+                      const std::vector<gloox::JID>& rms);
+
   virtual ~MucClient ();
 
   /**
@@ -208,9 +317,9 @@ public:
   void SetRootCA (const std::string& path);
 
   /**
-   * Tries to connect to the XMPP server and join the room.  Returns true
-   * on success, and false if either the connection or joining the room
-   * failed.
+   * Tries to connect to the XMPP server and join the rooms.  Returns true
+   * on success, and false if either the connection or joining any of the
+   * rooms failed.
    */
   bool Connect ();
 
@@ -234,16 +343,25 @@ public:
   void RegisterExtension (std::unique_ptr<gloox::StanzaExtension> ext);
 
   /**
-   * Publishes a message to the channel.  The actual gloox message is
-   * constructed internally with the right type and "to", and will carry
-   * all the given stanza extensions (of which ownership is taken).
+   * Publishes a message to the default (first) channel.  The actual gloox
+   * message is constructed internally with the right type and "to", and will
+   * carry all the given stanza extensions (of which ownership is taken).
    */
   void PublishMessage (ExtensionData&& ext);
 
+  /**
+   * Publishes a message to one particular of the channels we joined.
+   * If replaceable is true, then this message supersedes a previous
+   * replaceable message to the same room that has not yet been sent
+   * (e.g. because both are full updates of the same state).
+   */
+  void PublishMessage (const gloox::JID& room, ExtensionData&& ext,
+                       bool replaceable = false);
+
   /**
    * Sends a private message to a target JID.  Note that Democrit uses "real"
    * XMPP messages to the actual JID for private messaging, not MUC private
-   * messages.
+   * messages.  They are queued with priority over broadcasts.
    */
   void SendMessage (const gloox::JID& to, ExtensionData&& ext);
 
@@ -21,11 +21,13 @@
 
 #include "private/intervaljob.hpp"
 #include "private/state.hpp"
+#include "private/versioncounter.hpp"
 #include "proto/orders.pb.h"
 
 #include <chrono>
 #include <mutex>
 #include <memory>
+#include <vector>
 
 namespace democrit
 {
@@ -45,18 +47,54 @@ private:
   /** Global state instance, which holds the orders.  */
   State& state;
 
+  /**
+   * Lock that is held while running a refresh.  This makes sure that
+   * refreshes (which validate outside of the state lock) do not run
+   * concurrently and publish their results out of order.
+   */
+  std::mutex mutRefresh;
+
+  /** Version of the own orders, bumped whenever they are modified.  */
+  VersionCounter version;
+
   /** The worker job to send refreshing broadcasts.  */
   std::unique_ptr<IntervalJob> refresher;
 
+  /**
+   * If changes are debounced, the job that notifies pending changes.
+   * It is triggered on each change.  If this is null, changes are
+   * notified immediately.
+   */
+  std::unique_ptr<DelayedJob> changeNotifier;
+
   /**
    * Starts (or restarts) the refresher thread with the given interval.
    */
   void StartRefresher (std::chrono::milliseconds intv);
 
   /**
-   * Runs a single refresh iteration.
+   * Sets up the job for notifying debounced changes, if the given
+   * interval is not zero.
    */
-  void RunRefresh ();
+  void StartChangeNotifier (std::chrono::milliseconds debounce);
+
+  /**
+   * Runs a single refresh iteration.  If changed is true, this is done
+   * because of an explicit modification (and OrdersChanged is notified),
+   * otherwise it is a periodic refresh (and UpdateOrders is used).
+   *
+   * The orders are validated on a copy and without holding the lock
+   * on the global state, so that e.g. trade processing is not blocked
+   * by slow validation RPCs.
+   */
+  void RunRefresh (bool changed);
+
+  /**
+   * Called after the own orders have been modified.  Either runs
+   * a refresh immediately, or triggers the change notifier so that
+   * all changes during the debounce interval are notified together.
+   */
+  void MarkChanged ();
 
   /**
    * Internal implementation of GetOrders (returns all own orders),
@@ -75,6 +113,16 @@ protected:
   virtual bool ValidateOrder (const std::string& account,
                               const proto::Order& o) const;
 
+  /**
+   * Validates a batch of orders at once, returning the result for each.
+   * This is used when refreshing all orders.  By default, it calls
+   * ValidateOrder for each of them, but subclasses can override it with
+   * a more efficient implementation.
+   */
+  virtual std::vector<bool> ValidateOrders (
+      const std::string& account,
+      const std::vector<const proto::Order*>& orders) const;
+
   /**
    * Subclasses can implement this method to be notified of needed
    * updates for the orders of the current account.  This is mostly used
@@ -84,12 +132,39 @@ protected:
   virtual void UpdateOrders (const proto::OrdersOfAccount& ownOrders)
   {}
 
+  /**
+   * Called instead of UpdateOrders when the orders need to be updated
+   * because they were explicitly modified (e.g. added or cancelled) rather
+   * than for a periodic refresh.  By default this just calls UpdateOrders,
+   * but subclasses can use it to only broadcast what changed.
+   */
+  virtual void
+  OrdersChanged (const proto::OrdersOfAccount& ownOrders)
+  {
+    UpdateOrders (ownOrders);
+  }
+
 public:
 
   template <typename Rep, typename Period>
     explicit MyOrders (State& s, const std::chrono::duration<Rep, Period> intv)
+    : MyOrders(s, intv, std::chrono::milliseconds::zero ())
+  {}
+
+  /**
+   * Constructs the instance with a debounce interval for changes:  All
+   * modifications done within that interval will be notified together
+   * through a single call to OrdersChanged (at most one interval later).
+   * If the interval is zero, each change is notified immediately.
+   */
+  template <typename Rep1, typename Period1, typename Rep2, typename Period2>
+    explicit MyOrders (State& s,
+                       const std::chrono::duration<Rep1, Period1> intv,
+                       const std::chrono::duration<Rep2, Period2> debounce)
     : state(s)
   {
+    StartChangeNotifier (
+        std::chrono::duration_cast<std::chrono::milliseconds> (debounce));
     StartRefresher (intv);
   }
 
@@ -111,6 +186,20 @@ public:
    */
   void RemoveById (uint64_t id);
 
+  /**
+   * Applies a batch of changes in a single state transaction, so that
+   * they result in only one notification / broadcast:  The orders with
+   * IDs in "cancel" are removed (if they exist), and the orders in "add"
+   * are added unless they are invalid.  Returns for each of the new orders
+   * whether or not it has been added.
+   *
+   * If atomic is true, then nothing at all is changed if any of the
+   * new orders is invalid.  This can be used to replace orders (e.g. when
+   * re-quoting) without the risk of ending up with only some of them.
+   */
+  std::vector<bool> Update (const std::vector<uint64_t>& cancel,
+                            std::vector<proto::Order>&& add, bool atomic);
+
   /**
    * Tries to "lock" an order by ID.  If the order is not locked (and exists),
    * this returns true, locks the order and sets the output argument to the
@@ -132,6 +221,16 @@ public:
    */
   void Unlock (uint64_t id);
 
+  /**
+   * Returns the version counter of the own orders, which changes whenever
+   * they are modified (including locking and unlocking).
+   */
+  const VersionCounter&
+  GetVersion () const
+  {
+    return version;
+  }
+
   /**
    * Returns the current set of own orders.  This includes locked orders.
    */
@@ -143,6 +242,16 @@ public:
 
 };
 
+/**
+ * Computes the delta between two sets of orders of an account, i.e.
+ * the orders that were added / modified and those that were removed
+ * in "to" compared to "from".  The sequence number of the delta is not
+ * touched.  Returns true if there are any changes at all.
+ */
+bool ComputeOrdersDelta (const proto::OrdersOfAccount& from,
+                         const proto::OrdersOfAccount& to,
+                         proto::OrdersDelta& delta);
+
 } // namespace democrit
 
 #endif // DEMOCRIT_MYORDERS_HPP
@@ -20,15 +20,19 @@
 #define DEMOCRIT_ORDERBOOK_HPP
 
 #include "assetspec.hpp"
+#include "private/assetinterner.hpp"
 #include "private/intervaljob.hpp"
+#include "private/versioncounter.hpp"
 #include "proto/orders.pb.h"
 
 #include <chrono>
+#include <functional>
 #include <map>
 #include <mutex>
 #include <memory>
-#include <queue>
+#include <set>
 #include <string>
+#include <vector>
 
 namespace democrit
 {
@@ -74,22 +78,136 @@ private:
    */
   Clock::duration timeoutIntv;
 
+  /**
+   * Key used to sort orders for one asset and side.  Orders are sorted by
+   * price, and ties are broken by account and ID.
+   */
+  struct OrderKey
+  {
+
+    /** The order's price per unit.  */
+    uint64_t price;
+
+    /** The account owning the order.  */
+    std::string account;
+
+    /** The order's ID.  */
+    uint64_t id;
+
+    explicit OrderKey (const uint64_t p, const std::string& a, const uint64_t i)
+      : price(p), account(a), id(i)
+    {}
+
+    bool operator< (const OrderKey& o) const;
+
+  };
+
+  /**
+   * Sorted orders for one side (bids or asks) of an asset's orderbook.
+   * The values are the orders in the form they are returned, i.e. including
+   * the account and ID but without asset and type.
+   */
+  using SortedOrders = std::map<OrderKey, proto::Order>;
+
+  /**
+   * Aggregated data for one price level of one side of an asset's book.
+   */
+  struct Level
+  {
+
+    /** Total units of all orders at this price.  */
+    uint64_t units = 0;
+
+    /** Number of orders at this price.  */
+    unsigned orders = 0;
+
+  };
+
+  /** Price levels of one side of a book, keyed by the price.  */
+  using Levels = std::map<uint64_t, Level>;
+
+  /**
+   * All orders for one particular asset, sorted by price.  This is the
+   * main data structure of the orderbook, and kept up-to-date incrementally
+   * as orders are updated or time out.
+   */
+  struct AssetOrders
+  {
+
+    /** Bids, sorted by increasing price (i.e. reverse of the output).  */
+    SortedOrders bids;
+
+    /** Asks, sorted by increasing price.  */
+    SortedOrders asks;
+
+    /** Aggregated price levels of the bids.  */
+    Levels bidLevels;
+
+    /** Aggregated price levels of the asks.  */
+    Levels askLevels;
+
+  };
+
+  /**
+   * Index of all known orders by asset.  Assets are identified by their
+   * handles in the global AssetInterner, and only converted back to strings
+   * when publishing snapshots.
+   */
+  std::map<AssetId, AssetOrders> byAsset;
+
+  /**
+   * Reference to an order inside the byAsset index, which is used to
+   * remove it again when the account gets updated or times out.
+   */
+  struct IndexEntry
+  {
+
+    /** The asset entry in byAsset.  */
+    std::map<AssetId, AssetOrders>::iterator asset;
+
+    /** The side (bids or asks) inside the asset entry.  */
+    SortedOrders* side;
+
+    /** The price levels of the order's side.  */
+    Levels* levels;
+
+    /** The order entry itself.  */
+    SortedOrders::iterator entry;
+
+  };
+
+  /**
+   * Timeout deadlines of all accounts, i.e. the time after which their
+   * orders get removed unless they are refreshed.  This has exactly one
+   * entry per account, which is moved whenever the account is updated.
+   * When timing out orders, we only need to look at the front elements
+   * until the deadline is in the future.
+   */
+  using Deadlines = std::multimap<Clock::time_point, std::string>;
+
+  /** The deadlines of all accounts.  */
+  Deadlines deadlines;
+
   /**
    * The per-account data that we store for the orderbook.
    */
   struct AccountOrders
   {
 
-    /** The actual orders of that account.  */
-    proto::OrdersOfAccount orders;
+    /** References to all orders of that account in the index, by ID.  */
+    std::map<uint64_t, IndexEntry> entries;
 
-    /** The last update time.  */
-    Clock::time_point lastUpdate;
+    /** The account's entry in deadlines.  */
+    Deadlines::iterator deadline;
 
-    explicit AccountOrders (proto::OrdersOfAccount&& o,
-                            const Clock::time_point t)
-      : orders(std::move (o)), lastUpdate(t)
-    {}
+    /**
+     * Whether we know the sequence number of the account's state, i.e.
+     * whether deltas can be applied.
+     */
+    bool hasSequence = false;
+
+    /** The sequence number of the last update applied, if known.  */
+    uint64_t sequence = 0;
 
     AccountOrders () = default;
     AccountOrders (AccountOrders&&) = default;
@@ -104,38 +222,85 @@ private:
   std::map<std::string, AccountOrders> orders;
 
   /**
-   * An entry into the queue of update events.
+   * Immutable snapshot of one price level on one side of an asset's book,
+   * as it is returned to readers.
    */
-  struct UpdateEvent
+  struct LevelSnapshot
   {
 
-    /** The account that was updated.  */
-    std::string account;
+    /** The orders at this price, in the order they are returned.  */
+    std::vector<proto::Order> orders;
 
-    /** The update's time.  */
-    Clock::time_point time;
+    /** The aggregated data of the level.  */
+    Level level;
 
-    explicit UpdateEvent (const std::string& a, const Clock::time_point t)
-      : account(a), time(t)
-    {}
+  };
+
+  /**
+   * Snapshot of one side of an asset's book, by price.  Each level is
+   * stored in its own shared pointer, so that updates only need to rebuild
+   * the levels that were actually touched.
+   */
+  using SideSnapshot = std::map<uint64_t, std::shared_ptr<const LevelSnapshot>>;
+
+  /**
+   * Immutable snapshot of the data for one asset.
+   */
+  struct AssetSnapshot
+  {
+
+    /** The bids by price, i.e. in reverse of the order they are returned.  */
+    SideSnapshot bids;
+
+    /** The asks by price.  */
+    SideSnapshot asks;
+
+  };
+
+  /**
+   * Immutable snapshot of the orderbook.  Each asset's data is stored in
+   * its own shared pointer, so that unchanged assets are shared between
+   * successive snapshots.
+   */
+  using Snapshot = std::map<Asset, std::shared_ptr<const AssetSnapshot>>;
+
+  /**
+   * The currently published snapshot.  It is replaced (through the atomic
+   * shared_ptr functions) after every modification, so that readers can
+   * just grab a reference to it without having to lock the mutex or wait
+   * for writers.
+   */
+  std::shared_ptr<const Snapshot> snapshot;
+
+  /**
+   * Price levels modified since the last snapshot was published, for one
+   * asset.
+   */
+  struct DirtyLevels
+  {
+
+    /** Prices of modified bid levels.  */
+    std::set<uint64_t> bids;
 
-    UpdateEvent (UpdateEvent&&) = default;
-    UpdateEvent (const UpdateEvent&) = delete;
-    void operator= (const UpdateEvent&) = delete;
+    /** Prices of modified ask levels.  */
+    std::set<uint64_t> asks;
 
   };
 
   /**
-   * A queue of all the order updates we have received.  When trying to
-   * time out orders, we process the front elements of the queue, until
-   * the timestamp is too fresh.  Note that if an account is updated
-   * again, any previous entries remain in the queue (and will just be
-   * ignored when timing out orders).
+   * Price levels (by asset) whose orders have been modified since the last
+   * snapshot was published.
    */
-  std::queue<UpdateEvent> updates;
+  std::map<AssetId, DirtyLevels> dirtyLevels;
 
-  /** Lock used for this instance.  */
-  std::mutex mut;
+  /** Version of the orderbook, bumped whenever a snapshot is published.  */
+  VersionCounter version;
+
+  /**
+   * Lock used for this instance.  It is held by writers (but not needed
+   * for reading the published snapshot).
+   */
+  mutable std::mutex mut;
 
   /** The worker job to run timeouts.  */
   std::unique_ptr<IntervalJob> timeouter;
@@ -151,24 +316,106 @@ private:
   void RunTimeout ();
 
   /**
-   * Internal implementation of GetByAsset, which allows filtering for
-   * only one of the assets (ignoring all others).  This is used both
-   * for GetForAsset and GetByAsset.  If asset is set as null, then all
-   * assets will be returned instead.
+   * Removes all orders of the given account entry from the byAsset index.
+   * This must be called with the lock held.
+   */
+  void RemoveFromIndex (AccountOrders& acc);
+
+  /**
+   * Removes a single order from the byAsset index.  This must be called
+   * with the lock held.
+   */
+  void RemoveEntry (const IndexEntry& ref);
+
+  /**
+   * Inserts a new order into the byAsset index and the account's entries.
+   * There must not yet be an order with the same ID for the account.
+   * This must be called with the lock held.
+   */
+  void InsertOrder (const std::string& account, uint64_t id,
+                    proto::Order&& o, AccountOrders& acc);
+
+  /**
+   * Marks the given account as updated now, which resets its timeout.
+   * If isNew is true, then the account does not yet have an entry in
+   * deadlines.  This must be called with the lock held.
+   */
+  void MarkUpdated (const std::string& account, AccountOrders& acc,
+                    bool isNew);
+
+  /**
+   * Removes an account with all its orders.  This must be called with
+   * the lock held.
+   */
+  void EraseAccount (std::map<std::string, AccountOrders>::iterator mit);
+
+  /**
+   * Marks the level of the given order (in the given index entry) as
+   * modified.  This must be called with the lock held.
+   */
+  void MarkDirty (const IndexEntry& ref, uint64_t price);
+
+  /**
+   * Builds the snapshot of one price level in the given side of the index.
+   * If the level has no orders, null is returned.  This must be called
+   * with the lock held.
+   */
+  static std::shared_ptr<const LevelSnapshot> BuildLevel (
+      const SortedOrders& side, const Levels& levels, uint64_t price,
+      bool reverse);
+
+  /**
+   * Copies one asset's snapshot into the proto form in which it
+   * is returned.
+   */
+  static void CopyForAsset (const AssetSnapshot& data,
+                            proto::OrderbookForAsset& res);
+
+  /**
+   * Publishes a new snapshot, rebuilding the dirty price levels.
+   * This must be called with the lock held.
+   */
+  void PublishSnapshot ();
+
+  /**
+   * Returns the currently published snapshot.
+   */
+  std::shared_ptr<const Snapshot> GetSnapshot () const;
+
+  /**
+   * Function that selects a subset of the orders of one asset's book.  It
+   * gets the asset's snapshot and fills in the bids and asks of the output.
+   */
+  using OrderSelector
+      = std::function<void (const AssetSnapshot& full,
+                            proto::OrderbookForAsset& out)>;
+
+  /**
+   * Returns the books of the given assets from the current snapshot,
+   * with orders selected by the given function.
    */
-  proto::OrderbookByAsset InternalGetByAsset (const Asset* asset) const;
+  proto::OrderbookByAsset SelectForAssets (const std::vector<Asset>& assets,
+                                           const OrderSelector& select) const;
 
 public:
 
+  /**
+   * Constructs the orderbook with the given timeout of orders.  If a parent
+   * version counter is given, it is bumped together with the orderbook's
+   * own version on every change.
+   */
   template <typename Rep, typename Period>
-    explicit OrderBook (const std::chrono::duration<Rep, Period> to)
-    : timeout(to), timeoutIntv(MAX_TIMEOUT_INTV)
+    explicit OrderBook (const std::chrono::duration<Rep, Period> to,
+                        VersionCounter* parentVersion = nullptr)
+    : timeout(to), timeoutIntv(MAX_TIMEOUT_INTV),
+      snapshot(std::make_shared<Snapshot> ()), version(parentVersion)
   {
-    /* If the timeout interval is longer than the actual timeout (because
-       we set it to something very short in a test), set the timeout
-       interval to the same value instead.  */
-    if (timeoutIntv > timeout)
-      timeoutIntv = timeout;
+    /* If the timeout interval is not much shorter than the actual timeout
+       (because we set it to something very short in a test), use a fraction
+       of the timeout instead.  Otherwise whether an order is removed after
+       one or two timeouts depends on tiny scheduling differences.  */
+    if (timeoutIntv > timeout / 4)
+      timeoutIntv = timeout / 4;
 
     StartTimeouter ();
   }
@@ -177,13 +424,34 @@ public:
   OrderBook (const OrderBook&) = delete;
   void operator= (const OrderBook&) = delete;
 
+  /**
+   * Returns the version counter of the orderbook, which changes whenever
+   * a modification is published to readers.
+   */
+  const VersionCounter&
+  GetVersion () const
+  {
+    return version;
+  }
+
   /**
    * Updates the orders of the given account in the database.  If there
-   * are no orders specified, then the account will be removed from our
-   * database instead.
+   * are no orders specified (and no sequence number), then the account
+   * will be removed from our database instead.
    */
   void UpdateOrders (proto::OrdersOfAccount&& upd);
 
+  /**
+   * Applies an incremental update to the orders of the given account.
+   * This only works if the delta's sequence number directly follows the
+   * one of the last update we have for the account.  If that is not the
+   * case (e.g. because we missed some message), the delta is ignored
+   * and false returned.  The orders will then be synced again with the
+   * next full update sent by the account.
+   */
+  bool UpdateOrdersDelta (const std::string& account,
+                          proto::OrdersDelta&& delta);
+
   /**
    * Returns the orderbook for a given asset (not including our
    * own orders if any).
@@ -195,6 +463,48 @@ public:
    */
   proto::OrderbookByAsset GetByAsset () const;
 
+  /**
+   * Returns the aggregated depth (total units per price level on each
+   * side) of the book for the given asset.
+   */
+  proto::DepthForAsset GetDepthForAsset (const Asset& asset) const;
+
+  /**
+   * Returns the aggregated depth of the book for the given asset, but
+   * without the orders of the account in "excluded".  Its orders are
+   * only used to find the price levels that need to be corrected.  This
+   * is used by daemons attached to a shared market, whose own orders are
+   * part of the book.
+   */
+  proto::DepthForAsset GetDepthForAsset (
+      const Asset& asset, const proto::OrdersOfAccount& excluded) const;
+
+  /**
+   * Returns the orderbooks for the given assets, but including only the
+   * best "levels" price levels on each side (i.e. all orders with one of
+   * the best "levels" distinct prices).
+   */
+  proto::OrderbookByAsset GetBestForAssets (const std::vector<Asset>& assets,
+                                            unsigned levels) const;
+
+  /**
+   * Returns the best "levels" price levels of the given assets, without
+   * the orders of the excluded account.  Levels at which only that account
+   * has orders are skipped and do not count towards the limit.  This is
+   * used by daemons attached to a shared market.
+   */
+  proto::OrderbookByAsset GetBestForAssets (const std::vector<Asset>& assets,
+                                            unsigned levels,
+                                            const std::string& excluded) const;
+
+  /**
+   * Returns the orderbooks for the given assets, but including only orders
+   * whose price is between minPrice and maxPrice (both inclusive).
+   */
+  proto::OrderbookByAsset GetRangeForAssets (const std::vector<Asset>& assets,
+                                             uint64_t minPrice,
+                                             uint64_t maxPrice) const;
+
 };
 
 } // namespace democrit
@@ -0,0 +1,159 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_ORDERSINGRESS_HPP
+#define DEMOCRIT_ORDERSINGRESS_HPP
+
+#include "proto/orders.pb.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace democrit
+{
+
+/**
+ * Bounded queue of received order broadcasts that are waiting for
+ * validation.  Since only the latest full update of each account matters,
+ * a newer full update from an account replaces an older one that is still
+ * pending (instead of having both validated).  Delta updates can not be
+ * merged in this way, but they still count towards the bound.  When the
+ * queue is full, new updates are dropped; this is fine, since peers
+ * rebroadcast their orders regularly anyway.
+ *
+ * The counters are also reported to the global metrics.
+ *
+ * The queue itself only holds the data.  The caller is responsible for
+ * scheduling the actual processing whenever a new entry has been queued,
+ * and that processing then takes out the current data.
+ *
+ * This class is thread-safe.
+ */
+class OrdersIngress
+{
+
+public:
+
+  /** Result of adding an update to the queue.  */
+  enum class Result
+  {
+    /** The update was queued and processing needs to be scheduled.  */
+    QUEUED,
+    /** The update replaced an older pending one of the same account.  */
+    COALESCED,
+    /** The queue is full and the update was dropped.  */
+    DROPPED,
+  };
+
+  /** Counters for the updates we handled.  */
+  struct Stats
+  {
+
+    /** Number of updates received in total.  */
+    uint64_t received = 0;
+
+    /** Number of updates that replaced an older pending one.  */
+    uint64_t coalesced = 0;
+
+    /** Number of updates that were dropped because the queue was full.  */
+    uint64_t dropped = 0;
+
+  };
+
+private:
+
+  /** Maximum number of pending updates (full and delta) at any time.  */
+  const size_t maxPending;
+
+  /** Pending full updates by account.  */
+  std::map<std::string, proto::OrdersOfAccount> full;
+
+  /** Number of pending delta updates.  */
+  size_t numDeltas = 0;
+
+  /** Counters of what we did so far.  */
+  Stats stats;
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /**
+   * Returns true if the queue is full.  Must be called with the lock held.
+   */
+  bool IsFull () const;
+
+public:
+
+  explicit OrdersIngress (size_t m)
+    : maxPending(m)
+  {}
+
+  OrdersIngress () = delete;
+  OrdersIngress (const OrdersIngress&) = delete;
+  void operator= (const OrdersIngress&) = delete;
+
+  /**
+   * Adds a full update for the given account.  If QUEUED is returned,
+   * the caller should schedule a call to TakeFull for the account.
+   */
+  Result AddFull (const std::string& account, proto::OrdersOfAccount&& data);
+
+  /**
+   * Takes out the pending full update for the given account.  Returns false
+   * if there is none.
+   */
+  bool TakeFull (const std::string& account, proto::OrdersOfAccount& data);
+
+  /**
+   * Drops the pending full update for the given account, if any.  This is
+   * used when the account disconnects:  A later full update must then be
+   * queued anew behind the disconnect, rather than coalesced into a slot
+   * that is processed before it.
+   */
+  void DropFull (const std::string& account);
+
+  /**
+   * Reserves a slot in the queue for a delta update.  If QUEUED is
+   * returned, the caller should process the delta and call FinishDelta
+   * once it is taken out of the queue for processing.  Deltas are never
+   * coalesced, so the result is either QUEUED or DROPPED.
+   */
+  Result AddDelta ();
+
+  /**
+   * Releases the slot of a delta update that was previously queued.
+   */
+  void FinishDelta ();
+
+  /**
+   * Returns the number of updates currently pending.
+   */
+  size_t GetNumPending () const;
+
+  /**
+   * Returns the current counters.
+   */
+  Stats GetStats () const;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_ORDERSINGRESS_HPP
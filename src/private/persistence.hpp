@@ -0,0 +1,276 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_PERSISTENCE_HPP
+#define DEMOCRIT_PERSISTENCE_HPP
+
+#include "private/intervaljob.hpp"
+#include "proto/orders.pb.h"
+#include "proto/state.pb.h"
+#include "proto/trades.pb.h"
+
+#include <google/protobuf/repeated_field.h>
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+
+namespace democrit
+{
+
+/**
+ * Record of the parts of the State that a single transaction modified.
+ * The code doing the modification knows what it touches and records it
+ * here, so that only those parts need to be journaled (instead of copying
+ * and diffing the full state).  Appends to the trade archive are detected
+ * automatically from its size.
+ */
+class StateChanges
+{
+
+private:
+
+  /**
+   * Identification of a trade in the state, as its counterparty and
+   * the order's account and ID.  This matches Trade::GetKey.
+   */
+  using TradeId = std::tuple<std::string, std::string, uint64_t>;
+
+  /** Size of the trade archive before the modification.  */
+  const int archiveSize;
+
+  /** IDs of own orders that were added, modified or removed.  */
+  std::set<uint64_t> orders;
+
+  /** Whether the next free ID was changed.  */
+  bool nextFreeId = false;
+
+  /** Trades that were added, modified or removed.  */
+  std::set<TradeId> trades;
+
+  /** Set if the changes are unknown, so that a snapshot is needed.  */
+  bool unknown = false;
+
+  /**
+   * Returns the identification of the given trade.
+   */
+  static TradeId GetTradeId (const proto::TradeState& t);
+
+  friend bool ComputeJournalEntry (const StateChanges& changes,
+                                   const proto::State& after,
+                                   proto::StateJournalEntry& entry);
+
+public:
+
+  /**
+   * Starts recording changes on top of the given state.
+   */
+  explicit StateChanges (const proto::State& before)
+    : archiveSize(before.trade_archive_size ())
+  {}
+
+  StateChanges () = delete;
+  StateChanges (const StateChanges&) = delete;
+  void operator= (const StateChanges&) = delete;
+
+  /**
+   * Records that the own order with the given ID has been added,
+   * modified or removed.
+   */
+  void
+  TouchOrder (const uint64_t id)
+  {
+    orders.insert (id);
+  }
+
+  /**
+   * Records that the next free ID for own orders has been changed.
+   */
+  void
+  TouchNextFreeId ()
+  {
+    nextFreeId = true;
+  }
+
+  /**
+   * Records that the given trade has been added, modified or removed.
+   * Only the fields identifying the trade are used.
+   */
+  void
+  TouchTrade (const proto::TradeState& t)
+  {
+    trades.insert (GetTradeId (t));
+  }
+
+  /**
+   * Records that the state may have been modified arbitrarily, which
+   * requires a full snapshot.
+   */
+  void
+  TouchAll ()
+  {
+    unknown = true;
+  }
+
+};
+
+/**
+ * Persistence layer for the global State.  The data is stored in a
+ * directory as a binary snapshot of the full state, together with an
+ * append-only journal of changes done since that snapshot.  Journal
+ * entries are written right away, but only fsync'ed in batches from
+ * a background job.  After a configurable number of journal entries,
+ * a new snapshot is written and the journal is started afresh.
+ *
+ * On startup, the snapshot is loaded and the journal replayed on top
+ * of it.  If the last journal entry is incomplete (e.g. because of
+ * a crash while writing it), it is ignored.
+ *
+ * Journal entries only contain the parts of the state that a transaction
+ * touched, as recorded by the modifying code in a StateChanges instance.
+ *
+ * Recording is meant to be done from State with the exclusive state lock
+ * held.  Snapshots that are just due because of the journal's length can
+ * instead be written while holding only a shared lock, taken after the
+ * exclusive one was released.  The journal file itself is synchronised
+ * internally, and WriteSnapshot checks again under that lock whether the
+ * snapshot has not been written by someone else in the meantime.
+ */
+class StatePersistence
+{
+
+private:
+
+  /** The directory holding our files.  */
+  const std::string dir;
+
+  /** Number of journal entries after which a new snapshot is written.  */
+  const unsigned snapshotInterval;
+
+  /** File descriptor of the opened journal, or -1 if none.  */
+  int journal = -1;
+
+  /** Number of entries in the current journal.  */
+  unsigned numEntries = 0;
+
+  /** Whether there are journal writes that have not been synced yet.  */
+  bool dirty = false;
+
+  /** Lock for the journal file, so that it can be synced in the background.  */
+  std::mutex mut;
+
+  /** The background job syncing the journal to disk.  */
+  std::unique_ptr<IntervalJob> syncer;
+
+  /** Returns the path of the snapshot file.  */
+  std::string GetSnapshotPath () const;
+
+  /** Returns the path of the journal file.  */
+  std::string GetJournalPath () const;
+
+  /**
+   * Opens the journal file for appending.  If truncate is true, it is
+   * cleared as well.  Must be called with the lock held.
+   */
+  void OpenJournal (bool truncate);
+
+  /**
+   * Writes a new snapshot of the given state and clears the journal.
+   * Must be called with the lock held.
+   */
+  void InternalWriteSnapshot (const proto::State& s);
+
+  /**
+   * Fsyncs the journal if there are pending writes.
+   */
+  void Sync ();
+
+public:
+
+  /**
+   * Constructs the instance for the given directory (which must exist).
+   * Records are synced to disk with the given interval.
+   */
+  template <typename Rep, typename Period>
+    explicit StatePersistence (const std::string& d, const unsigned snapIntv,
+                               const std::chrono::duration<Rep, Period> sync)
+    : dir(d), snapshotInterval(snapIntv)
+  {
+    syncer = std::make_unique<IntervalJob> (sync, [this] ()
+      {
+        Sync ();
+      });
+  }
+
+  /**
+   * Syncs all pending data and closes the files.
+   */
+  ~StatePersistence ();
+
+  StatePersistence () = delete;
+  StatePersistence (const StatePersistence&) = delete;
+  void operator= (const StatePersistence&) = delete;
+
+  /**
+   * Loads the state from disk (if there is any) into the given proto, and
+   * opens the journal for recording further changes.  The loaded data is
+   * compacted into a new snapshot right away.  Returns true if there was
+   * existing data, and false if the state is fresh.
+   */
+  bool Load (proto::State& s);
+
+  /**
+   * Records the given changes of the state in the journal.  If they can
+   * not be expressed as journal entry, a snapshot is written right away.
+   * Returns true if the journal has become long enough that a new snapshot
+   * should be written with WriteSnapshot.  That can be done after the
+   * exclusive state lock has been released, as long as no other writer
+   * modifies the state until it is done.
+   */
+  bool Record (const StateChanges& changes, const proto::State& after);
+
+  /**
+   * Writes a new snapshot of the given state and clears the journal, if
+   * that is still due (i.e. no other thread did so in the meantime).
+   */
+  void WriteSnapshot (const proto::State& s);
+
+};
+
+/**
+ * Computes the journal entry for the given changes, based on the modified
+ * state.  Returns false if the change can not be expressed as a journal
+ * entry (i.e. the changes are unknown or archived trades were removed), so
+ * that a full snapshot is required.  The entry is empty if nothing changed.
+ */
+bool ComputeJournalEntry (const StateChanges& changes,
+                          const proto::State& after,
+                          proto::StateJournalEntry& entry);
+
+/**
+ * Applies a journal entry to the given state.
+ */
+void ApplyJournalEntry (const proto::StateJournalEntry& entry,
+                        proto::State& s);
+
+} // namespace democrit
+
+#endif // DEMOCRIT_PERSISTENCE_HPP
@@ -0,0 +1,78 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_PSBTDECODER_HPP
+#define DEMOCRIT_PSBTDECODER_HPP
+
+#include "private/lrucache.hpp"
+#include "private/rpcclient.hpp"
+#include "rpc-stubs/xayarpcclient.h"
+
+#include <xayautil/uint256.hpp>
+
+#include <json/json.h>
+
+#include <memory>
+#include <string>
+
+namespace democrit
+{
+
+/**
+ * Decoder for PSBTs, which uses Xaya Core's decodepsbt and memoises the
+ * results.  The decoded form only depends on the PSBT itself (and not on
+ * any chain or wallet state), so it can be cached indefinitely.  During
+ * a trade, the same PSBTs are typically decoded multiple times (e.g. for
+ * checking the outputs, and then comparing them to the signed version),
+ * so that this saves many RPC round trips with large payloads.
+ *
+ * This class is thread-safe.
+ */
+class PsbtDecoder
+{
+
+private:
+
+  /** RPC connection to Xaya Core.  */
+  RpcClient<XayaRpcClient>& rpc;
+
+  /** Cache of decoded PSBTs, keyed by the hash of the PSBT string.  */
+  LruCache<xaya::uint256, std::shared_ptr<const Json::Value>> cache;
+
+public:
+
+  explicit PsbtDecoder (RpcClient<XayaRpcClient>& r, const size_t cacheSize)
+    : rpc(r), cache(cacheSize)
+  {}
+
+  PsbtDecoder () = delete;
+  PsbtDecoder (const PsbtDecoder&) = delete;
+  void operator= (const PsbtDecoder&) = delete;
+
+  /**
+   * Returns the decoded form of the given PSBT, as per decodepsbt.
+   * Errors from the RPC call (e.g. for an invalid PSBT) are thrown as
+   * JsonRpcException, and not cached.
+   */
+  Json::Value Decode (const std::string& psbt);
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_PSBTDECODER_HPP
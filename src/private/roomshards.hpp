@@ -0,0 +1,121 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_ROOMSHARDS_HPP
+#define DEMOCRIT_ROOMSHARDS_HPP
+
+#include "assetspec.hpp"
+
+#include <gloox/jid.h>
+
+#include <set>
+#include <vector>
+
+namespace democrit
+{
+
+/**
+ * Partitioning of order broadcasts into multiple MUC rooms by asset.
+ * Each asset is assigned to one of a fixed number of shards by a hash of
+ * its name (which must be the same for all participants), and the orders
+ * for assets of a shard are published in a room of their own.  Clients only
+ * join the rooms of the shards they subscribe to, so that they do not have
+ * to receive and validate orders for the entire market.
+ *
+ * The rooms for the shards are named after a base room, with the shard
+ * number appended to the node, e.g. room-3@muc.server for the base room
+ * room@muc.server.  If the number of shards is zero, sharding is disabled
+ * and everything happens in the base room as "shard zero".
+ */
+class RoomShards
+{
+
+private:
+
+  /** The base room.  */
+  const gloox::JID baseRoom;
+
+  /** The number of shards (zero if sharding is disabled).  */
+  const unsigned numShards;
+
+  /** The shards we subscribe to.  */
+  std::set<unsigned> subscribed;
+
+public:
+
+  /**
+   * Constructs the instance for a given number of shards.  If the set
+   * of subscribed shards is empty, all of them are subscribed to.
+   */
+  explicit RoomShards (const gloox::JID& base, unsigned n,
+                       const std::set<unsigned>& subs = {});
+
+  RoomShards () = delete;
+  RoomShards (const RoomShards&) = default;
+  void operator= (const RoomShards&) = delete;
+
+  bool
+  IsSharded () const
+  {
+    return numShards > 0;
+  }
+
+  /**
+   * Returns the shard a given asset belongs to.
+   */
+  unsigned GetShard (const Asset& asset) const;
+
+  /**
+   * Returns true if we subscribe to the shard of the given asset.
+   */
+  bool
+  IsSubscribed (const Asset& asset) const
+  {
+    return subscribed.count (GetShard (asset)) > 0;
+  }
+
+  /**
+   * Returns the set of shards we subscribe to.
+   */
+  const std::set<unsigned>&
+  GetSubscribed () const
+  {
+    return subscribed;
+  }
+
+  /**
+   * Returns the room for the given shard.
+   */
+  gloox::JID GetRoom (unsigned shard) const;
+
+  /**
+   * Returns the rooms of all subscribed shards, in order of the shards.
+   */
+  std::vector<gloox::JID> GetRooms () const;
+
+  /**
+   * Looks up which of our subscribed shards a given (bare) room JID
+   * corresponds to.  Returns false if it is not one of them.
+   */
+  bool GetShardForRoom (const gloox::JID& room, unsigned& shard) const;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_ROOMSHARDS_HPP
@@ -22,18 +22,60 @@
 #include <jsonrpccpp/client.h>
 #include <jsonrpccpp/client/connectors/httpclient.h>
 
+#include <json/json.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <map>
-#include <mutex>
+#include <memory>
+#include <sstream>
 #include <string>
-#include <thread>
+#include <utility>
+#include <vector>
 
 namespace democrit
 {
 
+/**
+ * HTTP client connector for libjson-rpc-cpp that records the time of each
+ * call in the global metrics (as histogram "rpc.<method>").
+ */
+class MeteredHttpClient : public jsonrpc::HttpClient
+{
+
+public:
+
+  explicit MeteredHttpClient (const std::string& url)
+    : jsonrpc::HttpClient(url)
+  {}
+
+  void SendRPCMessage (const std::string& message,
+                       std::string& result) override;
+
+  /**
+   * Extracts the method name from a serialised JSON-RPC request (or
+   * batch request) for use in the metrics.  This just looks for the first
+   * "method" key, which avoids parsing the full (potentially large) request.
+   */
+  static std::string GetMethodName (const std::string& message);
+
+};
+
+/**
+ * Returns a new, process-wide unique ID for an RpcClient instance.
+ */
+uint64_t NewRpcClientId ();
+
 /**
  * Thin wrapper around a libjson-rpc-cpp JSON-RPC client, which makes
  * sure it is thread-safe by using a separate HTTP client instance for
  * each thread.
+ *
+ * The per-thread instances are held in thread-local storage, so that
+ * no locking is needed to access them, and they are freed automatically
+ * when a thread exits.  Each HTTP client is reused for all calls
+ * from its thread, so that its connection is kept alive between calls.
  */
 template <typename T>
   class RpcClient
@@ -41,20 +83,64 @@ template <typename T>
 
 private:
 
+  /**
+   * Minimum number of endpoints (for the same client type) for which each
+   * thread keeps clients.  The actual limit is the larger of this and the
+   * number of live RpcClient instances, so that clients of live instances
+   * are never evicted just because there are many of them (e.g. for lots
+   * of accounts in a shared market).  When a thread uses more endpoints,
+   * the least recently used clients are evicted.  This bounds the memory
+   * held by threads for endpoints whose instances were destroyed.
+   */
+  static constexpr size_t MIN_CLIENTS_PER_THREAD = 8;
+
+  /** Number of currently existing instances of this type.  */
+  static std::atomic<size_t> numInstances;
+
+  /**
+   * The HTTP and JSON-RPC clients used by one thread.
+   */
+  struct ThreadClients
+  {
+
+    /** The HTTP client.  */
+    MeteredHttpClient http;
+
+    /** The JSON-RPC client using the HTTP client.  */
+    T rpc;
+
+    /** Thread-local "time" of the last use, for evicting old clients.  */
+    uint64_t lastUse = 0;
+
+    explicit ThreadClients (const std::string& ep,
+                            const jsonrpc::clientVersion_t v)
+      : http(ep), rpc(http, v)
+    {}
+
+    ThreadClients (const ThreadClients&) = delete;
+    void operator= (const ThreadClients&) = delete;
+
+  };
+
+  /**
+   * Unique ID of this instance, which is used to quickly find the clients
+   * used last by a thread.  Unlike the address, it is never reused for
+   * another instance even after this one is destroyed.
+   */
+  const uint64_t id;
+
   /** The JSON-RPC HTTP endpoint to use.  */
   const std::string endpoint;
 
   /** The JSON-RPC client version to use.  */
   const jsonrpc::clientVersion_t clientVersion;
 
-  /** The HTTP client instances we use for our JSON-RPC clients per thread.  */
-  std::map<std::thread::id, jsonrpc::HttpClient> httpClients;
-
-  /** The actual JSON-RPC client instances per thread.  */
-  std::map<std::thread::id, T> rpcClients;
-
-  /** Mutex protecting the maps.  */
-  std::mutex mut;
+  /**
+   * Returns the clients for the current thread, creating them first
+   * if necessary.  The clients only depend on the endpoint and protocol
+   * version, so they are shared between all instances using the same.
+   */
+  ThreadClients& GetForThread ();
 
 public:
 
@@ -64,9 +150,16 @@ public:
    * will use V1 instead (needed for Xaya Core).
    */
   explicit RpcClient (const std::string& ep, const bool l = false)
-    : endpoint(ep),
+    : id(NewRpcClientId ()), endpoint(ep),
       clientVersion(l ? jsonrpc::JSONRPC_CLIENT_V1 : jsonrpc::JSONRPC_CLIENT_V2)
-  {}
+  {
+    ++numInstances;
+  }
+
+  ~RpcClient ()
+  {
+    --numInstances;
+  }
 
   RpcClient () = delete;
   RpcClient (const RpcClient<T>&) = delete;
@@ -87,6 +180,19 @@ public:
     return &(this->operator* ());
   }
 
+  /**
+   * Calls the given method with each of the given parameter values,
+   * sending all calls as a single JSON-RPC batch request (and in just one
+   * round trip).  The results are returned in the order of the params.
+   *
+   * The individual requests are always sent as JSON-RPC 2.0 (even for
+   * the legacy protocol), but responses in both the 1.0 and 2.0 formats
+   * are understood.  If any of the calls returns an error, a matching
+   * JsonRpcException is thrown just as for a single call.
+   */
+  std::vector<Json::Value> CallBatch (const std::string& method,
+                                      const std::vector<Json::Value>& params);
+
 };
 
 } // namespace democrit
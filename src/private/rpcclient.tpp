@@ -21,24 +21,146 @@
 namespace democrit
 {
 
+template <typename T>
+  constexpr size_t RpcClient<T>::MIN_CLIENTS_PER_THREAD;
+
+template <typename T>
+  std::atomic<size_t> RpcClient<T>::numInstances(0);
+
+template <typename T>
+  typename RpcClient<T>::ThreadClients&
+  RpcClient<T>::GetForThread ()
+{
+  /* Every lookup advances the thread's "time", which is used to
+     find the least recently used clients for eviction.  */
+  thread_local uint64_t now = 0;
+  ++now;
+
+  /* Typically, a thread makes many calls in a row through the same
+     instance.  So we remember the last used one, and only look up in
+     the full map if another instance is used.  */
+  thread_local uint64_t lastId = 0;
+  thread_local ThreadClients* last = nullptr;
+  if (last != nullptr && lastId == id)
+    {
+      last->lastUse = now;
+      return *last;
+    }
+
+  using Key = std::pair<std::string, jsonrpc::clientVersion_t>;
+  thread_local std::map<Key, std::unique_ptr<ThreadClients>> clients;
+
+  const Key key(endpoint, clientVersion);
+  auto mit = clients.find (key);
+  if (mit == clients.end ())
+    {
+      const size_t limit = std::max (MIN_CLIENTS_PER_THREAD,
+                                     numInstances.load ());
+      while (clients.size () >= limit)
+        {
+          auto oldest = clients.begin ();
+          for (auto it = clients.begin (); it != clients.end (); ++it)
+            if (it->second->lastUse < oldest->second->lastUse)
+              oldest = it;
+          clients.erase (oldest);
+        }
+
+      auto entry = std::make_unique<ThreadClients> (endpoint, clientVersion);
+      mit = clients.emplace (key, std::move (entry)).first;
+    }
+
+  lastId = id;
+  last = mit->second.get ();
+  last->lastUse = now;
+
+  return *last;
+}
+
 template <typename T>
   T&
   RpcClient<T>::operator* ()
 {
-  std::lock_guard<std::mutex> lock(mut);
-  const auto id = std::this_thread::get_id ();
+  return GetForThread ().rpc;
+}
+
+template <typename T>
+  std::vector<Json::Value>
+  RpcClient<T>::CallBatch (const std::string& method,
+                           const std::vector<Json::Value>& params)
+{
+  std::vector<Json::Value> res(params.size ());
+  if (params.empty ())
+    return res;
+
+  Json::Value request(Json::arrayValue);
+  for (unsigned i = 0; i < params.size (); ++i)
+    {
+      Json::Value call(Json::objectValue);
+      call["jsonrpc"] = "2.0";
+      call["method"] = method;
+      call["params"] = params[i];
+      call["id"] = i;
+      request.append (call);
+    }
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["commentStyle"] = "None";
+  wbuilder["indentation"] = "";
+
+  std::string responseStr;
+  GetForThread ().http.SendRPCMessage (Json::writeString (wbuilder, request),
+                                       responseStr);
+
+  Json::CharReaderBuilder rbuilder;
+  std::istringstream in(responseStr);
+  Json::Value response;
+  std::string parseErrors;
+  if (!Json::parseFromStream (rbuilder, in, &response, &parseErrors))
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_JSON_PARSE_ERROR, parseErrors);
+
+  /* If the server does not support batches (or the request was invalid as
+     a whole), it may reply with a single error object instead.  */
+  const auto throwIfError = [] (const Json::Value& val)
+    {
+      if (!val.isObject () || !val.isMember ("error")
+            || val["error"].isNull ())
+        return;
+
+      const auto& err = val["error"];
+      if (!err.isObject () || !err["code"].isInt ())
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+            "invalid error in batch response");
+
+      throw jsonrpc::JsonRpcException (err["code"].asInt (),
+                                       err["message"].asString ());
+    };
+
+  throwIfError (response);
+  if (!response.isArray () || response.size () != params.size ())
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+        "invalid batch response");
+
+  std::vector<bool> seen(params.size (), false);
+  for (const auto& entry : response)
+    {
+      throwIfError (entry);
 
-  const auto mit = rpcClients.find (id);
-  if (mit != rpcClients.end ())
-    return mit->second;
+      if (!entry.isObject () || !entry["id"].isUInt ()
+            || entry["id"].asUInt () >= params.size ()
+            || seen[entry["id"].asUInt ()])
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_CLIENT_INVALID_RESPONSE,
+            "invalid entry in batch response");
 
-  const auto http = httpClients.emplace (id, endpoint);
-  const auto rpc = rpcClients.emplace (
-      std::piecewise_construct,
-      std::forward_as_tuple (id),
-      std::forward_as_tuple (http.first->second, clientVersion));
+      const unsigned id = entry["id"].asUInt ();
+      seen[id] = true;
+      res[id] = entry["result"];
+    }
 
-  return rpc.first->second;
+  return res;
 }
 
 } // namespace democrit
@@ -0,0 +1,208 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_SCHEDULER_HPP
+#define DEMOCRIT_SCHEDULER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace democrit
+{
+
+/**
+ * Shared scheduler for running tasks repeatedly at set intervals.  It keeps
+ * all tasks in one timer queue ordered by their next due time, and runs
+ * them on a small, fixed pool of worker threads.  This avoids having one
+ * thread (and its wakeups) per repeating task, which adds up when many
+ * daemons run in the same process.
+ *
+ * A task is never run concurrently with itself.  The next run is scheduled
+ * one interval (plus optionally a random jitter) after the previous one
+ * finished.
+ *
+ * This class is thread-safe.
+ */
+class Scheduler
+{
+
+public:
+
+  /** Clock used for the scheduling.  */
+  using Clock = std::chrono::steady_clock;
+
+  /** Identifier for a scheduled task.  */
+  using TaskId = uint64_t;
+
+private:
+
+  /**
+   * Data about a scheduled task.
+   */
+  struct Task
+  {
+
+    /** The function to run.  */
+    std::function<void ()> fcn;
+
+    /** The interval between runs.  */
+    std::chrono::nanoseconds intv;
+
+    /** The maximum random jitter to add to each interval.  */
+    std::chrono::nanoseconds jitter;
+
+    /** The time it is due next (while in the queue).  */
+    Clock::time_point due;
+
+    /** Set while the task is being run.  */
+    bool running = false;
+
+    /** The thread running the task, if it is running.  */
+    std::thread::id runner;
+
+    /**
+     * Whether the task is run repeatedly at its interval, or only when
+     * it has been triggered.
+     */
+    bool repeating = true;
+
+    /** Set if it should be run again after the current run.  */
+    bool triggered = false;
+
+    /** Delay after the current run for running it again if triggered.  */
+    std::chrono::nanoseconds triggerDelay;
+
+    /** Set if the task is to be removed once the current run is done.  */
+    bool removing = false;
+
+  };
+
+  /** All currently scheduled tasks.  */
+  std::map<TaskId, Task> tasks;
+
+  /** The queue of tasks by their due time.  */
+  std::set<std::pair<Clock::time_point, TaskId>> queue;
+
+  /** Next ID to assign to a task.  */
+  TaskId nextId = 1;
+
+  /** Random generator for the jitter.  */
+  std::mt19937_64 rnd;
+
+  /** Set to true when the workers should stop.  */
+  bool stop = false;
+
+  /** Lock for all the state.  */
+  std::mutex mut;
+
+  /** Notified when the queue changes (or on stop).  */
+  std::condition_variable cvQueue;
+
+  /** Notified whenever a task finished running.  */
+  std::condition_variable cvDone;
+
+  /** The worker threads.  */
+  std::vector<std::thread> workers;
+
+  /**
+   * Main function of the worker threads.
+   */
+  void RunWorker ();
+
+  /**
+   * Puts the task into the queue with the given due time.  Must be called
+   * with the lock held and for tasks that are not yet queued.
+   */
+  void Enqueue (TaskId id, Task& t, Clock::time_point due);
+
+public:
+
+  /**
+   * Constructs a scheduler with the given number of worker threads.
+   */
+  explicit Scheduler (unsigned numThreads);
+
+  /**
+   * Stops the workers.  All tasks should have been removed before.
+   */
+  ~Scheduler ();
+
+  Scheduler () = delete;
+  Scheduler (const Scheduler&) = delete;
+  void operator= (const Scheduler&) = delete;
+
+  /**
+   * Returns the process-wide scheduler instance, whose number of threads
+   * is set by a command-line flag.
+   */
+  static Scheduler& Global ();
+
+  /**
+   * Adds a new repeating task.  It is run for the first time right away,
+   * and then again after each interval plus a random amount of up to
+   * the given jitter.
+   */
+  TaskId Add (std::chrono::nanoseconds intv, std::chrono::nanoseconds jitter,
+              const std::function<void ()>& fcn);
+
+  /**
+   * Adds a task that is not run on its own, but only (once) each time
+   * it is triggered with TriggerNow or TriggerAfter.
+   */
+  TaskId AddTriggered (const std::function<void ()>& fcn);
+
+  /**
+   * Requests that the task is run as soon as possible, rather than when
+   * it would be due.  If it is currently running, it will be run again
+   * right after.
+   */
+  void
+  TriggerNow (const TaskId id)
+  {
+    TriggerAfter (id, std::chrono::nanoseconds::zero ());
+  }
+
+  /**
+   * Requests that the task is run at the latest after the given delay.
+   * If it is already due earlier, nothing changes.  If it is currently
+   * running, it will be run again the given delay after the current
+   * run finished.
+   */
+  void TriggerAfter (TaskId id, std::chrono::nanoseconds delay);
+
+  /**
+   * Removes a task.  When this returns, the task is not running anymore
+   * (unless this is called from the task itself) and will not be run
+   * again.
+   */
+  void Remove (TaskId id);
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_SCHEDULER_HPP
@@ -25,14 +25,42 @@
 #include <gloox/stanzaextension.h>
 #include <gloox/tag.h>
 
+#include <memory>
+#include <mutex>
 #include <string>
 
 namespace democrit
 {
 
+/**
+ * Compresses a serialised proto payload for a stanza with zlib, if
+ * compression is enabled and the payload is large enough for it to be
+ * worthwhile.  Returns true if the payload has been replaced by its
+ * compressed form.
+ */
+bool MaybeCompressPayload (std::string& payload);
+
+/**
+ * Decompresses a payload that was compressed with MaybeCompressPayload.
+ * The size of the original data is given as string (as it is sent in the
+ * stanza's attribute).  Returns false if the data is invalid.
+ */
+bool DecompressPayload (const std::string& compressed, const std::string& size,
+                        std::string& out);
+
 /**
  * StanzaExtension that encodes a specific protocol buffer type into
  * its data using Charon's XmlPayload functionality.
+ *
+ * Large payloads may be compressed with zlib before encoding.  This is
+ * signalled by a "compression" attribute on the tag (with the original
+ * size in a "size" attribute), so that uncompressed stanzas from older
+ * peers are still understood.
+ *
+ * The proto data is immutable and shared between clones of a stanza, and
+ * so is its serialised (and possibly compressed) form once it has been
+ * computed for the first time.  This makes cloning cheap, which gloox does
+ * whenever stanzas are copied around.
  */
 template <typename Proto, int N, typename Self>
   class ProtoStanza : public gloox::StanzaExtension
@@ -40,8 +68,32 @@ template <typename Proto, int N, typename Self>
 
 private:
 
+  /**
+   * Serialised form of the data, computed lazily when the stanza is first
+   * turned into a tag.
+   */
+  struct Encoded
+  {
+
+    /** Used to compute the payload only once.  */
+    std::once_flag once;
+
+    /** The payload as put into the tag (i.e. possibly compressed).  */
+    std::string payload;
+
+    /** Size of the uncompressed data, if the payload is compressed.  */
+    size_t size = 0;
+
+    /** Whether or not the payload is compressed.  */
+    bool compressed = false;
+
+  };
+
   /** The underlying protocol buffer data.  */
-  Proto data;
+  std::shared_ptr<const Proto> data;
+
+  /** The serialised payload, shared between clones.  */
+  std::shared_ptr<Encoded> encoded;
 
   /** Set to false if this is invalid (e.g. failed to parse).  */
   bool valid;
@@ -68,6 +120,16 @@ public:
    */
   explicit ProtoStanza (const Proto& d);
 
+  /**
+   * Constructs an instance, moving the data in.
+   */
+  explicit ProtoStanza (Proto&& d);
+
+  /**
+   * Constructs an instance that shares the given data.
+   */
+  explicit ProtoStanza (std::shared_ptr<const Proto> d);
+
   /**
    * Constructs an instance from a given tag.
    */
@@ -81,6 +143,16 @@ public:
 
   const Proto&
   GetData () const
+  {
+    return *data;
+  }
+
+  /**
+   * Returns a shared pointer to the data, which can be used to hand it
+   * off (e.g. to a worker thread) without copying it.
+   */
+  std::shared_ptr<const Proto>
+  GetSharedData () const
   {
     return data;
   }
@@ -108,6 +180,22 @@ public:
 
 };
 
+/**
+ * Stanza for encoding an incremental update to the orders of an account,
+ * as sent by the user to the broadcast channel.
+ */
+class OrdersDeltaStanza
+    : public ProtoStanza<proto::OrdersDelta, 3, OrdersDeltaStanza>
+{
+
+public:
+
+  static constexpr const char* TAG = "ordersdelta";
+
+  using ProtoStanza::ProtoStanza;
+
+};
+
 /**
  * Stanza for encoding a processing message, which contains the data exchanged
  * privately between accounts while negotiating a trade.
@@ -19,9 +19,12 @@
 #ifndef DEMOCRIT_STATE_HPP
 #define DEMOCRIT_STATE_HPP
 
+#include "private/persistence.hpp"
 #include "proto/state.pb.h"
 
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
 #include <string>
 
 namespace democrit
@@ -30,6 +33,11 @@ namespace democrit
 /**
  * Wrapper around the global state that an instance holds in form of
  * a State proto.  It mostly handles synchronisation for accessing the state.
+ *
+ * Read-only access is done with a shared lock, so that readers do not block
+ * each other.  Code holding the lock (in particular for writing) should
+ * never do slow operations like RPC calls; those should be done on copies
+ * of the data instead (see e.g. TradeManager and MyOrders).
  */
 class State
 {
@@ -40,11 +48,16 @@ private:
   proto::State state;
 
   /**
-   * Mutex for the state.  This could be a std::shared_mutex for read/write
-   * locking, but for now should be sufficient with exlusive locks only
-   * until we use C++17.
+   * If set, the persistence layer to which all changes of the state
+   * are recorded.
    */
-  mutable std::mutex mut;
+  std::unique_ptr<StatePersistence> persistence;
+
+  /**
+   * Reader/writer lock for the state.  We use std::shared_timed_mutex
+   * since std::shared_mutex is only available from C++17.
+   */
+  mutable std::shared_timed_mutex mut;
 
 public:
 
@@ -58,29 +71,75 @@ public:
     state.set_account (account);
   }
 
+  /**
+   * Creates an instance that is persisted with the given persistence
+   * layer.  If there is existing data on disk, the state is restored from
+   * it (and the account verified to match).  Otherwise the state is
+   * initialised fresh with the given account.
+   */
+  explicit State (const std::string& account,
+                  std::unique_ptr<StatePersistence> p);
+
   State () = delete;
   State (const State&) = delete;
   void operator= (const State&) = delete;
 
   /**
-   * Exposes the state in a mutable form within the callback.
+   * Exposes the state in a mutable form within the callback.  The callback
+   * also gets a StateChanges instance, in which it has to record what it
+   * touches.  Only those parts are journaled if the state is persisted.
+   */
+  template <typename Fcn>
+    void
+    ModifyState (const Fcn& f)
+  {
+    std::unique_lock<std::shared_timed_mutex> lock(mut);
+
+    StateChanges changes(state);
+    f (state, changes);
+
+    if (persistence == nullptr || !persistence->Record (changes, state))
+      return;
+
+    /* The changes are in the journal already, and a snapshot is due because
+       of its length.  Serialising and syncing the snapshot only needs to
+       keep out other writers, not readers.  The lock is not downgraded
+       atomically, though:  Other writers may get in between and journal
+       their changes (or even write the snapshot themselves).  This is fine,
+       since every journaled change is also in the state we snapshot, and
+       WriteSnapshot checks again under its own lock whether a snapshot is
+       still due.  */
+    lock.unlock ();
+    std::shared_lock<std::shared_timed_mutex> readLock(mut);
+    persistence->WriteSnapshot (state);
+  }
+
+  /**
+   * Exposes the state in a mutable form within the callback, without
+   * tracking what is modified.  If the state is persisted, this writes
+   * a full snapshot.  It should thus only be used for rare (or test)
+   * modifications, and ModifyState otherwise.
    */
   template <typename Fcn>
     void
     AccessState (const Fcn& f)
   {
-    std::lock_guard<std::mutex> lock(mut);
-    f (state);
+    ModifyState ([&f] (proto::State& s, StateChanges& changes)
+      {
+        f (s);
+        changes.TouchAll ();
+      });
   }
 
   /**
-   * Exposes the state in a read-only form within the callback.
+   * Exposes the state in a read-only form within the callback.  Multiple
+   * readers may run concurrently.
    */
   template <typename Fcn>
     void
     ReadState (const Fcn& f) const
   {
-    std::lock_guard<std::mutex> lock(mut);
+    std::shared_lock<std::shared_timed_mutex> lock(mut);
     f (state);
   }
 
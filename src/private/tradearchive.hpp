@@ -0,0 +1,133 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_TRADEARCHIVE_HPP
+#define DEMOCRIT_TRADEARCHIVE_HPP
+
+#include "proto/trades.pb.h"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace democrit
+{
+
+/**
+ * On-disk store for archived trades that are no longer kept in memory.
+ * The trades are appended to a single file, and we keep an in-memory index
+ * with the position and some basic data (start time and state) of each
+ * entry.  That way, queries can skip non-matching entries cheaply, and only
+ * need to read the ones that might match.
+ *
+ * This class is thread-safe.
+ */
+class TradeArchive
+{
+
+private:
+
+  /** Data we keep in memory for each stored trade.  */
+  struct IndexEntry
+  {
+
+    /** Offset of the serialised trade in the file.  */
+    uint64_t offset;
+
+    /** Size of the serialised trade.  */
+    uint32_t size;
+
+    /** The trade's start time.  */
+    int64_t startTime;
+
+    /** The trade's state.  */
+    proto::Trade::State state;
+
+  };
+
+  /** Path of the file.  */
+  const std::string path;
+
+  /** File descriptor of the opened file.  */
+  int fd;
+
+  /** Index of all entries, in the order they were added.  */
+  std::vector<IndexEntry> index;
+
+  /** Current size of the file (i.e. offset of the next entry).  */
+  uint64_t fileSize = 0;
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /**
+   * Reads the file and builds up the index.  If the last entry is
+   * incomplete, it is removed from the file.
+   */
+  void BuildIndex ();
+
+  /**
+   * Reads the trade for the given index entry.
+   */
+  proto::Trade ReadEntry (const IndexEntry& entry) const;
+
+public:
+
+  /**
+   * Opens (or creates) the store at the given file.
+   */
+  explicit TradeArchive (const std::string& p);
+
+  ~TradeArchive ();
+
+  TradeArchive () = delete;
+  TradeArchive (const TradeArchive&) = delete;
+  void operator= (const TradeArchive&) = delete;
+
+  /**
+   * Appends the given trades (in order) to the store.  When this returns,
+   * the data has been synced to disk.
+   */
+  void Append (const std::vector<proto::Trade>& trades);
+
+  /**
+   * Returns the number of stored trades.
+   */
+  size_t GetSize () const;
+
+  /**
+   * Queries for trades matching the filter, going from the newest to the
+   * oldest entry.  The first "skip" matches are skipped (and skip is
+   * decremented accordingly), and then up to "limit" matches are appended
+   * to the output.
+   */
+  void Query (const proto::TradeFilter& filter, size_t& skip, size_t limit,
+              std::vector<proto::Trade>& out) const;
+
+};
+
+/**
+ * Returns true if the given trade matches the filter.
+ */
+bool MatchesTradeFilter (const proto::TradeFilter& filter,
+                         const proto::Trade& t);
+
+} // namespace democrit
+
+#endif // DEMOCRIT_TRADEARCHIVE_HPP
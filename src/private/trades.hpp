@@ -20,19 +20,34 @@
 #define DEMOCRIT_TRADES_HPP
 
 #include "assetspec.hpp"
+#include "private/addresscache.hpp"
 #include "private/checker.hpp"
+#include "private/headercache.hpp"
+#include "private/inputpool.hpp"
 #include "private/intervaljob.hpp"
 #include "private/myorders.hpp"
+#include "private/psbtdecoder.hpp"
 #include "private/rpcclient.hpp"
 #include "private/state.hpp"
+#include "private/tradearchive.hpp"
+#include "private/versioncounter.hpp"
+#include "private/workerpool.hpp"
 #include "proto/orders.pb.h"
 #include "proto/processing.pb.h"
 #include "proto/trades.pb.h"
 #include "rpc-stubs/demgsprpcclient.h"
 #include "rpc-stubs/xayarpcclient.h"
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 namespace democrit
@@ -72,14 +87,19 @@ private:
   const std::string& account;
 
   /**
-   * The actual data for this.  This references the instance inside the
-   * global state, and the global state will be locked during the entire
-   * time of using this instance.
+   * The actual data for this.  This references either the instance inside
+   * the global state (which is then locked during the entire time of using
+   * this instance), or a working copy of an active trade for which
+   * TradeManager holds the trade's own lock.
    */
   proto::TradeState& pb;
 
-  /** TradeChecker instance based on this Trade's data.  */
-  std::unique_ptr<TradeChecker> checker;
+  /**
+   * TradeChecker instance based on this Trade's data.  It is only
+   * constructed when first needed (see GetChecker), since many uses of
+   * Trade just extract some basic data.
+   */
+  mutable std::unique_ptr<TradeChecker> checker;
 
   /**
    * True if pb is mutable (i.e. the instance is constructed from a non-const
@@ -91,25 +111,26 @@ private:
                   const proto::TradeState& p)
     : tm(t), account(a),
       pb(const_cast<proto::TradeState&> (p)), isMutable(false)
-  {
-    checker = BuildTradeChecker ();
-  }
+  {}
 
   explicit Trade (const TradeManager& t, const std::string& a,
                   proto::TradeState& p)
     : tm(t), account(a),
       pb(p), isMutable(true)
-  {
-    checker = BuildTradeChecker ();
-  }
+  {}
 
   /**
    * Constructs a TradeChecker instance based on this trade's data.
-   * This is called from the constructor to initialise our checker
-   * member variable, which is then used for further processing.
+   * This is used to initialise our checker member variable on demand.
    */
   std::unique_ptr<TradeChecker> BuildTradeChecker () const;
 
+  /**
+   * Returns the TradeChecker for this trade, constructing it if this
+   * is the first time it is needed.
+   */
+  const TradeChecker& GetChecker () const;
+
   /**
    * Returns an ID that is used to identify the particular trade among
    * all active trades, e.g. when matching up with received messages.
@@ -119,6 +140,19 @@ private:
    */
   std::string GetIdentifier () const;
 
+  /**
+   * Returns a key that uniquely identifies this trade among all our
+   * active trades.  It is made up of the counterparty's name and the
+   * identifier.
+   */
+  std::string GetKey () const;
+
+  /**
+   * Fills in the btxid and inputs cached in our state from our_psbt,
+   * if they are not yet there.  This needs our_psbt to be present.
+   */
+  void CachePsbtData ();
+
   /**
    * Returns the type of order this is from our point of view.  In other words,
    * ASK if we are selling, and BID if we are buying.
@@ -224,8 +258,13 @@ public:
   /**
    * Runs a check on this trade's current state and perhaps performs updates
    * (like timing it out or checking success/failure against the chain).
+   *
+   * If checks is non-null, it may contain the result of checktrade
+   * for this trade's btxid already (as obtained from a batched checktrades
+   * call for all pending trades).  In that case, that result is used instead
+   * of querying the GSP again.
    */
-  void Update ();
+  void Update (const std::map<std::string, Json::Value>* checks = nullptr);
 
   /**
    * Does processing on external state (like wallet locks or myorders)
@@ -272,15 +311,269 @@ private:
   /** RPC client for the g/dem GSP.  */
   RpcClient<DemGspRpcClient>& demGsp;
 
+  /**
+   * If not null, the on-disk store to which old archived trades are moved
+   * when the in-memory archive grows too large.  If null, they are just
+   * discarded.
+   */
+  TradeArchive* archiveStore;
+
+  /**
+   * If not null, a pool of pre-selected wallet coins from which we fund
+   * trade transactions as the buyer (if a suitable one is available).
+   */
+  InputPool* inputPool;
+
+  /**
+   * Cache of block headers shared by the trade checkers of all trades.
+   * It is mutable, since filling it does not change the logical state.
+   */
+  mutable BlockHeaderCache headerCache;
+
+  /** Decoder (with cache) for the trade PSBTs.  */
+  mutable PsbtDecoder psbtDecoder;
+
+  /**
+   * Lock for moving trades out of the in-memory archive.  This is held
+   * also while querying trades, so that a query sees each trade exactly
+   * once (either in memory or in the store).
+   */
+  mutable std::mutex mutArchive;
+
+  /**
+   * Cache of fresh wallet addresses for the seller data.  This is only
+   * used (and refilled in the background) if updates are started, i.e.
+   * not in unit tests.
+   */
+  std::unique_ptr<AddressCache> addressCache;
+
   /** The periodic job running trade updates.  */
   std::unique_ptr<IntervalJob> updater;
 
   /**
-   * Processes all active trades, runs a periodic update on them (e.g. to see
-   * if they have timed out) and moves those that are finalised to the
-   * trade archive instead.
+   * Worker threads on which the updates of individual trades are run
+   * in parallel.  This may be null if parallel updates are disabled.
+   */
+  std::unique_ptr<WorkerPool> updateWorkers;
+
+  /** Thread waiting for new-block notifications from the GSP.  */
+  std::thread blockWatcher;
+
+  /** Thread waiting for pending-move notifications from the GSP.  */
+  std::thread pendingWatcher;
+
+  /** Set to true when the watcher threads should stop.  */
+  bool stopWatchers = false;
+
+  /** Mutex for stopWatchers.  */
+  std::mutex mutWatchers;
+
+  /** Condition variable notified when stopWatchers is set.  */
+  std::condition_variable cvWatchers;
+
+  /**
+   * True while we receive block notifications from the GSP.  In that case,
+   * the periodic updater only handles timeouts of initiated trades.
+   * Otherwise it also checks pending trades (as fallback).
+   */
+  std::atomic<bool> notificationsActive;
+
+  /**
+   * Locks for the individual active trades, by their key (as per
+   * Trade::GetKey).  A trade's lock is held while it is processed (which
+   * may involve slow RPC calls), so that different trades can be processed
+   * in parallel and without holding the global state lock.
+   */
+  std::map<std::string, std::shared_ptr<std::mutex>> tradeLocks;
+
+  /** Mutex protecting tradeLocks (but not the trades themselves).  */
+  std::mutex mutTradeLocks;
+
+  /**
+   * Version of the trades as returned by GetTrades, bumped whenever
+   * an active trade is added, modified or finalised, or archived trades
+   * are moved out of memory.
+   */
+  VersionCounter version;
+
+  /**
+   * For active trades, the (monotonic) time when they entered their
+   * current processing phase.  This is used to record the latencies of
+   * each phase in the metrics.  Trades restored from disk are not in here
+   * until their first phase change.
+   */
+  std::map<std::string, std::chrono::steady_clock::time_point> phaseStarts;
+
+  /** Mutex for phaseStarts.  */
+  std::mutex mutPhases;
+
+  /**
+   * Index of the active trades, mapping their key to the position inside
+   * State.trades.  This is kept up-to-date when the TradeManager adds or
+   * removes trades, but is only treated as a hint:  Entries are verified
+   * against the state when used, and the index is rebuilt if it does not
+   * match the state (e.g. because trades were modified directly).
+   */
+  mutable std::unordered_map<std::string, int> tradeIndex;
+
+  /**
+   * Mutex for tradeIndex.  The index is accessed while holding the state
+   * lock, but that may just be a shared lock for reading.
+   */
+  mutable std::mutex mutTradeIndex;
+
+  /** Possible outcomes of ModifyTrade.  */
+  enum class ModifyResult
+  {
+    /** There is no active trade with the given key.  */
+    NOT_FOUND,
+    /** The trade has been updated and is still active.  */
+    ACTIVE,
+    /** The trade has been finalised and moved to the archive.  */
+    FINALISED,
+    /**
+     * The trade has been finalised, but was left among the active trades
+     * as requested.  It will be moved to the archive the next time it
+     * is processed with ModifyTrade.
+     */
+    DEFERRED,
+  };
+
+  /**
+   * Returns the lock for the trade with the given key, creating it
+   * if necessary.
+   */
+  std::shared_ptr<std::mutex> GetTradeLock (const std::string& key);
+
+  /**
+   * Drops our reference to a trade's lock (which must not be held anymore)
+   * and removes it from tradeLocks if no other thread holds or waits
+   * for it.  This is done when the trade is gone from the state.
+   */
+  void ReleaseTradeLock (const std::string& key,
+                         std::shared_ptr<std::mutex>& ref);
+
+  /**
+   * Rebuilds tradeIndex from scratch.  Must be called with mutTradeIndex
+   * held.
+   */
+  void RebuildTradeIndex (const proto::State& s) const;
+
+  /**
+   * Looks up the position of the active trade with the given key in
+   * the state, or returns -1 if there is none.  Must be called while
+   * holding (at least a shared) lock on the state.
+   */
+  int FindTrade (const proto::State& s, const std::string& key) const;
+
+  /**
+   * Adds the active trade with the given data to the state and the index.
+   * Must be called while holding the exclusive lock on the state.
+   */
+  void InsertTrade (proto::State& s, proto::TradeState&& data);
+
+  /**
+   * Removes the active trade at the given position from the state and
+   * updates the index accordingly.  Must be called while holding the
+   * exclusive lock on the state.
+   */
+  void EraseTrade (proto::State& s, int pos);
+
+  /**
+   * Records the start of a new trade for the metrics.
+   */
+  void TrackNewTrade (const std::string& key);
+
+  /**
+   * Records the phase change (if any) of a trade from "before" to "after"
+   * in the metrics.
+   */
+  void TrackPhaseChange (const std::string& key,
+                         const proto::TradeState& before,
+                         const proto::TradeState& after);
+
+  /**
+   * Processes the active trade with the given key:  While holding its
+   * own lock, the callback is invoked with a Trade instance for a copy
+   * of its data, and then the modified data is written back to the state.
+   * If the trade is finalised afterwards, it is moved to the archive
+   * and HandleFinalised is run for it, unless deferFinalise is set.
+   */
+  ModifyResult ModifyTrade (const std::string& key,
+                            const std::function<void (Trade&)>& f,
+                            bool deferFinalise = false);
+
+  /**
+   * Does the external processing (e.g. releasing locked inputs or
+   * restoring our order) for a trade that has just been finalised.
+   */
+  void HandleFinalised (const std::string& account,
+                        const proto::TradeState& t) const;
+
+  /**
+   * Checks if the in-memory trade archive is larger than the window
+   * we keep, and if so, moves the oldest entries to the store.
+   */
+  void SpillArchive ();
+
+  /** Selection of active trades to process in UpdateAndArchiveTrades.  */
+  enum class UpdateSelection
+  {
+    /** Update all active trades.  */
+    ALL,
+    /**
+     * Skip pending trades, which can only change with new blocks or
+     * pending moves (and are updated on notifications for those).
+     */
+    TIMEOUTS,
+    /** Skip initiated trades, which can only time out.  */
+    CONFIRMATIONS,
+  };
+
+  /**
+   * Queries the GSP for the state of all given btxids with a single
+   * checktrades call, and returns the results in the format of the
+   * individual checktrade method keyed by btxid.  If the GSP does not
+   * support the batched call, an empty map is returned so that the
+   * trades fall back to checking themselves individually.
+   */
+  std::map<std::string, Json::Value> CheckTradesBatch (
+      const Json::Value& btxids) const;
+
+  /**
+   * Processes the selected active trades, runs an update on them (e.g. to see
+   * if they have timed out or are confirmed) and moves those that are
+   * finalised to the trade archive instead.
    */
-  void UpdateAndArchiveTrades ();
+  void UpdateAndArchiveTrades (UpdateSelection sel = UpdateSelection::ALL);
+
+  /**
+   * Starts the threads that long-poll the GSP for new blocks and pending
+   * moves, and update pending trades whenever something changed.
+   */
+  void StartWatchers ();
+
+  /**
+   * Signals the watcher threads to stop and waits for them.  Note that this
+   * may block until the currently running long-poll RPC call returns.
+   */
+  void StopWatchers ();
+
+  /**
+   * Main loop of the thread waiting for new blocks.
+   */
+  void RunBlockWatcher ();
+
+  /**
+   * Main loop of the thread waiting for pending moves.
+   */
+  void RunPendingWatcher ();
+
+  /**
+   * Waits for the given duration or until the watchers are stopped.
+   * Returns true if the watchers should keep running.
+   */
+  bool WatcherSleep (std::chrono::milliseconds dur);
 
   /**
    * Adds a new trade, based on one of our own orders being taken by
@@ -300,6 +593,12 @@ private:
    */
   void SetupUpdater (Trade::Clock::duration intv);
 
+  /**
+   * Returns a fresh address from the wallet, using the address cache
+   * if there is one.
+   */
+  std::string GetNewAddress () const;
+
   /**
    * Returns the current time (based on Trade::Clock) as UNIX timestamp,
    * which is stored in the TradeState proto.  For testing this is mocked
@@ -320,32 +619,79 @@ public:
   /**
    * Constructs a new instance based on the given references.  If startUpdates
    * is set, then an interval job is started for periodic updates of trades
-   * based on the timeout.  Unit tests disable updates and instead run them
-   * manually as needed.
+   * based on the timeout, and (unless disabled by flag) pending trades are
+   * updated based on notifications from the GSP.  Unit tests disable updates
+   * and instead run them manually as needed.
+   *
+   * The archive store may be null, in which case old archived trades
+   * are not kept once they fall out of the in-memory window.  Similarly,
+   * the input pool is optional; without it, the wallet selects coins for
+   * each trade transaction on demand.
    */
   explicit TradeManager (State& s, MyOrders& mo, const AssetSpec& as,
                          RpcClient<XayaRpcClient>& x,
                          RpcClient<DemGspRpcClient>& d,
+                         TradeArchive* store, InputPool* inputs,
                          bool startUpdates);
 
-  virtual ~TradeManager () = default;
+  virtual ~TradeManager ();
 
   TradeManager () = delete;
   TradeManager (const TradeManager&) = delete;
   void operator= (const TradeManager&) = delete;
 
   /**
-   * Returns the public data about all trades in our state.
+   * Returns the version counter of the trades returned by GetTrades.
+   */
+  const VersionCounter&
+  GetVersion () const
+  {
+    return version;
+  }
+
+  /**
+   * Returns the public data about all trades in our state.  This includes
+   * the active trades and the archived ones still kept in memory, but not
+   * those that have been moved to the on-disk store.
    */
   std::vector<proto::Trade> GetTrades () const;
 
+  /**
+   * Queries for trades (active, archived in memory and in the store)
+   * matching the given filter.  Trades are returned from newest to oldest
+   * (with active trades first), skipping the first "offset" matches and
+   * returning up to "limit" trades.
+   */
+  std::vector<proto::Trade> QueryTrades (const proto::TradeFilter& filter,
+                                         size_t offset, size_t limit) const;
+
   /**
    * Adds a new trade, based on taking the given order (i.e. we are the
    * taker, and the order is from the counterparty).  Returns true on success,
-   * and sets the message to be sent to the counterparty.
+   * and sets the message to be sent to the counterparty.  If info is not null,
+   * it is set to the public data of the new trade on success.
    */
   bool TakeOrder (const proto::Order& o, const Amount units,
-                  proto::ProcessingMessage& msg);
+                  proto::ProcessingMessage& msg,
+                  proto::Trade* info = nullptr);
+
+  /**
+   * Sweeps the given orderbook, taking the best orders on the opposite
+   * side of "type" (i.e. asks if type is BID and we want to buy) until
+   * the given number of units is covered.  Only orders with a price at or
+   * better than the limit price are taken.  Orders that cannot be taken
+   * (e.g. because their minimum is above the remaining units) are skipped.
+   *
+   * When selling, at most one order is taken:  All trades in which we are
+   * the seller spend our name output, so they cannot be done in parallel.
+   *
+   * Returns the public data of all trades that were started, and fills in
+   * the messages to be sent to the respective counterparties.
+   */
+  std::vector<proto::Trade> SweepOrders (
+      const proto::OrderbookForAsset& book, proto::Order::Type type,
+      Amount units, Amount limitPrice,
+      std::vector<proto::ProcessingMessage>& msgs);
 
   /**
    * Process a given message we have received via XMPP direct messaging.
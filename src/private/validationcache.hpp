@@ -0,0 +1,138 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_VALIDATIONCACHE_HPP
+#define DEMOCRIT_VALIDATIONCACHE_HPP
+
+#include "assetspec.hpp"
+#include "private/assetinterner.hpp"
+#include "proto/orders.pb.h"
+
+#include <xayautil/uint256.hpp>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace democrit
+{
+
+/**
+ * Cache for the results of validating orders against the game state
+ * (i.e. AssetSpec::CanSell and CanBuy).  Peers rebroadcast their unchanged
+ * orders regularly, and for many asset specs those checks require RPC calls
+ * to a GSP.  Since the result of the checks only depends on the account,
+ * asset, type and number of units, and only changes with new blocks, we
+ * can cache them as long as the block hash stays the same.
+ *
+ * The cache is tied to a "current" block hash.  Whenever a different block
+ * hash is set, all entries are flushed.
+ *
+ * This class is thread-safe.
+ */
+class ValidationCache
+{
+
+private:
+
+  /**
+   * Key for an entry in the cache.
+   */
+  struct Key
+  {
+
+    /** The account that owns the order.  */
+    std::string account;
+
+    /** The order's asset (as handle in the global AssetInterner).  */
+    AssetId asset;
+
+    /** The order's type.  */
+    proto::Order::Type type;
+
+    /** The number of units (max_units) being checked.  */
+    Amount units;
+
+    explicit Key (const std::string& a, AssetId id, const proto::Order& o);
+
+    bool operator< (const Key& o) const;
+
+  };
+
+  /** Maximum number of entries to keep before flushing the cache.  */
+  const size_t maxEntries;
+
+  /** The block hash the current entries are for.  */
+  xaya::uint256 block;
+
+  /** Whether or not we have a current block hash at all.  */
+  bool hasBlock = false;
+
+  /** The cached validation results.  */
+  std::map<Key, bool> entries;
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+public:
+
+  explicit ValidationCache (const size_t m)
+    : maxEntries(m)
+  {}
+
+  ValidationCache () = delete;
+  ValidationCache (const ValidationCache&) = delete;
+  void operator= (const ValidationCache&) = delete;
+
+  /**
+   * Sets the current block hash.  If it differs from the previous one,
+   * all cached entries are flushed.
+   */
+  void SetBlock (const xaya::uint256& hash);
+
+  /**
+   * Marks the current block as unknown, e.g. because we failed to
+   * query it.  This flushes the cache, and no more entries will be
+   * stored until SetBlock is called again.
+   */
+  void Invalidate ();
+
+  /**
+   * Looks up the validation result for the given account and order.
+   * Returns true and sets valid if there is a cached entry.
+   */
+  bool Lookup (const std::string& account, const proto::Order& o,
+               bool& valid) const;
+
+  /**
+   * Stores the validation result for the given account and order, which
+   * was computed at the given block hash.  If that is not the current
+   * block (e.g. because the GSP lags behind or a new block has just been
+   * found), this does nothing.  Since the order's asset is interned for the
+   * key, negative results are only stored for assets that have been
+   * interned already (so that arbitrary strings from peers do not fill
+   * the interner).
+   */
+  void Store (const std::string& account, const proto::Order& o, bool valid,
+              const xaya::uint256& hash);
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_VALIDATIONCACHE_HPP
@@ -0,0 +1,88 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_VERSIONCOUNTER_HPP
+#define DEMOCRIT_VERSIONCOUNTER_HPP
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+namespace democrit
+{
+
+/**
+ * Monotonically increasing version number of some piece of data, which
+ * is bumped whenever the data changes.  Readers can use it as key for caching
+ * data derived from it, and wait for it to change (for long-polling).
+ *
+ * A counter can have a parent, which is bumped together with it.  This is
+ * used to aggregate changes of multiple parts (e.g. sharded orderbooks)
+ * into one version that can be waited on.
+ *
+ * This class is thread-safe.
+ */
+class VersionCounter
+{
+
+private:
+
+  /** The current version.  */
+  uint64_t version = 1;
+
+  /** Optional parent counter that is bumped as well.  */
+  VersionCounter* const parent;
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /** Condition variable notified when the version changes.  */
+  mutable std::condition_variable cv;
+
+public:
+
+  explicit VersionCounter (VersionCounter* p = nullptr)
+    : parent(p)
+  {}
+
+  VersionCounter (const VersionCounter&) = delete;
+  void operator= (const VersionCounter&) = delete;
+
+  /**
+   * Returns the current version.
+   */
+  uint64_t Get () const;
+
+  /**
+   * Increments the version (and the parent's), waking up all waiters.
+   */
+  void Bump ();
+
+  /**
+   * Waits until the version differs from the known one or the timeout
+   * expires, and returns the current version.
+   */
+  uint64_t WaitForChange (uint64_t known,
+                          std::chrono::milliseconds timeout) const;
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_VERSIONCOUNTER_HPP
@@ -0,0 +1,156 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEMOCRIT_WORKERPOOL_HPP
+#define DEMOCRIT_WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace democrit
+{
+
+/**
+ * A pool of worker threads that execute submitted tasks asynchronously.
+ * Each task is associated to a string key (e.g. the account it is for)
+ * and a priority.  Tasks with the same key and priority are executed
+ * sequentially in the order they were submitted, while tasks of different
+ * keys can run in parallel.  Whenever a worker picks up a new task,
+ * tasks of high priority are preferred.
+ *
+ * By default the number of pending tasks is not limited.  Callers that
+ * submit tasks in response to untrusted input (like messages from other
+ * participants) should bound the lane with SetMaxPending.  A task that
+ * throws an exception is logged as error, and does not affect other tasks.
+ *
+ * This is used in the Daemon to move the processing of received
+ * stanzas (which may need blocking RPC calls) off the XMPP thread.
+ */
+class WorkerPool
+{
+
+public:
+
+  /** Priority of a task.  */
+  enum class Priority
+  {
+    HIGH,
+    LOW,
+  };
+
+  /** A task to execute.  */
+  using Task = std::function<void ()>;
+
+private:
+
+  /**
+   * Pending tasks of one priority.
+   */
+  struct Lane
+  {
+
+    /** Pending tasks for each key, in order.  */
+    std::map<std::string, std::deque<Task>> pending;
+
+    /**
+     * Keys that have pending tasks and are not currently being executed
+     * by some worker, in the order in which they should be picked up.
+     */
+    std::deque<std::string> ready;
+
+    /** Keys for which a task is currently running.  */
+    std::set<std::string> running;
+
+    /** Total number of pending tasks (not including running ones).  */
+    size_t numPending = 0;
+
+    /** Maximum number of pending tasks, or zero if unlimited.  */
+    size_t maxPending = 0;
+
+  };
+
+  /** The high-priority lane.  */
+  Lane high;
+
+  /** The low-priority lane.  */
+  Lane low;
+
+  /** Set to true when the workers should stop.  */
+  bool stop = false;
+
+  /** Lock for the pool's state.  */
+  std::mutex mut;
+
+  /** Condition variable to signal new tasks and stopping to workers.  */
+  std::condition_variable cv;
+
+  /** The worker threads.  */
+  std::vector<std::thread> workers;
+
+  /**
+   * Returns the lane for a given priority.
+   */
+  Lane& GetLane (Priority p);
+
+  /**
+   * Main function of each worker thread.
+   */
+  void RunWorker ();
+
+public:
+
+  /**
+   * Constructs the pool and starts the given number of worker threads.
+   */
+  explicit WorkerPool (unsigned numThreads);
+
+  /**
+   * Stops the pool.  Currently running tasks are finished, but all pending
+   * ones are discarded.
+   */
+  ~WorkerPool ();
+
+  WorkerPool () = delete;
+  WorkerPool (const WorkerPool&) = delete;
+  void operator= (const WorkerPool&) = delete;
+
+  /**
+   * Limits the number of pending tasks for the given priority.  Zero
+   * (the default) means that it is unlimited.
+   */
+  void SetMaxPending (Priority p, size_t n);
+
+  /**
+   * Submits a task for asynchronous execution.  Returns false (and drops
+   * the task) if the priority's limit of pending tasks is reached.
+   */
+  bool Submit (Priority p, const std::string& key, Task&& task);
+
+};
+
+} // namespace democrit
+
+#endif // DEMOCRIT_WORKERPOOL_HPP
@@ -0,0 +1,44 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/psbtdecoder.hpp"
+
+#include <xayautil/hash.hpp>
+
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+Json::Value
+PsbtDecoder::Decode (const std::string& psbt)
+{
+  const auto key = xaya::SHA256::Hash (psbt);
+
+  std::shared_ptr<const Json::Value> res;
+  if (cache.Lookup (key, res))
+    return *res;
+
+  res = std::make_shared<const Json::Value> (rpc->decodepsbt (psbt));
+  CHECK (res->isObject ()) << "Invalid decodepsbt result: " << *res;
+  cache.Insert (key, res);
+
+  return *res;
+}
+
+} // namespace democrit
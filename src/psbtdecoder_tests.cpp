@@ -0,0 +1,91 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/psbtdecoder.hpp"
+
+#include "mockxaya.hpp"
+#include "testutils.hpp"
+
+#include <jsonrpccpp/common/exception.h>
+
+#include <gtest/gtest.h>
+
+namespace democrit
+{
+namespace
+{
+
+class PsbtDecoderTests : public testing::Test
+{
+
+protected:
+
+  TestEnvironment<MockXayaRpcServer> env;
+
+  PsbtDecoderTests ()
+  {
+    env.GetXayaServer ().SetPsbt ("foo", ParseJson (R"({
+      "tx": {"txid": "foo"}
+    })"));
+    env.GetXayaServer ().SetPsbt ("bar", ParseJson (R"({
+      "tx": {"txid": "bar"}
+    })"));
+  }
+
+  unsigned
+  GetNumCalls ()
+  {
+    return env.GetXayaServer ().GetNumDecodePsbtCalls ();
+  }
+
+};
+
+TEST_F (PsbtDecoderTests, CachesResults)
+{
+  PsbtDecoder decoder(env.GetXayaRpc (), 10);
+
+  EXPECT_EQ (decoder.Decode ("foo")["tx"]["txid"], "foo");
+  EXPECT_EQ (decoder.Decode ("bar")["tx"]["txid"], "bar");
+  EXPECT_EQ (GetNumCalls (), 2);
+
+  EXPECT_EQ (decoder.Decode ("foo")["tx"]["txid"], "foo");
+  EXPECT_EQ (decoder.Decode ("bar")["tx"]["txid"], "bar");
+  EXPECT_EQ (GetNumCalls (), 2);
+}
+
+TEST_F (PsbtDecoderTests, Eviction)
+{
+  PsbtDecoder decoder(env.GetXayaRpc (), 1);
+
+  decoder.Decode ("foo");
+  decoder.Decode ("bar");
+  decoder.Decode ("foo");
+  EXPECT_EQ (GetNumCalls (), 3);
+}
+
+TEST_F (PsbtDecoderTests, ErrorsNotCached)
+{
+  PsbtDecoder decoder(env.GetXayaRpc (), 10);
+
+  EXPECT_THROW (decoder.Decode ("invalid"), jsonrpc::JsonRpcException);
+  EXPECT_THROW (decoder.Decode ("invalid"), jsonrpc::JsonRpcException);
+  EXPECT_EQ (GetNumCalls (), 2);
+}
+
+} // anonymous namespace
+} // namespace democrit
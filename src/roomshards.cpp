@@ -0,0 +1,111 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/roomshards.hpp"
+
+#include <glog/logging.h>
+
+#include <cstdint>
+#include <string>
+
+namespace democrit
+{
+
+RoomShards::RoomShards (const gloox::JID& base, const unsigned n,
+                        const std::set<unsigned>& subs)
+  : baseRoom(base), numShards(n)
+{
+  if (!IsSharded ())
+    {
+      CHECK (subs.empty () || subs == std::set<unsigned> {0})
+          << "Shard subscriptions given without sharding";
+      subscribed.insert (0);
+      return;
+    }
+
+  if (subs.empty ())
+    {
+      for (unsigned i = 0; i < numShards; ++i)
+        subscribed.insert (i);
+      return;
+    }
+
+  for (const auto s : subs)
+    CHECK_LT (s, numShards) << "Invalid shard subscription";
+  subscribed = subs;
+}
+
+unsigned
+RoomShards::GetShard (const Asset& asset) const
+{
+  if (!IsSharded ())
+    return 0;
+
+  /* All participants have to agree on the shard of each asset, so we need
+     a hash function that is fixed (unlike std::hash).  FNV-1a is simple
+     and good enough for spreading assets over the shards.  */
+  uint64_t hash = 14'695'981'039'346'656'037ull;
+  for (const unsigned char c : asset)
+    {
+      hash ^= c;
+      hash *= 1'099'511'628'211ull;
+    }
+
+  return hash % numShards;
+}
+
+gloox::JID
+RoomShards::GetRoom (const unsigned shard) const
+{
+  if (!IsSharded ())
+    {
+      CHECK_EQ (shard, 0);
+      return baseRoom;
+    }
+
+  CHECK_LT (shard, numShards);
+  gloox::JID res = baseRoom;
+  res.setUsername (baseRoom.username () + "-" + std::to_string (shard));
+
+  return res;
+}
+
+std::vector<gloox::JID>
+RoomShards::GetRooms () const
+{
+  std::vector<gloox::JID> res;
+  for (const auto s : subscribed)
+    res.push_back (GetRoom (s));
+
+  return res;
+}
+
+bool
+RoomShards::GetShardForRoom (const gloox::JID& room, unsigned& shard) const
+{
+  for (const auto s : subscribed)
+    if (GetRoom (s).bare () == room.bare ())
+      {
+        shard = s;
+        return true;
+      }
+
+  return false;
+}
+
+} // namespace democrit
@@ -0,0 +1,125 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/roomshards.hpp"
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <string>
+
+namespace democrit
+{
+namespace
+{
+
+using RoomShardsTests = testing::Test;
+
+TEST_F (RoomShardsTests, Unsharded)
+{
+  const gloox::JID base("room@muc.server");
+  const RoomShards shards(base, 0);
+
+  EXPECT_FALSE (shards.IsSharded ());
+  EXPECT_EQ (shards.GetShard ("gold"), 0);
+  EXPECT_EQ (shards.GetShard ("silver"), 0);
+  EXPECT_TRUE (shards.IsSubscribed ("gold"));
+  EXPECT_EQ (shards.GetSubscribed (), std::set<unsigned> ({0}));
+
+  const auto rooms = shards.GetRooms ();
+  ASSERT_EQ (rooms.size (), 1);
+  EXPECT_EQ (rooms[0].full (), "room@muc.server");
+}
+
+TEST_F (RoomShardsTests, RoomNames)
+{
+  const RoomShards shards(gloox::JID ("room@muc.server"), 4);
+
+  EXPECT_TRUE (shards.IsSharded ());
+  EXPECT_EQ (shards.GetSubscribed (), std::set<unsigned> ({0, 1, 2, 3}));
+  EXPECT_EQ (shards.GetRoom (0).full (), "room-0@muc.server");
+  EXPECT_EQ (shards.GetRoom (3).full (), "room-3@muc.server");
+
+  const auto rooms = shards.GetRooms ();
+  ASSERT_EQ (rooms.size (), 4);
+  EXPECT_EQ (rooms[2].full (), "room-2@muc.server");
+}
+
+TEST_F (RoomShardsTests, ShardForRoom)
+{
+  const RoomShards shards(gloox::JID ("room@muc.server"), 4, {1, 3});
+
+  unsigned shard;
+  ASSERT_TRUE (shards.GetShardForRoom (gloox::JID ("room-3@muc.server/nick"),
+                                       shard));
+  EXPECT_EQ (shard, 3);
+  ASSERT_TRUE (shards.GetShardForRoom (gloox::JID ("room-1@muc.server"),
+                                       shard));
+  EXPECT_EQ (shard, 1);
+
+  EXPECT_FALSE (shards.GetShardForRoom (gloox::JID ("room-2@muc.server"),
+                                        shard));
+  EXPECT_FALSE (shards.GetShardForRoom (gloox::JID ("room@muc.server"),
+                                        shard));
+  EXPECT_FALSE (shards.GetShardForRoom (gloox::JID ("room-1@other.server"),
+                                        shard));
+}
+
+TEST_F (RoomShardsTests, AssetPartitioning)
+{
+  const RoomShards shards(gloox::JID ("room@muc.server"), 8);
+
+  /* The hash function is part of the protocol, so it must not change.  */
+  EXPECT_EQ (shards.GetShard (""), 14'695'981'039'346'656'037ull % 8);
+
+  std::map<unsigned, unsigned> counts;
+  for (unsigned i = 0; i < 1'000; ++i)
+    {
+      const std::string asset = "asset " + std::to_string (i);
+      const auto shard = shards.GetShard (asset);
+      ASSERT_LT (shard, 8);
+      EXPECT_EQ (shards.GetShard (asset), shard);
+      ++counts[shard];
+    }
+
+  ASSERT_EQ (counts.size (), 8);
+  for (const auto& entry : counts)
+    EXPECT_GT (entry.second, 50) << "Shard " << entry.first;
+}
+
+TEST_F (RoomShardsTests, Subscriptions)
+{
+  const RoomShards shards(gloox::JID ("room@muc.server"), 8, {2});
+
+  unsigned found = 0;
+  for (unsigned i = 0; i < 100; ++i)
+    {
+      const std::string asset = "asset " + std::to_string (i);
+      EXPECT_EQ (shards.IsSubscribed (asset), shards.GetShard (asset) == 2);
+      if (shards.IsSubscribed (asset))
+        ++found;
+    }
+  EXPECT_GT (found, 0);
+
+  const auto rooms = shards.GetRooms ();
+  ASSERT_EQ (rooms.size (), 1);
+  EXPECT_EQ (rooms[0].full (), "room-2@muc.server");
+}
+
+} // anonymous namespace
+} // namespace democrit
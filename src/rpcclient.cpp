@@ -0,0 +1,77 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/rpcclient.hpp"
+
+#include "private/metrics.hpp"
+
+#include <atomic>
+
+namespace democrit
+{
+
+uint64_t
+NewRpcClientId ()
+{
+  /* IDs start at one, so that zero can be used as "none".  */
+  static std::atomic<uint64_t> next(1);
+  return next++;
+}
+
+std::string
+MeteredHttpClient::GetMethodName (const std::string& message)
+{
+  const std::string key = "\"method\"";
+  size_t pos = message.find (key);
+  if (pos == std::string::npos)
+    return "unknown";
+
+  pos = message.find ('"', message.find (':', pos + key.size ()));
+  if (pos == std::string::npos)
+    return "unknown";
+
+  const size_t end = message.find ('"', pos + 1);
+  if (end == std::string::npos)
+    return "unknown";
+
+  std::string res = message.substr (pos + 1, end - pos - 1);
+  if (!message.empty () && message[0] == '[')
+    res += ".batch";
+
+  return res;
+}
+
+void
+MeteredHttpClient::SendRPCMessage (const std::string& message,
+                                   std::string& result)
+{
+  const std::string name = "rpc." + GetMethodName (message);
+  ScopedTimer timer(name);
+
+  try
+    {
+      jsonrpc::HttpClient::SendRPCMessage (message, result);
+    }
+  catch (...)
+    {
+      Metrics::Global ().Increment (name + ".errors");
+      throw;
+    }
+}
+
+} // namespace democrit
@@ -18,6 +18,7 @@
 
 #include "private/rpcclient.hpp"
 
+#include "private/metrics.hpp"
 #include "rpc-stubs/testrpcclient.h"
 #include "rpc-stubs/testrpcserverstub.h"
 
@@ -26,7 +27,9 @@
 #include <gtest/gtest.h>
 
 #include <chrono>
+#include <memory>
 #include <sstream>
+#include <thread>
 #include <vector>
 
 namespace democrit
@@ -66,6 +69,8 @@ private:
   /** The test RPC server.  */
   TestRpcServer rpcServer;
 
+protected:
+
   /**
    * Returns the endpoint to use for the test server as string.
    */
@@ -77,8 +82,6 @@ private:
     return out.str ();
   }
 
-protected:
-
   /**
    * Number of server threads used.  This also corresponds to the number
    * of concurrent client threads we will run in tests.
@@ -88,10 +91,14 @@ protected:
   /** RPC client being tested.  */
   RpcClient<TestRpcClient> client;
 
+  /** RPC client using the legacy protocol.  */
+  RpcClient<TestRpcClient> legacyClient;
+
   RpcClientTests ()
     : httpServer(PORT, "", "", SERVER_THREADS),
       rpcServer(httpServer),
-      client(GetEndpoint ())
+      client(GetEndpoint ()),
+      legacyClient(GetEndpoint (), true)
   {
     rpcServer.StartListening ();
   }
@@ -129,5 +136,145 @@ TEST_F (RpcClientTests, ManyThreads)
     t.join ();
 }
 
+TEST_F (RpcClientTests, PerThreadInstances)
+{
+  TestRpcClient* const mainClient = &*client;
+  EXPECT_EQ (&*client, mainClient);
+  EXPECT_NE (&*legacyClient, mainClient);
+
+  /* Alternating between instances works and keeps their clients.  */
+  EXPECT_EQ (legacyClient->echo (1), 1);
+  EXPECT_EQ (client->echo (2), 2);
+  EXPECT_EQ (&*client, mainClient);
+
+  std::thread other([this, mainClient] ()
+    {
+      EXPECT_NE (&*client, mainClient);
+      EXPECT_EQ (client->echo (3), 3);
+    });
+  other.join ();
+}
+
+TEST_F (RpcClientTests, ThreadChurn)
+{
+  for (int i = 0; i < 100; ++i)
+    {
+      std::thread t([this, i] ()
+        {
+          EXPECT_EQ (client->echo (i), i);
+        });
+      t.join ();
+    }
+}
+
+TEST_F (RpcClientTests, ManyInstances)
+{
+  /* Use more instances from one thread than the minimum number of clients
+     kept per thread.  Since they share the endpoint, they also share the
+     thread's clients, and none get evicted.  */
+  std::vector<std::unique_ptr<RpcClient<TestRpcClient>>> clients;
+  for (int i = 0; i < 20; ++i)
+    clients.push_back (std::make_unique<RpcClient<TestRpcClient>> (
+        GetEndpoint ()));
+
+  TestRpcClient* const shared = &**clients[0];
+  for (int round = 0; round < 3; ++round)
+    for (int i = 0; i < static_cast<int> (clients.size ()); ++i)
+      {
+        EXPECT_EQ ((*clients[i])->echo (i), i);
+        EXPECT_EQ (&**clients[i], shared);
+      }
+}
+
+TEST_F (RpcClientTests, ManyEndpoints)
+{
+  /* Use more distinct endpoints from one thread than the minimum number
+     of clients kept per thread.  They are all kept, as the instances
+     are still alive.  */
+  std::vector<std::unique_ptr<RpcClient<TestRpcClient>>> clients;
+  for (int i = 0; i < 20; ++i)
+    {
+      std::ostringstream ep;
+      ep << GetEndpoint () << "/path" << i;
+      clients.push_back (std::make_unique<RpcClient<TestRpcClient>> (
+          ep.str ()));
+    }
+
+  std::vector<TestRpcClient*> first;
+  for (auto& c : clients)
+    first.push_back (&**c);
+
+  for (int round = 0; round < 3; ++round)
+    for (unsigned i = 0; i < clients.size (); ++i)
+      EXPECT_EQ (&**clients[i], first[i]);
+}
+
+/**
+ * Constructs the params array for the echo method.
+ */
+template <typename V>
+  Json::Value
+  EchoParams (const V& val)
+{
+  Json::Value res(Json::arrayValue);
+  res.append (val);
+  return res;
+}
+
+TEST_F (RpcClientTests, BatchCalls)
+{
+  EXPECT_TRUE (client.CallBatch ("echo", {}).empty ());
+
+  std::vector<Json::Value> params;
+  for (int i = 0; i < 10; ++i)
+    params.push_back (EchoParams (i));
+
+  for (auto* c : {&client, &legacyClient})
+    {
+      const auto res = c->CallBatch ("echo", params);
+      ASSERT_EQ (res.size (), params.size ());
+      for (int i = 0; i < 10; ++i)
+        EXPECT_EQ (res[i], i);
+    }
+}
+
+TEST_F (RpcClientTests, BatchError)
+{
+  EXPECT_THROW (
+      client.CallBatch ("echo", {EchoParams (1), EchoParams ("foo")}),
+      jsonrpc::JsonRpcException);
+  EXPECT_THROW (client.CallBatch ("invalid", {EchoParams (1)}),
+                jsonrpc::JsonRpcException);
+}
+
+TEST_F (RpcClientTests, CallMetrics)
+{
+  const auto getCount = [] ()
+    {
+      const auto data = Metrics::Global ().ToJson ();
+      return data["histograms"]["rpc.echo"]["count"].asInt ();
+    };
+
+  const int before = getCount ();
+  client->echo (1);
+  client->echo (2);
+  EXPECT_EQ (getCount (), before + 2);
+}
+
+TEST (MeteredHttpClientTests, GetMethodName)
+{
+  EXPECT_EQ (MeteredHttpClient::GetMethodName (R"({
+    "jsonrpc": "2.0",
+    "id": 1,
+    "method": "getblockheader",
+    "params": ["abc"]
+  })"), "getblockheader");
+  EXPECT_EQ (MeteredHttpClient::GetMethodName (
+      R"([{"id":0,"method":"gettxout"},{"id":1,"method":"gettxout"}])"),
+      "gettxout.batch");
+  EXPECT_EQ (MeteredHttpClient::GetMethodName ("{}"), "unknown");
+  EXPECT_EQ (MeteredHttpClient::GetMethodName (R"({"method":)"), "unknown");
+}
+
 } // anonymous namespace
 } // namespace democrit
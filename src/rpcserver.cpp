@@ -19,6 +19,8 @@
 #include "rpcserver.hpp"
 
 #include "json.hpp"
+#include "private/metrics.hpp"
+#include "private/rpcclient.hpp"
 #include "proto/orders.pb.h"
 
 #include <jsonrpccpp/common/errors.h>
@@ -26,9 +28,24 @@
 
 #include <glog/logging.h>
 
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <vector>
+
 namespace democrit
 {
 
+RpcServer::RpcServer (Daemon& d, jsonrpc::AbstractServerConnector& conn)
+  : DaemonRpcServerStub(conn), daemon(d),
+    fastPath(*this, conn.GetHandler ())
+{
+  /* The stub's constructor has registered its protocol handler with the
+     connector.  We put our own handler in front of it.  */
+  conn.SetHandler (&fastPath);
+}
+
 void
 RpcServer::Run ()
 {
@@ -63,9 +80,283 @@ RpcServer::getstatus ()
   res["gameid"] = daemon.GetAssetSpec ().GetGameId ();
   res["account"] = daemon.GetAccount ();
 
+  const auto updates = daemon.GetOrderUpdateStats ();
+  Json::Value updatesJson(Json::objectValue);
+  updatesJson["pending"] = static_cast<Json::UInt64> (updates.pending);
+  updatesJson["received"] = static_cast<Json::UInt64> (updates.received);
+  updatesJson["coalesced"] = static_cast<Json::UInt64> (updates.coalesced);
+  updatesJson["dropped"] = static_cast<Json::UInt64> (updates.dropped);
+  res["orderupdates"] = updatesJson;
+
   return res;
 }
 
+Json::Value
+RpcServer::getmetrics ()
+{
+  LOG (INFO) << "RPC method called: getmetrics";
+  return Metrics::Global ().ToJson ();
+}
+
+std::string
+RpcServer::getmetricstext ()
+{
+  LOG (INFO) << "RPC method called: getmetricstext";
+  return Metrics::Global ().ToPrometheus ();
+}
+
+namespace
+{
+
+/**
+ * Timeout for waitforchange.  After it, the call returns even if there
+ * has not been a change, so that clients can check their connection.
+ */
+constexpr auto WAIT_TIMEOUT = std::chrono::seconds (5);
+
+/**
+ * Versions are exposed to the RPC interface as 31-bit integers.  They
+ * wrap around, but clients only compare them for equality.
+ */
+int
+VersionToRpc (const uint64_t v)
+{
+  return static_cast<int> (v & 0x7FFF'FFFF);
+}
+
+} // anonymous namespace
+
+template <typename T>
+  std::shared_ptr<const RpcServer::Snapshot<T>>
+  RpcServer::GetSnapshot (std::shared_ptr<const Snapshot<T>>& slot,
+                          std::mutex& mut,
+                          const std::vector<Daemon::DataKind>& kinds,
+                          const std::function<void (T&)>& compute)
+{
+  /* The versions are read before computing the response.  If the data
+     changes while we compute, the snapshot will be (slightly) newer
+     than its versions claim, and just be replaced on the next call.  */
+  auto versions = GetVersions (kinds);
+
+  auto cur = std::atomic_load (&slot);
+  if (cur != nullptr && cur->versions == versions)
+    return cur;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  /* Some other thread may have computed it while we waited.  */
+  cur = std::atomic_load (&slot);
+  if (cur != nullptr && cur->versions == versions)
+    return cur;
+
+  auto updated = std::make_shared<Snapshot<T>> ();
+  updated->versions = std::move (versions);
+  compute (updated->value);
+
+  std::shared_ptr<const Snapshot<T>> published = std::move (updated);
+  std::atomic_store (&slot, published);
+
+  return published;
+}
+
+Json::Value
+RpcServer::GetCached (CachedResponse& cache,
+                      const std::vector<Daemon::DataKind>& kinds,
+                      const std::function<Json::Value ()>& compute)
+{
+  const auto snapshot = GetSnapshot<Json::Value> (cache.value,
+                                                  cache.mutCompute, kinds,
+      [&compute] (Json::Value& res)
+      {
+        res = compute ();
+      });
+
+  return snapshot->value;
+}
+
+void
+RpcServer::GetCachedText (CachedResponse& cache,
+                          const std::vector<Daemon::DataKind>& kinds,
+                          const std::function<void (std::string&)>& write,
+                          std::string& out)
+{
+  const auto snapshot = GetSnapshot<std::string> (cache.text,
+                                                  cache.mutCompute, kinds,
+                                                  write);
+  out += snapshot->value;
+}
+
+std::vector<uint64_t>
+RpcServer::GetVersions (const std::vector<Daemon::DataKind>& kinds) const
+{
+  std::vector<uint64_t> res;
+  for (const auto k : kinds)
+    res.push_back (daemon.GetDataVersion (k));
+  return res;
+}
+
+bool
+RpcServer::WriteFastPathResult (const std::string& method, std::string& out)
+{
+  if (method == "getordersbyasset")
+    {
+      LOG (INFO) << "RPC method called: getordersbyasset";
+      GetCachedText (cachedOrdersByAsset,
+                     {Daemon::DataKind::ORDERBOOK,
+                      Daemon::DataKind::OWN_ORDERS},
+                     [this] (std::string& buf)
+        {
+          ProtoToJsonText (daemon.GetOrdersByAsset (), buf);
+        }, out);
+      return true;
+    }
+
+  if (method == "getownorders")
+    {
+      LOG (INFO) << "RPC method called: getownorders";
+      GetCachedText (cachedOwnOrders, {Daemon::DataKind::OWN_ORDERS},
+                     [this] (std::string& buf)
+        {
+          ProtoToJsonText (daemon.GetOwnOrders (), buf);
+        }, out);
+      return true;
+    }
+
+  if (method == "gettrades")
+    {
+      LOG (INFO) << "RPC method called: gettrades";
+      GetCachedText (cachedTrades, {Daemon::DataKind::TRADES},
+                     [this] (std::string& buf)
+        {
+          buf += '[';
+          bool first = true;
+          for (const auto& t : daemon.GetTrades ())
+            {
+              if (!first)
+                buf += ',';
+              first = false;
+              ProtoToJsonText (t, buf);
+            }
+          buf += ']';
+        }, out);
+      return true;
+    }
+
+  return false;
+}
+
+bool
+RpcServer::IsFastPathMethod (const std::string& method)
+{
+  return method == "getordersbyasset"
+          || method == "getownorders"
+          || method == "gettrades";
+}
+
+RpcServer::FastPathHandler::FastPathHandler (
+    RpcServer& s, jsonrpc::IClientConnectionHandler* n)
+  : server(s), next(n)
+{
+  CHECK (next != nullptr);
+}
+
+void
+RpcServer::FastPathHandler::HandleRequest (const std::string& request,
+                                           std::string& retValue)
+{
+  /* Most requests are not for one of the fast-path methods.  Look at the
+     method name without parsing the request, so that those are only parsed
+     once by the normal handler.  If the peek is wrong (e.g. because some
+     "method" key comes before the real one), the request still gets
+     answered correctly, just not through the fast path.  */
+  if (!IsFastPathMethod (MeteredHttpClient::GetMethodName (request)))
+    {
+      next->HandleRequest (request, retValue);
+      return;
+    }
+
+  Json::Value req;
+  {
+    std::istringstream in(request);
+    Json::CharReaderBuilder rbuilder;
+    std::string parseErrors;
+    if (!Json::parseFromStream (rbuilder, in, &req, &parseErrors))
+      {
+        /* Let the normal handler produce the proper error response.  */
+        next->HandleRequest (request, retValue);
+        return;
+      }
+  }
+
+  /* We only handle plain JSON-RPC 2.0 calls (not notifications or batches)
+     of methods without parameters.  The ID is restricted to integers
+     and strings, for which we know exactly how Json::FastWriter
+     (as used by the normal handler) formats them.  */
+  const bool simpleCall
+      = req.isObject ()
+          && req["jsonrpc"] == "2.0"
+          && req["method"].isString ()
+          && req["params"].empty ()
+          && (req["id"].type () == Json::intValue
+                || req["id"].type () == Json::uintValue
+                || req["id"].isString ());
+  if (!simpleCall)
+    {
+      next->HandleRequest (request, retValue);
+      return;
+    }
+
+  /* Build the response the same way as the normal handler would, i.e. with
+     sorted keys and a final line feed.  The result is written directly
+     into the response buffer.  */
+  const Json::Value& id = req["id"];
+  retValue = "{\"id\":";
+  if (id.type () == Json::intValue)
+    retValue += std::to_string (id.asInt64 ());
+  else if (id.type () == Json::uintValue)
+    retValue += std::to_string (id.asUInt64 ());
+  else
+    retValue += Json::valueToQuotedString (id.asCString ());
+  retValue += ",\"jsonrpc\":\"2.0\",\"result\":";
+
+  if (!server.WriteFastPathResult (req["method"].asString (), retValue))
+    {
+      retValue.clear ();
+      next->HandleRequest (request, retValue);
+      return;
+    }
+
+  retValue += "}\n";
+}
+
+int
+RpcServer::waitforchange (const std::string& kind, const int known)
+{
+  VLOG (1) << "RPC method called: waitforchange " << kind << " " << known;
+
+  Daemon::DataKind k;
+  if (kind == "orderbook")
+    k = Daemon::DataKind::ORDERBOOK;
+  else if (kind == "ownorders")
+    k = Daemon::DataKind::OWN_ORDERS;
+  else if (kind == "trades")
+    k = Daemon::DataKind::TRADES;
+  else
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "invalid kind: " + kind);
+
+  /* The daemon's versions are full 64-bit numbers, while the client only
+     knows the truncated one.  If it matches the current version, we wait
+     for that exact version to change.  */
+  const uint64_t current = daemon.GetDataVersion (k);
+  if (VersionToRpc (current) != known)
+    return VersionToRpc (current);
+
+  const auto timeout
+      = std::chrono::duration_cast<std::chrono::milliseconds> (WAIT_TIMEOUT);
+  return VersionToRpc (daemon.WaitForChange (k, current, timeout));
+}
+
 Json::Value
 RpcServer::getordersforasset (const std::string& asset)
 {
@@ -73,18 +364,127 @@ RpcServer::getordersforasset (const std::string& asset)
   return ProtoToJson (daemon.GetOrdersForAsset (asset));
 }
 
+Json::Value
+RpcServer::getdepthforasset (const std::string& asset)
+{
+  LOG (INFO) << "RPC method called: getdepthforasset " << asset;
+  return ProtoToJson (daemon.GetDepthForAsset (asset));
+}
+
 Json::Value
 RpcServer::getordersbyasset ()
 {
   LOG (INFO) << "RPC method called: getordersbyasset";
-  return ProtoToJson (daemon.GetOrdersByAsset ());
+
+  /* In a shared market, our own orders are filtered from the result,
+     so it depends on them as well.  */
+  return GetCached (cachedOrdersByAsset,
+                    {Daemon::DataKind::ORDERBOOK, Daemon::DataKind::OWN_ORDERS},
+                    [this] ()
+    {
+      return ProtoToJson (daemon.GetOrdersByAsset ());
+    });
+}
+
+namespace
+{
+
+/**
+ * Parses a JSON array of asset strings, as passed to the RPC methods
+ * querying parts of the orderbook.  Throws a JSON-RPC exception if the
+ * value is invalid.
+ */
+std::vector<Asset>
+ParseAssetList (const Json::Value& val)
+{
+  if (!val.isArray ())
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "assets must be an array");
+
+  std::vector<Asset> res;
+  for (const auto& a : val)
+    {
+      if (!a.isString ())
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+            "assets must be strings");
+      res.push_back (a.asString ());
+    }
+
+  return res;
+}
+
+/**
+ * Parses a price (in satoshi) from a JSON value, throwing an invalid-params
+ * error if it is not a non-negative integer.
+ */
+uint64_t
+ParsePrice (const Json::Value& val, const std::string& name)
+{
+  const bool isInt = (val.type () == Json::intValue
+                        || val.type () == Json::uintValue);
+  if (!isInt || !val.isUInt64 ())
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     name + " must be a non-negative integer");
+
+  return val.asUInt64 ();
+}
+
+} // anonymous namespace
+
+Json::Value
+RpcServer::getbestorders (const Json::Value& assets, const int levels)
+{
+  LOG (INFO)
+      << "RPC method called: getbestorders " << levels << "\n" << assets;
+
+  const auto assetList = ParseAssetList (assets);
+  if (levels < 0)
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "levels must not be negative");
+
+  return ProtoToJson (daemon.GetBestOrders (assetList, levels));
+}
+
+Json::Value
+RpcServer::GetOrdersInRange (const Json::Value& assets,
+                             const Json::Value& minPrice,
+                             const Json::Value& maxPrice)
+{
+  const uint64_t minSat = ParsePrice (minPrice, "minprice");
+  const uint64_t maxSat = ParsePrice (maxPrice, "maxprice");
+  LOG (INFO)
+      << "RPC method called: getordersinrange " << minSat << " " << maxSat
+      << "\n" << assets;
+
+  const auto assetList = ParseAssetList (assets);
+
+  return ProtoToJson (daemon.GetOrdersInRange (assetList, minSat, maxSat));
+}
+
+Json::Value
+RpcServer::getordersinrange (const Json::Value& assets,
+                             const int maxprice, const int minprice)
+{
+  return GetOrdersInRange (assets, minprice, maxprice);
+}
+
+void
+RpcServer::getordersinrangeI (const Json::Value& request,
+                              Json::Value& response)
+{
+  response = GetOrdersInRange (request["assets"], request["minprice"],
+                               request["maxprice"]);
 }
 
 Json::Value
 RpcServer::getownorders ()
 {
   LOG (INFO) << "RPC method called: getownorders";
-  return ProtoToJson (daemon.GetOwnOrders ());
+  return GetCached (cachedOwnOrders, {Daemon::DataKind::OWN_ORDERS}, [this] ()
+    {
+      return ProtoToJson (daemon.GetOwnOrders ());
+    });
 }
 
 bool
@@ -97,6 +497,7 @@ RpcServer::addorder (const Json::Value& order)
     throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
                                      "invalid order");
 
+  std::lock_guard<std::mutex> lock(mutWrites);
   return daemon.AddOrder (std::move (o));
 }
 
@@ -104,16 +505,134 @@ Json::Value
 RpcServer::cancelorder (const int id)
 {
   LOG (INFO) << "RPC method called: cancelorder " << id;
+
+  std::lock_guard<std::mutex> lock(mutWrites);
   daemon.CancelOrder (id);
   return Json::Value ();
 }
 
+namespace
+{
+
+/**
+ * Parses a JSON array of orders, throwing a JSON-RPC error if it is invalid.
+ */
+std::vector<proto::Order>
+ParseOrderList (const Json::Value& val)
+{
+  if (!val.isArray ())
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "orders must be an array");
+
+  std::vector<proto::Order> res;
+  for (const auto& entry : val)
+    {
+      proto::Order o;
+      if (!ProtoFromJson (entry, o))
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS, "invalid order");
+      res.push_back (std::move (o));
+    }
+
+  return res;
+}
+
+/**
+ * Parses a JSON array of order IDs, throwing a JSON-RPC error if it
+ * is invalid.
+ */
+std::vector<uint64_t>
+ParseIdList (const Json::Value& val)
+{
+  if (!val.isArray ())
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "IDs must be an array");
+
+  std::vector<uint64_t> res;
+  for (const auto& id : val)
+    {
+      if (!id.isUInt64 ())
+        throw jsonrpc::JsonRpcException (
+            jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+            "IDs must be non-negative integers");
+      res.push_back (id.asUInt64 ());
+    }
+
+  return res;
+}
+
+} // anonymous namespace
+
+Json::Value
+RpcServer::addorders (const Json::Value& orders)
+{
+  LOG (INFO) << "RPC method called: addorders\n" << orders;
+
+  auto parsed = ParseOrderList (orders);
+
+  std::lock_guard<std::mutex> lock(mutWrites);
+  Json::Value res(Json::arrayValue);
+  for (const bool added : daemon.AddOrders (std::move (parsed)))
+    res.append (added);
+  return res;
+}
+
+Json::Value
+RpcServer::cancelorders (const Json::Value& ids)
+{
+  LOG (INFO) << "RPC method called: cancelorders\n" << ids;
+
+  const auto parsed = ParseIdList (ids);
+
+  std::lock_guard<std::mutex> lock(mutWrites);
+  daemon.CancelOrders (parsed);
+  return Json::Value ();
+}
+
+bool
+RpcServer::replaceorders (const Json::Value& cancel, const Json::Value& orders)
+{
+  LOG (INFO)
+      << "RPC method called: replaceorders\n" << cancel << "\n" << orders;
+
+  const auto ids = ParseIdList (cancel);
+  auto parsed = ParseOrderList (orders);
+
+  std::lock_guard<std::mutex> lock(mutWrites);
+  return daemon.ReplaceOrders (ids, std::move (parsed));
+}
+
 Json::Value
 RpcServer::gettrades ()
 {
   LOG (INFO) << "RPC method called: gettrades";
+  return GetCached (cachedTrades, {Daemon::DataKind::TRADES}, [this] ()
+    {
+      Json::Value res(Json::arrayValue);
+      for (const auto& t : daemon.GetTrades ())
+        res.append (ProtoToJson (t));
+      return res;
+    });
+}
+
+Json::Value
+RpcServer::querytrades (const Json::Value& filter, const int limit,
+                        const int offset)
+{
+  LOG (INFO)
+      << "RPC method called: querytrades\n" << filter
+      << "\n" << offset << " " << limit;
+
+  proto::TradeFilter f;
+  if (!ProtoFromJson (filter, f))
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "invalid filter");
+  if (limit < 0 || offset < 0)
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "offset and limit must be non-negative");
+
   Json::Value res(Json::arrayValue);
-  for (const auto& t : daemon.GetTrades ())
+  for (const auto& t : daemon.QueryTrades (f, offset, limit))
     res.append (ProtoToJson (t));
   return res;
 }
@@ -128,7 +647,58 @@ RpcServer::takeorder (const Json::Value& order, const int units)
     throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
                                      "invalid order");
 
+  std::lock_guard<std::mutex> lock(mutWrites);
   return daemon.TakeOrder (o, units);
 }
 
+Json::Value
+RpcServer::SweepOrders (const std::string& asset,
+                        const Json::Value& limitPrice,
+                        const std::string& type, const int units)
+{
+  const uint64_t limitSat = ParsePrice (limitPrice, "limitprice");
+  LOG (INFO)
+      << "RPC method called: sweeporders " << asset << " " << type
+      << " " << units << " " << limitSat;
+
+  proto::Order::Type t;
+  if (type == "bid")
+    t = proto::Order::BID;
+  else if (type == "ask")
+    t = proto::Order::ASK;
+  else
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "type must be \"bid\" or \"ask\"");
+
+  if (units <= 0)
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "units must be positive");
+
+  /* The trade code uses Amount (which is signed) for the limit price.  */
+  if (limitSat > static_cast<uint64_t> (std::numeric_limits<Amount>::max ()))
+    throw jsonrpc::JsonRpcException (jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+                                     "limitprice is too large");
+
+  std::lock_guard<std::mutex> lock(mutWrites);
+  Json::Value res(Json::arrayValue);
+  for (const auto& trade : daemon.SweepOrders (asset, t, units, limitSat))
+    res.append (ProtoToJson (trade));
+  return res;
+}
+
+Json::Value
+RpcServer::sweeporders (const std::string& asset, const int limitprice,
+                        const std::string& type, const int units)
+{
+  return SweepOrders (asset, limitprice, type, units);
+}
+
+void
+RpcServer::sweepordersI (const Json::Value& request, Json::Value& response)
+{
+  response = SweepOrders (request["asset"].asString (), request["limitprice"],
+                          request["type"].asString (),
+                          request["units"].asInt ());
+}
+
 } // namespace democrit
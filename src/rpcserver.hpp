@@ -26,13 +26,23 @@
 #include <jsonrpccpp/server.h>
 
 #include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
+#include <vector>
 
 namespace democrit
 {
 
 /**
  * Generic RPC server implementation for a democrit daemon.
+ *
+ * The server can be used with a connector that handles requests on
+ * multiple threads.  Read-only methods are then answered concurrently,
+ * mostly from immutable snapshots of the responses, while methods that
+ * modify the daemon's data are serialised.
  */
 class RpcServer : public DaemonRpcServerStub
 {
@@ -51,11 +61,163 @@ private:
   /** Condition variable for signalling "should stop".  */
   std::condition_variable cvStop;
 
+  /**
+   * Lock held by all methods that modify the daemon's data (like addorder
+   * or takeorder).  The HTTP server handles requests on multiple threads,
+   * and while read-only methods run concurrently from snapshots, the
+   * modifications are processed one at a time.
+   */
+  std::mutex mutWrites;
+
+  /**
+   * Immutable snapshot of some response value, together with the data
+   * versions it was computed for.  Snapshots are published atomically,
+   * so that concurrent readers can use them without any locks.
+   */
+  template <typename T>
+    struct Snapshot
+  {
+
+    /** The data versions for which the response is valid.  */
+    std::vector<uint64_t> versions;
+
+    /** The response itself.  */
+    T value;
+
+  };
+
+  /**
+   * A cached response of some RPC method, both as Json::Value (for the
+   * normal handler) and JSON text (for the fast path).
+   */
+  struct CachedResponse
+  {
+
+    /** The current snapshot as Json::Value, if any.  */
+    std::shared_ptr<const Snapshot<Json::Value>> value;
+
+    /** The current snapshot as JSON text, if any.  */
+    std::shared_ptr<const Snapshot<std::string>> text;
+
+    /**
+     * Lock held while recomputing a snapshot.  This makes sure that
+     * concurrent calls do not all do the same work at once.  Readers of
+     * an up-to-date snapshot do not need it.
+     */
+    std::mutex mutCompute;
+
+  };
+
+  /** Cached response of getordersbyasset.  */
+  CachedResponse cachedOrdersByAsset;
+
+  /** Cached response of getownorders.  */
+  CachedResponse cachedOwnOrders;
+
+  /** Cached response of gettrades.  */
+  CachedResponse cachedTrades;
+
+  /**
+   * Returns the snapshot in the given slot if it matches the current
+   * versions of the given kinds of data.  Otherwise a new one is computed
+   * with the given function and published.
+   */
+  template <typename T>
+    std::shared_ptr<const Snapshot<T>> GetSnapshot (
+        std::shared_ptr<const Snapshot<T>>& slot, std::mutex& mut,
+        const std::vector<Daemon::DataKind>& kinds,
+        const std::function<void (T&)>& compute);
+
+  /**
+   * Returns the cached response as Json::Value, recomputing it with the
+   * given function if the data versions have changed.
+   */
+  Json::Value GetCached (CachedResponse& cache,
+                         const std::vector<Daemon::DataKind>& kinds,
+                         const std::function<Json::Value ()>& compute);
+
+  /**
+   * Appends the cached JSON text of a response to the output buffer,
+   * recomputing it first with the given writer function if the data
+   * versions have changed.
+   */
+  void GetCachedText (CachedResponse& cache,
+                      const std::vector<Daemon::DataKind>& kinds,
+                      const std::function<void (std::string&)>& write,
+                      std::string& out);
+
+  /**
+   * Tries to compute the result of a method call without parameters
+   * directly as JSON text, which is appended to the buffer.  Returns false
+   * if the method is not one that is handled by the fast path.
+   */
+  bool WriteFastPathResult (const std::string& method, std::string& out);
+
+  /**
+   * Returns true if the given method is one handled by WriteFastPathResult.
+   */
+  static bool IsFastPathMethod (const std::string& method);
+
+  /**
+   * Connection handler that intercepts the incoming requests.  Single
+   * requests for one of the heavy methods without parameters (like
+   * getordersbyasset) are answered with JSON text written directly by
+   * ProtoToJsonText, rather than going through a Json::Value tree.
+   * Everything else is passed on to the normal handler of the stub.
+   */
+  class FastPathHandler : public jsonrpc::IClientConnectionHandler
+  {
+
+  private:
+
+    /** The RpcServer this is part of.  */
+    RpcServer& server;
+
+    /** The handler to forward all other requests to.  */
+    jsonrpc::IClientConnectionHandler* next;
+
+  public:
+
+    explicit FastPathHandler (RpcServer& s,
+                              jsonrpc::IClientConnectionHandler* n);
+
+    FastPathHandler () = delete;
+    FastPathHandler (const FastPathHandler&) = delete;
+    void operator= (const FastPathHandler&) = delete;
+
+    void HandleRequest (const std::string& request,
+                        std::string& retValue) override;
+
+  };
+
+  /** The fast-path handler installed on our connector.  */
+  FastPathHandler fastPath;
+
+  /**
+   * Reads the current data versions of the given kinds.
+   */
+  std::vector<uint64_t> GetVersions (
+      const std::vector<Daemon::DataKind>& kinds) const;
+
+  /**
+   * Implements getordersinrange with the price bounds given as JSON
+   * values, which are parsed as uint64.
+   */
+  Json::Value GetOrdersInRange (const Json::Value& assets,
+                                const Json::Value& minPrice,
+                                const Json::Value& maxPrice);
+
+  /**
+   * Implements sweeporders with the limit price given as JSON value,
+   * which is parsed as uint64.
+   */
+  Json::Value SweepOrders (const std::string& asset,
+                           const Json::Value& limitPrice,
+                           const std::string& type, int units);
+
 public:
 
-  explicit RpcServer (Daemon& d, jsonrpc::AbstractServerConnector& conn)
-    : DaemonRpcServerStub(conn), daemon(d)
-  {}
+  explicit RpcServer (Daemon& d, jsonrpc::AbstractServerConnector& conn);
 
   RpcServer () = delete;
   RpcServer (const RpcServer&) = delete;
@@ -68,16 +230,46 @@ public:
 
   void stop () override;
   Json::Value getstatus () override;
+  Json::Value getmetrics () override;
+  std::string getmetricstext () override;
+  int waitforchange (const std::string& kind, int known) override;
 
   Json::Value getordersforasset (const std::string& asset) override;
+  Json::Value getdepthforasset (const std::string& asset) override;
   Json::Value getordersbyasset () override;
+  Json::Value getbestorders (const Json::Value& assets, int levels) override;
+  Json::Value getordersinrange (const Json::Value& assets,
+                                int maxprice, int minprice) override;
+
+  /**
+   * The generated stub converts the price bounds to int before calling
+   * getordersinrange, which truncates valid uint64 prices.  We override
+   * its dispatch method to pass on the raw JSON values instead.
+   */
+  void getordersinrangeI (const Json::Value& request,
+                          Json::Value& response) override;
 
   Json::Value getownorders () override;
   bool addorder (const Json::Value& order) override;
   Json::Value cancelorder (int id) override;
+  Json::Value addorders (const Json::Value& orders) override;
+  Json::Value cancelorders (const Json::Value& ids) override;
+  bool replaceorders (const Json::Value& cancel,
+                      const Json::Value& orders) override;
 
   Json::Value gettrades () override;
+  Json::Value querytrades (const Json::Value& filter, int limit,
+                           int offset) override;
   bool takeorder (const Json::Value& order, int units) override;
+  Json::Value sweeporders (const std::string& asset, int limitprice,
+                           const std::string& type, int units) override;
+
+  /**
+   * Dispatches sweeporders with the limit price as raw JSON value,
+   * for the same reason as getordersinrangeI.
+   */
+  void sweepordersI (const Json::Value& request,
+                     Json::Value& response) override;
 
 };
 
@@ -0,0 +1,248 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/scheduler.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+DEFINE_int32 (democrit_scheduler_threads, 4,
+              "Number of threads for running periodic jobs");
+
+Scheduler::Scheduler (const unsigned numThreads)
+  : rnd(std::random_device () ())
+{
+  CHECK_GT (numThreads, 0);
+  for (unsigned i = 0; i < numThreads; ++i)
+    workers.emplace_back ([this] ()
+      {
+        RunWorker ();
+      });
+}
+
+Scheduler::~Scheduler ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    LOG_IF (WARNING, !tasks.empty ())
+        << "Destroying scheduler with " << tasks.size () << " tasks left";
+    stop = true;
+    cvQueue.notify_all ();
+  }
+
+  for (auto& w : workers)
+    w.join ();
+}
+
+Scheduler&
+Scheduler::Global ()
+{
+  static Scheduler instance(FLAGS_democrit_scheduler_threads);
+  return instance;
+}
+
+void
+Scheduler::Enqueue (const TaskId id, Task& t, const Clock::time_point due)
+{
+  t.due = due;
+  queue.emplace (due, id);
+  cvQueue.notify_all ();
+}
+
+Scheduler::TaskId
+Scheduler::Add (const std::chrono::nanoseconds intv,
+                const std::chrono::nanoseconds jitter,
+                const std::function<void ()>& fcn)
+{
+  CHECK_GE (jitter.count (), 0);
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  const TaskId id = nextId++;
+  auto& t = tasks[id];
+  t.fcn = fcn;
+  t.intv = intv;
+  t.jitter = jitter;
+  Enqueue (id, t, Clock::now ());
+
+  return id;
+}
+
+Scheduler::TaskId
+Scheduler::AddTriggered (const std::function<void ()>& fcn)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const TaskId id = nextId++;
+  auto& t = tasks[id];
+  t.fcn = fcn;
+  t.repeating = false;
+  t.due = Clock::time_point::max ();
+
+  return id;
+}
+
+void
+Scheduler::TriggerAfter (const TaskId id,
+                         const std::chrono::nanoseconds delay)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = tasks.find (id);
+  CHECK (mit != tasks.end ()) << "Unknown task " << id;
+  auto& t = mit->second;
+
+  if (t.running)
+    {
+      if (!t.triggered || delay < t.triggerDelay)
+        t.triggerDelay = delay;
+      t.triggered = true;
+      return;
+    }
+
+  const auto due
+      = Clock::now () + std::chrono::duration_cast<Clock::duration> (delay);
+  if (t.due <= due)
+    return;
+
+  /* Tasks added with AddTriggered are not in the queue until they are
+     triggered, in which case the erase is a no-op.  */
+  queue.erase (std::make_pair (t.due, id));
+  Enqueue (id, t, due);
+}
+
+void
+Scheduler::Remove (const TaskId id)
+{
+  std::unique_lock<std::mutex> lock(mut);
+
+  auto mit = tasks.find (id);
+  CHECK (mit != tasks.end ()) << "Unknown task " << id;
+
+  if (!mit->second.running)
+    {
+      queue.erase (std::make_pair (mit->second.due, id));
+      tasks.erase (mit);
+      return;
+    }
+
+  /* If we are called from within the task itself, we just remove it.
+     The worker will notice that and not reschedule it.  */
+  if (mit->second.runner == std::this_thread::get_id ())
+    {
+      tasks.erase (mit);
+      return;
+    }
+
+  /* Otherwise, mark the task so that it will not be requeued, and wait
+     for the current run to finish.  */
+  mit->second.removing = true;
+  while (true)
+    {
+      mit = tasks.find (id);
+      if (mit == tasks.end ())
+        return;
+      if (!mit->second.running)
+        break;
+      cvDone.wait (lock);
+    }
+
+  tasks.erase (mit);
+}
+
+void
+Scheduler::RunWorker ()
+{
+  std::unique_lock<std::mutex> lock(mut);
+  while (!stop)
+    {
+      if (queue.empty ())
+        {
+          cvQueue.wait (lock);
+          continue;
+        }
+
+      const auto first = *queue.begin ();
+      if (first.first > Clock::now ())
+        {
+          cvQueue.wait_until (lock, first.first);
+          continue;
+        }
+
+      queue.erase (queue.begin ());
+      const TaskId id = first.second;
+      auto& t = tasks.at (id);
+      t.running = true;
+      t.runner = std::this_thread::get_id ();
+      t.triggered = false;
+
+      /* The task is run without holding the lock, so that other tasks
+         can be scheduled and run in parallel.  The function is copied, so
+         that it stays valid even if the task is removed from inside.  */
+      const auto fcn = t.fcn;
+      lock.unlock ();
+      fcn ();
+      lock.lock ();
+
+      /* The task may have been removed from inside, or is waiting to be
+         removed by another thread.  In both cases, it is not requeued.  */
+      const auto mit = tasks.find (id);
+      if (mit != tasks.end ())
+        mit->second.running = false;
+      if (mit != tasks.end () && !mit->second.removing)
+        {
+          auto& done = mit->second;
+
+          /* Tasks added with AddTriggered are only requeued if they have
+             been triggered again while running.  */
+          std::chrono::nanoseconds delay(0);
+          bool requeue = true;
+          if (done.triggered)
+            delay = done.triggerDelay;
+          else if (done.repeating)
+            {
+              delay = done.intv;
+              if (done.jitter.count () > 0)
+                {
+                  std::uniform_int_distribution<int64_t> dist(
+                      0, done.jitter.count ());
+                  delay += std::chrono::nanoseconds (dist (rnd));
+                }
+            }
+          else
+            requeue = false;
+
+          if (requeue)
+            {
+              const auto due
+                  = Clock::now ()
+                      + std::chrono::duration_cast<Clock::duration> (delay);
+              Enqueue (id, done, due);
+            }
+          else
+            done.due = Clock::time_point::max ();
+        }
+
+      cvDone.notify_all ();
+    }
+}
+
+} // namespace democrit
@@ -0,0 +1,248 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/scheduler.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace democrit
+{
+namespace
+{
+
+/** Interval used for the tests.  */
+constexpr auto INTV = std::chrono::milliseconds (10);
+
+class SchedulerTests : public testing::Test
+{
+
+protected:
+
+  Scheduler scheduler;
+
+  SchedulerTests ()
+    : scheduler(2)
+  {}
+
+};
+
+TEST_F (SchedulerTests, RunsRepeatedly)
+{
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.Add (INTV, INTV.zero (), [&cnt] () { ++cnt; });
+
+  std::this_thread::sleep_for (3.5 * INTV);
+  scheduler.Remove (id);
+  EXPECT_EQ (cnt, 4);
+
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 4);
+}
+
+TEST_F (SchedulerTests, ManyTasks)
+{
+  constexpr unsigned num = 20;
+
+  std::atomic<unsigned> cnt(0);
+  std::vector<Scheduler::TaskId> ids;
+  for (unsigned i = 0; i < num; ++i)
+    ids.push_back (scheduler.Add (INTV, INTV.zero (), [&cnt] () { ++cnt; }));
+
+  std::this_thread::sleep_for (INTV / 2);
+  for (const auto id : ids)
+    scheduler.Remove (id);
+
+  EXPECT_EQ (cnt, num);
+}
+
+TEST_F (SchedulerTests, NotConcurrentWithItself)
+{
+  std::atomic<bool> running(false);
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.Add (INTV.zero (), INTV.zero (),
+      [&] ()
+      {
+        ASSERT_FALSE (running.exchange (true));
+        std::this_thread::sleep_for (INTV / 10);
+        ++cnt;
+        running = false;
+      });
+
+  std::this_thread::sleep_for (3 * INTV);
+  scheduler.Remove (id);
+  EXPECT_GT (cnt, 0);
+}
+
+TEST_F (SchedulerTests, BlockingTaskDoesNotStallOthers)
+{
+  const auto blocker = scheduler.Add (10 * INTV, INTV.zero (), [] ()
+    {
+      std::this_thread::sleep_for (5 * INTV);
+    });
+
+  std::this_thread::sleep_for (INTV / 2);
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.Add (INTV, INTV.zero (), [&cnt] () { ++cnt; });
+
+  std::this_thread::sleep_for (2.5 * INTV);
+  scheduler.Remove (id);
+  EXPECT_EQ (cnt, 3);
+
+  scheduler.Remove (blocker);
+}
+
+TEST_F (SchedulerTests, TriggerNow)
+{
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.Add (100 * INTV, INTV.zero (),
+                                 [&cnt] () { ++cnt; });
+
+  std::this_thread::sleep_for (INTV);
+  EXPECT_EQ (cnt, 1);
+
+  scheduler.TriggerNow (id);
+  std::this_thread::sleep_for (INTV);
+  EXPECT_EQ (cnt, 2);
+
+  scheduler.TriggerNow (id);
+  std::this_thread::sleep_for (INTV);
+  EXPECT_EQ (cnt, 3);
+
+  scheduler.Remove (id);
+}
+
+TEST_F (SchedulerTests, TriggerWhileRunning)
+{
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.Add (100 * INTV, INTV.zero (), [&cnt] ()
+    {
+      std::this_thread::sleep_for (2 * INTV);
+      ++cnt;
+    });
+
+  std::this_thread::sleep_for (INTV);
+  scheduler.TriggerNow (id);
+
+  std::this_thread::sleep_for (4 * INTV);
+  EXPECT_EQ (cnt, 2);
+
+  scheduler.Remove (id);
+}
+
+TEST_F (SchedulerTests, TriggeredTask)
+{
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.AddTriggered ([&cnt] () { ++cnt; });
+
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 0);
+
+  scheduler.TriggerAfter (id, 2 * INTV);
+  std::this_thread::sleep_for (INTV);
+  scheduler.TriggerAfter (id, 2 * INTV);
+  EXPECT_EQ (cnt, 0);
+
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 1);
+  std::this_thread::sleep_for (3 * INTV);
+  EXPECT_EQ (cnt, 1);
+
+  scheduler.TriggerNow (id);
+  std::this_thread::sleep_for (INTV);
+  EXPECT_EQ (cnt, 2);
+
+  scheduler.Remove (id);
+}
+
+TEST_F (SchedulerTests, TriggerAfterWhileRunning)
+{
+  std::atomic<unsigned> cnt(0);
+  const auto id = scheduler.AddTriggered ([&cnt] ()
+    {
+      std::this_thread::sleep_for (2 * INTV);
+      ++cnt;
+    });
+
+  scheduler.TriggerNow (id);
+  std::this_thread::sleep_for (INTV);
+  scheduler.TriggerAfter (id, 2 * INTV);
+
+  std::this_thread::sleep_for (2 * INTV);
+  EXPECT_EQ (cnt, 1);
+  std::this_thread::sleep_for (4 * INTV);
+  EXPECT_EQ (cnt, 2);
+
+  scheduler.Remove (id);
+}
+
+TEST_F (SchedulerTests, RemoveWaitsForRunningTask)
+{
+  std::atomic<bool> done(false);
+  const auto id = scheduler.Add (100 * INTV, INTV.zero (), [&done] ()
+    {
+      std::this_thread::sleep_for (3 * INTV);
+      done = true;
+    });
+
+  std::this_thread::sleep_for (INTV);
+  scheduler.Remove (id);
+  EXPECT_TRUE (done);
+}
+
+TEST_F (SchedulerTests, RemoveFromInside)
+{
+  std::atomic<unsigned> cnt(0);
+  Scheduler::TaskId id;
+  std::atomic<bool> added(false);
+  id = scheduler.Add (INTV, INTV.zero (), [&] ()
+    {
+      while (!added)
+        std::this_thread::yield ();
+      ++cnt;
+      scheduler.Remove (id);
+    });
+  added = true;
+
+  std::this_thread::sleep_for (3 * INTV);
+  EXPECT_EQ (cnt, 1);
+}
+
+TEST_F (SchedulerTests, Jitter)
+{
+  using Clock = Scheduler::Clock;
+
+  std::atomic<unsigned> cnt(0);
+  const auto before = Clock::now ();
+  const auto id = scheduler.Add (INTV, INTV, [&cnt] () { ++cnt; });
+
+  std::this_thread::sleep_for (10 * INTV);
+  scheduler.Remove (id);
+  const auto after = Clock::now ();
+
+  /* Each interval is between INTV and 2 * INTV.  */
+  const auto elapsed = after - before;
+  EXPECT_LE (cnt, elapsed / INTV + 1);
+  EXPECT_GE (cnt, elapsed / (2 * INTV));
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -18,10 +18,87 @@
 
 #include "private/stanzas.hpp"
 
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <zlib.h>
+
+#include <cstdlib>
+
 namespace democrit
 {
 
+DEFINE_int32 (democrit_stanza_compression_threshold, 0,
+              "If positive, stanza payloads larger than this many bytes are"
+              " sent zlib-compressed; note that peers running older versions"
+              " cannot read compressed stanzas");
+
+namespace
+{
+
+/**
+ * Maximum size of decompressed payloads we accept.  This protects against
+ * "zip bombs" sent by malicious peers.
+ */
+constexpr size_t MAX_DECOMPRESSED_SIZE = 4 << 20;
+
+} // anonymous namespace
+
 constexpr const char* AccountOrdersStanza::TAG;
+constexpr const char* OrdersDeltaStanza::TAG;
 constexpr const char* ProcessingMessageStanza::TAG;
 
+bool
+MaybeCompressPayload (std::string& payload)
+{
+  const int threshold = FLAGS_democrit_stanza_compression_threshold;
+  if (threshold <= 0 || payload.size () <= static_cast<size_t> (threshold))
+    return false;
+
+  uLongf len = compressBound (payload.size ());
+  std::string compressed(len, '\0');
+  const int rc = compress2 (reinterpret_cast<Bytef*> (&compressed[0]), &len,
+                            reinterpret_cast<const Bytef*> (payload.data ()),
+                            payload.size (), Z_DEFAULT_COMPRESSION);
+  CHECK_EQ (rc, Z_OK) << "zlib compression failed";
+  compressed.resize (len);
+
+  if (compressed.size () >= payload.size ())
+    return false;
+
+  payload = std::move (compressed);
+  return true;
+}
+
+bool
+DecompressPayload (const std::string& compressed, const std::string& size,
+                   std::string& out)
+{
+  if (size.empty () || size.find_first_not_of ("0123456789") != size.npos)
+    {
+      LOG (WARNING) << "Invalid size for compressed payload: " << size;
+      return false;
+    }
+
+  const auto expected = std::strtoull (size.c_str (), nullptr, 10);
+  if (expected > MAX_DECOMPRESSED_SIZE)
+    {
+      LOG (WARNING) << "Compressed payload is too large: " << size;
+      return false;
+    }
+
+  out.assign (expected, '\0');
+  uLongf len = expected;
+  const auto* in = reinterpret_cast<const Bytef*> (compressed.data ());
+  const int rc = uncompress (reinterpret_cast<Bytef*> (&out[0]), &len,
+                             in, compressed.size ());
+  if (rc != Z_OK || len != expected)
+    {
+      LOG (WARNING) << "Failed to decompress payload (zlib code " << rc << ")";
+      return false;
+    }
+
+  return true;
+}
+
 } // namespace democrit
@@ -23,6 +23,7 @@
 #include <glog/logging.h>
 
 #include <memory>
+#include <utility>
 
 namespace democrit
 {
@@ -32,17 +33,30 @@ template <typename Proto, int N, typename Self>
 
 template <typename Proto, int N, typename Self>
   ProtoStanza<Proto, N, Self>::ProtoStanza ()
-  : StanzaExtension(EXT_TYPE), valid(false)
+  : StanzaExtension(EXT_TYPE), data(std::make_shared<Proto> ()), valid(false)
 {}
 
 template <typename Proto, int N, typename Self>
   ProtoStanza<Proto, N, Self>::ProtoStanza (const Proto& d)
-  : StanzaExtension(EXT_TYPE), data(d), valid(true)
+  : ProtoStanza(std::make_shared<Proto> (d))
 {}
 
+template <typename Proto, int N, typename Self>
+  ProtoStanza<Proto, N, Self>::ProtoStanza (Proto&& d)
+  : ProtoStanza(std::make_shared<Proto> (std::move (d)))
+{}
+
+template <typename Proto, int N, typename Self>
+  ProtoStanza<Proto, N, Self>::ProtoStanza (std::shared_ptr<const Proto> d)
+  : StanzaExtension(EXT_TYPE), data(std::move (d)),
+    encoded(std::make_shared<Encoded> ()), valid(true)
+{
+  CHECK (data != nullptr);
+}
+
 template <typename Proto, int N, typename Self>
   ProtoStanza<Proto, N, Self>::ProtoStanza (const gloox::Tag& t)
-  : StanzaExtension(EXT_TYPE), valid(false)
+  : StanzaExtension(EXT_TYPE), data(std::make_shared<Proto> ()), valid(false)
 {
   /* We start with valid=false and only set it to true if we have successfully
      done all our parsing.  */
@@ -51,9 +65,23 @@ template <typename Proto, int N, typename Self>
   if (!charon::DecodeXmlPayload (t, payload))
     return;
 
-  if (!data.ParseFromString (payload))
+  if (t.hasAttribute ("compression"))
+    {
+      if (t.findAttribute ("compression") != "zlib")
+        return;
+
+      std::string decompressed;
+      if (!DecompressPayload (payload, t.findAttribute ("size"), decompressed))
+        return;
+      payload = std::move (decompressed);
+    }
+
+  auto parsed = std::make_shared<Proto> ();
+  if (!parsed->ParseFromString (payload))
     return;
 
+  data = std::move (parsed);
+  encoded = std::make_shared<Encoded> ();
   valid = true;
 }
 
@@ -79,6 +107,7 @@ template <typename Proto, int N, typename Self>
 {
   auto res = std::make_unique<Self> ();
   res->data = data;
+  res->encoded = encoded;
   res->valid = valid;
   return res.release ();
 }
@@ -89,11 +118,20 @@ template <typename Proto, int N, typename Self>
 {
   CHECK (IsValid ()) << "Trying to serialise an invalid stanza";
 
-  std::string payload;
-  CHECK (data.SerializeToString (&payload));
+  std::call_once (encoded->once, [this] ()
+    {
+      CHECK (data->SerializeToString (&encoded->payload));
+      encoded->size = encoded->payload.size ();
+      encoded->compressed = MaybeCompressPayload (encoded->payload);
+    });
 
-  auto res = charon::EncodeXmlPayload (Self::TAG, payload);
+  auto res = charon::EncodeXmlPayload (Self::TAG, encoded->payload);
   res->setXmlns (XMLNS);
+  if (encoded->compressed)
+    {
+      res->addAttribute ("compression", "zlib");
+      res->addAttribute ("size", std::to_string (encoded->size));
+    }
 
   return res.release ();
 }
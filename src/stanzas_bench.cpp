@@ -0,0 +1,68 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/stanzas.hpp"
+
+#include "benchutils.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <gloox/tag.h>
+
+#include <memory>
+
+namespace democrit
+{
+namespace
+{
+
+/**
+ * Encodes a large OrdersOfAccount into an XMPP tag.
+ */
+void
+EncodeAccountOrders (benchmark::State& state)
+{
+  const AccountOrdersStanza stanza(BenchOrders ("domob", state.range (0)));
+  for (auto _ : state)
+    {
+      std::unique_ptr<gloox::Tag> tag(stanza.tag ());
+      benchmark::DoNotOptimize (tag.get ());
+    }
+}
+BENCHMARK (EncodeAccountOrders)->RangeMultiplier (10)->Range (10, 10'000);
+
+/**
+ * Decodes a large OrdersOfAccount from an XMPP tag.
+ */
+void
+DecodeAccountOrders (benchmark::State& state)
+{
+  const AccountOrdersStanza original(BenchOrders ("domob", state.range (0)));
+  std::unique_ptr<gloox::Tag> tag(original.tag ());
+
+  for (auto _ : state)
+    {
+      const AccountOrdersStanza decoded(*tag);
+      CHECK (decoded.IsValid ());
+      benchmark::DoNotOptimize (decoded.GetData ());
+    }
+}
+BENCHMARK (DecodeAccountOrders)->RangeMultiplier (10)->Range (10, 10'000);
+
+} // anonymous namespace
+} // namespace democrit
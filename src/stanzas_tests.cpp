@@ -20,6 +20,7 @@
 
 #include "testutils.hpp"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -28,6 +29,9 @@
 
 namespace democrit
 {
+
+DECLARE_int32 (democrit_stanza_compression_threshold);
+
 namespace
 {
 
@@ -89,6 +93,20 @@ TEST_F (StanzasTests, AccountOrdersStanza)
   )");
 }
 
+TEST_F (StanzasTests, OrdersDeltaStanza)
+{
+  ProtoStanzaRoundtrip<OrdersDeltaStanza> (R"(
+    sequence: 42
+    upserted:
+      {
+        key: 101
+        value: { asset: "gold" type: BID price_sat: 10 }
+      }
+    removed: 5
+    removed: 7
+  )");
+}
+
 TEST_F (StanzasTests, ProcessingMessageStanza)
 {
   ProtoStanzaRoundtrip<ProcessingMessageStanza> (R"(
@@ -97,5 +115,138 @@ TEST_F (StanzasTests, ProcessingMessageStanza)
   )");
 }
 
+TEST_F (StanzasTests, CloneSharesData)
+{
+  auto data = ParseTextProto<proto::ProcessingMessage> (R"(
+    identifier: "me\n42"
+    psbt: { psbt: "abc" }
+  )");
+  const auto expected = data;
+
+  const ProcessingMessageStanza original(std::move (data));
+  ASSERT_TRUE (original.IsValid ());
+  EXPECT_TRUE (MessageDifferencer::Equals (original.GetData (), expected));
+
+  std::unique_ptr<ProcessingMessageStanza> copy(
+      dynamic_cast<ProcessingMessageStanza*> (original.clone ()));
+  ASSERT_NE (copy, nullptr);
+  ASSERT_TRUE (copy->IsValid ());
+  EXPECT_EQ (&copy->GetData (), &original.GetData ());
+  EXPECT_EQ (copy->GetSharedData (), original.GetSharedData ());
+
+  std::unique_ptr<gloox::Tag> tag1(original.tag ());
+  std::unique_ptr<gloox::Tag> tag2(copy->tag ());
+  std::string payload1, payload2;
+  ASSERT_TRUE (charon::DecodeXmlPayload (*tag1, payload1));
+  ASSERT_TRUE (charon::DecodeXmlPayload (*tag2, payload2));
+  EXPECT_EQ (payload1, payload2);
+}
+
+class StanzaCompressionTests : public testing::Test
+{
+
+protected:
+
+  StanzaCompressionTests ()
+  {
+    FLAGS_democrit_stanza_compression_threshold = 100;
+  }
+
+  ~StanzaCompressionTests ()
+  {
+    FLAGS_democrit_stanza_compression_threshold = 0;
+  }
+
+  /**
+   * Returns an orders proto that is large (and compresses well).
+   */
+  static proto::OrdersOfAccount
+  LargeOrders ()
+  {
+    proto::OrdersOfAccount res;
+    res.set_account ("domob");
+    for (unsigned i = 0; i < 100; ++i)
+      {
+        auto& o = (*res.mutable_orders ())[i];
+        o.set_asset ("some asset with a long name");
+        o.set_type (proto::Order::ASK);
+        o.set_price_sat (1'000);
+        o.set_max_units (10);
+      }
+    return res;
+  }
+
+};
+
+TEST_F (StanzaCompressionTests, SmallNotCompressed)
+{
+  proto::OrdersOfAccount data;
+  data.set_account ("domob");
+
+  const AccountOrdersStanza stanza(data);
+  std::unique_ptr<gloox::Tag> tag(stanza.tag ());
+  EXPECT_FALSE (tag->hasAttribute ("compression"));
+}
+
+TEST_F (StanzaCompressionTests, Roundtrip)
+{
+  const auto data = LargeOrders ();
+  const AccountOrdersStanza stanza(data);
+
+  std::unique_ptr<gloox::Tag> tag(stanza.tag ());
+  EXPECT_EQ (tag->findAttribute ("compression"), "zlib");
+  EXPECT_EQ (tag->findAttribute ("size"),
+             std::to_string (data.ByteSizeLong ()));
+
+  std::string payload;
+  ASSERT_TRUE (charon::DecodeXmlPayload (*tag, payload));
+  EXPECT_LT (payload.size (), data.ByteSizeLong () / 4);
+
+  const AccountOrdersStanza recovered(*tag);
+  ASSERT_TRUE (recovered.IsValid ());
+  EXPECT_TRUE (MessageDifferencer::Equals (recovered.GetData (), data));
+}
+
+TEST_F (StanzaCompressionTests, DisabledStillDecodes)
+{
+  const auto data = LargeOrders ();
+  const AccountOrdersStanza stanza(data);
+  std::unique_ptr<gloox::Tag> tag(stanza.tag ());
+
+  /* Even with compression turned off for sending, we still understand
+     compressed stanzas from others.  */
+  FLAGS_democrit_stanza_compression_threshold = 0;
+  const AccountOrdersStanza recovered(*tag);
+  ASSERT_TRUE (recovered.IsValid ());
+  EXPECT_TRUE (MessageDifferencer::Equals (recovered.GetData (), data));
+
+  std::unique_ptr<gloox::Tag> uncompressed(recovered.tag ());
+  EXPECT_FALSE (uncompressed->hasAttribute ("compression"));
+}
+
+TEST_F (StanzaCompressionTests, InvalidCompressedData)
+{
+  const AccountOrdersStanza stanza(LargeOrders ());
+  std::unique_ptr<gloox::Tag> good(stanza.tag ());
+  const std::string size = good->findAttribute ("size");
+
+  auto tag = charon::EncodeXmlPayload ("orders", "invalid data");
+  tag->setXmlns (AccountOrdersStanza::XMLNS);
+  tag->addAttribute ("compression", "zlib");
+  tag->addAttribute ("size", size);
+  EXPECT_FALSE (AccountOrdersStanza (*tag).IsValid ());
+
+  std::unique_ptr<gloox::Tag> modified(good->clone ());
+  modified->addAttribute ("compression", "zstd");
+  EXPECT_FALSE (AccountOrdersStanza (*modified).IsValid ());
+
+  for (const std::string s : {"", "abc", "-1", "1", "100000000"})
+    {
+      modified.reset (good->clone ());
+      modified->addAttribute ("size", s);
+      EXPECT_FALSE (AccountOrdersStanza (*modified).IsValid ()) << s;
+    }
+}
+
 } // anonymous namespace
 } // namespace democrit
@@ -0,0 +1,43 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/state.hpp"
+
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+State::State (const std::string& account,
+              std::unique_ptr<StatePersistence> p)
+  : persistence(std::move (p))
+{
+  /* Set the account first, so that it is part of the initial snapshot
+     written if there is no existing data.  */
+  state.set_account (account);
+  if (persistence == nullptr || !persistence->Load (state))
+    return;
+
+  CHECK_EQ (state.account (), account)
+      << "Persisted state is for a different account";
+  LOG (INFO)
+      << "Restored state with " << state.own_orders ().orders_size ()
+      << " own orders and " << state.trades_size () << " active trades";
+}
+
+} // namespace democrit
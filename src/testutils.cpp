@@ -135,6 +135,15 @@ TestAssets::CanSell (const std::string& name, const Asset& asset,
     return false;
 
   hash = currentHash;
+  {
+    std::lock_guard<std::mutex> lock(mutQueued);
+    if (!queuedHashes.empty ())
+      {
+        hash = queuedHashes.front ();
+        queuedHashes.pop_front ();
+      }
+  }
+
   return n <= mitAsset->second;
 }
 
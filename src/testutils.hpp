@@ -35,8 +35,11 @@
 #include <google/protobuf/text_format.h>
 #include <google/protobuf/util/message_differencer.h>
 
+#include <deque>
 #include <map>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace democrit
 {
@@ -138,7 +141,9 @@ template <typename Proto>
 
 DEFINE_PROTO_MATCHER (EqualsOrdersForAsset, OrderbookForAsset)
 DEFINE_PROTO_MATCHER (EqualsOrdersByAsset, OrderbookByAsset)
+DEFINE_PROTO_MATCHER (EqualsDepthForAsset, DepthForAsset)
 DEFINE_PROTO_MATCHER (EqualsOrdersOfAccount, OrdersOfAccount)
+DEFINE_PROTO_MATCHER (EqualsOrdersDelta, OrdersDelta)
 DEFINE_PROTO_MATCHER (EqualsTradeState, TradeState)
 DEFINE_PROTO_MATCHER (EqualsTrade, Trade)
 
@@ -160,6 +165,16 @@ private:
   /** Block hash returned for the state.  */
   xaya::uint256 currentHash;
 
+  /**
+   * Block hashes returned by the next CanSell calls (one each) before
+   * currentHash is used again.  This simulates the state moving on while
+   * a batch is checked.
+   */
+  mutable std::deque<xaya::uint256> queuedHashes;
+
+  /** Lock for queuedHashes, since CanSell may be called from any thread.  */
+  mutable std::mutex mutQueued;
+
 public:
 
   static constexpr const char* GAME_ID = "test";
@@ -172,6 +187,16 @@ public:
     currentHash = hash;
   }
 
+  /**
+   * Queues block hashes to be returned by the next calls to CanSell.
+   */
+  void
+  QueueBlocks (const std::vector<xaya::uint256>& hashes)
+  {
+    std::lock_guard<std::mutex> lock(mutQueued);
+    queuedHashes.insert (queuedHashes.end (), hashes.begin (), hashes.end ());
+  }
+
   void
   SetBalance (const std::string& name, const Asset& asset, const Amount n)
   {
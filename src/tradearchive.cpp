@@ -0,0 +1,262 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/tradearchive.hpp"
+
+#include <glog/logging.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace democrit
+{
+
+namespace
+{
+
+/** Size of the header (the payload length) of each entry in the file.  */
+constexpr size_t HEADER_SIZE = 4;
+
+/**
+ * Encodes a 32-bit length as little-endian header.
+ */
+void
+EncodeHeader (const uint32_t len, char* out)
+{
+  for (size_t i = 0; i < HEADER_SIZE; ++i)
+    out[i] = static_cast<char> ((len >> (8 * i)) & 0xFF);
+}
+
+/**
+ * Decodes a little-endian header.
+ */
+uint32_t
+DecodeHeader (const char* in)
+{
+  uint32_t res = 0;
+  for (size_t i = 0; i < HEADER_SIZE; ++i)
+    res |= static_cast<uint32_t> (static_cast<unsigned char> (in[i]))
+              << (8 * i);
+  return res;
+}
+
+/**
+ * Reads exactly the given number of bytes at some offset.  Returns false
+ * if the file ends before that.
+ */
+bool
+ReadAt (const int fd, const uint64_t offset, char* out, const size_t len)
+{
+  size_t done = 0;
+  while (done < len)
+    {
+      const auto n = pread (fd, out + done, len - done, offset + done);
+      CHECK_GE (n, 0)
+          << "Failed to read trade archive: " << std::strerror (errno);
+      if (n == 0)
+        return false;
+      done += n;
+    }
+
+  return true;
+}
+
+} // anonymous namespace
+
+TradeArchive::TradeArchive (const std::string& p)
+  : path(p)
+{
+  fd = open (path.c_str (), O_RDWR | O_CREAT, 0600);
+  CHECK_NE (fd, -1)
+      << "Failed to open trade archive " << path << ": "
+      << std::strerror (errno);
+
+  BuildIndex ();
+  LOG (INFO)
+      << "Opened trade archive " << path << " with " << index.size ()
+      << " trades";
+}
+
+TradeArchive::~TradeArchive ()
+{
+  close (fd);
+}
+
+void
+TradeArchive::BuildIndex ()
+{
+  index.clear ();
+  fileSize = 0;
+
+  while (true)
+    {
+      char header[HEADER_SIZE];
+      if (!ReadAt (fd, fileSize, header, HEADER_SIZE))
+        break;
+
+      IndexEntry entry;
+      entry.offset = fileSize + HEADER_SIZE;
+      entry.size = DecodeHeader (header);
+
+      std::string data(entry.size, '\0');
+      proto::Trade t;
+      if (!ReadAt (fd, entry.offset, &data[0], entry.size)
+            || !t.ParseFromString (data))
+        break;
+
+      entry.startTime = t.start_time ();
+      entry.state = t.state ();
+      index.push_back (entry);
+      fileSize = entry.offset + entry.size;
+    }
+
+  /* If there is some data left after the last complete entry (e.g. from
+     a crash during writing), remove it so new entries are appended
+     correctly.  */
+  CHECK_EQ (ftruncate (fd, fileSize), 0)
+      << "Failed to truncate trade archive: " << std::strerror (errno);
+}
+
+proto::Trade
+TradeArchive::ReadEntry (const IndexEntry& entry) const
+{
+  std::string data(entry.size, '\0');
+  CHECK (ReadAt (fd, entry.offset, &data[0], entry.size))
+      << "Trade archive entry at " << entry.offset << " is missing";
+
+  proto::Trade res;
+  CHECK (res.ParseFromString (data))
+      << "Failed to parse trade archive entry at " << entry.offset;
+
+  return res;
+}
+
+void
+TradeArchive::Append (const std::vector<proto::Trade>& trades)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  std::string buf;
+  std::vector<IndexEntry> added;
+  for (const auto& t : trades)
+    {
+      const std::string data = t.SerializeAsString ();
+
+      char header[HEADER_SIZE];
+      EncodeHeader (data.size (), header);
+      buf.append (header, HEADER_SIZE);
+
+      IndexEntry entry;
+      entry.offset = fileSize + buf.size ();
+      entry.size = data.size ();
+      entry.startTime = t.start_time ();
+      entry.state = t.state ();
+      added.push_back (entry);
+
+      buf.append (data);
+    }
+
+  size_t done = 0;
+  while (done < buf.size ())
+    {
+      const auto n = pwrite (fd, buf.data () + done, buf.size () - done,
+                             fileSize + done);
+      CHECK_GT (n, 0)
+          << "Failed to write trade archive: " << std::strerror (errno);
+      done += n;
+    }
+  CHECK_EQ (fsync (fd), 0)
+      << "Failed to sync trade archive: " << std::strerror (errno);
+
+  fileSize += buf.size ();
+  index.insert (index.end (), added.begin (), added.end ());
+}
+
+size_t
+TradeArchive::GetSize () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return index.size ();
+}
+
+void
+TradeArchive::Query (const proto::TradeFilter& filter, size_t& skip,
+                     const size_t limit, std::vector<proto::Trade>& out) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  /* If the filter only uses fields that we have in the index, we do not
+     need to read the entries that are skipped.  */
+  const bool indexOnly = !filter.has_asset () && !filter.has_counterparty ();
+
+  size_t found = 0;
+  for (auto it = index.rbegin (); it != index.rend () && found < limit; ++it)
+    {
+      if (filter.has_min_start_time ()
+            && it->startTime < filter.min_start_time ())
+        continue;
+      if (filter.has_max_start_time ()
+            && it->startTime > filter.max_start_time ())
+        continue;
+      if (filter.has_state () && it->state != filter.state ())
+        continue;
+
+      if (indexOnly && skip > 0)
+        {
+          --skip;
+          continue;
+        }
+
+      auto t = ReadEntry (*it);
+      if (!MatchesTradeFilter (filter, t))
+        continue;
+
+      if (skip > 0)
+        {
+          --skip;
+          continue;
+        }
+
+      out.push_back (std::move (t));
+      ++found;
+    }
+}
+
+bool
+MatchesTradeFilter (const proto::TradeFilter& filter, const proto::Trade& t)
+{
+  if (filter.has_min_start_time ()
+        && t.start_time () < filter.min_start_time ())
+    return false;
+  if (filter.has_max_start_time ()
+        && t.start_time () > filter.max_start_time ())
+    return false;
+  if (filter.has_state () && t.state () != filter.state ())
+    return false;
+  if (filter.has_asset () && t.asset () != filter.asset ())
+    return false;
+  if (filter.has_counterparty () && t.counterparty () != filter.counterparty ())
+    return false;
+
+  return true;
+}
+
+} // namespace democrit
@@ -0,0 +1,244 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/tradearchive.hpp"
+
+#include "testutils.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace democrit
+{
+namespace
+{
+
+using testing::ElementsAre;
+
+class TradeArchiveTests : public testing::Test
+{
+
+protected:
+
+  /** The temporary directory used.  */
+  std::string dir;
+
+  /** The archive file.  */
+  std::string file;
+
+  TradeArchiveTests ()
+  {
+    std::string tmpl = testing::TempDir () + "/democrit-archive-XXXXXX";
+    CHECK (mkdtemp (&tmpl[0]) != nullptr);
+    dir = tmpl;
+    file = dir + "/archive";
+  }
+
+  ~TradeArchiveTests ()
+  {
+    std::remove (file.c_str ());
+    std::remove (dir.c_str ());
+  }
+
+  /**
+   * Constructs a trade with the given data.
+   */
+  static proto::Trade
+  MakeTrade (const int64_t startTime, const std::string& asset,
+             const std::string& state)
+  {
+    return ParseTextProto<proto::Trade> (
+        "start_time: " + std::to_string (startTime)
+          + " asset: \"" + asset + "\""
+          + " counterparty: \"domob\""
+          + " state: " + state);
+  }
+
+  /**
+   * Runs a query and returns the start times of the trades found.
+   */
+  static std::vector<int64_t>
+  QueryTimes (const TradeArchive& a, const proto::TradeFilter& filter,
+              size_t skip, const size_t limit)
+  {
+    std::vector<proto::Trade> trades;
+    a.Query (filter, skip, limit, trades);
+
+    std::vector<int64_t> res;
+    for (const auto& t : trades)
+      res.push_back (t.start_time ());
+    return res;
+  }
+
+};
+
+TEST_F (TradeArchiveTests, Empty)
+{
+  TradeArchive a(file);
+  EXPECT_EQ (a.GetSize (), 0);
+  EXPECT_THAT (QueryTimes (a, proto::TradeFilter (), 0, 10),
+               ElementsAre ());
+}
+
+TEST_F (TradeArchiveTests, NewestFirst)
+{
+  TradeArchive a(file);
+  a.Append ({MakeTrade (1, "gold", "SUCCESS"), MakeTrade (2, "gold", "FAILED")});
+  a.Append ({MakeTrade (3, "silver", "SUCCESS")});
+
+  EXPECT_EQ (a.GetSize (), 3);
+  EXPECT_THAT (QueryTimes (a, proto::TradeFilter (), 0, 10),
+               ElementsAre (3, 2, 1));
+}
+
+TEST_F (TradeArchiveTests, Pagination)
+{
+  TradeArchive a(file);
+  std::vector<proto::Trade> trades;
+  for (int i = 1; i <= 10; ++i)
+    trades.push_back (MakeTrade (i, "gold", "SUCCESS"));
+  a.Append (trades);
+
+  const proto::TradeFilter filter;
+  EXPECT_THAT (QueryTimes (a, filter, 0, 3), ElementsAre (10, 9, 8));
+  EXPECT_THAT (QueryTimes (a, filter, 3, 3), ElementsAre (7, 6, 5));
+  EXPECT_THAT (QueryTimes (a, filter, 8, 3), ElementsAre (2, 1));
+  EXPECT_THAT (QueryTimes (a, filter, 20, 3), ElementsAre ());
+
+  size_t skip = 15;
+  std::vector<proto::Trade> out;
+  a.Query (filter, skip, 3, out);
+  EXPECT_EQ (skip, 5);
+}
+
+TEST_F (TradeArchiveTests, Filters)
+{
+  TradeArchive a(file);
+  a.Append ({
+    MakeTrade (1, "gold", "SUCCESS"),
+    MakeTrade (2, "silver", "SUCCESS"),
+    MakeTrade (3, "gold", "FAILED"),
+    MakeTrade (4, "gold", "SUCCESS"),
+    MakeTrade (5, "silver", "ABANDONED"),
+  });
+
+  EXPECT_THAT (QueryTimes (a, ParseTextProto<proto::TradeFilter> (R"(
+    min_start_time: 2
+    max_start_time: 4
+  )"), 0, 10), ElementsAre (4, 3, 2));
+
+  EXPECT_THAT (QueryTimes (a, ParseTextProto<proto::TradeFilter> (R"(
+    state: SUCCESS
+  )"), 0, 10), ElementsAre (4, 2, 1));
+
+  EXPECT_THAT (QueryTimes (a, ParseTextProto<proto::TradeFilter> (R"(
+    asset: "gold"
+  )"), 1, 10), ElementsAre (3, 1));
+
+  EXPECT_THAT (QueryTimes (a, ParseTextProto<proto::TradeFilter> (R"(
+    asset: "gold"
+    state: SUCCESS
+  )"), 0, 1), ElementsAre (4));
+
+  EXPECT_THAT (QueryTimes (a, ParseTextProto<proto::TradeFilter> (R"(
+    counterparty: "andy"
+  )"), 0, 10), ElementsAre ());
+}
+
+TEST_F (TradeArchiveTests, Reopen)
+{
+  {
+    TradeArchive a(file);
+    a.Append ({MakeTrade (1, "gold", "SUCCESS")});
+    a.Append ({MakeTrade (2, "silver", "FAILED")});
+  }
+
+  TradeArchive a(file);
+  EXPECT_EQ (a.GetSize (), 2);
+  a.Append ({MakeTrade (3, "gold", "SUCCESS")});
+  EXPECT_THAT (QueryTimes (a, proto::TradeFilter (), 0, 10),
+               ElementsAre (3, 2, 1));
+}
+
+TEST_F (TradeArchiveTests, IncompleteEntry)
+{
+  {
+    TradeArchive a(file);
+    a.Append ({MakeTrade (1, "gold", "SUCCESS")});
+  }
+
+  {
+    std::ofstream out(file, std::ios::binary | std::ios::app);
+    out << "\x50\x00\x00\x00partial";
+  }
+
+  TradeArchive a(file);
+  EXPECT_EQ (a.GetSize (), 1);
+  a.Append ({MakeTrade (2, "gold", "SUCCESS")});
+  EXPECT_THAT (QueryTimes (a, proto::TradeFilter (), 0, 10),
+               ElementsAre (2, 1));
+
+  TradeArchive reopened(file);
+  EXPECT_EQ (reopened.GetSize (), 2);
+}
+
+TEST (MatchesTradeFilterTests, Works)
+{
+  const auto t = ParseTextProto<proto::Trade> (R"(
+    start_time: 10
+    asset: "gold"
+    counterparty: "domob"
+    state: PENDING
+  )");
+
+  EXPECT_TRUE (MatchesTradeFilter (proto::TradeFilter (), t));
+  EXPECT_TRUE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    min_start_time: 10
+    max_start_time: 10
+    state: PENDING
+    asset: "gold"
+    counterparty: "domob"
+  )"), t));
+
+  EXPECT_FALSE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    min_start_time: 11
+  )"), t));
+  EXPECT_FALSE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    max_start_time: 9
+  )"), t));
+  EXPECT_FALSE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    state: SUCCESS
+  )"), t));
+  EXPECT_FALSE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    asset: "silver"
+  )"), t));
+  EXPECT_FALSE (MatchesTradeFilter (ParseTextProto<proto::TradeFilter> (R"(
+    counterparty: "andy"
+  )"), t));
+}
+
+} // anonymous namespace
+} // namespace democrit
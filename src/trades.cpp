@@ -18,31 +18,72 @@
 
 #include "private/trades.hpp"
 
+#include "private/metrics.hpp"
+
 #include <xayautil/jsonutils.hpp>
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <google/protobuf/repeated_field.h>
+#include <google/protobuf/util/message_differencer.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
 #include <sstream>
 
 namespace democrit
 {
 
 DEFINE_int32 (democrit_confirmations, 6,
-              "Block confirmations until a trade is finalised");
+              "Block confirmations until a trade is finalised (must be"
+              " below the GSP's minimum trade retention depth of 100)");
 DEFINE_int32 (democrit_feerate_wo_names, 1'000,
               "Fee rate (in sat/vb) to use for the trade transaction"
               " without name input/output");
 DEFINE_int32 (democrit_trade_timeout_ms, 30'000,
               "Milliseconds until an initiated trade will be abandoned if not"
               " finalised with the counterparty");
+DEFINE_bool (democrit_trade_notifications, true,
+             "If true, pending trades are updated when the GSP notifies about"
+             " new blocks or pending moves, instead of periodic polling");
+DEFINE_int32 (democrit_trade_update_threads, 8,
+              "Number of threads to use for updating active trades in"
+              " parallel (zero to update them sequentially)");
+DEFINE_int32 (democrit_address_cache_size, 20,
+              "Number of fresh wallet addresses to keep ready for seller"
+              " data (zero to disable the cache)");
+DEFINE_int64 (democrit_address_cache_refill_ms, 1'000,
+              "Interval (in milliseconds) for refilling the address cache");
+DEFINE_int32 (democrit_block_header_cache_size, 1'000,
+              "Maximum number of block headers to cache for checking"
+              " the block ancestry when verifying trades");
+DEFINE_int32 (democrit_psbt_cache_size, 100,
+              "Maximum number of decoded PSBTs to cache");
+DEFINE_int32 (democrit_trade_archive_window, 1'000,
+              "Maximum number of archived trades to keep in memory; older"
+              " ones are moved to the on-disk store");
 
 namespace
 {
 
+using google::protobuf::RepeatedPtrField;
+
 /** Value paid into name outputs (in satoshis).  */
 constexpr Amount NAME_VALUE = 1'000'000;
 
+/**
+ * Minimum depth at which the g/dem GSP prunes trades and reports them only
+ * as final (DemGame::MIN_RETENTION_DEPTH).  Our required confirmations must
+ * be below that, so that trades are seen as confirmed before final.
+ */
+constexpr int GSP_MIN_RETENTION_DEPTH = 100;
+
+/** Time to wait before retrying a failed GSP notification call.  */
+constexpr auto WATCHER_RETRY = std::chrono::seconds (5);
+
 /**
  * Tries to lock or unlock an unspent output in the Xaya Wallet.  Returns
  * true on success and false on failure.
@@ -72,24 +113,102 @@ LockUnspent (RpcClient<XayaRpcClient>& rpc, const bool lock,
 }
 
 /**
- * Unlocks all inputs in the given PSBT.
+ * Decodes a PSBT and returns the "tx" field of the result.
  */
-void
-UnlockPsbtInputs (RpcClient<XayaRpcClient>& rpc, const std::string& psbt)
+Json::Value
+DecodePsbtTx (PsbtDecoder& decoder, const std::string& psbt)
 {
-  const auto decoded = rpc->decodepsbt (psbt);
-  CHECK (decoded.isObject ());
+  const auto decoded = decoder.Decode (psbt);
   const auto& tx = decoded["tx"];
   CHECK (tx.isObject ());
-  const auto& vin = tx["vin"];
-  CHECK (vin.isArray ());
+  return tx;
+}
 
+/**
+ * Unlocks all the given inputs.
+ */
+void
+UnlockInputs (RpcClient<XayaRpcClient>& rpc,
+              const RepeatedPtrField<proto::OutPoint>& inputs)
+{
   /* Note that not all inputs will be ours (at least the name input won't),
      but that is fine as LockUnspent gracefully handles unlock-errors.  */
+  for (const auto& in : inputs)
+    LockUnspent (rpc, false, in);
+}
+
+/**
+ * Unlocks all inputs in the given PSBT.
+ */
+void
+UnlockPsbtInputs (RpcClient<XayaRpcClient>& rpc, PsbtDecoder& decoder,
+                  const std::string& psbt)
+{
+  const auto tx = DecodePsbtTx (decoder, psbt);
+  const auto& vin = tx["vin"];
+  CHECK (vin.isArray ());
+
   for (const auto& in : vin)
     LockUnspent (rpc, false, OutPointFromJson (in));
 }
 
+/**
+ * Returns the identifier (as per Trade::GetIdentifier) of the trade
+ * for the given order.
+ */
+std::string
+TradeIdentifier (const proto::Order& o)
+{
+  /* New lines are not valid inside Xaya names, so they can act as
+     separator between maker name and order ID.  */
+
+  std::ostringstream res;
+  res << o.account () << '\n' << o.id ();
+
+  return res.str ();
+}
+
+/**
+ * Returns the key (as per Trade::GetKey) of the given trade.  This works
+ * directly with the proto, so that no Trade instance has to be built
+ * e.g. when looking up trades in the state.
+ */
+std::string
+TradeKey (const proto::TradeState& pb)
+{
+  return pb.counterparty () + '\n' + TradeIdentifier (pb.order ());
+}
+
+/**
+ * Returns the name of the processing phase a trade is in, as used for
+ * the latency metrics.
+ */
+std::string
+TradePhase (const proto::TradeState& pb)
+{
+  switch (pb.state ())
+    {
+    case proto::Trade::INITIATED:
+      if (pb.has_our_psbt ())
+        return "signed";
+      if (pb.has_their_psbt ())
+        return "psbt";
+      if (pb.has_seller_data ())
+        return "sellerdata";
+      return "initiated";
+    case proto::Trade::PENDING:
+      return "pending";
+    case proto::Trade::SUCCESS:
+      return "success";
+    case proto::Trade::FAILED:
+      return "failed";
+    case proto::Trade::ABANDONED:
+      return "abandoned";
+    default:
+      return "unknown";
+    }
+}
+
 } // anonymous namespace
 
 /* ************************************************************************** */
@@ -113,21 +232,59 @@ Trade::BuildTradeChecker () const
     }
 
   return std::make_unique<TradeChecker> (
-      tm.spec, tm.xayaRpc,
+      tm.spec, tm.xayaRpc, tm.headerCache, tm.psbtDecoder,
       buyer, seller,
       pb.order ().asset (), pb.order ().price_sat (), pb.units ());
 }
 
+const TradeChecker&
+Trade::GetChecker () const
+{
+  if (checker == nullptr)
+    checker = BuildTradeChecker ();
+  return *checker;
+}
+
 std::string
 Trade::GetIdentifier () const
 {
-  /* New lines are not valid inside Xaya names, so they can act as
-     separator between maker name and order ID.  */
+  return TradeIdentifier (pb.order ());
+}
 
-  std::ostringstream res;
-  res << pb.order ().account () << '\n' << pb.order ().id ();
+std::string
+Trade::GetKey () const
+{
+  return TradeKey (pb);
+}
 
-  return res.str ();
+void
+Trade::CachePsbtData ()
+{
+  CHECK (pb.has_our_psbt ());
+  if (pb.has_btxid ())
+    return;
+
+  VLOG (1) << "Decoding our PSBT to cache its btxid and inputs";
+  const auto tx = DecodePsbtTx (tm.psbtDecoder, pb.our_psbt ());
+
+  const auto& btxidVal = tx["btxid"];
+  CHECK (btxidVal.isString ());
+
+  /* The inputs are only needed when checking for double spends, which
+     only happens if the transaction is not known to the GSP.  Thus we
+     accept missing inputs here, and just leave the list empty.  The
+     conflict check then fails hard, since a transaction always has
+     inputs and without them, a double spend would go unnoticed.  */
+  pb.clear_inputs ();
+  const auto& vin = tx["vin"];
+  if (!vin.isNull ())
+    {
+      CHECK (vin.isArray ());
+      for (const auto& in : vin)
+        *pb.add_inputs () = OutPointFromJson (in);
+    }
+
+  pb.set_btxid (btxidVal.asString ());
 }
 
 proto::Order::Type
@@ -279,6 +436,7 @@ Trade::MergePsbt (const proto::TradePsbt& psbt)
 void
 Trade::HandleMessage (const proto::ProcessingMessage& msg)
 {
+  ScopedTimer timer("trade.handlemessage");
   CHECK (isMutable) << "Trade instance is not mutable";
 
   /* In any state except INITIATED, there is nothing more to do except
@@ -310,8 +468,8 @@ Trade::CreateSellerData ()
       return false;
     }
 
-  sd.set_name_address (tm.xayaRpc->getnewaddress ());
-  sd.set_chi_address (tm.xayaRpc->getnewaddress ());
+  sd.set_name_address (tm.GetNewAddress ());
+  sd.set_chi_address (tm.GetNewAddress ());
 
   *pb.mutable_seller_data () = std::move (sd);
   return true;
@@ -336,7 +494,12 @@ Trade::ConstructTransaction (const TradeChecker& checker,
 
   /* First step:  Let the wallet fund a transaction paying the seller
      their CHI, but without the name input or output.  This determines the
-     coins spent by the buyer, and also the change they get.  */
+     coins spent by the buyer, and also the change they get.
+
+     If we have a pre-selected (and already locked) coin from the input pool
+     that covers the total, we pass it in explicitly.  Then the wallet does
+     not need to run coin selection, except for adding more inputs in case
+     the coin does not also cover the fee.  */
   std::string chiPart;
   {
     Json::Value outputs(Json::arrayValue);
@@ -348,58 +511,96 @@ Trade::ConstructTransaction (const TradeChecker& checker,
     options["fee_rate"] = FLAGS_democrit_feerate_wo_names;
     options["lockUnspents"] = true;
 
-    const auto resp = tm.xayaRpc->walletcreatefundedpsbt (
-        Json::Value (Json::arrayValue), outputs, 0, options);
-
-    CHECK (resp.isObject ());
-    const auto& psbtVal = resp["psbt"];
-    CHECK (psbtVal.isString ());
-    chiPart = psbtVal.asString ();
-    VLOG (1) << "Funded PSBT:\n" << chiPart;
-  }
-
-  /* Second step:  Build a transaction that just has the name input and
-     output with the desired name operation.  */
-  std::string namePart;
-  {
     Json::Value inputs(Json::arrayValue);
-    Json::Value cur(Json::objectValue);
-    cur["txid"] = nameIn.hash ();
-    cur["vout"] = static_cast<Json::Int> (nameIn.n ());
-    inputs.append (cur);
-
-    Json::Value outputs(Json::arrayValue);
-    cur = Json::Value (Json::objectValue);
-    cur[sd.name_address ()] = xaya::ChiAmountToJson (NAME_VALUE);
-    outputs.append (cur);
-
-    namePart = tm.xayaRpc->createpsbt (inputs, outputs);
-
-    Json::Value nameOp(Json::objectValue);
-    nameOp["op"] = "name_update";
-    nameOp["name"] = "p/" + sellerName;
-    nameOp["value"] = checker.GetNameUpdateValue ();
+    proto::OutPoint pooled;
+    if (tm.inputPool != nullptr && tm.inputPool->Take (total, pooled))
+      {
+        VLOG (1)
+            << "Funding trade from pooled input "
+            << pooled.hash () << ":" << pooled.n ();
+
+        cur = Json::Value (Json::objectValue);
+        cur["txid"] = pooled.hash ();
+        cur["vout"] = static_cast<Json::Int> (pooled.n ());
+        inputs.append (cur);
+        options["add_inputs"] = true;
+      }
 
-    const auto resp = tm.xayaRpc->namepsbt (namePart, 0, nameOp);
+    Json::Value resp;
+    try
+      {
+        resp = tm.xayaRpc->walletcreatefundedpsbt (inputs, outputs, 0,
+                                                   options);
+      }
+    catch (...)
+      {
+        /* The pooled coin is no longer in the pool, so nothing else would
+           unlock it.  We release it back to the wallet.  */
+        if (!inputs.empty ())
+          LockUnspent (tm.xayaRpc, false, pooled);
+        throw;
+      }
 
     CHECK (resp.isObject ());
     const auto& psbtVal = resp["psbt"];
     CHECK (psbtVal.isString ());
-    namePart = psbtVal.asString ();
-    VLOG (1) << "PSBT with just the name operation:\n" << namePart;
+    chiPart = psbtVal.asString ();
+    VLOG (1) << "Funded PSBT:\n" << chiPart;
   }
 
-  /* Third step:  Combine the two PSBTs (CHI and name parts) into a single
-     one with both their inputs and outputs.  */
+  /* If any of the remaining steps fails, the coins locked by funding the
+     CHI part (including a pooled one) have to be unlocked again, as the
+     transaction is discarded.  */
   std::string psbt;
-  {
-    Json::Value psbts(Json::arrayValue);
-    psbts.append (chiPart);
-    psbts.append (namePart);
+  try
+    {
+      /* Second step:  Build a transaction that just has the name input and
+         output with the desired name operation.  */
+      std::string namePart;
+      {
+        Json::Value inputs(Json::arrayValue);
+        Json::Value cur(Json::objectValue);
+        cur["txid"] = nameIn.hash ();
+        cur["vout"] = static_cast<Json::Int> (nameIn.n ());
+        inputs.append (cur);
+
+        Json::Value outputs(Json::arrayValue);
+        cur = Json::Value (Json::objectValue);
+        cur[sd.name_address ()] = xaya::ChiAmountToJson (NAME_VALUE);
+        outputs.append (cur);
+
+        namePart = tm.xayaRpc->createpsbt (inputs, outputs);
+
+        Json::Value nameOp(Json::objectValue);
+        nameOp["op"] = "name_update";
+        nameOp["name"] = "p/" + sellerName;
+        nameOp["value"] = checker.GetNameUpdateValue ();
+
+        const auto resp = tm.xayaRpc->namepsbt (namePart, 0, nameOp);
+
+        CHECK (resp.isObject ());
+        const auto& psbtVal = resp["psbt"];
+        CHECK (psbtVal.isString ());
+        namePart = psbtVal.asString ();
+        VLOG (1) << "PSBT with just the name operation:\n" << namePart;
+      }
 
-    psbt = tm.xayaRpc->joinpsbts (psbts);
-    VLOG (1) << "Final unsigned PSBT:\n" << psbt;
-  }
+      /* Third step:  Combine the two PSBTs (CHI and name parts) into a single
+         one with both their inputs and outputs.  */
+      {
+        Json::Value psbts(Json::arrayValue);
+        psbts.append (chiPart);
+        psbts.append (namePart);
+
+        psbt = tm.xayaRpc->joinpsbts (psbts);
+        VLOG (1) << "Final unsigned PSBT:\n" << psbt;
+      }
+    }
+  catch (...)
+    {
+      UnlockPsbtInputs (tm.xayaRpc, tm.psbtDecoder, chiPart);
+      throw;
+    }
 
   return psbt;
 }
@@ -433,6 +634,7 @@ SignPsbt (RpcClient<XayaRpcClient>& rpc, const std::string& psbt,
 bool
 Trade::HasReply (proto::ProcessingMessage& reply)
 {
+  ScopedTimer timer("trade.hasreply");
   CHECK (isMutable) << "Trade instance is not mutable";
 
   /* In any state except INITIATED, there is nothing more to do except
@@ -468,7 +670,8 @@ Trade::HasReply (proto::ProcessingMessage& reply)
     {
       CHECK (pb.has_their_psbt ());
 
-      if (!checker->CheckForSellerOutputs (pb.their_psbt (), pb.seller_data ()))
+      const auto& checker = GetChecker ();
+      if (!checker.CheckForSellerOutputs (pb.their_psbt (), pb.seller_data ()))
         {
           LOG (WARNING) << "Buyer provided invalid PSBT for the trade";
           return false;
@@ -477,8 +680,8 @@ Trade::HasReply (proto::ProcessingMessage& reply)
       bool complete;
       const auto psbt = SignPsbt (tm.xayaRpc, pb.their_psbt (), complete);
 
-      if (!checker->CheckForSellerSignature (pb.their_psbt (), psbt,
-                                             pb.seller_data ()))
+      if (!checker.CheckForSellerSignature (pb.their_psbt (), psbt,
+                                            pb.seller_data ()))
         {
           LOG (WARNING) << "Signing PSBT as seller provided invalid signatures";
           return false;
@@ -517,24 +720,33 @@ Trade::HasReply (proto::ProcessingMessage& reply)
   if (GetOrderType () == proto::Order::BID && !pb.has_our_psbt ())
     {
       proto::OutPoint nameIn;
-      if (!checker->CheckForBuyerTrade (nameIn))
+      if (!GetChecker ().CheckForBuyerTrade (nameIn))
         {
           LOG (WARNING) << "Seller cannot fulfill the trade";
           return false;
         }
 
-      const auto unsignedPsbt = ConstructTransaction (*checker, nameIn);
+      const auto unsignedPsbt = ConstructTransaction (GetChecker (), nameIn);
 
       bool complete;
-      const auto signedPsbt = SignPsbt (tm.xayaRpc, unsignedPsbt, complete);
+      std::string signedPsbt;
+      try
+        {
+          signedPsbt = SignPsbt (tm.xayaRpc, unsignedPsbt, complete);
+        }
+      catch (...)
+        {
+          UnlockPsbtInputs (tm.xayaRpc, tm.psbtDecoder, unsignedPsbt);
+          throw;
+        }
 
-      if (!checker->CheckForBuyerSignature (unsignedPsbt, signedPsbt))
+      if (!GetChecker ().CheckForBuyerSignature (unsignedPsbt, signedPsbt))
         {
           LOG (WARNING) << "Signing PSBT as buyer provided invalid signatures";
           /* ConstructTransaction locked the inputs in our wallet, but we
              are now discarding this transaction.  Make sure to unlock the
              inputs again.  */
-          UnlockPsbtInputs (tm.xayaRpc, signedPsbt);
+          UnlockPsbtInputs (tm.xayaRpc, tm.psbtDecoder, signedPsbt);
           return false;
         }
 
@@ -625,8 +837,9 @@ Trade::HasReply (proto::ProcessingMessage& reply)
 }
 
 void
-Trade::Update ()
+Trade::Update (const std::map<std::string, Json::Value>* checks)
 {
+  ScopedTimer timer("trade.update");
   VLOG (1) << "Updating trade:\n" << pb.DebugString ();
   CHECK (isMutable) << "Trade instance is not mutable";
 
@@ -655,16 +868,14 @@ Trade::Update ()
   /* First, check the state of this trade's btxid in the g/dem GSP.  If it is
      confirmed with a sufficiently low height (compared to the current block
      height), then we mark the trade as succeeded.  */
-  CHECK (pb.has_our_psbt ());
-  const auto decoded = tm.xayaRpc->decodepsbt (pb.our_psbt ());
-  CHECK (decoded.isObject ());
-  const auto& tx = decoded["tx"];
-  CHECK (tx.isObject ());
-  const auto& btxidVal = tx["btxid"];
-  CHECK (btxidVal.isString ());
-  const std::string btxid = btxidVal.asString ();
-
-  const auto check = tm.demGsp->checktrade (btxid);
+  CachePsbtData ();
+  const std::string& btxid = pb.btxid ();
+
+  Json::Value check;
+  if (checks != nullptr && checks->count (btxid) > 0)
+    check = checks->at (btxid);
+  else
+    check = tm.demGsp->checktrade (btxid);
   CHECK (check.isObject ());
   const auto& curHeightVal = check["height"];
   CHECK (curHeightVal.isUInt ());
@@ -674,6 +885,17 @@ Trade::Update ()
   const auto& stateVal = dataVal["state"];
   CHECK (stateVal.isString ());
 
+  /* The GSP may prune trades that are buried deep enough, and then only
+     reports them as final.  That only happens at GSP_MIN_RETENTION_DEPTH
+     or deeper, which is beyond our own confirmations as checked in the
+     constructor, so this is consistent with the confirmed case below.  */
+  if (stateVal.asString () == "final")
+    {
+      LOG (INFO) << "Trade with btxid " << btxid << " is final";
+      pb.set_state (proto::Trade::SUCCESS);
+      return;
+    }
+
   if (stateVal.asString () == "confirmed")
     {
       const auto& confHeightVal = dataVal["height"];
@@ -703,34 +925,34 @@ Trade::Update ()
   /* If one of the trade's inputs is not available, the trade is conflicted.
      The first time this happens, we remember the block height.  If we then
      advance beyond the required confirmations, we mark it as failed.  */
-  const auto& vin = tx["vin"];
-  CHECK (vin.isArray ());
-  bool conflicted = false;
-  for (const auto& in : vin)
+  /* gettxout can return JSON objects and JSON null, which does not work
+     well with the libjson-rpc-cpp generated code.  Thus we call it directly,
+     and do so for all inputs in a single batch.  */
+  CHECK_GT (pb.inputs_size (), 0)
+      << "No inputs known for trade with btxid " << btxid;
+  std::vector<Json::Value> params;
+  for (const auto& in : pb.inputs ())
     {
-      CHECK (in.isObject ());
-      const auto& hashVal = in["txid"];
-      CHECK (hashVal.isString ());
-      const auto& nVal = in["vout"];
-      CHECK (nVal.isUInt ());
-
-      /* gettxout can return JSON objects and JSON null, which does not work
-         well with the libjson-rpc-cpp generated code.  */
-      Json::Value params(Json::arrayValue);
-      params.append (hashVal.asString ());
-      params.append (nVal.asUInt ());
-      const auto utxoData = tm.xayaRpc->CallMethod ("gettxout", params);
-
-      if (utxoData.isNull ())
-        {
-          VLOG (1)
-              << "For trade with btxid " << btxid
-              << ", the input " << hashVal << ":" << nVal
-              << " has been double spent";
-          conflicted = true;
-          break;
-        }
+      Json::Value cur(Json::arrayValue);
+      cur.append (in.hash ());
+      cur.append (in.n ());
+      params.push_back (cur);
     }
+  const auto utxos = tm.xayaRpc.CallBatch ("gettxout", params);
+  CHECK_EQ (static_cast<int> (utxos.size ()), pb.inputs_size ());
+
+  bool conflicted = false;
+  for (int i = 0; i < pb.inputs_size (); ++i)
+    if (utxos[i].isNull ())
+      {
+        const auto& in = pb.inputs (i);
+        VLOG (1)
+            << "For trade with btxid " << btxid
+            << ", the input " << in.hash () << ":" << in.n ()
+            << " has been double spent";
+        conflicted = true;
+        break;
+      }
   if (!conflicted)
     {
       pb.clear_conflict_height ();
@@ -798,7 +1020,10 @@ Trade::HandleFailure () const
   if (GetOrderType () == proto::Order::BID && pb.has_our_psbt ())
     {
       VLOG (1) << "Unlocking inputs for failed sale:\n" << pb.our_psbt ();
-      UnlockPsbtInputs (tm.xayaRpc, pb.our_psbt ());
+      if (pb.has_btxid ())
+        UnlockInputs (tm.xayaRpc, pb.inputs ());
+      else
+        UnlockPsbtInputs (tm.xayaRpc, tm.psbtDecoder, pb.our_psbt ());
     }
 }
 
@@ -807,67 +1032,480 @@ Trade::HandleFailure () const
 TradeManager::TradeManager (State& s, MyOrders& mo, const AssetSpec& as,
                             RpcClient<XayaRpcClient>& x,
                             RpcClient<DemGspRpcClient>& d,
+                            TradeArchive* store, InputPool* inputs,
                             const bool startUpdates)
   : state(s), myOrders(mo), spec(as),
-    xayaRpc(x), demGsp(d)
+    xayaRpc(x), demGsp(d), archiveStore(store), inputPool(inputs),
+    headerCache(std::max (FLAGS_democrit_block_header_cache_size, 0)),
+    psbtDecoder(xayaRpc, std::max (FLAGS_democrit_psbt_cache_size, 0)),
+    notificationsActive(false)
 {
+  CHECK_LT (FLAGS_democrit_confirmations, GSP_MIN_RETENTION_DEPTH)
+      << "--democrit_confirmations is too high for the GSP's pruning";
+
+  if (FLAGS_democrit_trade_update_threads > 0)
+    updateWorkers = std::make_unique<WorkerPool> (
+        FLAGS_democrit_trade_update_threads);
+
   if (startUpdates)
-    SetupUpdater (GetTradeTimeout ());
+    {
+      if (FLAGS_democrit_address_cache_size > 0)
+        {
+          addressCache = std::make_unique<AddressCache> (
+              xayaRpc, FLAGS_democrit_address_cache_size);
+          addressCache->StartRefills (std::chrono::milliseconds (
+              FLAGS_democrit_address_cache_refill_ms));
+        }
+
+      SetupUpdater (GetTradeTimeout ());
+      if (FLAGS_democrit_trade_notifications)
+        StartWatchers ();
+    }
+}
+
+TradeManager::~TradeManager ()
+{
+  StopWatchers ();
+  updater.reset ();
+}
+
+std::shared_ptr<std::mutex>
+TradeManager::GetTradeLock (const std::string& key)
+{
+  std::lock_guard<std::mutex> lock(mutTradeLocks);
+
+  auto& res = tradeLocks[key];
+  if (res == nullptr)
+    res = std::make_shared<std::mutex> ();
+
+  return res;
+}
+
+void
+TradeManager::ReleaseTradeLock (const std::string& key,
+                                std::shared_ptr<std::mutex>& ref)
+{
+  ref.reset ();
+
+  /* Other threads may still hold or wait for the lock.  Since references
+     to it are only handed out with mutTradeLocks held, the entry can be
+     dropped safely if the map's is the only one left.  */
+  std::lock_guard<std::mutex> lock(mutTradeLocks);
+  const auto mit = tradeLocks.find (key);
+  if (mit != tradeLocks.end () && mit->second.use_count () == 1)
+    tradeLocks.erase (mit);
+}
+
+void
+TradeManager::RebuildTradeIndex (const proto::State& s) const
+{
+  tradeIndex.clear ();
+  for (int i = 0; i < s.trades_size (); ++i)
+    tradeIndex.emplace (TradeKey (s.trades (i)), i);
+}
+
+int
+TradeManager::FindTrade (const proto::State& s, const std::string& key) const
+{
+  std::lock_guard<std::mutex> lock(mutTradeIndex);
+
+  if (tradeIndex.size () != static_cast<size_t> (s.trades_size ()))
+    RebuildTradeIndex (s);
+
+  auto mit = tradeIndex.find (key);
+  if (mit == tradeIndex.end ())
+    return -1;
+
+  const int pos = mit->second;
+  if (pos < s.trades_size () && TradeKey (s.trades (pos)) == key)
+    return pos;
+
+  /* The index is out of sync with the state.  */
+  RebuildTradeIndex (s);
+  mit = tradeIndex.find (key);
+  return mit == tradeIndex.end () ? -1 : mit->second;
 }
 
 void
-TradeManager::UpdateAndArchiveTrades ()
+TradeManager::InsertTrade (proto::State& s, proto::TradeState&& data)
+{
+  std::lock_guard<std::mutex> lock(mutTradeIndex);
+
+  /* If the index is not complete anyway, we do not add the new entry
+     to it.  It will be rebuilt on the next lookup.  */
+  if (tradeIndex.size () == static_cast<size_t> (s.trades_size ()))
+    tradeIndex.emplace (TradeKey (data), s.trades_size ());
+
+  *s.mutable_trades ()->Add () = std::move (data);
+}
+
+void
+TradeManager::EraseTrade (proto::State& s, const int pos)
+{
+  std::lock_guard<std::mutex> lock(mutTradeIndex);
+
+  auto& trades = *s.mutable_trades ();
+  CHECK_GE (pos, 0);
+  CHECK_LT (pos, trades.size ());
+
+  tradeIndex.erase (TradeKey (trades.Get (pos)));
+  for (auto& entry : tradeIndex)
+    if (entry.second > pos)
+      --entry.second;
+
+  trades.erase (trades.begin () + pos);
+}
+
+void
+TradeManager::TrackNewTrade (const std::string& key)
+{
+  Metrics::Global ().Increment ("trades.started");
+
+  std::lock_guard<std::mutex> lock(mutPhases);
+  phaseStarts[key] = std::chrono::steady_clock::now ();
+}
+
+void
+TradeManager::TrackPhaseChange (const std::string& key,
+                                const proto::TradeState& before,
+                                const proto::TradeState& after)
+{
+  const std::string from = TradePhase (before);
+  const std::string to = TradePhase (after);
+  if (from == to)
+    return;
+
+  bool done;
+  switch (after.state ())
+    {
+    case proto::Trade::SUCCESS:
+    case proto::Trade::FAILED:
+    case proto::Trade::ABANDONED:
+      done = true;
+      break;
+    default:
+      done = false;
+      break;
+    }
+
+  const auto now = std::chrono::steady_clock::now ();
+  bool known;
+  std::chrono::steady_clock::time_point start;
+  {
+    std::lock_guard<std::mutex> lock(mutPhases);
+    const auto mit = phaseStarts.find (key);
+    known = (mit != phaseStarts.end ());
+    if (known)
+      start = mit->second;
+
+    if (done)
+      phaseStarts.erase (key);
+    else
+      phaseStarts[key] = now;
+  }
+
+  if (known)
+    Metrics::Global ().Record ("trade.phase." + from + "." + to, now - start);
+  if (done)
+    Metrics::Global ().Increment ("trades." + to);
+}
+
+TradeManager::ModifyResult
+TradeManager::ModifyTrade (const std::string& key,
+                           const std::function<void (Trade&)>& f,
+                           const bool deferFinalise)
 {
-  VLOG (1) << "Running periodic update of trades...";
+  auto tradeLock = GetTradeLock (key);
+  std::unique_lock<std::mutex> lock(*tradeLock);
 
   std::string account;
-  std::vector<proto::TradeState> finalised;
-  state.AccessState ([&] (proto::State& s)
+  proto::TradeState data;
+  bool found = false;
+  state.ReadState ([&] (const proto::State& s)
     {
       account = s.account ();
+      const int pos = FindTrade (s, key);
+      if (pos >= 0)
+        {
+          data = s.trades (pos);
+          found = true;
+        }
+    });
 
-      google::protobuf::RepeatedPtrField<proto::TradeState> stillActive;
-      for (proto::TradeState& t : *s.mutable_trades ())
+  if (!found)
+    {
+      lock.unlock ();
+      ReleaseTradeLock (key, tradeLock);
+      return ModifyResult::NOT_FOUND;
+    }
+
+  bool finalised;
+  bool deferred = false;
+  bool changed;
+  proto::Trade publicInfo;
+  {
+    const proto::TradeState before = data;
+    Trade obj(*this, account, data);
+    f (obj);
+    TrackPhaseChange (key, before, data);
+    changed = !google::protobuf::util::MessageDifferencer::Equals (before,
+                                                                   data);
+    finalised = obj.IsFinalised () && !deferFinalise;
+    if (finalised)
+      publicInfo = obj.GetPublicInfo ();
+    else if (obj.IsFinalised ())
+      deferred = true;
+  }
+
+  /* Since all modifications of active trades are done while holding
+     the trade's lock, nothing can have changed the trade in the state
+     while we worked on our copy.  */
+  state.ModifyState ([&] (proto::State& s, StateChanges& changes)
+    {
+      const int pos = FindTrade (s, key);
+      CHECK_GE (pos, 0)
+          << "Locked trade " << key << " is no longer in the state";
+      changes.TouchTrade (data);
+
+      if (finalised)
         {
-          Trade obj(*this, account, t);
-          obj.Update ();
-          if (obj.IsFinalised ())
-            {
-              *s.mutable_trade_archive ()->Add () = obj.GetPublicInfo ();
-              finalised.emplace_back (std::move (t));
-            }
-          else
-            *stillActive.Add () = std::move (t);
+          *s.mutable_trade_archive ()->Add () = std::move (publicInfo);
+          EraseTrade (s, pos);
         }
+      else
+        *s.mutable_trades (pos) = data;
+    });
+
+  if (changed || finalised)
+    version.Bump ();
+
+  if (!finalised)
+    return deferred ? ModifyResult::DEFERRED : ModifyResult::ACTIVE;
 
-      s.mutable_trades ()->Swap (&stillActive);
+  lock.unlock ();
+  ReleaseTradeLock (key, tradeLock);
+
+  HandleFinalised (account, data);
+  SpillArchive ();
+
+  return ModifyResult::FINALISED;
+}
+
+void
+TradeManager::SpillArchive ()
+{
+  std::lock_guard<std::mutex> lock(mutArchive);
+
+  /* Every removal from the in-memory archive means a full snapshot of the
+     persisted state, so we do not move out entries one by one.  Instead,
+     once the window is exceeded, we move out enough entries to leave it
+     only half-full.  */
+  const int window = FLAGS_democrit_trade_archive_window;
+  std::vector<proto::Trade> spilled;
+  state.ReadState ([&] (const proto::State& s)
+    {
+      const int size = s.trade_archive_size ();
+      if (size <= window)
+        return;
+
+      const int num = size - window / 2;
+      spilled.reserve (num);
+      for (int i = 0; i < num; ++i)
+        spilled.push_back (s.trade_archive (i));
+    });
+
+  if (spilled.empty ())
+    return;
+
+  if (archiveStore == nullptr)
+    LOG (INFO)
+        << "Discarding " << spilled.size () << " old archived trades";
+  else
+    {
+      VLOG (1) << "Moving " << spilled.size () << " archived trades to disk";
+      archiveStore->Append (spilled);
+    }
+
+  /* Only this method removes from the in-memory archive (and we hold the
+     lock), so the first entries are still the same ones.  */
+  state.ModifyState ([&spilled] (proto::State& s, StateChanges&)
+    {
+      s.mutable_trade_archive ()->DeleteSubrange (0, spilled.size ());
     });
+  version.Bump ();
+}
 
+void
+TradeManager::HandleFinalised (const std::string& account,
+                               const proto::TradeState& t) const
+{
   /* If trades got finalised, we need to do some further processing on them,
      e.g. to release locked inputs or to restore the order if we are the maker
      and the trade failed.  */
-  for (const auto& t : finalised)
+  const Trade obj(*this, account, t);
+  switch (t.state ())
     {
-      const Trade obj(*this, account, t);
-      switch (t.state ())
+    case proto::Trade::ABANDONED:
+    case proto::Trade::FAILED:
+      obj.HandleFailure ();
+      break;
+    case proto::Trade::SUCCESS:
+      obj.HandleSuccess ();
+      break;
+    default:
+      /* Any other state should not have been finalised!  */
+      LOG (FATAL)
+          << "Trade with state " << static_cast<int> (t.state ())
+          << " has been archived";
+    }
+}
+
+std::map<std::string, Json::Value>
+TradeManager::CheckTradesBatch (const Json::Value& btxids) const
+{
+  CHECK (btxids.isArray ());
+
+  std::map<std::string, Json::Value> res;
+  if (btxids.empty ())
+    return res;
+
+  Json::Value batch;
+  try
+    {
+      batch = demGsp->checktrades (btxids);
+    }
+  catch (const jsonrpc::JsonRpcException& exc)
+    {
+      LOG_FIRST_N (WARNING, 1)
+          << "Batched checktrades failed, falling back to individual"
+          << " checks: " << exc.what ();
+      return res;
+    }
+
+  CHECK (batch.isObject ());
+  Json::Value data;
+  CHECK (batch.removeMember ("data", &data));
+  CHECK (data.isArray ());
+  CHECK_EQ (data.size (), btxids.size ());
+
+  for (unsigned i = 0; i < btxids.size (); ++i)
+    {
+      Json::Value cur = batch;
+      cur["data"] = data[i];
+      res.emplace (btxids[i].asString (), std::move (cur));
+    }
+
+  return res;
+}
+
+void
+TradeManager::UpdateAndArchiveTrades (const UpdateSelection sel)
+{
+  VLOG (1) << "Running update of trades...";
+
+  /* For pending trades that have their btxid cached already, we query the
+     GSP for all of them at once.  This saves RPC round-trips, and also means
+     that all trades are checked against a consistent GSP state.  */
+  std::vector<std::string> keys;
+  Json::Value btxids(Json::arrayValue);
+  state.ReadState ([&] (const proto::State& s)
+    {
+      for (const auto& t : s.trades ())
         {
-        case proto::Trade::ABANDONED:
-        case proto::Trade::FAILED:
-          obj.HandleFailure ();
-          break;
-        case proto::Trade::SUCCESS:
-          obj.HandleSuccess ();
-          break;
-        default:
-          /* Any other state should not have been finalised!  */
-          LOG (FATAL)
-              << "Trade with state " << static_cast<int> (t.state ())
-              << " has been archived";
+          switch (sel)
+            {
+            case UpdateSelection::TIMEOUTS:
+              if (t.state () == proto::Trade::PENDING)
+                continue;
+              break;
+            case UpdateSelection::CONFIRMATIONS:
+              if (t.state () == proto::Trade::INITIATED)
+                continue;
+              break;
+            default:
+              break;
+            }
+
+          keys.push_back (TradeKey (t));
+          if (t.state () == proto::Trade::PENDING && t.has_btxid ())
+            btxids.append (t.btxid ());
         }
+    });
+
+  const auto checks = CheckTradesBatch (btxids);
+
+  /* Each trade is updated (which requires RPC calls) only while holding
+     its own lock, so that other trades and the rest of the state can
+     still be accessed in the mean time.  This allows us to run the updates
+     of all trades in parallel on the worker pool.
+
+     Trades that get finalised are left in the active list for now, and only
+     archived (and post-processed) afterwards in the order of the original
+     snapshot.  This keeps the order of the archive and the external
+     processing deterministic.  */
+  std::vector<ModifyResult> results(keys.size ());
+  const auto updateOne = [&] (const size_t i)
+    {
+      results[i] = ModifyTrade (keys[i], [&checks] (Trade& t)
+        {
+          t.Update (&checks);
+        }, true);
+    };
+
+  if (updateWorkers == nullptr || keys.size () <= 1)
+    for (size_t i = 0; i < keys.size (); ++i)
+      updateOne (i);
+  else
+    {
+      std::mutex mutDone;
+      std::condition_variable cvDone;
+      size_t remaining = keys.size ();
+      std::exception_ptr error;
+
+      for (size_t i = 0; i < keys.size (); ++i)
+        updateWorkers->Submit (WorkerPool::Priority::LOW, keys[i],
+            [&, i] ()
+            {
+              std::exception_ptr exc;
+              try
+                {
+                  updateOne (i);
+                }
+              catch (...)
+                {
+                  exc = std::current_exception ();
+                }
+
+              std::lock_guard<std::mutex> lock(mutDone);
+              if (exc != nullptr && error == nullptr)
+                error = exc;
+              if (--remaining == 0)
+                cvDone.notify_all ();
+            });
+
+      std::unique_lock<std::mutex> lock(mutDone);
+      cvDone.wait (lock, [&remaining] ()
+        {
+          return remaining == 0;
+        });
+
+      if (error != nullptr)
+        std::rethrow_exception (error);
     }
 
-  LOG_IF (INFO, !finalised.empty ())
-      << "Archived " << finalised.size () << " finalised trades";
+  unsigned numFinalised = 0;
+  for (size_t i = 0; i < keys.size (); ++i)
+    {
+      if (results[i] != ModifyResult::DEFERRED)
+        continue;
+
+      const auto res = ModifyTrade (keys[i], [] (Trade&) {});
+      if (res == ModifyResult::FINALISED)
+        ++numFinalised;
+    }
+
+  LOG_IF (INFO, numFinalised > 0)
+      << "Archived " << numFinalised << " finalised trades";
 }
 
 std::vector<proto::Trade>
@@ -885,16 +1523,182 @@ TradeManager::GetTrades () const
   return res;
 }
 
+std::vector<proto::Trade>
+TradeManager::QueryTrades (const proto::TradeFilter& filter, size_t offset,
+                           const size_t limit) const
+{
+  std::lock_guard<std::mutex> lock(mutArchive);
+
+  std::vector<proto::Trade> res;
+  const auto addIfMatch = [&] (proto::Trade&& t)
+    {
+      if (res.size () >= limit || !MatchesTradeFilter (filter, t))
+        return;
+
+      if (offset > 0)
+        {
+          --offset;
+          return;
+        }
+
+      res.push_back (std::move (t));
+    };
+
+  state.ReadState ([&] (const proto::State& s)
+    {
+      for (int i = s.trades_size () - 1; i >= 0; --i)
+        addIfMatch (Trade (*this, s.account (), s.trades (i)).GetPublicInfo ());
+      for (int i = s.trade_archive_size () - 1; i >= 0; --i)
+        addIfMatch (proto::Trade (s.trade_archive (i)));
+    });
+
+  if (archiveStore != nullptr && res.size () < limit)
+    archiveStore->Query (filter, offset, limit - res.size (), res);
+
+  return res;
+}
+
 void
 TradeManager::SetupUpdater (const Trade::Clock::duration intv)
 {
   updater = std::make_unique<IntervalJob> (intv,
       [this] ()
         {
-          UpdateAndArchiveTrades ();
+          UpdateAndArchiveTrades (notificationsActive
+                                    ? UpdateSelection::TIMEOUTS
+                                    : UpdateSelection::ALL);
         });
 }
 
+void
+TradeManager::StartWatchers ()
+{
+  CHECK (!blockWatcher.joinable () && !pendingWatcher.joinable ());
+
+  {
+    std::lock_guard<std::mutex> lock(mutWatchers);
+    stopWatchers = false;
+  }
+
+  blockWatcher = std::thread ([this] ()
+    {
+      RunBlockWatcher ();
+    });
+  pendingWatcher = std::thread ([this] ()
+    {
+      RunPendingWatcher ();
+    });
+}
+
+void
+TradeManager::StopWatchers ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutWatchers);
+    stopWatchers = true;
+    cvWatchers.notify_all ();
+  }
+
+  if (blockWatcher.joinable ())
+    blockWatcher.join ();
+  if (pendingWatcher.joinable ())
+    pendingWatcher.join ();
+
+  notificationsActive = false;
+}
+
+bool
+TradeManager::WatcherSleep (const std::chrono::milliseconds dur)
+{
+  std::unique_lock<std::mutex> lock(mutWatchers);
+  cvWatchers.wait_for (lock, dur, [this] ()
+    {
+      return stopWatchers;
+    });
+  return !stopWatchers;
+}
+
+void
+TradeManager::RunBlockWatcher ()
+{
+  /* With an empty known block, waitforchange does not return right away
+     but only on the next change (or its timeout).  Thus we update once
+     on start, so that changes from before are not missed until then.
+     notificationsActive is only set once a call actually succeeded, so
+     until then the periodic updater keeps checking all trades.  */
+  UpdateAndArchiveTrades (UpdateSelection::CONFIRMATIONS);
+
+  std::string knownBlock;
+  while (WatcherSleep (std::chrono::milliseconds::zero ()))
+    {
+      std::string newBlock;
+      try
+        {
+          newBlock = demGsp->waitforchange (knownBlock);
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          LOG_IF (WARNING, notificationsActive)
+              << "Block notifications from the GSP failed, falling back"
+              << " to polling trades: " << exc.what ();
+          notificationsActive = false;
+          WatcherSleep (WATCHER_RETRY);
+          continue;
+        }
+
+      notificationsActive = true;
+      if (newBlock == knownBlock)
+        continue;
+
+      VLOG (1) << "New best block in the GSP: " << newBlock;
+      knownBlock = newBlock;
+      UpdateAndArchiveTrades (UpdateSelection::CONFIRMATIONS);
+    }
+}
+
+void
+TradeManager::RunPendingWatcher ()
+{
+  int knownVersion = 0;
+  while (WatcherSleep (std::chrono::milliseconds::zero ()))
+    {
+      Json::Value pending;
+      try
+        {
+          pending = demGsp->waitforpendingchange (knownVersion);
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          /* This is expected if the GSP does not track pending moves.
+             Block notifications work independently of it.  */
+          LOG (WARNING)
+              << "Pending notifications from the GSP are not available: "
+              << exc.what ();
+          return;
+        }
+
+      CHECK (pending.isObject ());
+      const auto& versionVal = pending["version"];
+      CHECK (versionVal.isInt ());
+      const int version = versionVal.asInt ();
+      if (version == knownVersion)
+        continue;
+
+      VLOG (1) << "Pending state of the GSP changed to version " << version;
+      knownVersion = version;
+      UpdateAndArchiveTrades (UpdateSelection::CONFIRMATIONS);
+    }
+}
+
+std::string
+TradeManager::GetNewAddress () const
+{
+  if (addressCache != nullptr)
+    return addressCache->Get ();
+
+  return xayaRpc->getnewaddress ();
+}
+
 int64_t
 TradeManager::GetCurrentTime () const
 {
@@ -942,7 +1746,7 @@ CheckOrder (const proto::Order& o, const Amount units)
 
 bool
 TradeManager::TakeOrder (const proto::Order& o, const Amount units,
-                         proto::ProcessingMessage& msg)
+                         proto::ProcessingMessage& msg, proto::Trade* info)
 {
   if (!CheckOrder (o, units))
     return false;
@@ -954,45 +1758,125 @@ TradeManager::TakeOrder (const proto::Order& o, const Amount units,
   data.set_counterparty (o.account ());
   data.set_state (proto::Trade::INITIATED);
 
-  bool ok;
-  state.AccessState ([&] (proto::State& s)
+  std::string account;
+  state.ReadState ([&account] (const proto::State& s)
     {
-      if (data.counterparty () == s.account ())
-        {
-          LOG (WARNING)
-              << "Can't take own order:\n" << data.order ().DebugString ();
-          ok = false;
-          return;
-        }
+      account = s.account ();
+    });
 
-      Trade t(*this, s.account (), data);
+  if (data.counterparty () == account)
+    {
+      LOG (WARNING)
+          << "Can't take own order:\n" << data.order ().DebugString ();
+      return false;
+    }
 
-      try
-        {
-          if (t.HasReply (msg))
-            {
-              /* This means we were the seller and it filled in the seller
-                 data as well.  We still add the "taking_order" field below.  */
-            }
-          else
-            t.InitProcessingMessage (msg);
-        }
-      catch (const jsonrpc::JsonRpcException& exc)
+  /* The trade is not yet in the state, so nobody else can access it and
+     we can do the initial processing (which may need RPC calls) without
+     any lock held.  */
+  {
+    Trade t(*this, account, data);
+
+    try
+      {
+        if (t.HasReply (msg))
+          {
+            /* This means we were the seller and it filled in the seller
+               data as well.  We still add the "taking_order" field below.  */
+          }
+        else
+          t.InitProcessingMessage (msg);
+      }
+    catch (const jsonrpc::JsonRpcException& exc)
+      {
+        LOG (WARNING)
+            << "JSON-RPC exception: " << exc.what ()
+            << "\nWhile taking order:\n" << data.order ().DebugString ();
+        return false;
+      }
+
+    t.SetTakingOrder (msg);
+    if (info != nullptr)
+      *info = t.GetPublicInfo ();
+  }
+
+  const std::string key = TradeKey (data);
+  state.ModifyState ([this, &data] (proto::State& s, StateChanges& changes)
+    {
+      changes.TouchTrade (data);
+      InsertTrade (s, std::move (data));
+    });
+  version.Bump ();
+  TrackNewTrade (key);
+
+  return true;
+}
+
+std::vector<proto::Trade>
+TradeManager::SweepOrders (const proto::OrderbookForAsset& book,
+                           const proto::Order::Type type, Amount units,
+                           const Amount limitPrice,
+                           std::vector<proto::ProcessingMessage>& msgs)
+{
+  const RepeatedPtrField<proto::Order>* side;
+  proto::Order::Type takenType;
+  switch (type)
+    {
+    case proto::Order::BID:
+      side = &book.asks ();
+      takenType = proto::Order::ASK;
+      break;
+    case proto::Order::ASK:
+      side = &book.bids ();
+      takenType = proto::Order::BID;
+      break;
+    default:
+      LOG (FATAL) << "Unexpected order type: " << type;
+    }
+
+  std::vector<proto::Trade> res;
+  for (const auto& entry : *side)
+    {
+      if (units <= 0)
+        break;
+
+      /* The book is sorted with the best prices first, so we can stop
+         at the first order beyond the limit.  */
+      const auto price = static_cast<Amount> (entry.price_sat ());
+      if (type == proto::Order::BID ? price > limitPrice : price < limitPrice)
+        break;
+
+      const Amount cur
+          = std::min (units, static_cast<Amount> (entry.max_units ()));
+      if (cur < static_cast<Amount> (entry.min_units ()))
         {
-          LOG (WARNING)
-              << "JSON-RPC exception: " << exc.what ()
-              << "\nWhile taking order:\n" << data.order ().DebugString ();
-          ok = false;
-          return;
+          VLOG (1)
+              << "Skipping order with minimum above " << cur << " units:\n"
+              << entry.DebugString ();
+          continue;
         }
 
-      t.SetTakingOrder (msg);
+      proto::Order o = entry;
+      o.set_asset (book.asset ());
+      o.set_type (takenType);
 
-      *s.mutable_trades ()->Add () = std::move (data);
-      ok = true;
-    });
+      proto::ProcessingMessage msg;
+      proto::Trade info;
+      if (!TakeOrder (o, cur, msg, &info))
+        continue;
 
-  return ok;
+      msgs.push_back (std::move (msg));
+      res.push_back (std::move (info));
+      units -= cur;
+
+      /* Each trade where we sell spends our name output, so at most one
+         of them could actually go through.  Thus we only start a single
+         one when selling.  */
+      if (type == proto::Order::ASK)
+        break;
+    }
+
+  return res;
 }
 
 bool
@@ -1009,8 +1893,10 @@ TradeManager::OrderTaken (const proto::Order& o, const Amount units,
   data.set_counterparty (counterparty);
   data.set_state (proto::Trade::INITIATED);
 
+  const std::string key = TradeKey (data);
   bool ok;
-  state.AccessState ([&data, &ok] (proto::State& s)
+  state.ModifyState ([this, &data, &ok] (proto::State& s,
+                                        StateChanges& changes)
     {
       CHECK_EQ (data.order ().account (), s.account ());
 
@@ -1022,11 +1908,18 @@ TradeManager::OrderTaken (const proto::Order& o, const Amount units,
         }
       else
         {
-          *s.mutable_trades ()->Add () = std::move (data);
+          changes.TouchTrade (data);
+          InsertTrade (s, std::move (data));
           ok = true;
         }
     });
 
+  if (ok)
+    {
+      version.Bump ();
+      TrackNewTrade (key);
+    }
+
   return ok;
 }
 
@@ -1061,31 +1954,34 @@ TradeManager::ProcessMessage (const proto::ProcessingMessage& msg,
          processing below.  */
     }
 
+  /* A trade matches the message (see Trade::Matches) exactly if its
+     key is made up of the message's counterparty and identifier, so we
+     can look it up directly in the index.  */
+  const std::string key = msg.counterparty () + '\n' + msg.identifier ();
+  bool found = false;
+  state.ReadState ([&] (const proto::State& s)
+    {
+      found = (FindTrade (s, key) >= 0);
+    });
+
+  if (!found)
+    return false;
+
   bool ok = false;
-  state.AccessState ([&] (proto::State& s)
+  ModifyTrade (key, [&] (Trade& t)
     {
-      for (auto& tPb : *s.mutable_trades ())
+      try
+        {
+          t.HandleMessage (msg);
+          if (t.HasReply (reply))
+            ok = true;
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
         {
-          Trade t(*this, s.account (), tPb);
-          if (!t.Matches (msg))
-            continue;
+          LOG (WARNING)
+              << "JSON-RPC exception: " << exc.what ()
+              << "\nWhile processing message:\n" << msg.DebugString ();
           CHECK (!ok);
-
-          try
-            {
-              t.HandleMessage (msg);
-              if (t.HasReply (reply))
-                ok = true;
-            }
-          catch (const jsonrpc::JsonRpcException& exc)
-            {
-              LOG (WARNING)
-                  << "JSON-RPC exception: " << exc.what ()
-                  << "\nWhile processing message:\n" << msg.DebugString ();
-              CHECK (!ok);
-            }
-
-          break;
         }
     });
 
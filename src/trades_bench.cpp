@@ -0,0 +1,199 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/trades.hpp"
+
+#include "mockxaya.hpp"
+#include "private/myorders.hpp"
+#include "private/state.hpp"
+#include "proto/processing.pb.h"
+#include "proto/trades.pb.h"
+
+#include <benchmark/benchmark.h>
+
+#include <glog/logging.h>
+
+#include <chrono>
+
+namespace democrit
+{
+namespace
+{
+
+constexpr auto NO_EXPIRY = std::chrono::seconds (1'000);
+
+/** Our account name in the benchmarks.  */
+constexpr const char* ACCOUNT = "me";
+
+/** The counterparty of all trades.  */
+constexpr const char* COUNTERPARTY = "buyer";
+
+/**
+ * TradeManager instance used in the benchmarks.  It holds its own State
+ * and MyOrders, and is connected to the mock Xaya and GSP servers of
+ * a test environment.
+ */
+class BenchTradeManager : public State, public MyOrders, public TradeManager
+{
+
+public:
+
+  explicit BenchTradeManager (TestEnvironment<MockXayaRpcServer>& env)
+    : State(ACCOUNT),
+      MyOrders(static_cast<State&> (*this), NO_EXPIRY),
+      TradeManager(static_cast<State&> (*this),
+                   static_cast<MyOrders&> (*this),
+                   env.GetAssetSpec (), env.GetXayaRpc (), env.GetGspRpc (),
+                   nullptr, nullptr, false)
+  {}
+
+  /**
+   * Adds a sell order for gold with the given ID to our own orders.
+   */
+  void
+  AddSellOrder (const uint64_t id)
+  {
+    AccessState ([id] (proto::State& s)
+      {
+        s.set_next_free_id (id);
+      });
+
+    proto::Order o;
+    o.set_asset ("gold");
+    o.set_max_units (1);
+    o.set_price_sat (10);
+    o.set_type (proto::Order::ASK);
+    CHECK (MyOrders::Add (std::move (o)));
+  }
+
+  /**
+   * Adds the given number of active trades, with IDs starting at one.
+   * In all of them, we are the maker and seller and are waiting for the
+   * buyer's PSBT.
+   */
+  void
+  AddActiveTrades (const unsigned num)
+  {
+    AccessState ([num] (proto::State& s)
+      {
+        for (unsigned i = 1; i <= num; ++i)
+          {
+            auto& t = *s.mutable_trades ()->Add ();
+            t.set_state (proto::Trade::INITIATED);
+            t.set_start_time (1);
+            t.set_units (1);
+            t.set_counterparty (COUNTERPARTY);
+
+            auto& o = *t.mutable_order ();
+            o.set_account (ACCOUNT);
+            o.set_id (i);
+            o.set_asset ("gold");
+            o.set_max_units (1);
+            o.set_price_sat (10);
+            o.set_type (proto::Order::ASK);
+
+            auto& sd = *t.mutable_seller_data ();
+            sd.set_name_address ("name addr");
+            sd.set_chi_address ("chi addr");
+            sd.mutable_name_output ()->set_hash ("me txid");
+            sd.mutable_name_output ()->set_n (12);
+          }
+      });
+  }
+
+};
+
+/**
+ * Returns a processing message from the counterparty for the trade
+ * with the given order ID.
+ */
+proto::ProcessingMessage
+MessageForTrade (const uint64_t id)
+{
+  proto::ProcessingMessage res;
+  res.set_counterparty (COUNTERPARTY);
+  res.set_identifier (std::string (ACCOUNT) + '\n' + std::to_string (id));
+  return res;
+}
+
+/**
+ * Processes a message for one of many active trades.  The message is
+ * (redundant) seller data sent by the buyer, which does not change the
+ * trade and is not answered.  This measures the overhead of finding and
+ * updating the trade.
+ */
+void
+ProcessMessageForActiveTrade (benchmark::State& state)
+{
+  TestEnvironment<MockXayaRpcServer> env;
+  BenchTradeManager tm(env);
+
+  const unsigned num = state.range (0);
+  tm.AddActiveTrades (num);
+
+  unsigned next = 0;
+  for (auto _ : state)
+    {
+      state.PauseTiming ();
+      auto msg = MessageForTrade (1 + next++ % num);
+      auto& sd = *msg.mutable_seller_data ();
+      sd.set_name_address ("other addr");
+      sd.set_chi_address ("other chi");
+      state.ResumeTiming ();
+
+      proto::ProcessingMessage reply;
+      CHECK (!tm.ProcessMessage (msg, reply));
+    }
+}
+BENCHMARK (ProcessMessageForActiveTrade)
+    ->RangeMultiplier (10)->Range (10, 10'000);
+
+/**
+ * Processes a message taking one of our orders while there are many
+ * other active trades.  This creates a new trade and our seller data,
+ * which is done with RPC calls to the mock Xaya server.
+ */
+void
+ProcessMessageTakingOrder (benchmark::State& state)
+{
+  TestEnvironment<MockXayaRpcServer> env;
+  BenchTradeManager tm(env);
+
+  const unsigned num = state.range (0);
+  tm.AddActiveTrades (num);
+
+  uint64_t nextId = num + 1;
+  for (auto _ : state)
+    {
+      state.PauseTiming ();
+      const uint64_t id = nextId++;
+      tm.AddSellOrder (id);
+      auto msg = MessageForTrade (id);
+      msg.mutable_taking_order ()->set_id (id);
+      msg.mutable_taking_order ()->set_units (1);
+      state.ResumeTiming ();
+
+      proto::ProcessingMessage reply;
+      CHECK (tm.ProcessMessage (msg, reply));
+    }
+}
+BENCHMARK (ProcessMessageTakingOrder)
+    ->RangeMultiplier (10)->Range (10, 10'000);
+
+} // anonymous namespace
+} // namespace democrit
@@ -19,10 +19,14 @@
 #include "private/trades.hpp"
 
 #include "mockxaya.hpp"
+#include "private/inputpool.hpp"
+#include "private/metrics.hpp"
 #include "private/myorders.hpp"
 #include "private/state.hpp"
 #include "testutils.hpp"
 
+#include <xayautil/jsonutils.hpp>
+
 #include <gflags/gflags.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -72,13 +76,14 @@ public:
 
   template <typename XayaRpc>
     explicit TestTradeManager (const std::string& a,
-                               TestEnvironment<XayaRpc>& env)
+                               TestEnvironment<XayaRpc>& env,
+                               InputPool* inputs = nullptr)
     : State(a),
       MyOrders(static_cast<State&> (*this), NO_EXPIRY),
       TradeManager(static_cast<State&> (*this),
                    static_cast<MyOrders&> (*this),
                    env.GetAssetSpec (), env.GetXayaRpc (), env.GetGspRpc (),
-                   false),
+                   nullptr, inputs, false),
       mockTime(0), account(a)
   {}
 
@@ -249,20 +254,22 @@ public:
     proto::OutPoint nameIn;
     nameIn.set_hash (txid);
     nameIn.set_n (n);
-    return t.ConstructTransaction (*t.checker, nameIn);
+    return t.ConstructTransaction (t.GetChecker (), nameIn);
   }
 
   /**
    * Exposes a Trade's checker variable to tests.
    */
-  static TradeChecker&
+  static const TradeChecker&
   GetTradeChecker (const Trade& t)
   {
-    return *t.checker;
+    return t.GetChecker ();
   }
 
   using TradeManager::OrderTaken;
   using TradeManager::SetupUpdater;
+  using TradeManager::StartWatchers;
+  using TradeManager::StopWatchers;
   using TradeManager::UpdateAndArchiveTrades;
 
 };
@@ -555,6 +562,9 @@ TEST_F (TradeUpdateTests, NoTimeOutWhenPending)
     state: PENDING
     start_time: 10
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 }
 
@@ -567,6 +577,9 @@ TEST_F (TradeUpdateTests, MarkedSuccess)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 
   env.GetGspServer ().SetCurrentHeight (109);
@@ -577,6 +590,9 @@ TEST_F (TradeUpdateTests, MarkedSuccess)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 
   env.GetGspServer ().SetCurrentHeight (110);
@@ -586,6 +602,25 @@ TEST_F (TradeUpdateTests, MarkedSuccess)
   )"), EqualsTradeState (R"(
     state: SUCCESS
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
+  )"));
+}
+
+TEST_F (TradeUpdateTests, MarkedSuccessWhenFinal)
+{
+  env.GetGspServer ().SetCurrentHeight (1'000);
+  env.GetGspServer ().SetFinal ("id");
+  EXPECT_THAT (UpdateTrade (R"(
+    state: PENDING
+    our_psbt: "psbt"
+  )"), EqualsTradeState (R"(
+    state: SUCCESS
+    our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 }
 
@@ -600,6 +635,9 @@ TEST_F (TradeUpdateTests, NotDoubleSpent)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 }
 
@@ -613,6 +651,9 @@ TEST_F (TradeUpdateTests, NotConflictedIfPending)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
   )"));
 }
 
@@ -628,6 +669,9 @@ TEST_F (TradeUpdateTests, MarkedFailed)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
     conflict_height: 101
   )"));
 
@@ -639,6 +683,9 @@ TEST_F (TradeUpdateTests, MarkedFailed)
   )"), EqualsTradeState (R"(
     state: PENDING
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
     conflict_height: 101
   )"));
 
@@ -650,10 +697,47 @@ TEST_F (TradeUpdateTests, MarkedFailed)
   )"), EqualsTradeState (R"(
     state: FAILED
     our_psbt: "psbt"
+    btxid: "id"
+    inputs: { hash: "name in" n: 12 }
+    inputs: { hash: "coin in" n: 1 }
     conflict_height: 101
   )"));
 }
 
+TEST_F (TradeUpdateTests, UsesCachedPsbtData)
+{
+  /* The PSBT is not known to the mock server, so decodepsbt would fail.
+     The cached data is used instead.  */
+  env.GetGspServer ().SetPending ("id");
+  EXPECT_THAT (UpdateTrade (R"(
+    state: PENDING
+    our_psbt: "unknown psbt"
+    btxid: "id"
+    inputs: { hash: "other in" n: 5 }
+  )"), EqualsTradeState (R"(
+    state: PENDING
+    our_psbt: "unknown psbt"
+    btxid: "id"
+    inputs: { hash: "other in" n: 5 }
+  )"));
+
+  /* The cached inputs are checked for double spends, not the ones from
+     the PSBT data in the mock server.  */
+  env.GetXayaServer ().AddUtxo ("other in", 5);
+  env.GetGspServer ().SetCurrentHeight (101);
+  EXPECT_THAT (UpdateTrade (R"(
+    state: PENDING
+    our_psbt: "psbt"
+    btxid: "unknown id"
+    inputs: { hash: "other in" n: 5 }
+  )"), EqualsTradeState (R"(
+    state: PENDING
+    our_psbt: "psbt"
+    btxid: "unknown id"
+    inputs: { hash: "other in" n: 5 }
+  )"));
+}
+
 /* ************************************************************************** */
 
 using TradeSellerDataTests = TradeStateTests;
@@ -926,6 +1010,60 @@ TEST_F (TradeBuyerTransactionTests, ConstructTransaction)
   ASSERT_TRUE (checker.CheckForSellerOutputs ("unsigned", pb.seller_data ()));
 }
 
+TEST_F (TradeBuyerTransactionTests, ConstructWithPooledInput)
+{
+  auto& srv = env.GetXayaServer ();
+  srv.AddSpendable ("pool txid", 5, 50);
+  InputPool pool(env.GetXayaRpc (), {10}, 1);
+  pool.Refill ();
+  ASSERT_EQ (pool.GetSize (), 1);
+
+  TestTradeManager pooledTm("me", env, &pool);
+  pooledTm.AddTrade (R"(
+    state: INITIATED
+    start_time: 1
+    order:
+      {
+        id: 42
+        account: "me"
+        asset: "gold"
+        price_sat: 10
+        type: BID
+      }
+    units: 3
+    counterparty: "other"
+    seller_data:
+      {
+        name_address: "addr 1"
+        chi_address: "addr 2"
+      }
+  )");
+
+  auto t = pooledTm.LookupTrade ("me", 42);
+  ASSERT_NE (t, nullptr);
+  const auto& pb = pooledTm.GetInternalState (*t);
+  const auto& checker = pooledTm.GetTradeChecker (*t);
+
+  srv.PrepareConstructTransaction (
+      "unsigned", "other",
+      13, pb.seller_data (), 30,
+      checker.GetNameUpdateValue ());
+  auto outputs = ParseJson ("[{}]");
+  outputs[0]["addr 2"] = xaya::ChiAmountToJson (30);
+  EXPECT_CALL (srv, CreateFundedPsbt (
+      ParseJson (R"([{"txid": "pool txid", "vout": 5}])"),
+      outputs,
+      ParseJson (R"({
+        "fee_rate": 100,
+        "lockUnspents": true,
+        "add_inputs": true
+      })"))
+  ).WillOnce (Return ("chi part"));
+
+  ASSERT_EQ (pooledTm.ConstructTransaction (*t, "other txid", 13), "unsigned");
+  EXPECT_EQ (pool.GetSize (), 0);
+}
+
 TEST_F (TradeBuyerTransactionTests, WaitingForSellerData)
 {
   ExpectNoReply (R"(
@@ -1535,6 +1673,52 @@ TEST_F (TradeManagerTests, TakingOrderSuccess)
   ));
 }
 
+TEST_F (TradeManagerTests, PhaseMetrics)
+{
+  const auto getCounter = [] (const std::string& name)
+    {
+      return Metrics::Global ().ToJson ()["counters"][name].asInt ();
+    };
+  const auto getHistogram = [] (const std::string& name)
+    {
+      const auto data = Metrics::Global ().ToJson ();
+      return data["histograms"][name]["count"].asInt ();
+    };
+
+  const int started = getCounter ("trades.started");
+  const int abandoned = getCounter ("trades.abandoned");
+  const int timedOut = getHistogram ("trade.phase.initiated.abandoned");
+
+  const auto own = ParseTextProto<proto::Order> (R"(
+    account: "me"
+    id: 42
+    asset: "gold"
+    max_units: 100
+    price_sat: 42
+    type: BID
+  )");
+  const auto other = ParseTextProto<proto::Order> (R"(
+    account: "other"
+    id: 42
+    asset: "gold"
+    max_units: 100
+    price_sat: 64
+    type: ASK
+  )");
+
+  proto::ProcessingMessage msg;
+  ASSERT_TRUE (tm.OrderTaken (own, 100, "other"));
+  ASSERT_TRUE (tm.TakeOrder (other, 10, msg));
+  EXPECT_EQ (getCounter ("trades.started"), started + 2);
+
+  FLAGS_democrit_trade_timeout_ms = 1'000;
+  tm.SetMockTime (1'000);
+  tm.UpdateAndArchiveTrades ();
+
+  EXPECT_EQ (getCounter ("trades.abandoned"), abandoned + 2);
+  EXPECT_EQ (getHistogram ("trade.phase.initiated.abandoned"), timedOut + 2);
+}
+
 TEST_F (TradeManagerTests, TakingSellOrder)
 {
   proto::ProcessingMessage msg;
@@ -1572,6 +1756,138 @@ TEST_F (TradeManagerTests, TakingBuyOrder)
   )"));
 }
 
+TEST_F (TradeManagerTests, SweepAsks)
+{
+  const auto book = ParseTextProto<proto::OrderbookForAsset> (R"(
+    asset: "gold"
+    bids: { account: "bidder" id: 1 price_sat: 50 max_units: 100 }
+    asks: { account: "a" id: 1 price_sat: 10 max_units: 5 }
+    asks: { account: "b" id: 2 price_sat: 11 min_units: 10 max_units: 20 }
+    asks: { account: "c" id: 3 price_sat: 12 max_units: 2 }
+    asks: { account: "a" id: 4 price_sat: 12 max_units: 10 }
+    asks: { account: "d" id: 5 price_sat: 20 max_units: 100 }
+  )");
+
+  std::vector<proto::ProcessingMessage> msgs;
+  const auto trades = tm.SweepOrders (book, proto::Order::BID, 9, 15, msgs);
+
+  /* The order from "b" is skipped since its minimum is above the remaining
+     units, and the one from "a" with ID 4 is only taken partially.  */
+  EXPECT_THAT (trades, ElementsAre (
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "a"
+      type: BID
+      asset: "gold"
+      units: 5
+      price_sat: 10
+      role: TAKER
+    )"),
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "c"
+      type: BID
+      asset: "gold"
+      units: 2
+      price_sat: 12
+      role: TAKER
+    )"),
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "a"
+      type: BID
+      asset: "gold"
+      units: 2
+      price_sat: 12
+      role: TAKER
+    )")
+  ));
+
+  ASSERT_EQ (msgs.size (), 3);
+  EXPECT_THAT (msgs[0], EqualsProcessingMessage (R"(
+    counterparty: "a"
+    identifier: "a\n1"
+    taking_order: { id: 1 units: 5 }
+  )"));
+  EXPECT_THAT (msgs[2], EqualsProcessingMessage (R"(
+    counterparty: "a"
+    identifier: "a\n4"
+    taking_order: { id: 4 units: 2 }
+  )"));
+
+  EXPECT_EQ (tm.GetTrades ().size (), 3);
+}
+
+TEST_F (TradeManagerTests, SweepAsksWithLimit)
+{
+  const auto book = ParseTextProto<proto::OrderbookForAsset> (R"(
+    asset: "gold"
+    asks: { account: "a" id: 1 price_sat: 10 max_units: 5 }
+    asks: { account: "b" id: 2 price_sat: 20 max_units: 5 }
+    asks: { account: "c" id: 3 price_sat: 30 max_units: 5 }
+  )");
+
+  std::vector<proto::ProcessingMessage> msgs;
+  const auto trades = tm.SweepOrders (book, proto::Order::BID, 100, 20, msgs);
+
+  EXPECT_THAT (trades, ElementsAre (
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "a"
+      type: BID
+      asset: "gold"
+      units: 5
+      price_sat: 10
+      role: TAKER
+    )"),
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "b"
+      type: BID
+      asset: "gold"
+      units: 5
+      price_sat: 20
+      role: TAKER
+    )")
+  ));
+  EXPECT_EQ (msgs.size (), 2);
+}
+
+TEST_F (TradeManagerTests, SweepBidsTakesOneOrder)
+{
+  const auto book = ParseTextProto<proto::OrderbookForAsset> (R"(
+    asset: "gold"
+    bids: { account: "a" id: 1 price_sat: 50 min_units: 10 max_units: 20 }
+    bids: { account: "b" id: 2 price_sat: 40 max_units: 2 }
+    bids: { account: "c" id: 3 price_sat: 40 max_units: 5 }
+    asks: { account: "d" id: 4 price_sat: 10 max_units: 100 }
+  )");
+
+  /* The first bid is skipped because of its minimum, and then we only
+     take the following one (even though it does not cover all units).  */
+  std::vector<proto::ProcessingMessage> msgs;
+  const auto trades = tm.SweepOrders (book, proto::Order::ASK, 5, 40, msgs);
+
+  EXPECT_THAT (trades, ElementsAre (
+    EqualsTrade (R"(
+      state: INITIATED
+      start_time: 123
+      counterparty: "b"
+      type: ASK
+      asset: "gold"
+      units: 2
+      price_sat: 40
+      role: TAKER
+    )")
+  ));
+  EXPECT_EQ (msgs.size (), 1);
+}
+
 TEST_F (TradeManagerTests, ProcessingTakeOrderUnavailable)
 {
   tm.AddOrder (42, R"(
@@ -1948,6 +2264,63 @@ TEST_F (TradeManagerTests, Archive)
   EXPECT_EQ (tm.LookupTrade ("other", 20), nullptr);
 }
 
+TEST_F (TradeManagerTests, LookupAfterArchiving)
+{
+  FLAGS_democrit_trade_timeout_ms = 100'000;
+
+  /* The trades are added directly to the state, not through the
+     TradeManager.  Lookups should still find them, also after some
+     trades before them have been archived.  */
+  for (const int id : {1, 2, 3})
+    tm.AddTrade (R"(
+      state: )" + std::string (id == 2 ? "SUCCESS" : "INITIATED") + R"(
+      start_time: )" + std::to_string (id == 3 ? 300 : 100) + R"(
+      order:
+        {
+          account: "other"
+          id: )" + std::to_string (id) + R"(
+          asset: "gold"
+          price_sat: 10
+          type: BID
+        }
+      units: 1
+      counterparty: "other"
+    )");
+
+  tm.SetMockTime (150);
+  tm.UpdateAndArchiveTrades ();
+  EXPECT_NE (tm.LookupTrade ("other", 1), nullptr);
+  EXPECT_EQ (tm.LookupTrade ("other", 2), nullptr);
+  EXPECT_NE (tm.LookupTrade ("other", 3), nullptr);
+
+  /* Messages for trades that are archived or do not exist are ignored.  */
+  tm.ProcessWithoutReply (R"(
+    counterparty: "other"
+    identifier: "other\n2"
+  )");
+  tm.ProcessWithoutReply (R"(
+    counterparty: "someone else"
+    identifier: "other\n1"
+  )");
+
+  tm.SetMockTime (250);
+  tm.UpdateAndArchiveTrades ();
+  EXPECT_EQ (tm.LookupTrade ("other", 1), nullptr);
+  EXPECT_NE (tm.LookupTrade ("other", 3), nullptr);
+
+  tm.SetMockTime (450);
+  tm.UpdateAndArchiveTrades ();
+  EXPECT_EQ (tm.LookupTrade ("other", 3), nullptr);
+
+  std::vector<int64_t> archived;
+  for (const auto& t : tm.GetTrades ())
+    {
+      EXPECT_TRUE (t.state () != proto::Trade::INITIATED);
+      archived.push_back (t.start_time ());
+    }
+  EXPECT_THAT (archived, ElementsAre (100, 100, 300));
+}
+
 TEST_F (TradeManagerTests, RunsUpdates)
 {
   constexpr auto INTV = std::chrono::milliseconds (50);
@@ -2003,6 +2376,220 @@ TEST_F (TradeManagerTests, RunsUpdates)
   EXPECT_EQ (tm.LookupTrade ("other", 10), nullptr);
 }
 
+TEST_F (TradeManagerTests, UpdatesOnNewBlocks)
+{
+  FLAGS_democrit_confirmations = 2;
+
+  env.GetXayaServer ().SetPsbt ("signed", ParseJson (R"({
+    "tx":
+      {
+        "btxid": "id"
+      }
+  })"));
+  env.GetGspServer ().SetCurrentHeight (10);
+  env.GetGspServer ().SetPending ("id");
+
+  tm.AddTrade (R"(
+    state: PENDING
+    start_time: 100
+    order:
+      {
+        account: "other"
+        id: 10
+        asset: "gold"
+        price_sat: 100
+        type: ASK
+      }
+    units: 42
+    counterparty: "other"
+    our_psbt: "signed"
+  )");
+
+  /* There is no periodic updater running, so updates can only come
+     from the GSP notifications.  */
+  tm.StartWatchers ();
+  std::this_thread::sleep_for (std::chrono::milliseconds (50));
+  EXPECT_NE (tm.LookupTrade ("other", 10), nullptr);
+
+  /* The trade is confirmed but still lacks confirmations.  */
+  env.GetGspServer ().SetConfirmed ("id", 10);
+  env.GetGspServer ().SetCurrentHeight (10);
+  std::this_thread::sleep_for (std::chrono::milliseconds (50));
+  EXPECT_NE (tm.LookupTrade ("other", 10), nullptr);
+
+  env.GetGspServer ().SetCurrentHeight (11);
+  for (int i = 0; i < 100 && tm.LookupTrade ("other", 10) != nullptr; ++i)
+    std::this_thread::sleep_for (std::chrono::milliseconds (10));
+  tm.StopWatchers ();
+
+  EXPECT_EQ (tm.LookupTrade ("other", 10), nullptr);
+  EXPECT_THAT (tm.GetTrades (), ElementsAre (
+    EqualsTrade (R"(
+      state: SUCCESS
+      start_time: 100
+      counterparty: "other"
+      type: BID
+      asset: "gold"
+      units: 42
+      price_sat: 100
+      role: TAKER
+    )")
+  ));
+}
+
+TEST_F (TradeManagerTests, BatchedChecks)
+{
+  FLAGS_democrit_confirmations = 1;
+
+  auto& gsp = env.GetGspServer ();
+  gsp.SetCurrentHeight (10);
+  gsp.SetPending ("first");
+  gsp.SetConfirmed ("second", 10);
+
+  tm.AddTrade (R"(
+    state: PENDING
+    start_time: 1
+    order:
+      {
+        account: "other"
+        id: 10
+        asset: "gold"
+        price_sat: 100
+        type: ASK
+      }
+    units: 1
+    counterparty: "other"
+    our_psbt: "first psbt"
+    btxid: "first"
+  )");
+  tm.AddTrade (R"(
+    state: PENDING
+    start_time: 2
+    order:
+      {
+        account: "other"
+        id: 20
+        asset: "gold"
+        price_sat: 100
+        type: ASK
+      }
+    units: 2
+    counterparty: "other"
+    our_psbt: "second psbt"
+    btxid: "second"
+  )");
+
+  tm.UpdateAndArchiveTrades ();
+
+  EXPECT_EQ (gsp.GetNumBatchChecks (), 1);
+  EXPECT_EQ (gsp.GetNumSingleChecks (), 0);
+  EXPECT_NE (tm.LookupTrade ("other", 10), nullptr);
+  EXPECT_EQ (tm.LookupTrade ("other", 20), nullptr);
+}
+
+TEST_F (TradeManagerTests, BatchedChecksFallback)
+{
+  FLAGS_democrit_confirmations = 1;
+
+  auto& gsp = env.GetGspServer ();
+  gsp.DisableBatchChecks ();
+  gsp.SetCurrentHeight (10);
+  gsp.SetPending ("first");
+  gsp.SetConfirmed ("second", 10);
+
+  tm.AddTrade (R"(
+    state: PENDING
+    start_time: 1
+    order:
+      {
+        account: "other"
+        id: 10
+        asset: "gold"
+        price_sat: 100
+        type: ASK
+      }
+    units: 1
+    counterparty: "other"
+    our_psbt: "first psbt"
+    btxid: "first"
+  )");
+  tm.AddTrade (R"(
+    state: PENDING
+    start_time: 2
+    order:
+      {
+        account: "other"
+        id: 20
+        asset: "gold"
+        price_sat: 100
+        type: ASK
+      }
+    units: 2
+    counterparty: "other"
+    our_psbt: "second psbt"
+    btxid: "second"
+  )");
+
+  tm.UpdateAndArchiveTrades ();
+
+  EXPECT_EQ (gsp.GetNumBatchChecks (), 0);
+  EXPECT_EQ (gsp.GetNumSingleChecks (), 2);
+  EXPECT_NE (tm.LookupTrade ("other", 10), nullptr);
+  EXPECT_EQ (tm.LookupTrade ("other", 20), nullptr);
+}
+
+TEST_F (TradeManagerTests, ParallelUpdates)
+{
+  FLAGS_democrit_confirmations = 1;
+  constexpr int numTrades = 20;
+
+  auto& gsp = env.GetGspServer ();
+  gsp.SetCurrentHeight (10);
+
+  for (int i = 0; i < numTrades; ++i)
+    {
+      const std::string btxid = "id " + std::to_string (i);
+      if (i % 2 == 0)
+        gsp.SetConfirmed (btxid, 10);
+      else
+        gsp.SetPending (btxid);
+
+      auto data = ParseTextProto<proto::TradeState> (R"(
+        state: PENDING
+        order:
+          {
+            account: "other"
+            asset: "gold"
+            price_sat: 100
+            type: ASK
+          }
+        units: 1
+        counterparty: "other"
+        our_psbt: "psbt"
+      )");
+      data.set_start_time (i);
+      data.mutable_order ()->set_id (i);
+      data.set_btxid (btxid);
+      tm.AddTrade (data);
+    }
+
+  tm.UpdateAndArchiveTrades ();
+
+  /* The finalised trades are archived in their original order, after
+     the still active ones.  */
+  const auto trades = tm.GetTrades ();
+  ASSERT_EQ (trades.size (), numTrades);
+  for (int i = 0; i < numTrades / 2; ++i)
+    {
+      EXPECT_EQ (trades[i].start_time (), 2 * i + 1);
+      EXPECT_TRUE (trades[i].state () == proto::Trade::PENDING);
+
+      const auto& archived = trades[numTrades / 2 + i];
+      EXPECT_EQ (archived.start_time (), 2 * i);
+      EXPECT_TRUE (archived.state () == proto::Trade::SUCCESS);
+    }
+}
+
 TEST_F (TradeManagerTests, UnlocksFailedOrder)
 {
   tm.AddOrder (1, R"(
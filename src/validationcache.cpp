@@ -0,0 +1,110 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/validationcache.hpp"
+
+#include <glog/logging.h>
+
+namespace democrit
+{
+
+ValidationCache::Key::Key (const std::string& a, const AssetId id,
+                           const proto::Order& o)
+  : account(a), asset(id), type(o.type ()), units(o.max_units ())
+{}
+
+bool
+ValidationCache::Key::operator< (const Key& o) const
+{
+  if (account != o.account)
+    return account < o.account;
+  if (asset != o.asset)
+    return asset < o.asset;
+  if (type != o.type)
+    return type < o.type;
+  return units < o.units;
+}
+
+void
+ValidationCache::SetBlock (const xaya::uint256& hash)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (hasBlock && block == hash)
+    return;
+
+  VLOG (1)
+      << "Flushing " << entries.size () << " cached validation results"
+      << " for new block " << hash.ToHex ();
+  entries.clear ();
+  block = hash;
+  hasBlock = true;
+}
+
+void
+ValidationCache::Invalidate ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  entries.clear ();
+  hasBlock = false;
+}
+
+bool
+ValidationCache::Lookup (const std::string& account, const proto::Order& o,
+                         bool& valid) const
+{
+  AssetId id;
+  if (!AssetInterner::Global ().Find (o.asset (), id))
+    return false;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = entries.find (Key (account, id, o));
+  if (mit == entries.end ())
+    return false;
+
+  valid = mit->second;
+  return true;
+}
+
+void
+ValidationCache::Store (const std::string& account, const proto::Order& o,
+                        const bool valid, const xaya::uint256& hash)
+{
+  auto& interner = AssetInterner::Global ();
+  AssetId id;
+  if (valid)
+    id = interner.Intern (o.asset ());
+  else if (!interner.Find (o.asset (), id))
+    return;
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (!hasBlock || block != hash)
+    return;
+
+  if (entries.size () >= maxEntries)
+    {
+      VLOG (1) << "Validation cache is full, flushing";
+      entries.clear ();
+    }
+
+  entries[Key (account, id, o)] = valid;
+}
+
+} // namespace democrit
@@ -0,0 +1,143 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/validationcache.hpp"
+
+#include "testutils.hpp"
+
+#include <xayautil/hash.hpp>
+
+#include <gtest/gtest.h>
+
+namespace democrit
+{
+namespace
+{
+
+class ValidationCacheTests : public testing::Test
+{
+
+protected:
+
+  ValidationCache cache;
+
+  ValidationCacheTests ()
+    : cache(3)
+  {}
+
+  /**
+   * Looks up a given order (as text proto) in the cache.  Returns the
+   * cached result as 0 (invalid) or 1 (valid), and -1 if there is no
+   * cache entry for it.
+   */
+  int
+  Lookup (const std::string& account, const std::string& order) const
+  {
+    bool res;
+    if (!cache.Lookup (account, ParseTextProto<proto::Order> (order), res))
+      return -1;
+    return res ? 1 : 0;
+  }
+
+  /**
+   * Stores a result for an order given as text proto, computed at
+   * the block whose hash is derived from the given string.
+   */
+  void
+  Store (const std::string& account, const std::string& order,
+         const bool valid, const std::string& block = "block")
+  {
+    cache.Store (account, ParseTextProto<proto::Order> (order), valid,
+                 xaya::SHA256::Hash (block));
+  }
+
+};
+
+TEST_F (ValidationCacheTests, NoBlock)
+{
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+}
+
+TEST_F (ValidationCacheTests, Key)
+{
+  cache.SetBlock (xaya::SHA256::Hash ("block"));
+
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true);
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 2", false);
+
+  EXPECT_EQ (Lookup ("domob", R"(
+    asset: "gold" type: ASK max_units: 1 price_sat: 42 min_units: 1
+  )"), 1);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 2"), 0);
+
+  EXPECT_EQ (Lookup ("andy", "asset: \"gold\" type: ASK max_units: 1"), -1);
+  EXPECT_EQ (Lookup ("domob", "asset: \"silver\" type: ASK max_units: 1"), -1);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: BID max_units: 1"), -1);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 3"), -1);
+}
+
+TEST_F (ValidationCacheTests, NewBlock)
+{
+  cache.SetBlock (xaya::SHA256::Hash ("block 1"));
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true, "block 1");
+
+  cache.SetBlock (xaya::SHA256::Hash ("block 1"));
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), 1);
+
+  cache.SetBlock (xaya::SHA256::Hash ("block 2"));
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+}
+
+TEST_F (ValidationCacheTests, OtherBlock)
+{
+  cache.SetBlock (xaya::SHA256::Hash ("block 1"));
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true, "block 2");
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+
+  cache.SetBlock (xaya::SHA256::Hash ("block 2"));
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+}
+
+TEST_F (ValidationCacheTests, Invalidate)
+{
+  cache.SetBlock (xaya::SHA256::Hash ("block"));
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true);
+
+  cache.Invalidate ();
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+}
+
+TEST_F (ValidationCacheTests, MaxEntries)
+{
+  cache.SetBlock (xaya::SHA256::Hash ("block"));
+
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 1", true);
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 2", true);
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 3", true);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), 1);
+
+  Store ("domob", "asset: \"gold\" type: ASK max_units: 4", true);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 1"), -1);
+  EXPECT_EQ (Lookup ("domob", "asset: \"gold\" type: ASK max_units: 4"), 1);
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -0,0 +1,56 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/versioncounter.hpp"
+
+namespace democrit
+{
+
+uint64_t
+VersionCounter::Get () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return version;
+}
+
+void
+VersionCounter::Bump ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    ++version;
+    cv.notify_all ();
+  }
+
+  if (parent != nullptr)
+    parent->Bump ();
+}
+
+uint64_t
+VersionCounter::WaitForChange (const uint64_t known,
+                               const std::chrono::milliseconds timeout) const
+{
+  std::unique_lock<std::mutex> lock(mut);
+  cv.wait_for (lock, timeout, [this, known] ()
+    {
+      return version != known;
+    });
+  return version;
+}
+
+} // namespace democrit
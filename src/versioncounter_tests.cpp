@@ -0,0 +1,82 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/versioncounter.hpp"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace democrit
+{
+namespace
+{
+
+using VersionCounterTests = testing::Test;
+
+TEST_F (VersionCounterTests, Bump)
+{
+  VersionCounter cnt;
+  const auto v = cnt.Get ();
+  cnt.Bump ();
+  EXPECT_GT (cnt.Get (), v);
+}
+
+TEST_F (VersionCounterTests, Parent)
+{
+  VersionCounter parent;
+  VersionCounter a(&parent), b(&parent);
+
+  const auto v = parent.Get ();
+  a.Bump ();
+  b.Bump ();
+  EXPECT_EQ (parent.Get (), v + 2);
+}
+
+TEST_F (VersionCounterTests, WaitReturnsImmediatelyIfDifferent)
+{
+  VersionCounter cnt;
+  const auto v = cnt.Get ();
+  EXPECT_EQ (cnt.WaitForChange (v - 1, std::chrono::seconds (10)), v);
+}
+
+TEST_F (VersionCounterTests, WaitTimesOut)
+{
+  VersionCounter cnt;
+  const auto v = cnt.Get ();
+  EXPECT_EQ (cnt.WaitForChange (v, std::chrono::milliseconds (10)), v);
+}
+
+TEST_F (VersionCounterTests, WaitWokenUp)
+{
+  VersionCounter parent;
+  VersionCounter cnt(&parent);
+  const auto v = parent.Get ();
+
+  std::thread bumper([&cnt] ()
+    {
+      std::this_thread::sleep_for (std::chrono::milliseconds (10));
+      cnt.Bump ();
+    });
+
+  EXPECT_EQ (parent.WaitForChange (v, std::chrono::seconds (10)), v + 1);
+  bumper.join ();
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -0,0 +1,152 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/workerpool.hpp"
+
+#include <glog/logging.h>
+
+#include <exception>
+
+namespace democrit
+{
+
+WorkerPool::WorkerPool (const unsigned numThreads)
+{
+  CHECK_GT (numThreads, 0);
+
+  for (unsigned i = 0; i < numThreads; ++i)
+    workers.emplace_back ([this] ()
+      {
+        RunWorker ();
+      });
+}
+
+WorkerPool::~WorkerPool ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    stop = true;
+    cv.notify_all ();
+  }
+
+  for (auto& w : workers)
+    w.join ();
+}
+
+WorkerPool::Lane&
+WorkerPool::GetLane (const Priority p)
+{
+  switch (p)
+    {
+    case Priority::HIGH:
+      return high;
+    case Priority::LOW:
+      return low;
+    default:
+      LOG (FATAL) << "Invalid priority: " << static_cast<int> (p);
+    }
+}
+
+void
+WorkerPool::SetMaxPending (const Priority p, const size_t n)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  GetLane (p).maxPending = n;
+}
+
+bool
+WorkerPool::Submit (const Priority p, const std::string& key, Task&& task)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  auto& lane = GetLane (p);
+  if (lane.maxPending > 0 && lane.numPending >= lane.maxPending)
+    return false;
+
+  auto& queue = lane.pending[key];
+
+  /* If the key is running already, it will be put back into the ready
+     queue when the current task finishes.  */
+  if (queue.empty () && lane.running.count (key) == 0)
+    lane.ready.push_back (key);
+
+  queue.push_back (std::move (task));
+  ++lane.numPending;
+  cv.notify_one ();
+
+  return true;
+}
+
+void
+WorkerPool::RunWorker ()
+{
+  std::unique_lock<std::mutex> lock(mut);
+  while (true)
+    {
+      cv.wait (lock, [this] ()
+        {
+          return stop || !high.ready.empty () || !low.ready.empty ();
+        });
+      if (stop)
+        return;
+
+      Lane& lane = high.ready.empty () ? low : high;
+
+      const std::string key = std::move (lane.ready.front ());
+      lane.ready.pop_front ();
+
+      auto mit = lane.pending.find (key);
+      CHECK (mit != lane.pending.end ());
+      CHECK (!mit->second.empty ());
+      Task task = std::move (mit->second.front ());
+      mit->second.pop_front ();
+      CHECK_GT (lane.numPending, 0);
+      --lane.numPending;
+      lane.running.insert (key);
+
+      /* An exception must not escape the worker thread (which would
+         terminate the process), nor leave the key marked as running.  */
+      lock.unlock ();
+      try
+        {
+          task ();
+        }
+      catch (const std::exception& exc)
+        {
+          LOG (ERROR) << "Task for key " << key << " failed: " << exc.what ();
+        }
+      catch (...)
+        {
+          LOG (ERROR) << "Task for key " << key << " threw unknown exception";
+        }
+      lock.lock ();
+
+      lane.running.erase (key);
+      mit = lane.pending.find (key);
+      CHECK (mit != lane.pending.end ());
+      if (mit->second.empty ())
+        lane.pending.erase (mit);
+      else
+        {
+          lane.ready.push_back (key);
+          cv.notify_one ();
+        }
+    }
+}
+
+} // namespace democrit
@@ -0,0 +1,255 @@
+/*
+    Democrit - atomic trades for XAYA games
+    Copyright (C) 2021  Autonomous Worlds Ltd
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "private/workerpool.hpp"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace democrit
+{
+namespace
+{
+
+using testing::ElementsAre;
+using testing::UnorderedElementsAre;
+
+/**
+ * Simple "gate" that tasks can wait on, so that tests can control
+ * when they finish.
+ */
+class Gate
+{
+
+private:
+
+  bool open = false;
+  std::mutex mut;
+  std::condition_variable cv;
+
+public:
+
+  void
+  Open ()
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    open = true;
+    cv.notify_all ();
+  }
+
+  void
+  Wait ()
+  {
+    std::unique_lock<std::mutex> lock(mut);
+    cv.wait (lock, [this] () { return open; });
+  }
+
+};
+
+class WorkerPoolTests : public testing::Test
+{
+
+protected:
+
+  /** Lock for the log of executed tasks.  */
+  std::mutex mutLog;
+
+  /** Log of executed tasks.  */
+  std::vector<int> log;
+
+  /**
+   * Returns a task that adds the given value to the log.
+   */
+  WorkerPool::Task
+  LogTask (const int val)
+  {
+    return [this, val] ()
+      {
+        std::lock_guard<std::mutex> lock(mutLog);
+        log.push_back (val);
+      };
+  }
+
+  /**
+   * Sleeps a short time, which should be enough for pending tasks
+   * to be executed.
+   */
+  static void
+  SleepSome ()
+  {
+    std::this_thread::sleep_for (std::chrono::milliseconds (50));
+  }
+
+};
+
+TEST_F (WorkerPoolTests, SequentialPerKey)
+{
+  WorkerPool pool(4);
+
+  Gate gate;
+  pool.Submit (WorkerPool::Priority::LOW, "key", [this, &gate] ()
+    {
+      gate.Wait ();
+      LogTask (1) ();
+    });
+  for (int i = 2; i <= 5; ++i)
+    pool.Submit (WorkerPool::Priority::LOW, "key", LogTask (i));
+
+  SleepSome ();
+  {
+    std::lock_guard<std::mutex> lock(mutLog);
+    EXPECT_THAT (log, ElementsAre ());
+  }
+
+  gate.Open ();
+  SleepSome ();
+  std::lock_guard<std::mutex> lock(mutLog);
+  EXPECT_THAT (log, ElementsAre (1, 2, 3, 4, 5));
+}
+
+TEST_F (WorkerPoolTests, ParallelForDifferentKeys)
+{
+  WorkerPool pool(2);
+
+  Gate gate;
+  pool.Submit (WorkerPool::Priority::LOW, "blocked", [&gate] ()
+    {
+      gate.Wait ();
+    });
+  pool.Submit (WorkerPool::Priority::LOW, "other", LogTask (1));
+  pool.Submit (WorkerPool::Priority::HIGH, "blocked", LogTask (2));
+
+  SleepSome ();
+  {
+    std::lock_guard<std::mutex> lock(mutLog);
+    EXPECT_THAT (log, UnorderedElementsAre (1, 2));
+  }
+
+  gate.Open ();
+}
+
+TEST_F (WorkerPoolTests, HighPriorityFirst)
+{
+  WorkerPool pool(1);
+
+  Gate gate;
+  pool.Submit (WorkerPool::Priority::LOW, "block", [&gate] ()
+    {
+      gate.Wait ();
+    });
+  SleepSome ();
+
+  pool.Submit (WorkerPool::Priority::LOW, "a", LogTask (1));
+  pool.Submit (WorkerPool::Priority::LOW, "b", LogTask (2));
+  pool.Submit (WorkerPool::Priority::HIGH, "c", LogTask (3));
+  pool.Submit (WorkerPool::Priority::HIGH, "a", LogTask (4));
+
+  gate.Open ();
+  SleepSome ();
+  std::lock_guard<std::mutex> lock(mutLog);
+  EXPECT_THAT (log, ElementsAre (3, 4, 1, 2));
+}
+
+TEST_F (WorkerPoolTests, MaxPending)
+{
+  WorkerPool pool(1);
+  pool.SetMaxPending (WorkerPool::Priority::HIGH, 2);
+
+  Gate gate;
+  ASSERT_TRUE (pool.Submit (WorkerPool::Priority::HIGH, "block", [&gate] ()
+    {
+      gate.Wait ();
+    }));
+  SleepSome ();
+
+  /* The running task does not count as pending.  */
+  EXPECT_TRUE (pool.Submit (WorkerPool::Priority::HIGH, "a", LogTask (1)));
+  EXPECT_TRUE (pool.Submit (WorkerPool::Priority::HIGH, "b", LogTask (2)));
+  EXPECT_FALSE (pool.Submit (WorkerPool::Priority::HIGH, "a", LogTask (3)));
+  EXPECT_TRUE (pool.Submit (WorkerPool::Priority::LOW, "a", LogTask (4)));
+
+  gate.Open ();
+  SleepSome ();
+  EXPECT_TRUE (pool.Submit (WorkerPool::Priority::HIGH, "a", LogTask (5)));
+  SleepSome ();
+
+  std::lock_guard<std::mutex> lock(mutLog);
+  EXPECT_THAT (log, ElementsAre (1, 2, 4, 5));
+}
+
+TEST_F (WorkerPoolTests, ThrowingTask)
+{
+  WorkerPool pool(1);
+
+  pool.Submit (WorkerPool::Priority::HIGH, "a", [] ()
+    {
+      throw std::runtime_error ("failed");
+    });
+  pool.Submit (WorkerPool::Priority::HIGH, "a", [] ()
+    {
+      throw 42;
+    });
+  pool.Submit (WorkerPool::Priority::HIGH, "a", LogTask (1));
+  pool.Submit (WorkerPool::Priority::LOW, "b", LogTask (2));
+
+  SleepSome ();
+  std::lock_guard<std::mutex> lock(mutLog);
+  EXPECT_THAT (log, ElementsAre (1, 2));
+}
+
+TEST_F (WorkerPoolTests, PendingDiscardedOnDestruction)
+{
+  std::atomic<unsigned> counter(0);
+  Gate gate;
+  std::thread opener;
+
+  {
+    WorkerPool pool(1);
+
+    pool.Submit (WorkerPool::Priority::LOW, "key", [&gate, &counter] ()
+      {
+        gate.Wait ();
+        ++counter;
+      });
+    pool.Submit (WorkerPool::Priority::LOW, "key", [&counter] ()
+      {
+        ++counter;
+      });
+
+    SleepSome ();
+    opener = std::thread ([&gate] ()
+      {
+        std::this_thread::sleep_for (std::chrono::milliseconds (10));
+        gate.Open ();
+      });
+  }
+
+  opener.join ();
+  EXPECT_EQ (counter, 1);
+}
+
+} // anonymous namespace
+} // namespace democrit
@@ -63,6 +63,9 @@ class Daemon:
     self.args.extend (["--democrit_order_timeout_ms",
                        str (int (ORDER_TIMEOUT * 1_000))])
     self.args.extend (["--democrit_confirmations", str (10)])
+    # Broadcast changes to our orders immediately, so that tests can
+    # just sleep a short time for them to propagate.
+    self.args.extend (["--democrit_order_broadcast_delay_ms", str (0)])
     self.args.extend (["--democrit_trade_timeout_ms",
                        str (int (TRADE_TIMEOUT * 1_000))])
     self.args.extend (extraArgs)
@@ -139,8 +142,19 @@ class Daemon:
     golden data.
     """
 
-    data = self.rpc.gettrades ()
+    return self.stripStartTimes (self.rpc.gettrades ())
 
+  def queryTrades (self, filter={}, offset=0, limit=100):
+    """
+    Returns a page of trades as per the querytrades RPC method, with
+    the start_time fields stripped out like in getTrades.
+    """
+
+    return self.stripStartTimes (self.rpc.querytrades (
+        filter=filter, offset=offset, limit=limit))
+
+  @staticmethod
+  def stripStartTimes (data):
     for d in data:
       assert "start_time" in d
       del d["start_time"]
@@ -29,7 +29,11 @@ class GetStatusTest (NonFungibleTest):
     with self.runDemocrit () as d1, \
          self.runDemocrit () as d2:
       for d in [d1, d2]:
-        self.assertEqual (d.rpc.getstatus (), {
+        status = d.rpc.getstatus ()
+        updates = status.pop ("orderupdates")
+        self.assertEqual (sorted (updates.keys ()),
+                          ["coalesced", "dropped", "pending", "received"])
+        self.assertEqual (status, {
           "account": d.account,
           "connected": True,
           "gameid": "nf",
@@ -54,7 +54,11 @@ class OrderbookTest (NonFungibleTest):
       self.assertEqual (d2.rpc.getordersbyasset (), {})
 
       self.mainLogger.info ("Testing valid orders...")
+      ownVersion = d1.rpc.waitforchange (kind="ownorders", known=-1)
       self.assertEqual (d1.addOrder ("bid", daBar, 1, 2), True)
+      self.assertNotEqual (
+          d1.rpc.waitforchange (kind="ownorders", known=ownVersion),
+          ownVersion)
       self.assertEqual (d1.addOrder ("ask", daFoo, 10, 1), True)
       self.sleepSome ()
       self.assertEqual (d1.rpc.getownorders (), {
@@ -107,6 +111,79 @@ class OrderbookTest (NonFungibleTest):
         },
       })
 
+      self.mainLogger.info ("Testing partial orderbook queries...")
+      self.assertEqual (d2.rpc.getbestorders (assets=[daFoo, "x"], levels=1), {
+        daFoo: {
+          "asset": daFoo,
+          "bids": [],
+          "asks": [
+            {
+              "account": d1.account,
+              "id": 1,
+              "price_sat": int (10e8),
+              "min_units": 1,
+              "max_units": 1,
+            },
+          ],
+        },
+        "x": {
+          "asset": "x",
+          "bids": [],
+          "asks": [],
+        },
+      })
+      self.assertEqual (
+          d2.rpc.getordersinrange (assets=[daFoo, daBar],
+                                   minprice=0, maxprice=int (5e8)), {
+        daFoo: {
+          "asset": daFoo,
+          "bids": [],
+          "asks": [],
+        },
+        daBar: {
+          "asset": daBar,
+          "asks": [],
+          "bids": [
+            {
+              "account": d1.account,
+              "id": 0,
+              "price_sat": int (1e8),
+              "min_units": 1,
+              "max_units": 2,
+            },
+          ],
+        },
+      })
+
+      # Price bounds are not limited to the int32 range, but must be
+      # non-negative integers.
+      self.assertEqual (
+          d2.rpc.getordersinrange (assets=[daFoo],
+                                   minprice=int (5e8), maxprice=int (100e8)), {
+        daFoo: {
+          "asset": daFoo,
+          "bids": [],
+          "asks": [
+            {
+              "account": d1.account,
+              "id": 1,
+              "price_sat": int (10e8),
+              "min_units": 1,
+              "max_units": 1,
+            },
+          ],
+        },
+      })
+      self.expectError (-32602, ".*minprice.*",
+                        d2.rpc.getordersinrange,
+                        assets=[daFoo], minprice=-1, maxprice=10)
+
+      self.assertEqual (d2.rpc.getdepthforasset (asset=daBar), {
+        "asset": daBar,
+        "bids": [{"price_sat": int (1e8), "units": 2, "orders": 1}],
+        "asks": [],
+      })
+
       self.mainLogger.info ("Cancelling an order...")
       d1.rpc.cancelorder (id=42)
       d1.rpc.cancelorder (id=1)
@@ -140,6 +217,83 @@ class OrderbookTest (NonFungibleTest):
         },
       })
 
+      self.mainLogger.info ("Bulk order management...")
+      self.assertEqual (d1.rpc.addorders (orders=[
+        {
+          "asset": daFoo,
+          "type": "ask",
+          "price_sat": int (20e8),
+          "max_units": 1,
+        },
+        {
+          "asset": daBar,
+          "type": "ask",
+          "price_sat": int (1e8),
+          "max_units": 1,
+        },
+      ]), [True, False])
+      self.assertEqual (d1.rpc.replaceorders (cancel=[0, 2], orders=[
+        {
+          "asset": daBar,
+          "type": "bid",
+          "price_sat": int (2e8),
+          "max_units": 3,
+        },
+        {
+          "asset": daBar,
+          "type": "ask",
+          "price_sat": int (1e8),
+          "max_units": 1,
+        },
+      ]), False)
+      self.assertEqual ([o["id"] for o in d1.rpc.getownorders ()["orders"]],
+                        [0, 2])
+      self.assertEqual (d1.rpc.replaceorders (cancel=[0, 2], orders=[
+        {
+          "asset": daBar,
+          "type": "bid",
+          "price_sat": int (2e8),
+          "max_units": 3,
+        },
+      ]), True)
+      self.sleepSome ()
+      self.assertEqual (d1.rpc.getownorders (), {
+        "account": d1.account,
+        "orders": [
+          {
+            "id": 3,
+            "asset": daBar,
+            "type": "bid",
+            "price_sat": int (2e8),
+            "min_units": 1,
+            "max_units": 3,
+          },
+        ],
+      })
+      self.assertEqual (d2.rpc.getordersbyasset (), {
+        daBar: {
+          "asset": daBar,
+          "asks": [],
+          "bids": [
+            {
+              "account": d1.account,
+              "id": 3,
+              "price_sat": int (2e8),
+              "min_units": 1,
+              "max_units": 3,
+            },
+          ],
+        },
+      })
+
+      d1.rpc.cancelorders (ids=[3, 42])
+      self.sleepSome ()
+      self.assertEqual (d1.rpc.getownorders (), {
+        "account": d1.account,
+        "orders": [],
+      })
+      self.assertEqual (d2.rpc.getordersbyasset (), {})
+
 
 if __name__ == "__main__":
   OrderbookTest ().main ()
@@ -186,6 +186,12 @@ class TradingSuccessTest (NonFungibleTest):
       buyerTrade2["state"] = "success"
       self.assertEqual (seller.getTrades (), [sellerTrade1, sellerTrade2])
       self.assertEqual (buyer.getTrades (), [buyerTrade1, buyerTrade2])
+      self.assertEqual (seller.queryTrades (), [sellerTrade2, sellerTrade1])
+      self.assertEqual (seller.queryTrades (offset=1), [sellerTrade1])
+      self.assertEqual (buyer.queryTrades (filter={"state": "success"},
+                                           limit=1),
+                        [buyerTrade2])
+      self.assertEqual (buyer.queryTrades (filter={"state": "failed"}), [])
       self.assertEqual (buyer.rpc.getordersforasset (asset=demAsset), {
         "asset": demAsset,
         "bids": [],